@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "solid_buffer.h"
+#include "viewporter-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+
+/* 只有 4 个字节的 shm buffer */
+static struct wl_buffer *
+create_pixel_buffer(struct wl_shm *shm, uint32_t color)
+{
+	struct wl_shm_pool *pool;
+	struct wl_buffer *buff;
+	uint32_t *pixel;
+	int fd;
+
+	fd = memfd_create("solid-buffer", MFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, 4) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	pixel = mmap(NULL, 4, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (pixel == MAP_FAILED)
+	{
+		close(fd);
+		return NULL;
+	}
+	*pixel = color;
+	munmap(pixel, 4);
+
+	pool = wl_shm_create_pool(shm, fd, 4);
+	buff = wl_shm_pool_create_buffer(pool, 0, 1, 1, 4,
+									 WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return buff;
+}
+
+struct wl_buffer *
+solid_buffer_create(struct wl_shm *shm, struct wp_viewporter *viewporter,
+					struct wp_single_pixel_buffer_manager_v1 *single_pixel_manager,
+					struct wl_surface *surface, int32_t width, int32_t height,
+					uint32_t color, struct wp_viewport **viewport)
+{
+	struct wl_buffer *buff;
+
+	if (viewporter == NULL)
+		return NULL;
+
+	if (single_pixel_manager)
+	{
+		/* 每个通道从 8 位扩展到 32 位，XRGB 没有 alpha，按不透明处理 */
+		buff = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+			single_pixel_manager,
+			((color >> 16) & 0xff) * 0x01010101,
+			((color >> 8) & 0xff) * 0x01010101,
+			(color & 0xff) * 0x01010101,
+			0xffffffff);
+	}
+	else
+	{
+		buff = create_pixel_buffer(shm, color);
+	}
+	if (buff == NULL)
+		return NULL;
+
+	*viewport = wp_viewporter_get_viewport(viewporter, surface);
+	wp_viewport_set_destination(*viewport, width, height);
+	return buff;
+}
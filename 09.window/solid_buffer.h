@@ -0,0 +1,24 @@
+#ifndef SOLID_BUFFER_H
+#define SOLID_BUFFER_H
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+struct wp_viewporter;
+struct wp_viewport;
+struct wp_single_pixel_buffer_manager_v1;
+
+/* 纯色 surface 的快速路径，09、11、12、14、16 几个 shm 的例子共用
+ * 整个窗口只有一种颜色时没必要分配 width*height*4 的 buffer 再逐个像素填充：
+ * 合成器支持 wp_single_pixel_buffer_manager_v1 时使用 1x1 的单像素 buffer，
+ * 否则使用 1x1 的 shm buffer，再由 wp_viewporter 放大到 width x height。
+ * color 是 XRGB8888，viewport 返回给 surface 创建的 wp_viewport。
+ * 没有 wp_viewporter 时返回 NULL，调用者回到整块 buffer 填充的方式
+ * */
+struct wl_buffer *
+solid_buffer_create(struct wl_shm *shm, struct wp_viewporter *viewporter,
+					struct wp_single_pixel_buffer_manager_v1 *single_pixel_manager,
+					struct wl_surface *surface, int32_t width, int32_t height,
+					uint32_t color, struct wp_viewport **viewport);
+
+#endif
@@ -14,6 +14,10 @@
 #include <unistd.h>
 #include <linux/input.h>
 
+#include "viewporter-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+#include "solid_buffer.h"
+
 static struct wl_display *display = NULL;
 static struct wl_compositor *compositor = NULL;
 struct wl_surface *surface;
@@ -21,6 +25,10 @@ struct wl_shell *shell;
 struct wl_shell_surface *shell_surface;
 struct wl_shm *shm;
 struct wl_buffer *buffer;
+// 纯色快速路径用到的扩展，合成器不支持时为 NULL
+struct wp_viewporter *viewporter;
+struct wp_single_pixel_buffer_manager_v1 *single_pixel_manager;
+struct wp_viewport *viewport;
 // input device
 struct wl_seat *seat;
 struct wl_pointer *pointer;
@@ -29,6 +37,8 @@ void *shm_data;
 
 int WIDTH = 480;
 int HEIGHT = 360;
+/* 窗口的颜色，XRGB8888 */
+#define WINDOW_COLOR 0xff0000 // 红色
 
 #define BIND_WL_REG(registry, ptr, id, intf, n) \
 	do                                          \
@@ -255,10 +265,19 @@ create_buffer()
 	return buff;
 }
 
+static void paint_pixels(uint32_t color);
+
 static void
 create_window()
 {
-	buffer = create_buffer();
+	/* 窗口内容只有一种颜色，优先使用纯色快速路径 */
+	buffer = solid_buffer_create(shm, viewporter, single_pixel_manager, surface,
+								 WIDTH, HEIGHT, WINDOW_COLOR, &viewport);
+	if (buffer == NULL)
+	{
+		buffer = create_buffer();
+		paint_pixels(WINDOW_COLOR);
+	}
 
 	wl_surface_attach(surface, buffer, 0, 0);
 	//wl_surface_damage(surface, 0, 0, WIDTH, HEIGHT);
@@ -296,6 +315,15 @@ global_registry_handler(void *data, struct wl_registry *registry,
 		BIND_WL_REG(registry, seat, id, &wl_seat_interface, 1);
 		wl_seat_add_listener(seat,&seat_listener,NULL);
 	}
+	else if (strcmp(interface, wp_viewporter_interface.name) == 0)
+	{
+		BIND_WL_REG(registry, viewporter, id, &wp_viewporter_interface, 1);
+	}
+	else if (strcmp(interface, wp_single_pixel_buffer_manager_v1_interface.name) == 0)
+	{
+		BIND_WL_REG(registry, single_pixel_manager, id,
+					&wp_single_pixel_buffer_manager_v1_interface, 1);
+	}
 }
 
 static void
@@ -311,13 +339,13 @@ static const struct wl_registry_listener registry_listener = {
 };
 
 static void
-paint_pixels() {
+paint_pixels(uint32_t color) {
     int n;
     uint32_t *pixel = shm_data;
 
     fprintf(stderr, "Painting pixels\n");
     for (n =0; n < WIDTH*HEIGHT; n++) {
-	*pixel++ = 0xff0000;//红色
+	*pixel++ = color;
     }
 }
 
@@ -373,7 +401,6 @@ int main(int argc, char **argv)
 	//wl_shell_suface_add_listener(shell_surface,&shell_surface_listener,NULL);
 
 	create_window();
-	paint_pixels();
 
 	while(wl_display_dispatch(display)!=-1){
 		;
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <wayland-client.h>
+
+#include "cursor.h"
+
+int
+cursor_manager_init(struct cursor_manager *manager, struct wl_shm *shm,
+		struct wl_compositor *compositor, const struct cursor_desc *descs,
+		int count)
+{
+	struct wl_shm_pool *pool;
+	size_t offset = 0;
+	int frame = 0;
+	int fd, i, j;
+
+	memset(manager, 0, sizeof(*manager));
+	manager->timer_fd = -1;
+	manager->current = -1;
+	manager->attached = -1;
+
+	manager->cursors = calloc(count, sizeof(*manager->cursors));
+	if (manager->cursors == NULL)
+		return -1;
+	manager->cursor_count = count;
+
+	for (i = 0; i < count; i++)
+	{
+		struct cursor *cursor = &manager->cursors[i];
+		cursor->name = descs[i].name;
+		cursor->width = descs[i].width;
+		cursor->height = descs[i].height;
+		cursor->hotspot_x = descs[i].hotspot_x;
+		cursor->hotspot_y = descs[i].hotspot_y;
+		cursor->frames = descs[i].frames > 0 ? descs[i].frames : 1;
+		cursor->delay_ms = descs[i].delay_ms;
+		cursor->first_frame = manager->frame_count;
+		manager->frame_count += cursor->frames;
+		manager->size += (size_t)cursor->width * cursor->height * 4 * cursor->frames;
+	}
+
+	manager->buffers = calloc(manager->frame_count, sizeof(*manager->buffers));
+	if (manager->buffers == NULL)
+		goto fail;
+
+	fd = memfd_create("cursor", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, manager->size) < 0)
+	{
+		fprintf(stderr, "creating cursor pool of %zu B failed: %m\n", manager->size);
+		if (fd >= 0)
+			close(fd);
+		goto fail;
+	}
+	manager->data = mmap(NULL, manager->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (manager->data == MAP_FAILED)
+	{
+		fprintf(stderr, "mmap failed: %m\n");
+		manager->data = NULL;
+		close(fd);
+		goto fail;
+	}
+
+	/* 所有帧依次排在同一个 pool 里，每帧一个 buffer */
+	pool = wl_shm_create_pool(shm, fd, manager->size);
+	for (i = 0; i < count; i++)
+	{
+		const struct cursor *cursor = &manager->cursors[i];
+		int stride = cursor->width * 4;
+		size_t frame_size = (size_t)stride * cursor->height;
+
+		for (j = 0; j < cursor->frames; j++, frame++)
+		{
+			uint32_t *pixels = (uint32_t *)((uint8_t *)manager->data + offset);
+			memset(pixels, 0, frame_size);
+			descs[i].draw(pixels, cursor->width, cursor->width, cursor->height,
+					j, descs[i].data);
+			manager->buffers[frame] = wl_shm_pool_create_buffer(pool, offset,
+					cursor->width, cursor->height, stride, WL_SHM_FORMAT_ARGB8888);
+			offset += frame_size;
+		}
+	}
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	manager->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (manager->timer_fd < 0)
+	{
+		fprintf(stderr, "timerfd_create failed: %m\n");
+		goto fail;
+	}
+
+	manager->surface = wl_compositor_create_surface(compositor);
+	fprintf(stderr, "cursor pool: %d cursors, %d frames, %zu B\n",
+			count, manager->frame_count, manager->size);
+	return 0;
+
+fail:
+	cursor_manager_finish(manager);
+	return -1;
+}
+
+void
+cursor_manager_finish(struct cursor_manager *manager)
+{
+	int i;
+
+	for (i = 0; manager->buffers && i < manager->frame_count; i++)
+		if (manager->buffers[i])
+			wl_buffer_destroy(manager->buffers[i]);
+	free(manager->buffers);
+	manager->buffers = NULL;
+	free(manager->cursors);
+	manager->cursors = NULL;
+
+	if (manager->surface)
+		wl_surface_destroy(manager->surface);
+	manager->surface = NULL;
+	if (manager->data)
+		munmap(manager->data, manager->size);
+	manager->data = NULL;
+	if (manager->timer_fd >= 0)
+		close(manager->timer_fd);
+	manager->timer_fd = -1;
+}
+
+int
+cursor_manager_find(struct cursor_manager *manager, const char *name)
+{
+	int i;
+
+	for (i = 0; i < manager->cursor_count; i++)
+		if (strcmp(manager->cursors[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+/* 当前光标是动画并且鼠标在窗口里时才让定时器跑 */
+static void
+arm_timer(struct cursor_manager *manager)
+{
+	struct itimerspec its;
+	const struct cursor *cursor;
+
+	memset(&its, 0, sizeof(its));
+	if (manager->pointer && manager->current >= 0)
+	{
+		cursor = &manager->cursors[manager->current];
+		if (cursor->frames > 1 && cursor->delay_ms > 0)
+		{
+			its.it_value.tv_sec = cursor->delay_ms / 1000;
+			its.it_value.tv_nsec = (cursor->delay_ms % 1000) * 1000000L;
+			its.it_interval = its.it_value;
+		}
+	}
+	timerfd_settime(manager->timer_fd, 0, &its, NULL);
+}
+
+/* 把当前帧显示出来，只在真的有变化时发请求 */
+static void
+show(struct cursor_manager *manager)
+{
+	const struct cursor *cursor;
+	int index;
+
+	if (manager->pointer == NULL || manager->current < 0)
+		return;
+
+	cursor = &manager->cursors[manager->current];
+	index = cursor->first_frame + manager->frame;
+	if (manager->attached != index)
+	{
+		wl_surface_attach(manager->surface, manager->buffers[index], 0, 0);
+		wl_surface_damage(manager->surface, 0, 0, cursor->width, cursor->height);
+		wl_surface_commit(manager->surface);
+		manager->attached = index;
+		manager->attaches++;
+	}
+
+	if (!manager->cursor_set ||
+		manager->hotspot_x != cursor->hotspot_x ||
+		manager->hotspot_y != cursor->hotspot_y)
+	{
+		wl_pointer_set_cursor(manager->pointer, manager->serial, manager->surface,
+				cursor->hotspot_x, cursor->hotspot_y);
+		manager->cursor_set = 1;
+		manager->hotspot_x = cursor->hotspot_x;
+		manager->hotspot_y = cursor->hotspot_y;
+	}
+}
+
+void
+cursor_manager_enter(struct cursor_manager *manager,
+		struct wl_pointer *pointer, uint32_t serial)
+{
+	manager->pointer = pointer;
+	manager->serial = serial;
+	manager->cursor_set = 0;
+	if (manager->current < 0)
+		manager->current = 0;
+	/* 离开再进入时 surface 上的帧没变，只需要重新 set_cursor */
+	show(manager);
+	arm_timer(manager);
+}
+
+void
+cursor_manager_leave(struct cursor_manager *manager)
+{
+	manager->pointer = NULL;
+	arm_timer(manager);
+}
+
+void
+cursor_manager_set(struct cursor_manager *manager, int cursor)
+{
+	if (cursor < 0 || cursor >= manager->cursor_count || cursor == manager->current)
+		return;
+
+	manager->current = cursor;
+	manager->frame = 0;
+	show(manager);
+	arm_timer(manager);
+}
+
+int
+cursor_manager_timer_fd(struct cursor_manager *manager)
+{
+	return manager->timer_fd;
+}
+
+void
+cursor_manager_tick(struct cursor_manager *manager)
+{
+	uint64_t expirations;
+	const struct cursor *cursor;
+
+	if (read(manager->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+	if (manager->current < 0)
+		return;
+
+	/* 处理晚了就跳过错过的帧，动画速度不受影响 */
+	cursor = &manager->cursors[manager->current];
+	manager->frame = (manager->frame + expirations) % cursor->frames;
+	show(manager);
+}
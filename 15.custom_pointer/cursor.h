@@ -0,0 +1,93 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include <stdint.h>
+
+/* 光标管理
+ *
+ * 所有光标的所有动画帧在初始化时画进同一个 shm pool，每一帧预先建好 wl_buffer。
+ * 之后切换光标不分配任何东西，只有显示的帧变化时才 attach/commit 一次，
+ * 动画由 timerfd 驱动
+ * */
+
+struct wl_shm;
+struct wl_compositor;
+struct wl_pointer;
+struct wl_surface;
+struct wl_buffer;
+
+/* 画一帧，pixels 是 ARGB8888(预乘)，stride 以像素为单位 */
+typedef void (*cursor_draw_func)(uint32_t *pixels, int stride, int width,
+		int height, int frame, void *data);
+
+struct cursor_desc {
+	const char *name;
+	int width;
+	int height;
+	int hotspot_x;
+	int hotspot_y;
+	/* 静态光标为 1 */
+	int frames;
+	int delay_ms;
+	cursor_draw_func draw;
+	void *data;
+};
+
+struct cursor {
+	const char *name;
+	int width;
+	int height;
+	int hotspot_x;
+	int hotspot_y;
+	int first_frame;
+	int frames;
+	int delay_ms;
+};
+
+struct cursor_manager {
+	struct wl_surface *surface;
+	struct wl_pointer *pointer;
+	struct cursor *cursors;
+	int cursor_count;
+	/* 所有帧的 buffer，按光标顺序排列 */
+	struct wl_buffer **buffers;
+	int frame_count;
+	void *data;
+	size_t size;
+	int timer_fd;
+
+	int current;
+	int frame;
+	/* 最近一次进入时的 serial，pointer 为 NULL 表示鼠标不在窗口里 */
+	uint32_t serial;
+	/* surface 上现在挂着的帧，-1 表示没有 */
+	int attached;
+	/* 这次进入之后已经 set_cursor 过，以及当时用的热点 */
+	int cursor_set;
+	int hotspot_x;
+	int hotspot_y;
+	/* 统计 attach 的次数 */
+	unsigned attaches;
+};
+
+int cursor_manager_init(struct cursor_manager *manager, struct wl_shm *shm,
+		struct wl_compositor *compositor, const struct cursor_desc *descs,
+		int count);
+void cursor_manager_finish(struct cursor_manager *manager);
+
+/* 按名字找光标，找不到返回 -1 */
+int cursor_manager_find(struct cursor_manager *manager, const char *name);
+
+/* 在 wl_pointer 的 enter / leave 事件里调用 */
+void cursor_manager_enter(struct cursor_manager *manager,
+		struct wl_pointer *pointer, uint32_t serial);
+void cursor_manager_leave(struct cursor_manager *manager);
+
+/* 切换光标，和当前光标相同时什么也不做 */
+void cursor_manager_set(struct cursor_manager *manager, int cursor);
+
+/* 动画用的 timerfd，可读时调用 cursor_manager_tick */
+int cursor_manager_timer_fd(struct cursor_manager *manager);
+void cursor_manager_tick(struct cursor_manager *manager);
+
+#endif
@@ -0,0 +1,598 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "cursor_theme.h"
+
+/* XCursor 文件格式，全部是小端 uint32
+ * 文件头: "Xcur" 头长度 版本 目录项数，然后每个目录项是 (类型, 标称大小, 位置)
+ * 图片块: 头长度(36) 类型 标称大小 版本 宽 高 热点x 热点y 帧间隔，后面是预乘 ARGB
+ * */
+#define XCURSOR_MAGIC 0x72756358
+#define XCURSOR_IMAGE 0xfffd0002
+#define XCURSOR_MAX_SIZE 1024
+#define XCURSOR_DEPTH 8
+
+#define CACHE_MAGIC 0x43434c57 /* "WLCC" */
+#define CACHE_VERSION 2
+/* 条目表放在前两页，像素从这里开始 */
+#define CACHE_DATA 8192
+/* 找不到的光标过这么久(秒)再去主题里找一次，期间可能装了新主题 */
+#define CACHE_MISSING_TTL 60
+
+struct cache_entry {
+	char name[CURSOR_THEME_NAME];
+	/* 0 表示主题里没有这个光标，省得别的进程再去找一遍 */
+	int32_t frames;
+	/* 最近一次去主题里找的时间(CLOCK_BOOTTIME 秒)，只对找不到的条目有用 */
+	int64_t checked;
+	int32_t width;
+	int32_t height;
+	int32_t hotspot_x;
+	int32_t hotspot_y;
+	int32_t delay_ms;
+	uint64_t offset;
+};
+
+struct cache_header {
+	uint32_t magic;
+	uint32_t version;
+	char theme[64];
+	int32_t size;
+	int32_t count;
+	uint64_t data_end;
+	struct cache_entry entries[CURSOR_THEME_MAX];
+};
+
+/* 解码出来的一个光标，frames 帧大小相同的像素依次排列 */
+struct xcursor {
+	int width;
+	int height;
+	int hotspot_x;
+	int hotspot_y;
+	int delay_ms;
+	int frames;
+	uint32_t *pixels;
+};
+
+static const char *
+search_path(void)
+{
+	const char *path = getenv("XCURSOR_PATH");
+	return path && *path ? path : "~/.local/share/icons:~/.icons:/usr/share/icons:/usr/share/pixmaps";
+}
+
+/* 依次取出 path 里用 : 分隔的目录，~ 展开成 $HOME */
+static const char *
+next_dir(const char *path, char *dir, size_t size)
+{
+	const char *end;
+	const char *home = "";
+	size_t len;
+
+	if (*path == '\0')
+		return NULL;
+	end = strchrnul(path, ':');
+	len = end - path;
+	if (len > 0 && path[0] == '~')
+	{
+		home = getenv("HOME");
+		if (home == NULL)
+			home = "";
+		path++;
+		len--;
+	}
+	snprintf(dir, size, "%s%.*s", home, (int)len, path);
+	return *end ? end + 1 : end;
+}
+
+static uint32_t
+le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* 只留下最接近 size 的标称大小的所有帧 */
+static int
+xcursor_decode(const uint8_t *data, size_t length, int size, struct xcursor *cursor)
+{
+	uint32_t header, ntoc, best = 0, i;
+	int best_diff = -1;
+
+	if (length < 16 || le32(data) != XCURSOR_MAGIC)
+		return -1;
+	header = le32(data + 4);
+	ntoc = le32(data + 12);
+	if (header < 16 || header > length || ntoc > (length - header) / 12)
+		return -1;
+
+	for (i = 0; i < ntoc; i++)
+	{
+		const uint8_t *toc = data + header + i * 12;
+		int diff;
+
+		if (le32(toc) != XCURSOR_IMAGE)
+			continue;
+		diff = abs((int)le32(toc + 4) - size);
+		if (best_diff < 0 || diff < best_diff)
+		{
+			best_diff = diff;
+			best = le32(toc + 4);
+		}
+	}
+	if (best_diff < 0)
+		return -1;
+
+	memset(cursor, 0, sizeof(*cursor));
+	for (i = 0; i < ntoc; i++)
+	{
+		const uint8_t *toc = data + header + i * 12;
+		uint32_t pos = le32(toc + 8);
+		const uint8_t *chunk = data + pos;
+		uint32_t width, height;
+		size_t frame_size;
+		uint32_t *pixels;
+
+		if (le32(toc) != XCURSOR_IMAGE || le32(toc + 4) != best)
+			continue;
+		if (pos > length || length - pos < 36 || le32(chunk + 4) != XCURSOR_IMAGE)
+			continue;
+		width = le32(chunk + 16);
+		height = le32(chunk + 20);
+		if (width == 0 || height == 0 || width > XCURSOR_MAX_SIZE || height > XCURSOR_MAX_SIZE)
+			continue;
+		frame_size = (size_t)width * height * 4;
+		if (length - pos - 36 < frame_size)
+			continue;
+
+		/* 动画的所有帧要一样大，和第一帧不一样的丢掉 */
+		if (cursor->frames == 0)
+		{
+			cursor->width = width;
+			cursor->height = height;
+			cursor->hotspot_x = le32(chunk + 24);
+			cursor->hotspot_y = le32(chunk + 28);
+			cursor->delay_ms = le32(chunk + 32);
+		}
+		else if ((int)width != cursor->width || (int)height != cursor->height)
+			continue;
+
+		pixels = realloc(cursor->pixels, frame_size * (cursor->frames + 1));
+		if (pixels == NULL)
+		{
+			free(cursor->pixels);
+			return -1;
+		}
+		cursor->pixels = pixels;
+		/* 小端机器上文件里的像素就是 ARGB8888 */
+		memcpy((uint8_t *)pixels + frame_size * cursor->frames, chunk + 36, frame_size);
+		cursor->frames++;
+	}
+	if (cursor->frames == 0)
+		return -1;
+	if (cursor->hotspot_x >= cursor->width)
+		cursor->hotspot_x = cursor->width - 1;
+	if (cursor->hotspot_y >= cursor->height)
+		cursor->hotspot_y = cursor->height - 1;
+	return 0;
+}
+
+static int
+xcursor_load_file(const char *path, int size, struct xcursor *cursor)
+{
+	struct stat st;
+	void *data;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size == 0)
+	{
+		close(fd);
+		return -1;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return -1;
+	ret = xcursor_decode(data, st.st_size, size, cursor);
+	munmap(data, st.st_size);
+	if (ret < 0)
+		fprintf(stderr, "%s is not a valid cursor file\n", path);
+	return ret;
+}
+
+/* 读 index.theme 里的 Inherits=，多个主题用逗号或分号分隔 */
+static int
+read_inherits(const char *dir, const char *theme, char *inherits, size_t size)
+{
+	char path[512], line[512];
+	FILE *file;
+	int found = 0;
+
+	snprintf(path, sizeof(path), "%s/%s/index.theme", dir, theme);
+	file = fopen(path, "re");
+	if (file == NULL)
+		return 0;
+	while (!found && fgets(line, sizeof(line), file))
+	{
+		if (strncmp(line, "Inherits", 8) != 0)
+			continue;
+		char *value = line + 8;
+		while (*value == ' ' || *value == '\t')
+			value++;
+		if (*value != '=')
+			continue;
+		value++;
+		value[strcspn(value, "\r\n")] = '\0';
+		snprintf(inherits, size, "%s", value);
+		found = 1;
+	}
+	fclose(file);
+	return found;
+}
+
+/* 和 libXcursor 一样：先在所有目录里找这个主题，再按顺序找它继承的主题 */
+static int
+xcursor_load(const char *theme, const char *name, int size, struct xcursor *cursor,
+		int depth)
+{
+	char dir[256], path[512], inherits[256];
+	const char *p;
+
+	if (depth > XCURSOR_DEPTH)
+		return -1;
+
+	for (p = search_path(); (p = next_dir(p, dir, sizeof(dir))) != NULL;)
+	{
+		snprintf(path, sizeof(path), "%s/%s/cursors/%s", dir, theme, name);
+		if (xcursor_load_file(path, size, cursor) == 0)
+			return 0;
+	}
+
+	for (p = search_path(); (p = next_dir(p, dir, sizeof(dir))) != NULL;)
+	{
+		if (!read_inherits(dir, theme, inherits, sizeof(inherits)))
+			continue;
+		for (char *save, *parent = strtok_r(inherits, ",; \t", &save); parent;
+				parent = strtok_r(NULL, ",; \t", &save))
+		{
+			if (strcmp(parent, theme) != 0 &&
+				xcursor_load(parent, name, size, cursor, depth + 1) == 0)
+				return 0;
+		}
+		/* 和 libXcursor 一样只看第一个找到的 index.theme */
+		break;
+	}
+	return -1;
+}
+
+static int
+read_header(struct cursor_theme *theme, struct cache_header *header)
+{
+	return pread(theme->fd, header, sizeof(*header), 0) == sizeof(*header) ? 0 : -1;
+}
+
+static int
+header_valid(const struct cursor_theme *theme, const struct cache_header *header)
+{
+	return header->magic == CACHE_MAGIC && header->version == CACHE_VERSION &&
+		strncmp(header->theme, theme->name, sizeof(header->theme)) == 0 &&
+		header->size == theme->size &&
+		header->count >= 0 && header->count <= CURSOR_THEME_MAX &&
+		header->data_end >= CACHE_DATA;
+}
+
+static int64_t
+now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return ts.tv_sec;
+}
+
+/* 缓存文件不是当前格式、主题或大小时重建，要在排他锁里调用
+ * 共享的文件别的进程可能正在不加锁地读像素，不能原地截短：
+ * 在旁边写好一个新文件再 rename 过去，还开着旧文件的进程继续用旧的
+ * */
+static int
+init_cache(struct cursor_theme *theme, const char *path)
+{
+	struct cache_header header;
+	char tmp[300];
+	int fd;
+
+	if (read_header(theme, &header) == 0 && header_valid(theme, &header))
+		return 0;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	snprintf(header.theme, sizeof(header.theme), "%s", theme->name);
+	header.size = theme->size;
+	header.data_end = CACHE_DATA;
+	if (!theme->shared)
+	{
+		if (ftruncate(theme->fd, 0) < 0 ||
+			pwrite(theme->fd, &header, sizeof(header), 0) != sizeof(header))
+		{
+			fprintf(stderr, "initializing cursor cache failed: %m\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0600);
+	if (fd < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+		rename(tmp, path) < 0)
+	{
+		fprintf(stderr, "initializing cursor cache failed: %m\n");
+		if (fd >= 0)
+		{
+			unlink(tmp);
+			close(fd);
+		}
+		return -1;
+	}
+	/* 旧文件的锁随着 close 释放，等在上面的进程会发现文件被换掉了 */
+	close(theme->fd);
+	theme->fd = fd;
+	return 0;
+}
+
+/* 打开共享的缓存文件并拿到排他锁
+ * 等锁的时候别的进程可能已经 rename 了一个新文件过来，锁住的要是路径现在指向的那个
+ * */
+static int
+open_locked(const char *path)
+{
+	struct stat locked, current;
+
+	for (;;)
+	{
+		int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+		if (fd < 0)
+			return -1;
+		flock(fd, LOCK_EX);
+		if (fstat(fd, &locked) == 0 && stat(path, &current) == 0 &&
+			locked.st_dev == current.st_dev && locked.st_ino == current.st_ino)
+			return fd;
+		close(fd);
+	}
+}
+
+static int
+open_cache(struct cursor_theme *theme)
+{
+	const char *runtime = getenv("XDG_RUNTIME_DIR");
+	char path[256], name[64];
+	int ret;
+
+	theme->fd = -1;
+	path[0] = '\0';
+	if (runtime && *runtime)
+	{
+		/* 主题名来自环境变量，不能让它带上路径 */
+		snprintf(name, sizeof(name), "%s", theme->name);
+		for (char *c = name; *c; c++)
+			if (*c == '/')
+				*c = '_';
+		snprintf(path, sizeof(path), "%s/wl-cursor-%s-%d.cache", runtime, name, theme->size);
+		theme->fd = open_locked(path);
+		if (theme->fd < 0)
+			fprintf(stderr, "opening %s failed: %m, cursor cache is private\n", path);
+		else
+			theme->shared = 1;
+	}
+	if (theme->fd < 0)
+	{
+		theme->fd = memfd_create("cursor-theme", MFD_CLOEXEC);
+		if (theme->fd < 0)
+			return -1;
+		flock(theme->fd, LOCK_EX);
+	}
+
+	ret = init_cache(theme, path);
+	flock(theme->fd, LOCK_UN);
+	return ret;
+}
+
+int
+cursor_theme_open(struct cursor_theme *theme, const char *name, int size)
+{
+	memset(theme, 0, sizeof(*theme));
+	if (name == NULL)
+		name = getenv("XCURSOR_THEME");
+	if (name == NULL || *name == '\0')
+		name = "default";
+	if (size <= 0 && getenv("XCURSOR_SIZE"))
+		size = atoi(getenv("XCURSOR_SIZE"));
+	if (size <= 0)
+		size = 24;
+	snprintf(theme->name, sizeof(theme->name), "%s", name);
+	theme->size = size;
+
+	if (open_cache(theme) < 0)
+	{
+		cursor_theme_close(theme);
+		return -1;
+	}
+	return 0;
+}
+
+void
+cursor_theme_close(struct cursor_theme *theme)
+{
+	if (theme->fd >= 0)
+		close(theme->fd);
+	theme->fd = -1;
+	theme->image_count = 0;
+}
+
+/* 过期的找不到的条目后面可能又追加了同名的条目，从后往前找最新的 */
+static struct cache_entry *
+find_entry(struct cache_header *header, const char *name)
+{
+	for (int i = header->count - 1; i >= 0; i--)
+		if (strncmp(header->entries[i].name, name, CURSOR_THEME_NAME) == 0)
+			return &header->entries[i];
+	return NULL;
+}
+
+static int
+entry_fresh(const struct cache_entry *entry)
+{
+	return entry->frames > 0 || now_s() - entry->checked < CACHE_MISSING_TTL;
+}
+
+/* 解码 name 并追加进缓存，要在排他锁里调用
+ * 找不到的光标也记一条；missing 是已经过期的找不到的条目，还是找不到时只更新它的时间。
+ * 返回写进去的条目，缓存满了返回 NULL
+ * */
+static const struct cache_entry *
+append_entry(struct cursor_theme *theme, struct cache_header *header, const char *name,
+		struct cache_entry *missing)
+{
+	struct cache_entry *entry;
+	struct xcursor cursor;
+	size_t size = 0;
+	int loaded = xcursor_load(theme->name, name, theme->size, &cursor, 0) == 0;
+
+	if (!loaded && missing)
+	{
+		/* 没有像素的条目改了也不影响别人，原地更新 */
+		missing->checked = now_s();
+		if (pwrite(theme->fd, missing, sizeof(*missing),
+				(const uint8_t *)missing - (const uint8_t *)header) != sizeof(*missing))
+			fprintf(stderr, "writing cursor cache failed: %m\n");
+		return missing;
+	}
+	if (header->count >= CURSOR_THEME_MAX)
+	{
+		if (loaded)
+			free(cursor.pixels);
+		return NULL;
+	}
+	entry = &header->entries[header->count];
+	memset(entry, 0, sizeof(*entry));
+	snprintf(entry->name, sizeof(entry->name), "%s", name);
+	entry->checked = now_s();
+
+	if (loaded)
+	{
+		size = (size_t)cursor.width * cursor.height * 4 * cursor.frames;
+		if (pwrite(theme->fd, cursor.pixels, size, header->data_end) != (ssize_t)size)
+		{
+			fprintf(stderr, "writing cursor cache failed: %m\n");
+			free(cursor.pixels);
+			return NULL;
+		}
+		free(cursor.pixels);
+		entry->frames = cursor.frames;
+		entry->width = cursor.width;
+		entry->height = cursor.height;
+		entry->hotspot_x = cursor.hotspot_x;
+		entry->hotspot_y = cursor.hotspot_y;
+		entry->delay_ms = cursor.delay_ms;
+		entry->offset = header->data_end;
+		theme->decoded++;
+	}
+
+	/* 像素先写，条目和 count 后写，下一个光标的像素按 64 字节对齐 */
+	header->data_end = (header->data_end + size + 63) & ~(uint64_t)63;
+	header->count++;
+	if (pwrite(theme->fd, header, sizeof(*header), 0) != sizeof(*header))
+	{
+		fprintf(stderr, "writing cursor cache failed: %m\n");
+		return NULL;
+	}
+	return entry;
+}
+
+static void
+draw_cached(uint32_t *pixels, int stride, int width, int height, int frame, void *data)
+{
+	const struct cursor_theme_image *image = data;
+	size_t frame_size = (size_t)image->width * image->height * 4;
+
+	/* cursor_manager 给的 stride 就是宽度，一帧可以一次读完 */
+	if (stride != image->width || width != image->width || height != image->height ||
+		pread(image->theme->fd, pixels, frame_size,
+			image->offset + frame_size * frame) != (ssize_t)frame_size)
+		fprintf(stderr, "reading cursor frame %d from cache failed\n", frame);
+}
+
+int
+cursor_theme_desc(struct cursor_theme *theme, const char *name,
+		struct cursor_desc *desc)
+{
+	struct cache_header header;
+	struct cache_entry *found;
+	const struct cache_entry *entry;
+	struct cursor_theme_image *image;
+
+	if (theme->fd < 0 || strlen(name) >= CURSOR_THEME_NAME ||
+		theme->image_count >= CURSOR_THEME_MAX)
+		return -1;
+
+	/* 大多数时候别的进程已经解码过了，共享锁下查一下表就行 */
+	flock(theme->fd, LOCK_SH);
+	entry = read_header(theme, &header) == 0 ? find_entry(&header, name) : NULL;
+	flock(theme->fd, LOCK_UN);
+	if (entry && entry_fresh(entry))
+	{
+		theme->cached++;
+	}
+	else
+	{
+		/* 拿到排他锁之前可能已经有人写进去了，要重新读一次
+		 * 打开时检查过文件头，之后文件只会被追加，不会再变成别的格式
+		 * */
+		entry = NULL;
+		flock(theme->fd, LOCK_EX);
+		if (read_header(theme, &header) == 0 && header_valid(theme, &header))
+		{
+			found = find_entry(&header, name);
+			if (found && entry_fresh(found))
+			{
+				entry = found;
+				theme->cached++;
+			}
+			else
+			{
+				entry = append_entry(theme, &header, name, found);
+			}
+		}
+		flock(theme->fd, LOCK_UN);
+	}
+	if (entry == NULL || entry->frames <= 0)
+		return -1;
+
+	image = &theme->images[theme->image_count++];
+	image->theme = theme;
+	image->offset = entry->offset;
+	image->width = entry->width;
+	image->height = entry->height;
+	image->frames = entry->frames;
+
+	desc->name = name;
+	desc->width = entry->width;
+	desc->height = entry->height;
+	desc->hotspot_x = entry->hotspot_x;
+	desc->hotspot_y = entry->hotspot_y;
+	desc->frames = entry->frames;
+	desc->delay_ms = entry->delay_ms;
+	desc->draw = draw_cached;
+	desc->data = image;
+	return 0;
+}
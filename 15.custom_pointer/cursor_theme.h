@@ -0,0 +1,55 @@
+#ifndef CURSOR_THEME_H
+#define CURSOR_THEME_H
+
+#include <stdint.h>
+
+#include "cursor.h"
+
+/* 从 XCursor 主题里加载光标
+ *
+ * 只解析真正用到的光标文件，每个光标第一次用到时才解码。
+ * 解码结果追加进 $XDG_RUNTIME_DIR 下按主题和大小命名的缓存文件(tmpfs)，
+ * 同一用户的其他进程直接从这里读像素，不用再扫描主题目录、解析文件，
+ * 第一个进程之后加载光标主题几乎没有开销。
+ * 缓存文件只追加：已经写进去的像素不会再改，写的时候拿 flock 排他锁，
+ * 读条目表时拿共享锁，像素在 data_end 之前，读的时候不用锁。
+ * 格式不对要重建时写一个新文件 rename 过去，不截短正在被别人读的文件；
+ * 主题里找不到的光标也记下来，过一分钟再去找一次
+ * */
+
+#define CURSOR_THEME_MAX 64
+#define CURSOR_THEME_NAME 32
+
+struct cursor_theme_image {
+	struct cursor_theme *theme;
+	uint64_t offset;
+	int width;
+	int height;
+	int frames;
+};
+
+struct cursor_theme {
+	char name[64];
+	int size;
+	/* 缓存文件，没有 XDG_RUNTIME_DIR 时是本进程私有的 memfd */
+	int fd;
+	int shared;
+	/* 给 cursor_desc 的 data 用，地址在 close 之前不变 */
+	struct cursor_theme_image images[CURSOR_THEME_MAX];
+	int image_count;
+	/* 统计：从缓存拿到的、本进程解码的光标数 */
+	unsigned cached;
+	unsigned decoded;
+};
+
+/* name 为 NULL 时用 $XCURSOR_THEME(默认 default)，size 为 0 时用 $XCURSOR_SIZE(默认 24) */
+int cursor_theme_open(struct cursor_theme *theme, const char *name, int size);
+void cursor_theme_close(struct cursor_theme *theme);
+
+/* 填好 desc，draw 会从缓存里复制像素，调用 cursor_manager_init 之前不能 close。
+ * desc->name 是传进来的 name，主题里没有这个光标返回 -1
+ * */
+int cursor_theme_desc(struct cursor_theme *theme, const char *name,
+		struct cursor_desc *desc);
+
+#endif
@@ -12,8 +12,15 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
 #include <linux/input.h>
 
+#include "cursor.h"
+#include "cursor_theme.h"
+#include "layer.h"
+
 static struct wl_display *display = NULL;
 static struct wl_compositor *compositor = NULL;
 struct wl_surface *surface;
@@ -24,16 +31,21 @@ struct wl_buffer *buffer;
 // input device
 struct wl_seat *seat;
 struct wl_pointer *pointer;
+struct wl_subcompositor *subcompositor;
 
-struct wl_surface *pointer_surface;
-struct wl_buffer *pointer_buffer;
+// 所有光标放在一个 pool 里，窗口左半边是默认光标，右半边是转圈的忙碌光标
+struct cursor_manager cursors;
+int cursor_default = -1;
+int cursor_busy = -1;
 
 void *shm_data;
-void *pointer_shm_data;
 
 int WIDTH = 480;
 int HEIGHT = 360;
 
+// 跟随鼠标移动的标记大小
+#define MARKER_SIZE 16
+
 #define BIND_WL_REG(registry, ptr, id, intf, n) \
 	do                                          \
 	{                                           \
@@ -41,57 +53,117 @@ int HEIGHT = 360;
 			registry, id, intf, n);             \
 	} while (0)
 
-static struct wl_buffer *
-create_pointer_buffer()
+// 纯色方块，和原来的光标一样
+static void
+draw_square(uint32_t *pixels, int stride, int width, int height, int frame, void *data)
 {
-	struct wl_shm_pool *pool;
-	int stride = 40 * 4; // 4 bytes per pixel
-	int size = stride * 40;
-	int fd;
-	struct wl_buffer *buff;
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			pixels[y * stride + x] = 0xff00ff00;//绿色
+}
 
-	fd = os_create_anonymous_file(size);
-	if (fd < 0)
+#define SPINNER_DOTS 12
+
+// 一圈小圆点，每一帧最亮的点往前走一格
+static void
+draw_spinner(uint32_t *pixels, int stride, int width, int height, int frame, void *data)
+{
+	float cx = width / 2.0f, cy = height / 2.0f;
+	float ring = width * 0.35f, dot = width * 0.09f;
+
+	for (int i = 0; i < SPINNER_DOTS; i++)
 	{
-		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
-				size);
-		exit(1);
+		float angle = 2 * M_PI * i / SPINNER_DOTS;
+		float dx = cx + ring * sinf(angle), dy = cy - ring * cosf(angle);
+		int age = (frame - i + SPINNER_DOTS) % SPINNER_DOTS;
+		uint32_t a = 255 - age * 200 / SPINNER_DOTS;
+
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+			{
+				float d = hypotf(x + 0.5f - dx, y + 0.5f - dy) - dot;
+				if (d >= 1)
+					continue;
+				// 边缘 1 个像素做抗锯齿，白色预乘后 RGB 等于 alpha
+				uint32_t v = d <= 0 ? a : (uint32_t)(a * (1 - d));
+				pixels[y * stride + x] = v << 24 | v << 16 | v << 8 | v;
+			}
 	}
+}
+
+// 光标主题里没有时用自己画的
+static const struct cursor_desc cursor_descs[] = {
+	{ "default", 40, 40, 20, 20, 1, 0, draw_square, NULL },
+	{ "busy", 32, 32, 16, 16, SPINNER_DOTS, 80, draw_spinner, NULL },
+};
+
+// 光标主题里可能的名字，按顺序找
+static const char *const theme_names[][3] = {
+	{ "default", "left_ptr", NULL },
+	{ "wait", "watch", NULL },
+};
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
 
-	pointer_shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (pointer_shm_data == MAP_FAILED)
+// 创建光标，主题要等所有帧复制进 pool 之后才能关
+static int
+create_cursors(void)
+{
+	struct cursor_desc descs[2];
+	struct cursor_theme theme;
+	double start = now_ms();
+	int themed = cursor_theme_open(&theme, NULL, 0) == 0;
+	int ret;
+
+	for (int i = 0; i < 2; i++)
 	{
-		fprintf(stderr, "mmap failed: %m\n");
-		close(fd);
-		exit(1);
+		descs[i] = cursor_descs[i];
+		for (int j = 0; themed && theme_names[i][j]; j++)
+		{
+			if (cursor_theme_desc(&theme, theme_names[i][j], &descs[i]) == 0)
+			{
+				descs[i].name = cursor_descs[i].name;
+				break;
+			}
+		}
 	}
-
-	pool = wl_shm_create_pool(shm, fd, size);
-	buff = wl_shm_pool_create_buffer(pool, 0,
-									 40 ,40,
-									 stride,
-									 WL_SHM_FORMAT_XRGB8888);
-	//wl_buffer_add_listener(buffer, &buffer_listener, buffer);
-	wl_shm_pool_destroy(pool);
-	return buff;
+	if (themed)
+		fprintf(stderr, "cursor theme %s size %d: %u from %s cache, %u decoded, %.2f ms\n",
+				theme.name, theme.size, theme.cached, theme.shared ? "shared" : "private",
+				theme.decoded, now_ms() - start);
+
+	ret = cursor_manager_init(&cursors, shm, compositor, descs, 2);
+	if (themed)
+		cursor_theme_close(&theme);
+	return ret;
 }
 
+static void move_marker(int x, int y);
+
 static void
 pointer_handle_enter(void *data, struct wl_pointer *pointer,
                      uint32_t serial, struct wl_surface *surface,
                      wl_fixed_t sx, wl_fixed_t sy)
 {
     //fprintf(stderr, "Pointer entered surface %p at %f %f\n", surface, wl_fixed_to_double(sx), wl_fixed_to_double(sy));
-    wl_surface_attach(pointer_surface,pointer_buffer,0,0);
-    wl_surface_commit(pointer_surface);
-    wl_pointer_set_cursor(pointer,serial,pointer_surface,20,20);
+    // 光标的帧已经挂在 surface 上了，再次进入只需要 set_cursor
+    cursor_manager_set(&cursors, wl_fixed_to_int(sx) < WIDTH / 2 ? cursor_default : cursor_busy);
+    cursor_manager_enter(&cursors, pointer, serial);
 }
 
 static void
 pointer_handle_leave(void *data, struct wl_pointer *pointer,
                      uint32_t serial, struct wl_surface *surface)
 {
-    fprintf(stderr, "Pointer left surface %p\n", surface);
+    fprintf(stderr, "Pointer left surface %p, %u cursor attaches so far\n",
+            surface, cursors.attaches);
+    cursor_manager_leave(&cursors);
 }
 
 static void
@@ -99,6 +171,9 @@ pointer_handle_motion(void *data, struct wl_pointer *pointer,
                       uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
 {
     printf("Pointer moved at %f %f\n", wl_fixed_to_double(sx), wl_fixed_to_double(sy));
+    // 光标没变时不会发任何请求
+    cursor_manager_set(&cursors, wl_fixed_to_int(sx) < WIDTH / 2 ? cursor_default : cursor_busy);
+    move_marker(wl_fixed_to_int(sx), wl_fixed_to_int(sy));
 }
 
 static void
@@ -297,14 +372,20 @@ create_buffer()
 	return buff;
 }
 
+static void paint_pixels();
+
+/* 背景是静态内容，画好之后只提交这一次 */
 static void
 create_window()
 {
 	buffer = create_buffer();
+	paint_pixels();
 
 	wl_surface_attach(surface, buffer, 0, 0);
 	//wl_surface_damage(surface, 0, 0, WIDTH, HEIGHT);
 	wl_surface_commit(surface);
+
+	layer_count((uint64_t)WIDTH * HEIGHT * 4);
 }
 
 static void
@@ -337,6 +418,8 @@ global_registry_handler(void *data, struct wl_registry *registry,
 	}else if(strcmp(interface, "wl_seat")==0){
 		BIND_WL_REG(registry, seat, id, &wl_seat_interface, 1);
 		wl_seat_add_listener(seat,&seat_listener,NULL);
+	}else if(strcmp(interface, "wl_subcompositor")==0){
+		BIND_WL_REG(registry, subcompositor, id, &wl_subcompositor_interface, 1);
 	}
 }
 
@@ -352,6 +435,51 @@ static const struct wl_registry_listener registry_listener = {
 	global_registry_remover,
 };
 
+static struct layer marker;
+
+/* 标记的内容只画一次，之后鼠标移动只改变 subsurface 的位置，
+ * 背景不需要重画
+ * */
+static void
+create_marker()
+{
+	struct layer_buffer *lb;
+	struct wl_region *region;
+	int i;
+
+	if (subcompositor == NULL)
+	{
+		fprintf(stderr, "Can't find subcompositor, no marker\n");
+		return;
+	}
+	if (layer_init(&marker, shm, compositor, subcompositor, surface, 0, 0, MARKER_SIZE, MARKER_SIZE, 0) < 0)
+	{
+		fprintf(stderr, "Can't create marker layer: %m\n");
+		return;
+	}
+
+	// 空的输入区域，鼠标事件穿过标记落到父 surface 上
+	region = wl_compositor_create_region(compositor);
+	wl_surface_set_input_region(marker.surface, region);
+	wl_region_destroy(region);
+
+	lb = layer_next_buffer(&marker);
+	for (i = 0; i < MARKER_SIZE * MARKER_SIZE; i++)
+		lb->data[i] = 0xffff00;//黄色
+	// 同步模式的 subsurface，内容跟随父 surface 的下一次提交一起生效
+	layer_submit(&marker, lb, 0, 0, MARKER_SIZE, MARKER_SIZE);
+}
+
+static void
+move_marker(int x, int y)
+{
+	if (marker.subsurface == NULL)
+		return;
+
+	layer_move(&marker, surface, x - MARKER_SIZE / 2, y - MARKER_SIZE / 2);
+	layer_report(WIDTH * HEIGHT * 4);
+}
+
 static void
 paint_pixels() {
     int n;
@@ -401,7 +529,6 @@ int main(int argc, char **argv)
 	{
 		fprintf(stderr, "Created surface\n");
 	}
-	pointer_surface = wl_compositor_create_surface(compositor);
 
 	shell_surface = wl_shell_get_shell_surface(shell, surface);
 	if (shell_surface == NULL)
@@ -416,20 +543,49 @@ int main(int argc, char **argv)
 	wl_shell_surface_set_toplevel(shell_surface);
 	//wl_shell_suface_add_listener(shell_surface,&shell_surface_listener,NULL);
 	
-	pointer_buffer = create_pointer_buffer();
-	
-	uint32_t *pixel = pointer_shm_data;
-	for(int i=0;i<40*40;i++){
-		*pixel++ = 0x00ff00;//绿色
+	if (create_cursors() < 0)
+	{
+		fprintf(stderr, "Can't create cursors\n");
+		exit(1);
 	}
+	cursor_default = cursor_manager_find(&cursors, "default");
+	cursor_busy = cursor_manager_find(&cursors, "busy");
 
+	// 父 surface 提交后 subsurface 才会显示出来
+	create_marker();
 	create_window();
-	paint_pixels();
 
-	while(wl_display_dispatch(display)!=-1){
-		;
+	/* 除了 Wayland 事件还要等光标动画的定时器 */
+	struct pollfd fds[2] = {
+		{ wl_display_get_fd(display), POLLIN, 0 },
+		{ cursor_manager_timer_fd(&cursors), POLLIN, 0 },
+	};
+	for (;;)
+	{
+		while (wl_display_prepare_read(display) != 0)
+			wl_display_dispatch_pending(display);
+		wl_display_flush(display);
+		if (poll(fds, 2, -1) < 0)
+		{
+			wl_display_cancel_read(display);
+			break;
+		}
+		if (fds[0].revents & POLLIN)
+		{
+			if (wl_display_read_events(display) < 0)
+				break;
+		}
+		else
+		{
+			wl_display_cancel_read(display);
+		}
+		if (wl_display_dispatch_pending(display) < 0)
+			break;
+		if (fds[1].revents & POLLIN)
+			cursor_manager_tick(&cursors);
 	}
 
+	cursor_manager_finish(&cursors);
 	wl_display_disconnect(display);
 	printf("disconnected from display\n");
 
@@ -14,6 +14,9 @@
 #include <unistd.h>
 #include <linux/input.h>
 
+#include "image.h"
+#include "cursor.h"
+
 static struct wl_display *display = NULL;
 static struct wl_compositor *compositor = NULL;
 struct wl_surface *surface;
@@ -25,11 +28,12 @@ struct wl_buffer *buffer;
 struct wl_seat *seat;
 struct wl_pointer *pointer;
 
-struct wl_surface *pointer_surface;
-struct wl_buffer *pointer_buffer;
+// 光标放在 cursor_manager 的 pool 里，进入窗口时不再重新 attach
+struct cursor_manager cursors;
 
 void *shm_data;
-void *pointer_shm_data;
+// 光标图片，.img 文件直接作为 shm pool
+struct image pointer_image;
 
 int WIDTH = 480;
 int HEIGHT = 360;
@@ -41,39 +45,47 @@ int HEIGHT = 360;
 			registry, id, intf, n);             \
 	} while (0)
 
-static struct wl_buffer *
-create_pointer_buffer()
+// 把 1.img 复制到光标 pool 里，没有 alpha 的格式当成不透明
+static void
+draw_image(uint32_t *pixels, int stride, int width, int height, int frame, void *data)
 {
-	struct wl_shm_pool *pool;
-	int stride = 32 * 4; // 4 bytes per pixel
-	int size = stride * 32;
-	int fd;
-	struct wl_buffer *buff;
+	struct image *image = data;
+	const uint8_t *src = image_map(image);
+	uint32_t opaque = image->header.format == WL_SHM_FORMAT_XRGB8888 ? 0xff000000 : 0;
 
-	fd = open("./1.rgb", O_RDWR);
-	if (fd < 0)
+	if (src == NULL)
+		return;
+	for (int y = 0; y < height; y++)
 	{
-		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
-				size);
-		exit(1);
+		const uint32_t *row = (const uint32_t *)(src + (size_t)y * image->header.stride);
+		for (int x = 0; x < width; x++)
+			pixels[y * stride + x] = row[x] | opaque;
 	}
+}
 
-	pointer_shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (pointer_shm_data == MAP_FAILED)
+static void
+create_cursors()
+{
+	// 大小和格式都从文件头读取
+	if (image_open(&pointer_image, "./1.img", IMAGE_SEALED) < 0)
+		exit(1);
+	if (pointer_image.header.format != WL_SHM_FORMAT_XRGB8888 &&
+		pointer_image.header.format != WL_SHM_FORMAT_ARGB8888)
 	{
-		fprintf(stderr, "mmap failed: %m\n");
-		close(fd);
+		fprintf(stderr, "1.img must be xrgb8888 or argb8888\n");
 		exit(1);
 	}
 
-	pool = wl_shm_create_pool(shm, fd, size);
-	buff = wl_shm_pool_create_buffer(pool, 0,
-									 32 ,32,
-									 stride,
-									 WL_SHM_FORMAT_XRGB8888);
-	//wl_buffer_add_listener(buffer, &buffer_listener, buffer);
-	wl_shm_pool_destroy(pool);
-	return buff;
+	struct cursor_desc desc = {
+		"image",
+		pointer_image.header.width, pointer_image.header.height,
+		pointer_image.header.width / 2, pointer_image.header.height / 2,
+		1, 0, draw_image, &pointer_image,
+	};
+	if (cursor_manager_init(&cursors, shm, compositor, &desc, 1) < 0)
+		exit(1);
+	// 像素已经复制进 pool 了
+	image_close(&pointer_image);
 }
 
 static void
@@ -82,9 +94,7 @@ pointer_handle_enter(void *data, struct wl_pointer *pointer,
                      wl_fixed_t sx, wl_fixed_t sy)
 {
     //fprintf(stderr, "Pointer entered surface %p at %f %f\n", surface, wl_fixed_to_double(sx), wl_fixed_to_double(sy));
-    wl_surface_attach(pointer_surface,pointer_buffer,0,0);
-    wl_surface_commit(pointer_surface);
-    wl_pointer_set_cursor(pointer,serial,pointer_surface,16,16);
+    cursor_manager_enter(&cursors, pointer, serial);
 }
 
 static void
@@ -92,6 +102,7 @@ pointer_handle_leave(void *data, struct wl_pointer *pointer,
                      uint32_t serial, struct wl_surface *surface)
 {
     fprintf(stderr, "Pointer left surface %p\n", surface);
+    cursor_manager_leave(&cursors);
 }
 
 static void
@@ -401,7 +412,6 @@ int main(int argc, char **argv)
 	{
 		fprintf(stderr, "Created surface\n");
 	}
-	pointer_surface = wl_compositor_create_surface(compositor);
 
 	shell_surface = wl_shell_get_shell_surface(shell, surface);
 	if (shell_surface == NULL)
@@ -416,7 +426,7 @@ int main(int argc, char **argv)
 	wl_shell_surface_set_toplevel(shell_surface);
 	//wl_shell_suface_add_listener(shell_surface,&shell_surface_listener,NULL);
 	
-	pointer_buffer = create_pointer_buffer();
+	create_cursors();
 
 	create_window();
 	paint_pixels();
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "layer.h"
+
+// 所有图层累计提交的字节数和帧数
+static uint64_t bytes_submitted = 0;
+static uint32_t frames_submitted = 0;
+
+static void
+layer_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct layer_buffer *lb = data;
+	struct layer *layer = lb->layer;
+	void (*ready)(struct layer *, void *) = layer->ready;
+
+	lb->busy = 0;
+	if (ready)
+	{
+		layer->ready = NULL;
+		ready(layer, layer->ready_data);
+	}
+}
+
+static const struct wl_buffer_listener layer_buffer_listener = {
+	layer_buffer_release
+};
+
+int
+layer_init(struct layer *layer, struct wl_shm *shm,
+		   struct wl_compositor *compositor, struct wl_subcompositor *subcompositor,
+		   struct wl_surface *parent, int x, int y, int width, int height, int desync)
+{
+	struct wl_shm_pool *pool;
+	int stride = width * 4;
+	int size = stride * height;
+	uint8_t *data;
+	int fd;
+	int i;
+
+	memset(layer, 0, sizeof(*layer));
+	layer->width = width;
+	layer->height = height;
+
+	fd = memfd_create("layer", MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size * LAYER_BUFFERS) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	data = mmap(NULL, size * LAYER_BUFFERS, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(shm, fd, size * LAYER_BUFFERS);
+	for (i = 0; i < LAYER_BUFFERS; i++)
+	{
+		layer->buffers[i].layer = layer;
+		layer->buffers[i].data = (uint32_t *)(data + i * size);
+		layer->buffers[i].buffer = wl_shm_pool_create_buffer(pool, i * size,
+									width, height, stride, WL_SHM_FORMAT_XRGB8888);
+		wl_buffer_add_listener(layer->buffers[i].buffer,
+							   &layer_buffer_listener, &layer->buffers[i]);
+	}
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	layer->surface = wl_compositor_create_surface(compositor);
+	layer->subsurface = wl_subcompositor_get_subsurface(subcompositor,
+														layer->surface, parent);
+	wl_subsurface_set_position(layer->subsurface, x, y);
+	if (desync)
+		wl_subsurface_set_desync(layer->subsurface);
+
+	return 0;
+}
+
+struct layer_buffer *
+layer_next_buffer(struct layer *layer)
+{
+	int i;
+
+	for (i = 0; i < LAYER_BUFFERS; i++)
+	{
+		if (!layer->buffers[i].busy)
+			return &layer->buffers[i];
+	}
+	return NULL;
+}
+
+void
+layer_wait(struct layer *layer, void (*ready)(struct layer *layer, void *data),
+		   void *data)
+{
+	layer->ready = ready;
+	layer->ready_data = data;
+}
+
+void
+layer_submit(struct layer *layer, struct layer_buffer *lb,
+			 int x, int y, int width, int height)
+{
+	lb->busy = 1;
+	wl_surface_attach(layer->surface, lb->buffer, 0, 0);
+	wl_surface_damage(layer->surface, x, y, width, height);
+	wl_surface_commit(layer->surface);
+
+	layer_count((uint64_t)width * height * 4);
+}
+
+void
+layer_move(struct layer *layer, struct wl_surface *parent, int x, int y)
+{
+	wl_subsurface_set_position(layer->subsurface, x, y);
+	wl_surface_commit(parent);
+
+	layer_count(0);
+}
+
+void
+layer_count(uint64_t bytes)
+{
+	bytes_submitted += bytes;
+	frames_submitted++;
+}
+
+void
+layer_report(int window_bytes)
+{
+	if (frames_submitted == 0 || frames_submitted % 60 != 0)
+		return;
+
+	fprintf(stderr, "%u frames, %llu bytes/frame (full window repaint: %d bytes/frame)\n",
+			frames_submitted,
+			(unsigned long long)(bytes_submitted / frames_submitted),
+			window_bytes);
+}
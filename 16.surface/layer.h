@@ -0,0 +1,75 @@
+#ifndef LAYER_H
+#define LAYER_H
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+/* 图层：一个 wl_surface 和它自己的一组 buffer，15、16 两个例子共用
+ * 静态内容(背景、装饰)放在父 surface 上，只提交一次；
+ * 动画或者交互的内容放在小的 subsurface 上，
+ * 每帧提交的 buffer 大小和 damage 只有动画区域那么大
+ * */
+#define LAYER_BUFFERS 2
+
+struct layer;
+
+struct layer_buffer {
+	struct wl_buffer *buffer;
+	uint32_t *data;
+	int busy;
+	struct layer *layer;
+};
+
+struct layer {
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	int width;
+	int height;
+	struct layer_buffer buffers[LAYER_BUFFERS];
+	/* layer_wait 设置，有 buffer 被释放时调用一次 */
+	void (*ready)(struct layer *layer, void *data);
+	void *ready_data;
+};
+
+/* 在 parent 上创建一个 width x height 的 subsurface 图层
+ * 位置和 sync/desync 属性在父 surface 下一次 commit 时生效
+ * desync 的图层可以独立提交，不需要等父 surface
+ * */
+int
+layer_init(struct layer *layer, struct wl_shm *shm,
+		   struct wl_compositor *compositor, struct wl_subcompositor *subcompositor,
+		   struct wl_surface *parent, int x, int y, int width, int height, int desync);
+
+/* 取一个合成器没有在使用的 buffer，都在使用时返回 NULL */
+struct layer_buffer *
+layer_next_buffer(struct layer *layer);
+
+/* buffer 都在合成器手里时，等到其中一个被释放再调用 ready，
+ * 不需要为了拿到 frame callback 提交一个空的 commit
+ * */
+void
+layer_wait(struct layer *layer, void (*ready)(struct layer *layer, void *data),
+		   void *data);
+
+/* 提交图层中 (x, y, width, height) 这块变化的区域
+ * 只把这块区域计入每帧提交的字节数
+ * */
+void
+layer_submit(struct layer *layer, struct layer_buffer *lb,
+			 int x, int y, int width, int height);
+
+/* 移动图层只修改父 surface 的状态，父 surface 提交时不带新的 buffer，
+ * 所以这一帧提交的字节数为 0
+ * */
+void
+layer_move(struct layer *layer, struct wl_surface *parent, int x, int y);
+
+/* 所有图层累计提交的字节数和帧数，父 surface 自己提交的 buffer 用 layer_count 计入 */
+void
+layer_count(uint64_t bytes);
+
+/* 每 60 帧打印一次平均每帧提交的字节数，和重画整个窗口的字节数对比 */
+void
+layer_report(int window_bytes);
+
+#endif
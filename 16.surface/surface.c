@@ -13,6 +13,11 @@
 #include <errno.h>
 #include <unistd.h>
 
+#include "viewporter-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+#include "solid_buffer.h"
+#include "layer.h"
+
 static struct wl_display *display = NULL;
 static struct wl_compositor *compositor = NULL;
 struct wl_surface *surface;
@@ -20,11 +25,24 @@ struct wl_shell *shell;
 struct wl_shell_surface *shell_surface;
 struct wl_shm *shm;
 struct wl_buffer *buffer;
+// 纯色快速路径用到的扩展，合成器不支持时为 NULL
+struct wp_viewporter *viewporter;
+struct wp_single_pixel_buffer_manager_v1 *single_pixel_manager;
+struct wp_viewport *viewport;
+struct wl_subcompositor *subcompositor;
 
 void *shm_data;
 
 int WIDTH = 480;
 int HEIGHT = 360;
+/* 窗口的颜色，XRGB8888 */
+#define WINDOW_COLOR 0xff0000 // 红色
+
+// 动画区域(进度条)的位置和大小
+#define BAR_X 20
+#define BAR_Y (HEIGHT - 40)
+#define BAR_WIDTH (WIDTH - 40)
+#define BAR_HEIGHT 16
 
 #define BIND_WL_REG(registry, ptr, id, intf, n) \
 	do                                          \
@@ -184,16 +202,86 @@ create_buffer()
 	return buff;
 }
 
+static void paint_pixels(uint32_t color);
+
+/* 背景是静态内容，画好之后只提交这一次 */
 static void
 create_window()
 {
-	buffer = create_buffer();
+	/* 背景只有一种颜色，优先使用纯色快速路径 */
+	buffer = solid_buffer_create(shm, viewporter, single_pixel_manager, surface,
+								 WIDTH, HEIGHT, WINDOW_COLOR, &viewport);
+	if (buffer == NULL)
+	{
+		buffer = create_buffer();
+		paint_pixels(WINDOW_COLOR);
+		layer_count((uint64_t)WIDTH * HEIGHT * 4);
+	}
+	else
+	{
+		layer_count(4);
+	}
 
 	wl_surface_attach(surface, buffer, 0, 0);
 	//wl_surface_damage(surface, 0, 0, WIDTH, HEIGHT);
 	wl_surface_commit(surface);
 }
 
+static struct layer bar;
+static uint32_t bar_progress = 0;
+
+static const struct wl_callback_listener bar_frame_listener;
+
+static void draw_bar();
+
+static void
+bar_ready(struct layer *layer, void *data)
+{
+	draw_bar();
+}
+
+/* 只重画进度条所在的 subsurface，背景保持不动 */
+static void
+draw_bar()
+{
+	struct layer_buffer *lb = layer_next_buffer(&bar);
+	struct wl_callback *cb;
+	int filled;
+	int x, y;
+
+	if (lb == NULL)
+	{
+		// 两个 buffer 都还在合成器手里，等其中一个被释放再画
+		layer_wait(&bar, bar_ready, NULL);
+		return;
+	}
+
+	cb = wl_surface_frame(bar.surface);
+	wl_callback_add_listener(cb, &bar_frame_listener, NULL);
+
+	filled = bar_progress % (bar.width + 1);
+	for (y = 0; y < bar.height; y++)
+	{
+		for (x = 0; x < bar.width; x++)
+			lb->data[y * bar.width + x] = x < filled ? 0x00ff00 : 0x202020;
+	}
+	bar_progress += 2;
+
+	layer_submit(&bar, lb, 0, 0, bar.width, bar.height);
+	layer_report(WIDTH * HEIGHT * 4);
+}
+
+static void
+bar_frame_done(void *data, struct wl_callback *cb, uint32_t time)
+{
+	wl_callback_destroy(cb);
+	draw_bar();
+}
+
+static const struct wl_callback_listener bar_frame_listener = {
+	bar_frame_done
+};
+
 static void
 handle_ping(void *data, struct wl_shell_surface *shell_surface,
 							uint32_t serial)
@@ -247,6 +335,19 @@ global_registry_handler(void *data, struct wl_registry *registry,
 		BIND_WL_REG(registry, shm, id, &wl_shm_interface, 1);
 		wl_shm_add_listener(shm, &shm_listener, NULL);
 	}
+	else if (strcmp(interface, wp_viewporter_interface.name) == 0)
+	{
+		BIND_WL_REG(registry, viewporter, id, &wp_viewporter_interface, 1);
+	}
+	else if (strcmp(interface, wp_single_pixel_buffer_manager_v1_interface.name) == 0)
+	{
+		BIND_WL_REG(registry, single_pixel_manager, id,
+					&wp_single_pixel_buffer_manager_v1_interface, 1);
+	}
+	else if (strcmp(interface, "wl_subcompositor") == 0)
+	{
+		BIND_WL_REG(registry, subcompositor, id, &wl_subcompositor_interface, 1);
+	}
 }
 
 static void
@@ -262,13 +363,13 @@ static const struct wl_registry_listener registry_listener = {
 };
 
 static void
-paint_pixels() {
+paint_pixels(uint32_t color) {
     int n;
     uint32_t *pixel = shm_data;
 
     fprintf(stderr, "Painting pixels\n");
     for (n =0; n < WIDTH*HEIGHT; n++) {
-	*pixel++ = 0xff0000;//红色
+	*pixel++ = color;
     }
 }
 
@@ -323,8 +424,20 @@ int main(int argc, char **argv)
 	wl_shell_surface_set_toplevel(shell_surface);
 	wl_shell_surface_add_listener(shell_surface,&shell_surface_listener,NULL);
 
+	if (subcompositor == NULL)
+	{
+		fprintf(stderr, "Can't find subcompositor\n");
+		exit(1);
+	}
+	if (layer_init(&bar, shm, compositor, subcompositor, surface, BAR_X, BAR_Y, BAR_WIDTH, BAR_HEIGHT, 1) < 0)
+	{
+		fprintf(stderr, "Can't create bar layer: %m\n");
+		exit(1);
+	}
+
+	// 父 surface 提交后 subsurface 的位置才生效
 	create_window();
-	paint_pixels();
+	draw_bar();
 
 	while(wl_display_dispatch(display)!=-1){
 		;
@@ -0,0 +1,477 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <wayland-client.h>
+
+#include "image.h"
+#include "asset_batch.h"
+
+/* 每次提交多少个文件，一个文件最多占 3 个 SQE */
+#define BATCH_CHUNK 256
+#define RING_ENTRIES (BATCH_CHUNK * 4)
+
+/* statx 就失败了的文件，不在 pool 里 */
+#define NO_OFFSET UINT64_MAX
+
+enum {
+	OP_STATX,
+	OP_OPEN,
+	OP_READ,
+	OP_CLOSE,
+};
+
+/* 直接用系统调用操作 io_uring，不依赖 liburing */
+struct uring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_sqe *sqes;
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map;
+	size_t cq_map_size;
+	size_t sqes_size;
+	/* 已经填好还没提交的 SQE 数 */
+	unsigned pending;
+};
+
+static int
+uring_init(struct uring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_map_size > ring->sq_map_size)
+			ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = ring->sq_map_size;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED)
+			goto fail;
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail;
+
+	uint8_t *sq = ring->sq_map, *cq = ring->cq_map;
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+
+fail:
+	if (ring->sq_map && ring->sq_map != MAP_FAILED)
+		munmap(ring->sq_map, ring->sq_map_size);
+	if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_size);
+	close(ring->fd);
+	ring->fd = -1;
+	return -1;
+}
+
+static void
+uring_finish(struct uring *ring)
+{
+	if (ring->fd < 0)
+		return;
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_size);
+	munmap(ring->sq_map, ring->sq_map_size);
+	/* 关掉 ring 时注册过的文件也一起释放 */
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+/* 调用者保证一批不超过 sq_entries，这里不会满 */
+static struct io_uring_sqe *
+uring_sqe(struct uring *ring, int op, int index)
+{
+	unsigned tail = *ring->sq_tail + ring->pending;
+	struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (uint64_t)index << 2 | op;
+	ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+	ring->pending++;
+	return sqe;
+}
+
+/* 提交所有填好的 SQE，并等到至少 wait 个完成 */
+static int
+uring_enter(struct uring *ring, unsigned wait, unsigned *submits)
+{
+	unsigned submit = ring->pending;
+
+	/* SQE 的内容要在 tail 之前对内核可见 */
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE);
+	ring->pending = 0;
+	while (submit > 0 || wait > 0) {
+		int ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		(*submits)++;
+		submit -= ret;
+		wait = 0;
+	}
+	return 0;
+}
+
+/* 取下一个完成事件，没有时返回 0 */
+static int
+uring_cqe(struct uring *ring, struct io_uring_cqe *out)
+{
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	*out = ring->cqes[head & ring->cq_mask];
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* 等齐 count 个完成事件，每个交给 handle 处理 */
+static int
+uring_reap(struct uring *ring, unsigned count, unsigned *submits,
+		void (*handle)(struct asset_batch *, int, int, int, void *),
+		struct asset_batch *batch, void *data)
+{
+	struct io_uring_cqe cqe;
+
+	if (uring_enter(ring, count, submits) < 0)
+		return -1;
+	while (count > 0) {
+		if (!uring_cqe(ring, &cqe)) {
+			if (uring_enter(ring, 1, submits) < 0)
+				return -1;
+			continue;
+		}
+		handle(batch, cqe.user_data >> 2, cqe.user_data & 3, cqe.res, data);
+		count--;
+	}
+	return 0;
+}
+
+static int
+sync_stat(struct asset_load *asset)
+{
+	struct stat st;
+
+	if (stat(asset->path, &st) < 0) {
+		asset->error = errno;
+		return -1;
+	}
+	asset->size = st.st_size;
+	asset->error = 0;
+	return 0;
+}
+
+/* 在内核里从文件复制到 pool，memfd 的页直接被文件内容填满，不用先清零 */
+static int
+sync_read(struct asset_batch *batch, struct asset_load *asset)
+{
+	int fd = open(asset->path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		asset->error = errno;
+		return -1;
+	}
+	if (image_copy_range(fd, 0, batch->fd, asset->offset, asset->size) < 0) {
+		asset->error = errno ? errno : EIO;
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	asset->error = 0;
+	return 0;
+}
+
+static void
+handle_statx(struct asset_batch *batch, int index, int op, int res, void *data)
+{
+	struct statx *stx = data;
+
+	if (res < 0)
+		batch->assets[index].error = -res;
+	else
+		batch->assets[index].size = stx[index].stx_size;
+}
+
+static void
+handle_read(struct asset_batch *batch, int index, int op, int res, void *data)
+{
+	struct asset_load *asset = &batch->assets[index];
+
+	/* 链上前面的操作失败时后面的是 -ECANCELED，第一个错误才有意义 */
+	if ((op == OP_OPEN || op == OP_READ) && res < 0 && asset->error == 0)
+		asset->error = -res;
+	else if (op == OP_READ && res >= 0 && (uint64_t)res != asset->size)
+		asset->error = EIO;
+}
+
+/* 所有文件一起 statx，拿到大小才能在 pool 里排位置 */
+static int
+uring_stat(struct asset_batch *batch, struct uring *ring)
+{
+	struct statx *stx = calloc(batch->count, sizeof(*stx));
+
+	if (stx == NULL)
+		return -1;
+	for (int i = 0; i < batch->count; i += BATCH_CHUNK) {
+		int n = batch->count - i < BATCH_CHUNK ? batch->count - i : BATCH_CHUNK;
+		for (int j = i; j < i + n; j++) {
+			struct io_uring_sqe *sqe = uring_sqe(ring, OP_STATX, j);
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)batch->assets[j].path;
+			sqe->len = STATX_SIZE;
+			sqe->off = (uintptr_t)&stx[j];
+		}
+		if (uring_reap(ring, n, &batch->submits, handle_statx, batch, stx) < 0) {
+			free(stx);
+			return -1;
+		}
+	}
+	free(stx);
+	return 0;
+}
+
+/* 每个文件一条 openat -> read -> close 链，用注册文件表里的槽位，不占进程的 fd */
+static int
+uring_read(struct asset_batch *batch, struct uring *ring)
+{
+	int fds[BATCH_CHUNK];
+
+	for (int i = 0; i < BATCH_CHUNK; i++)
+		fds[i] = -1;
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+				fds, BATCH_CHUNK) < 0)
+		return -1;
+
+	for (int i = 0; i < batch->count; i += BATCH_CHUNK) {
+		int n = batch->count - i < BATCH_CHUNK ? batch->count - i : BATCH_CHUNK;
+		unsigned expected = 0;
+
+		for (int j = i; j < i + n; j++) {
+			struct asset_load *asset = &batch->assets[j];
+			struct io_uring_sqe *sqe;
+			int slot = j - i;
+
+			if (asset->error || asset->size == 0)
+				continue;
+
+			sqe = uring_sqe(ring, OP_OPEN, j);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)asset->path;
+			/* 打开到注册文件表里的不是普通 fd，不能带 O_CLOEXEC */
+			sqe->open_flags = O_RDONLY;
+			sqe->file_index = slot + 1;
+			sqe->flags = IOSQE_IO_LINK;
+
+			sqe = uring_sqe(ring, OP_READ, j);
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = slot;
+			sqe->addr = (uintptr_t)(batch->pool + asset->offset);
+			sqe->len = asset->size;
+			sqe->off = 0;
+			sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+
+			sqe = uring_sqe(ring, OP_CLOSE, j);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->file_index = slot + 1;
+			expected += 3;
+		}
+		if (uring_reap(ring, expected, &batch->submits, handle_read, batch, NULL) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int
+asset_batch_load(struct asset_batch *batch, const char *const *paths, int count,
+		int flags)
+{
+	struct uring ring;
+	int loaded = 0;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->fd = -1;
+	ring.fd = -1;
+	batch->assets = calloc(count, sizeof(*batch->assets));
+	if (batch->assets == NULL)
+		return -1;
+	batch->count = count;
+	for (int i = 0; i < count; i++)
+		batch->assets[i].path = paths[i];
+
+	if ((flags & ASSET_BATCH_URING) && uring_init(&ring, RING_ENTRIES) == 0)
+		batch->uring = 1;
+
+	/* 第一步：大小 */
+	if (batch->uring && uring_stat(batch, &ring) < 0) {
+		for (int i = 0; i < count; i++)
+			batch->assets[i].error = 0;
+		batch->uring = 0;
+	}
+	for (int i = 0; i < count; i++) {
+		struct asset_load *asset = &batch->assets[i];
+		if (!batch->uring || asset->error == EINVAL || asset->error == EOPNOTSUPP)
+			sync_stat(asset);
+	}
+
+	/* 第二步：在 pool 里排好位置 */
+	for (int i = 0; i < count; i++) {
+		struct asset_load *asset = &batch->assets[i];
+		if (asset->error) {
+			asset->offset = NO_OFFSET;
+			continue;
+		}
+		asset->offset = batch->pool_size;
+		batch->pool_size += (asset->size + IMAGE_PAGE_SIZE - 1) & ~(uint64_t)(IMAGE_PAGE_SIZE - 1);
+	}
+	if (batch->pool_size == 0)
+		goto out;
+
+	batch->fd = memfd_create("assets", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (batch->fd < 0 || ftruncate(batch->fd, batch->pool_size) < 0) {
+		fprintf(stderr, "creating asset pool failed: %m\n");
+		goto fail;
+	}
+	/* io_uring 读进用户内存，一次分配好所有页，读的时候不用再逐页缺页
+	 * 同步读在内核里复制，映射只用来看文件头
+	 * */
+	batch->pool = mmap(NULL, batch->pool_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | (batch->uring ? MAP_POPULATE : 0), batch->fd, 0);
+	if (batch->pool == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		batch->pool = NULL;
+		goto fail;
+	}
+
+	/* 第三步：内容，io_uring 没读成的(操作不支持、读短了)再同步读一次 */
+	if (batch->uring && uring_read(batch, &ring) < 0) {
+		/* statx 失败的保留原来的错误，其它的全部重读 */
+		for (int i = 0; i < count; i++)
+			if (batch->assets[i].offset != NO_OFFSET)
+				batch->assets[i].error = EINVAL;
+	}
+	for (int i = 0; i < count; i++) {
+		struct asset_load *asset = &batch->assets[i];
+		if (asset->offset == NO_OFFSET)
+			continue;
+		if (batch->uring && asset->error == 0)
+			continue;
+		/* 空文件不用读，但上面可能给它标了错误 */
+		if (asset->size == 0) {
+			asset->error = 0;
+			continue;
+		}
+		if (batch->uring)
+			batch->retried++;
+		sync_read(batch, asset);
+	}
+
+	fcntl(batch->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+
+out:
+	uring_finish(&ring);
+	for (int i = 0; i < count; i++) {
+		if (batch->assets[i].error)
+			fprintf(stderr, "%s: %s\n", batch->assets[i].path,
+					strerror(batch->assets[i].error));
+		else
+			loaded++;
+	}
+	return loaded > 0 ? loaded : -1;
+
+fail:
+	uring_finish(&ring);
+	asset_batch_finish(batch);
+	return -1;
+}
+
+void
+asset_batch_finish(struct asset_batch *batch)
+{
+	if (batch->pool)
+		munmap(batch->pool, batch->pool_size);
+	if (batch->fd >= 0)
+		close(batch->fd);
+	free(batch->assets);
+	batch->pool = NULL;
+	batch->fd = -1;
+	batch->assets = NULL;
+	batch->count = 0;
+}
+
+struct wl_shm_pool *
+asset_batch_create_pool(struct asset_batch *batch, struct wl_shm *shm)
+{
+	if (batch->pool_size == 0 || batch->pool_size > INT32_MAX) {
+		fprintf(stderr, "asset pool of %llu B can't be shared\n",
+				(unsigned long long)batch->pool_size);
+		return NULL;
+	}
+	return wl_shm_create_pool(shm, batch->fd, batch->pool_size);
+}
+
+struct wl_buffer *
+asset_batch_create_buffer(struct asset_batch *batch, struct wl_shm_pool *pool,
+		int i)
+{
+	const struct asset_load *asset = &batch->assets[i];
+	const struct image_header *h;
+
+	if (asset->error || asset->size < sizeof(*h))
+		return NULL;
+	h = (const struct image_header *)(batch->pool + asset->offset);
+	if (image_check_header(h, asset->size, asset->path) < 0)
+		return NULL;
+	return wl_shm_pool_create_buffer(pool, asset->offset + h->data_offset,
+			h->width, h->height, h->stride, h->format);
+}
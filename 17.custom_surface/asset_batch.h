@@ -0,0 +1,61 @@
+#ifndef ASSET_BATCH_H
+#define ASSET_BATCH_H
+
+#include <stdint.h>
+
+/* 一次加载很多个小文件(图标、光标)
+ *
+ * 所有文件读进同一个 memfd(每个从页边界开始)，这个 memfd 就是 wl_shm pool，
+ * 每个 .img 建一个指向自己像素的 wl_buffer。
+ * 默认逐个 stat / open 再在内核里复制；
+ * 带 ASSET_BATCH_URING 时先一次提交所有 statx 拿到大小，再一次提交所有
+ * openat -> read -> close 链，没有 io_uring(内核太老、被 seccomp 禁用)时退回同步读
+ * */
+
+/* 用 io_uring 读取，默认同步读取
+ * 实测(loadbench)128 个图标时 io_uring 冷热缓存都比同步慢，
+ * 1024 个冷缓存时才快大约 20%，热缓存仍然慢一半：
+ * 文件小，每个只有一次 read，省下的系统调用抵不过链的开销和读进用户内存的缺页
+ * */
+#define ASSET_BATCH_URING 0x1
+
+struct asset_load {
+	const char *path;
+	/* 在 pool 里的偏移，按页对齐 */
+	uint64_t offset;
+	uint64_t size;
+	/* 0 或 errno */
+	int error;
+};
+
+struct asset_batch {
+	struct asset_load *assets;
+	int count;
+	int fd;
+	uint8_t *pool;
+	uint64_t pool_size;
+	/* 是否用了 io_uring，以及 io_uring_enter 的次数 */
+	int uring;
+	unsigned submits;
+	/* io_uring 失败后同步补读的文件数 */
+	int retried;
+};
+
+/* 返回成功加载的文件数，全部失败或出错返回 -1 */
+int asset_batch_load(struct asset_batch *batch, const char *const *paths,
+		int count, int flags);
+void asset_batch_finish(struct asset_batch *batch);
+
+struct wl_shm;
+struct wl_shm_pool;
+struct wl_buffer;
+
+/* 整个 pool 交给合成器，之后每个资源只需要 asset_batch_create_buffer */
+struct wl_shm_pool *asset_batch_create_pool(struct asset_batch *batch,
+		struct wl_shm *shm);
+
+/* 第 i 个资源是 .img 时，创建指向它像素数据的 wl_buffer */
+struct wl_buffer *asset_batch_create_buffer(struct asset_batch *batch,
+		struct wl_shm_pool *pool, int i);
+
+#endif
@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <wayland-client.h>
+
+#include "asset_cache.h"
+#include "resample.h"
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void
+asset_cache_init(struct asset_cache *cache, struct wl_shm *shm, const char *dir)
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	memset(cache, 0, sizeof(*cache));
+	cache->shm = shm;
+	if (dir)
+		snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+	else if (xdg && *xdg)
+		snprintf(cache->dir, sizeof(cache->dir), "%s/wayland-demo", xdg);
+	else if (home && *home)
+		snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/wayland-demo", home);
+}
+
+void
+asset_cache_finish(struct asset_cache *cache)
+{
+	for (int i = 0; i < cache->count; i++) {
+		struct asset_variant *v = &cache->variants[i];
+		if (v->buffer)
+			wl_buffer_destroy(v->buffer);
+		if (!v->borrowed)
+			image_close(&v->image);
+		free((char *)v->name);
+	}
+	cache->count = 0;
+}
+
+/* 缓存文件名里带上源图校验和、大小和格式，任何一个变了都不会误用旧文件 */
+static void
+variant_path(const struct asset_cache *cache, const char *name,
+		uint64_t checksum, uint32_t width, uint32_t height, uint32_t format,
+		char *path, size_t size)
+{
+	const char *base = strrchr(name, '/');
+
+	base = base ? base + 1 : name;
+	snprintf(path, size, "%s/%s.%016llx.%ux%u.%08x.img", cache->dir, base,
+			(unsigned long long)checksum, width, height, format);
+}
+
+/* 先写临时文件再 rename，另一个进程同时读到的要么没有要么是完整的 */
+static void
+persist(const struct asset_cache *cache, struct image *image, const char *path)
+{
+	char tmp[576];
+	char parent[sizeof(cache->dir)];
+	char *slash;
+	int fd;
+
+	/* 只补最后两级目录(~/.cache 和 wayland-demo) */
+	snprintf(parent, sizeof(parent), "%s", cache->dir);
+	slash = strrchr(parent, '/');
+	if (slash && slash != parent) {
+		*slash = '\0';
+		mkdir(parent, 0755);
+	}
+	if (mkdir(cache->dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "asset cache: mkdir %s failed: %m\n", cache->dir);
+		return;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "asset cache: open %s failed: %m\n", tmp);
+		return;
+	}
+	if (ftruncate(fd, image->file_size) < 0 ||
+		image_copy_range(image->fd, 0, fd, 0, image->file_size) < 0 ||
+		rename(tmp, path) < 0) {
+		fprintf(stderr, "asset cache: writing %s failed: %m\n", path);
+		unlink(tmp);
+	}
+	close(fd);
+}
+
+/* 从缓存目录直接打开，文件就是 pool，不读也不复制 */
+static int
+load(struct image *image, const char *path, uint32_t width, uint32_t height,
+		uint32_t format)
+{
+	if (access(path, R_OK) < 0)
+		return -1;
+	if (image_open(image, path, 0) < 0)
+		return -1;
+	if (image->header.width != width || image->header.height != height ||
+		image->header.format != format) {
+		image_close(image);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+build(struct image *image, struct image *source, uint32_t width, uint32_t height,
+		uint32_t format)
+{
+	const struct image_header *h = &source->header;
+	const uint32_t *src = image_map(source);
+	uint32_t *dst;
+
+	if (src == NULL)
+		return -1;
+	dst = image_create(image, width, height, format);
+	if (dst == NULL)
+		return -1;
+
+	if (width == h->width && height == h->height) {
+		for (uint32_t y = 0; y < height; y++)
+			memcpy(dst + (size_t)y * width, src + (size_t)y * (h->stride / 4),
+					width * 4);
+	} else if (resample(src, h->width, h->height, h->stride / 4, dst, width, height,
+				width, h->format == WL_SHM_FORMAT_ARGB8888) < 0) {
+		fprintf(stderr, "asset cache: out of memory\n");
+		image_close(image);
+		return -1;
+	}
+
+	/* 任何一边没有 alpha 都按不透明处理 */
+	if (format != h->format) {
+		size_t n = (size_t)width * height;
+		for (size_t i = 0; i < n; i++)
+			dst[i] |= 0xff000000;
+	}
+
+	if (image_finish(image) < 0) {
+		image_close(image);
+		return -1;
+	}
+	return 0;
+}
+
+struct asset_variant *
+asset_cache_get(struct asset_cache *cache, const char *name,
+		struct image *source, int source_scale, int scale, uint32_t format)
+{
+	const struct image_header *h = &source->header;
+	struct asset_variant *v;
+	char path[512];
+	double start;
+
+	if (source_scale < 1)
+		source_scale = 1;
+	if (scale < 1)
+		scale = 1;
+
+	for (int i = 0; i < cache->count; i++) {
+		v = &cache->variants[i];
+		if (v->scale == scale && v->source_scale == source_scale &&
+			v->format == format && v->source_checksum == h->data_checksum && strcmp(v->name, name) == 0) {
+			cache->hits++;
+			return v;
+		}
+	}
+
+	if ((h->format != WL_SHM_FORMAT_ARGB8888 && h->format != WL_SHM_FORMAT_XRGB8888) ||
+		(format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888)) {
+		fprintf(stderr, "asset cache: %s: unsupported format\n", name);
+		return NULL;
+	}
+	if (cache->count == ASSET_CACHE_SIZE) {
+		fprintf(stderr, "asset cache: full\n");
+		return NULL;
+	}
+
+	v = &cache->variants[cache->count];
+	memset(v, 0, sizeof(*v));
+	v->source_checksum = h->data_checksum;
+	v->source_scale = source_scale;
+	v->scale = scale;
+	v->format = format;
+
+	uint32_t width = (h->width + source_scale - 1) / source_scale * scale;
+	uint32_t height = (h->height + source_scale - 1) / source_scale * scale;
+	start = now_ms();
+
+	if (width == h->width && height == h->height && format == h->format) {
+		/* 正好是源图本身 */
+		v->image = *source;
+		v->borrowed = 1;
+	} else {
+		variant_path(cache, name, h->data_checksum, width, height, format,
+				path, sizeof(path));
+		if (cache->dir[0] && load(&v->image, path, width, height, format) == 0) {
+			cache->loads++;
+			fprintf(stderr, "asset cache: %s @%dx loaded from %s\n", name, scale, path);
+		} else {
+			if (build(&v->image, source, width, height, format) < 0)
+				return NULL;
+			cache->builds++;
+			fprintf(stderr, "asset cache: %s @%dx built %ux%u in %.1f ms\n",
+					name, scale, width, height, now_ms() - start);
+			if (cache->dir[0])
+				persist(cache, &v->image, path);
+		}
+	}
+
+	v->buffer = image_create_buffer(&v->image, cache->shm);
+	if (v->buffer == NULL) {
+		if (!v->borrowed)
+			image_close(&v->image);
+		return NULL;
+	}
+	v->name = strdup(name);
+	cache->count++;
+	return v;
+}
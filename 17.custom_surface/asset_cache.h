@@ -0,0 +1,61 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <stdint.h>
+
+#include "image.h"
+
+/* 按输出缩放倍数准备好的图片
+ *
+ * 以 (图片, 缩放倍数, 格式) 为键，第一次用到时用 resample 生成一次，
+ * 之后直接返回同一个 wl_buffer，配合 wl_surface_set_buffer_scale 使用，
+ * 每帧没有任何缩放的开销。
+ * 生成的结果可以存进缓存目录(.img)，下次启动直接把文件交给合成器
+ * */
+#define ASSET_CACHE_SIZE 16
+
+struct wl_shm;
+struct wl_buffer;
+
+struct asset_variant {
+	const char *name;
+	/* 源图像素的校验和，源图变了旧的缓存文件就不会再命中 */
+	uint64_t source_checksum;
+	int source_scale;
+	int scale;
+	uint32_t format;
+	/* 直接用源图时不归缓存所有 */
+	int borrowed;
+	struct image image;
+	struct wl_buffer *buffer;
+};
+
+struct asset_cache {
+	struct wl_shm *shm;
+	/* 持久化目录，空字符串表示只放在内存里 */
+	char dir[256];
+	struct asset_variant variants[ASSET_CACHE_SIZE];
+	int count;
+	/* 统计：内存命中、从缓存目录加载、重新生成 */
+	unsigned hits;
+	unsigned loads;
+	unsigned builds;
+};
+
+/* dir 为 NULL 时用 $XDG_CACHE_HOME/wayland-demo(或 ~/.cache/wayland-demo)，
+ * 为空字符串时不持久化
+ * */
+void asset_cache_init(struct asset_cache *cache, struct wl_shm *shm,
+		const char *dir);
+void asset_cache_finish(struct asset_cache *cache);
+
+/* 取 source 在输出缩放倍数 scale 下的版本
+ * source_scale 是源图本身按几倍屏画的，结果的大小是
+ * ceil(源图大小 / source_scale) * scale，总是 scale 的整数倍
+ * format 只支持 ARGB8888 / XRGB8888 之间的转换
+ * */
+struct asset_variant *asset_cache_get(struct asset_cache *cache,
+		const char *name, struct image *source, int source_scale, int scale,
+		uint32_t format);
+
+#endif
@@ -0,0 +1,904 @@
+/////////////////////
+// \note 把 PNG / PPM / BMP 转换成 .img
+//       ./convert [--format xrgb8888|argb8888|xbgr8888|abgr8888] [--threads N]
+//                 input output.{img,qoi}
+//       解码是单线程的，像素格式转换按行分给多个线程，用 SIMD 做字节重排和预乘
+//       输出 .qoi 时按条带多线程编码，输入也可以是不透明的 .img
+/////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <wayland-client.h>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+#include "image.h"
+#include "qoi.h"
+
+#define MAX_THREADS 64
+
+/* 解码后的图片
+ * 能直接重排字节的情况(8 位、每个通道一个字节)记录每个通道的字节偏移，
+ * 其他情况(调色板、16 位、低位深、透明色)先逐行展开成 RGBA
+ * */
+struct picture {
+	int width;
+	int height;
+	/* 第一行(最上面一行)的地址，stride 可以是负数(自下而上存放的 BMP) */
+	const uint8_t *data;
+	ptrdiff_t stride;
+
+	int direct;
+	int bpp;
+	/* 通道的字节偏移，没有 alpha 时 a 为 -1 */
+	int r, g, b, a;
+
+	/* 展开时用到的 PNG 信息 */
+	int color_type;
+	int depth;
+	uint8_t palette[256][4];
+	int has_key;
+	uint16_t key[3];
+
+	/* 需要释放的内存和映射 */
+	void *owned;
+	void *map;
+	size_t map_size;
+};
+
+struct target {
+	const char *name;
+	uint32_t format;
+	/* 内存中的字节顺序是 BGRA 还是 RGBA */
+	int rgba_order;
+	int has_alpha;
+};
+
+static const struct target targets[] = {
+	{ "xrgb8888", WL_SHM_FORMAT_XRGB8888, 0, 0 },
+	{ "argb8888", WL_SHM_FORMAT_ARGB8888, 0, 1 },
+	{ "xbgr8888", WL_SHM_FORMAT_XBGR8888, 1, 0 },
+	{ "abgr8888", WL_SHM_FORMAT_ABGR8888, 1, 1 },
+};
+
+/* 一行的转换方式：4 个像素一组的 pshufb 掩码，之后或上 alpha，再按需预乘 */
+struct converter {
+	int bpp;
+	uint8_t shuffle[16];
+	uint32_t alpha_or;
+	int premultiply;
+	int off[4];
+};
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t
+be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint32_t
+le32(const uint8_t *p)
+{
+	return (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+static uint16_t
+le16(const uint8_t *p)
+{
+	return p[1] << 8 | p[0];
+}
+
+/* ---------------------------------------------------------------- PNG */
+
+static inline uint8_t
+paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+/* 原地去掉每一行的过滤，prev 是已经还原的上一行，第一行时为 NULL */
+static int
+png_unfilter(uint8_t *row, const uint8_t *prev, int filter, size_t n, int bpp)
+{
+	size_t i;
+
+	switch (filter) {
+	case 0:
+		break;
+	case 1:
+		for (i = bpp; i < n; i++)
+			row[i] += row[i - bpp];
+		break;
+	case 2:
+		if (prev)
+			for (i = 0; i < n; i++)
+				row[i] += prev[i];
+		break;
+	case 3:
+		for (i = 0; i < n; i++) {
+			int left = i >= (size_t)bpp ? row[i - bpp] : 0;
+			int up = prev ? prev[i] : 0;
+			row[i] += (left + up) >> 1;
+		}
+		break;
+	case 4:
+		for (i = 0; i < n; i++) {
+			int left = i >= (size_t)bpp ? row[i - bpp] : 0;
+			int up = prev ? prev[i] : 0;
+			int ul = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+			row[i] += paeth(left, up, ul);
+		}
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+static int
+png_decode(struct picture *pic, const uint8_t *p, size_t size)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	static const int channels_of[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	z_stream zs;
+	uint8_t *buf = NULL;
+	size_t row_bytes = 0, buf_size = 0;
+	int channels = 0, interlace = 0, ended = 0;
+	size_t pos = 8;
+
+	if (size < 8 || memcmp(p, signature, 8) != 0)
+		return -1;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit(&zs) != Z_OK)
+		return -1;
+
+	while (pos + 12 <= size) {
+		uint32_t len = be32(p + pos);
+		const uint8_t *type = p + pos + 4;
+		const uint8_t *data = p + pos + 8;
+
+		if (len > size - pos - 12) {
+			fprintf(stderr, "png: truncated chunk\n");
+			goto fail;
+		}
+		pos += 12 + len;
+
+		if (memcmp(type, "IHDR", 4) == 0 && len >= 13) {
+			pic->width = be32(data);
+			pic->height = be32(data + 4);
+			pic->depth = data[8];
+			pic->color_type = data[9];
+			interlace = data[12];
+			if (pic->color_type > 6 || channels_of[pic->color_type] == 0 ||
+				pic->width <= 0 || pic->height <= 0 ||
+				(pic->depth != 1 && pic->depth != 2 && pic->depth != 4 &&
+				 pic->depth != 8 && pic->depth != 16)) {
+				fprintf(stderr, "png: bad header\n");
+				goto fail;
+			}
+			if (interlace) {
+				fprintf(stderr, "png: interlaced images are not supported\n");
+				goto fail;
+			}
+			channels = channels_of[pic->color_type];
+			row_bytes = ((size_t)pic->width * channels * pic->depth + 7) / 8;
+			buf_size = (row_bytes + 1) * pic->height;
+			buf = malloc(buf_size);
+			if (buf == NULL)
+				goto fail;
+			zs.next_out = buf;
+			zs.avail_out = buf_size;
+		} else if (memcmp(type, "PLTE", 4) == 0) {
+			for (uint32_t i = 0; i < len / 3 && i < 256; i++) {
+				pic->palette[i][0] = data[i * 3];
+				pic->palette[i][1] = data[i * 3 + 1];
+				pic->palette[i][2] = data[i * 3 + 2];
+				pic->palette[i][3] = 255;
+			}
+		} else if (memcmp(type, "tRNS", 4) == 0) {
+			if (pic->color_type == 3) {
+				for (uint32_t i = 0; i < len && i < 256; i++)
+					pic->palette[i][3] = data[i];
+			} else if (pic->color_type == 0 && len >= 2) {
+				pic->has_key = 1;
+				pic->key[0] = data[0] << 8 | data[1];
+			} else if (pic->color_type == 2 && len >= 6) {
+				pic->has_key = 1;
+				for (int i = 0; i < 3; i++)
+					pic->key[i] = data[i * 2] << 8 | data[i * 2 + 1];
+			}
+		} else if (memcmp(type, "IDAT", 4) == 0) {
+			if (buf == NULL)
+				goto fail;
+			/* IDAT 可能有很多块，边读边解压，不拼接 */
+			zs.next_in = (uint8_t *)data;
+			zs.avail_in = len;
+			/* 像素数据已经满了就不再解压，忽略后面多余的数据 */
+			while (zs.avail_in > 0 && zs.avail_out > 0 && !ended) {
+				int ret = inflate(&zs, Z_NO_FLUSH);
+				if (ret == Z_STREAM_END)
+					ended = 1;
+				else if (ret != Z_OK) {
+					fprintf(stderr, "png: inflate failed: %s\n", zs.msg ? zs.msg : "");
+					goto fail;
+				}
+			}
+		} else if (memcmp(type, "IEND", 4) == 0) {
+			break;
+		}
+	}
+
+	if (buf == NULL || zs.total_out != buf_size) {
+		fprintf(stderr, "png: image data truncated\n");
+		goto fail;
+	}
+	inflateEnd(&zs);
+
+	int filter_bpp = (channels * pic->depth + 7) / 8;
+	for (int y = 0; y < pic->height; y++) {
+		uint8_t *row = buf + y * (row_bytes + 1);
+		const uint8_t *prev = y ? row - row_bytes : NULL;
+		if (png_unfilter(row + 1, prev, row[0], row_bytes, filter_bpp) < 0) {
+			fprintf(stderr, "png: bad filter %d\n", row[0]);
+			free(buf);
+			return -1;
+		}
+	}
+
+	pic->owned = buf;
+	pic->data = buf + 1;
+	pic->stride = row_bytes + 1;
+	/* 8 位且没有透明色的灰度、RGB 可以直接重排 */
+	if (pic->depth == 8 && pic->color_type != 3 && !pic->has_key) {
+		pic->direct = 1;
+		pic->bpp = channels;
+		if (channels <= 2) {
+			pic->r = pic->g = pic->b = 0;
+			pic->a = channels == 2 ? 1 : -1;
+		} else {
+			pic->r = 0;
+			pic->g = 1;
+			pic->b = 2;
+			pic->a = channels == 4 ? 3 : -1;
+		}
+	}
+	return 0;
+
+fail:
+	inflateEnd(&zs);
+	free(buf);
+	return -1;
+}
+
+static inline unsigned
+png_sample(const uint8_t *row, size_t i, int depth)
+{
+	if (depth == 16)
+		return row[i * 2] << 8 | row[i * 2 + 1];
+	if (depth == 8)
+		return row[i];
+	size_t bit = i * depth;
+	return (row[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1);
+}
+
+static inline uint8_t
+png_scale(unsigned v, int depth)
+{
+	if (depth == 16)
+		return v >> 8;
+	if (depth == 8)
+		return v;
+	return v * 255 / ((1 << depth) - 1);
+}
+
+/* 把一行展开成 8 位 RGBA */
+static void
+png_expand_row(const struct picture *pic, const uint8_t *src, uint8_t *out)
+{
+	int d = pic->depth;
+
+	for (int x = 0; x < pic->width; x++, out += 4) {
+		unsigned v, r, g, b;
+
+		switch (pic->color_type) {
+		case 0:
+			v = png_sample(src, x, d);
+			out[0] = out[1] = out[2] = png_scale(v, d);
+			out[3] = pic->has_key && v == pic->key[0] ? 0 : 255;
+			break;
+		case 2:
+			r = png_sample(src, x * 3, d);
+			g = png_sample(src, x * 3 + 1, d);
+			b = png_sample(src, x * 3 + 2, d);
+			out[0] = png_scale(r, d);
+			out[1] = png_scale(g, d);
+			out[2] = png_scale(b, d);
+			out[3] = pic->has_key && r == pic->key[0] && g == pic->key[1] &&
+				b == pic->key[2] ? 0 : 255;
+			break;
+		case 3:
+			memcpy(out, pic->palette[png_sample(src, x, d)], 4);
+			break;
+		case 4:
+			out[0] = out[1] = out[2] = png_scale(png_sample(src, x * 2, d), d);
+			out[3] = png_scale(png_sample(src, x * 2 + 1, d), d);
+			break;
+		case 6:
+			for (int c = 0; c < 4; c++)
+				out[c] = png_scale(png_sample(src, x * 4 + c, d), d);
+			break;
+		}
+	}
+}
+
+/* ---------------------------------------------------------------- PPM */
+
+/* 跳过空白和注释后读一个十进制数 */
+static int
+ppm_number(const uint8_t *p, size_t size, size_t *pos)
+{
+	int v = 0;
+
+	while (*pos < size) {
+		if (p[*pos] == '#') {
+			while (*pos < size && p[*pos] != '\n')
+				(*pos)++;
+		} else if (p[*pos] == ' ' || p[*pos] == '\t' || p[*pos] == '\r' ||
+			p[*pos] == '\n') {
+			(*pos)++;
+		} else {
+			break;
+		}
+	}
+	if (*pos >= size || p[*pos] < '0' || p[*pos] > '9')
+		return -1;
+	while (*pos < size && p[*pos] >= '0' && p[*pos] <= '9')
+		v = v * 10 + p[(*pos)++] - '0';
+	return v;
+}
+
+static int
+ppm_decode(struct picture *pic, const uint8_t *p, size_t size)
+{
+	size_t pos = 2;
+
+	if (size < 2 || p[0] != 'P' || (p[1] != '6' && p[1] != '5'))
+		return -1;
+
+	int channels = p[1] == '6' ? 3 : 1;
+	int width = ppm_number(p, size, &pos);
+	int height = ppm_number(p, size, &pos);
+	int maxval = ppm_number(p, size, &pos);
+	if (width <= 0 || height <= 0 || maxval <= 0) {
+		fprintf(stderr, "ppm: bad header\n");
+		return -1;
+	}
+	if (maxval > 255) {
+		fprintf(stderr, "ppm: 16-bit samples are not supported\n");
+		return -1;
+	}
+	/* 头后面只有一个空白字符 */
+	pos++;
+	if (pos + (size_t)width * height * channels > size) {
+		fprintf(stderr, "ppm: truncated\n");
+		return -1;
+	}
+
+	pic->width = width;
+	pic->height = height;
+	pic->data = p + pos;
+	pic->stride = (ptrdiff_t)width * channels;
+	pic->direct = 1;
+	pic->bpp = channels;
+	pic->r = 0;
+	pic->g = channels == 3 ? 1 : 0;
+	pic->b = channels == 3 ? 2 : 0;
+	pic->a = -1;
+	return 0;
+}
+
+/* ---------------------------------------------------------------- BMP */
+
+/* 掩码必须正好是某个字节 */
+static int
+mask_byte(uint32_t mask)
+{
+	for (int i = 0; i < 4; i++)
+		if (mask == 0xffu << (i * 8))
+			return i;
+	return -1;
+}
+
+static int
+bmp_decode(struct picture *pic, const uint8_t *p, size_t size)
+{
+	if (size < 54 || p[0] != 'B' || p[1] != 'M')
+		return -1;
+
+	uint32_t offset = le32(p + 10);
+	uint32_t header_size = le32(p + 14);
+	int32_t width = le32(p + 18);
+	int32_t height = le32(p + 22);
+	int bits = le16(p + 28);
+	uint32_t compression = le32(p + 30);
+
+	if (width <= 0 || height == 0 || (bits != 24 && bits != 32)) {
+		fprintf(stderr, "bmp: only 24/32-bit images are supported\n");
+		return -1;
+	}
+
+	pic->direct = 1;
+	pic->bpp = bits / 8;
+	pic->b = 0;
+	pic->g = 1;
+	pic->r = 2;
+	/* BI_RGB 的 32 位图第 4 个字节没有定义，当作不透明 */
+	pic->a = -1;
+
+	if (compression == 3 && bits == 32 && size >= 66) {
+		pic->r = mask_byte(le32(p + 54));
+		pic->g = mask_byte(le32(p + 58));
+		pic->b = mask_byte(le32(p + 62));
+		if (header_size >= 56 && size >= 70 && le32(p + 66))
+			pic->a = mask_byte(le32(p + 66));
+		if (pic->r < 0 || pic->g < 0 || pic->b < 0 ||
+			(header_size >= 56 && le32(p + 66) && pic->a < 0)) {
+			fprintf(stderr, "bmp: unsupported bit fields\n");
+			return -1;
+		}
+	} else if (compression != 0) {
+		fprintf(stderr, "bmp: compressed images are not supported\n");
+		return -1;
+	}
+
+	int rows = height < 0 ? -height : height;
+	size_t stride = ((size_t)bits * width + 31) / 32 * 4;
+	if (offset > size || stride * rows > size - offset) {
+		fprintf(stderr, "bmp: truncated\n");
+		return -1;
+	}
+
+	pic->width = width;
+	pic->height = rows;
+	/* 高度为正时最后一行在文件最前面 */
+	if (height > 0) {
+		pic->data = p + offset + stride * (rows - 1);
+		pic->stride = -(ptrdiff_t)stride;
+	} else {
+		pic->data = p + offset;
+		pic->stride = stride;
+	}
+	return 0;
+}
+
+/* ---------------------------------------------------------------- IMG */
+
+/* 只接受不透明的格式，ARGB8888 已经预乘过，不能再当成普通的 RGBA */
+static int
+img_decode(struct picture *pic, const uint8_t *p, size_t size)
+{
+	struct image_header h;
+
+	if (size < sizeof(h))
+		return -1;
+	memcpy(&h, p, sizeof(h));
+	if (h.magic != IMAGE_MAGIC || h.version != IMAGE_VERSION ||
+		h.data_offset > size || (uint64_t)h.stride * h.height > size - h.data_offset ||
+		h.stride < h.width * 4) {
+		fprintf(stderr, "img: bad header\n");
+		return -1;
+	}
+	if (h.format != WL_SHM_FORMAT_XRGB8888 && h.format != WL_SHM_FORMAT_XBGR8888) {
+		fprintf(stderr, "img: only xrgb8888 / xbgr8888 input is supported\n");
+		return -1;
+	}
+
+	pic->width = h.width;
+	pic->height = h.height;
+	pic->data = p + h.data_offset;
+	pic->stride = h.stride;
+	pic->direct = 1;
+	pic->bpp = 4;
+	pic->g = 1;
+	pic->r = h.format == WL_SHM_FORMAT_XRGB8888 ? 2 : 0;
+	pic->b = h.format == WL_SHM_FORMAT_XRGB8888 ? 0 : 2;
+	pic->a = -1;
+	return 0;
+}
+
+/* ---------------------------------------------------------------- 转换 */
+
+static void
+converter_init(struct converter *conv, const struct picture *pic,
+		const struct target *target)
+{
+	int order[4];
+
+	conv->bpp = pic->bpp;
+	if (target->rgba_order) {
+		order[0] = pic->r;
+		order[1] = pic->g;
+		order[2] = pic->b;
+	} else {
+		order[0] = pic->b;
+		order[1] = pic->g;
+		order[2] = pic->r;
+	}
+	order[3] = target->has_alpha ? pic->a : -1;
+
+	for (int c = 0; c < 4; c++)
+		conv->off[c] = order[c];
+	for (int i = 0; i < 4; i++)
+		for (int c = 0; c < 4; c++)
+			conv->shuffle[i * 4 + c] = order[c] < 0 ? 0x80 : i * pic->bpp + order[c];
+
+	/* 没有 alpha 的目标格式也把 X 填成 0xff */
+	conv->alpha_or = order[3] < 0 ? 0xff000000 : 0;
+	conv->premultiply = order[3] >= 0;
+}
+
+/* alpha 在最高字节，其余三个通道乘以 alpha / 255 */
+static void
+premultiply_row(uint32_t *dst, int n)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	const __m256i c128 = _mm256_set1_epi16(128);
+	const __m256i amask = _mm256_set1_epi32(0xff000000);
+	const __m256i zero = _mm256_setzero_si256();
+	for (; i + 8 <= n; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i lo = _mm256_unpacklo_epi8(x, zero);
+		__m256i hi = _mm256_unpackhi_epi8(x, zero);
+		__m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, 0xff), 0xff);
+		__m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, 0xff), 0xff);
+		lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, alo), c128);
+		hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, ahi), c128);
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+		__m256i r = _mm256_packus_epi16(lo, hi);
+		r = _mm256_blendv_epi8(r, x, amask);
+		_mm256_storeu_si256((__m256i *)(dst + i), r);
+	}
+#elif defined(__SSSE3__)
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i amask = _mm_set1_epi32(0xff000000);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i lo = _mm_unpacklo_epi8(x, zero);
+		__m128i hi = _mm_unpackhi_epi8(x, zero);
+		__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+		__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+		lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), c128);
+		hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), c128);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+		__m128i r = _mm_packus_epi16(lo, hi);
+		r = _mm_or_si128(_mm_andnot_si128(amask, r), _mm_and_si128(amask, x));
+		_mm_storeu_si128((__m128i *)(dst + i), r);
+	}
+#endif
+	for (; i < n; i++) {
+		uint32_t p = dst[i], a = p >> 24, out = p & 0xff000000;
+		for (int s = 0; s < 24; s += 8) {
+			uint32_t t = ((p >> s) & 0xff) * a + 128;
+			out |= ((t + (t >> 8)) >> 8) << s;
+		}
+		dst[i] = out;
+	}
+}
+
+static void
+convert_row(const struct converter *conv, const uint8_t *src, uint32_t *dst, int n)
+{
+	int bpp = conv->bpp;
+	int i = 0;
+
+	/* 每次读 16 字节，只用前 4 * bpp 个，保证不会读到行尾之后 */
+#if defined(__AVX2__)
+	const __m256i mask = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i *)conv->shuffle));
+	const __m256i alpha = _mm256_set1_epi32(conv->alpha_or);
+	for (; (i + 4) * bpp + 16 <= n * bpp; i += 8) {
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)(src + i * bpp))),
+				_mm_loadu_si128((const __m128i *)(src + (i + 4) * bpp)), 1);
+		v = _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha);
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+#endif
+#if defined(__SSSE3__)
+	const __m128i mask4 = _mm_loadu_si128((const __m128i *)conv->shuffle);
+	const __m128i alpha4 = _mm_set1_epi32(conv->alpha_or);
+	for (; i * bpp + 16 <= n * bpp; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * bpp));
+		v = _mm_or_si128(_mm_shuffle_epi8(v, mask4), alpha4);
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+#endif
+	for (; i < n; i++) {
+		const uint8_t *s = src + i * bpp;
+		uint32_t p = conv->alpha_or;
+		for (int c = 0; c < 4; c++)
+			if (conv->off[c] >= 0)
+				p |= (uint32_t)s[conv->off[c]] << (c * 8);
+		dst[i] = p;
+	}
+
+	if (conv->premultiply)
+		premultiply_row(dst, n);
+}
+
+struct job {
+	pthread_t thread;
+	int started;
+	const struct picture *pic;
+	const struct converter *conv;
+	uint32_t *dst;
+	int y0;
+	int y1;
+};
+
+static void *
+convert_rows(void *data)
+{
+	struct job *job = data;
+	const struct picture *pic = job->pic;
+	uint8_t *rgba = NULL;
+
+	if (!pic->direct) {
+		rgba = malloc((size_t)pic->width * 4);
+		if (rgba == NULL)
+			return NULL;
+	}
+
+	for (int y = job->y0; y < job->y1; y++) {
+		const uint8_t *src = pic->data + y * pic->stride;
+		uint32_t *dst = job->dst + (size_t)y * pic->width;
+
+		if (rgba) {
+			png_expand_row(pic, src, rgba);
+			src = rgba;
+		}
+		convert_row(job->conv, src, dst, pic->width);
+	}
+
+	free(rgba);
+	return job;
+}
+
+/* premultiply 为 0 时保留未预乘的 alpha(QOI 存的是未预乘的值) */
+static int
+convert(const struct picture *pic, const struct target *target, uint32_t *dst,
+		int threads, int premultiply)
+{
+	struct job jobs[MAX_THREADS];
+	struct converter conv;
+	struct picture rgba_pic;
+	int failed = 0;
+
+	/* 需要展开的图先展开成 RGBA，再按 RGBA 重排 */
+	if (pic->direct) {
+		converter_init(&conv, pic, target);
+	} else {
+		rgba_pic = *pic;
+		rgba_pic.bpp = 4;
+		rgba_pic.r = 0;
+		rgba_pic.g = 1;
+		rgba_pic.b = 2;
+		rgba_pic.a = 3;
+		converter_init(&conv, &rgba_pic, target);
+	}
+	if (!premultiply)
+		conv.premultiply = 0;
+
+	if (threads > pic->height)
+		threads = pic->height;
+
+	for (int i = 0; i < threads; i++) {
+		jobs[i].pic = pic;
+		jobs[i].conv = &conv;
+		jobs[i].dst = dst;
+		jobs[i].y0 = (int64_t)pic->height * i / threads;
+		jobs[i].y1 = (int64_t)pic->height * (i + 1) / threads;
+	}
+
+	/* 第 0 份在当前线程做 */
+	for (int i = 1; i < threads; i++) {
+		jobs[i].started = pthread_create(&jobs[i].thread, NULL, convert_rows,
+				&jobs[i]) == 0;
+		/* 建不了线程就自己做 */
+		if (!jobs[i].started && convert_rows(&jobs[i]) == NULL)
+			failed = 1;
+	}
+	if (convert_rows(&jobs[0]) == NULL)
+		failed = 1;
+	for (int i = 1; i < threads; i++) {
+		void *ret;
+		if (!jobs[i].started)
+			continue;
+		pthread_join(jobs[i].thread, &ret);
+		if (ret == NULL)
+			failed = 1;
+	}
+	return failed ? -1 : 0;
+}
+
+static int
+qoi_write(const char *path, const uint32_t *pixels, int width, int height,
+		int channels, int threads, size_t *size)
+{
+	uint8_t *data = qoi_encode(pixels, width, height, width, channels, threads, size);
+	if (data == NULL) {
+		fprintf(stderr, "qoi encoding failed\n");
+		return -1;
+	}
+
+	FILE *fp = fopen(path, "wb");
+	int ok = fp && fwrite(data, 1, *size, fp) == *size;
+	if (fp && fclose(fp) != 0)
+		ok = 0;
+	free(data);
+	if (!ok) {
+		fprintf(stderr, "write %s failed: %m\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+picture_load(struct picture *pic, const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	memset(pic, 0, sizeof(*pic));
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "open %s failed: %m\n", path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	pic->map_size = st.st_size;
+	pic->map = mmap(NULL, pic->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pic->map == MAP_FAILED) {
+		fprintf(stderr, "mmap %s failed: %m\n", path);
+		return -1;
+	}
+
+	const uint8_t *p = pic->map;
+	size_t size = pic->map_size;
+	int ret;
+	if (size >= 8 && p[0] == 0x89 && p[1] == 'P')
+		ret = png_decode(pic, p, size);
+	else if (size >= 2 && p[0] == 'P' && (p[1] == '5' || p[1] == '6'))
+		ret = ppm_decode(pic, p, size);
+	else if (size >= 2 && p[0] == 'B' && p[1] == 'M')
+		ret = bmp_decode(pic, p, size);
+	else if (size >= 4 && memcmp(p, "WLMG", 4) == 0)
+		ret = img_decode(pic, p, size);
+	else {
+		fprintf(stderr, "%s: unknown file type\n", path);
+		ret = -1;
+	}
+
+	if (ret < 0) {
+		munmap(pic->map, pic->map_size);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+picture_free(struct picture *pic)
+{
+	free(pic->owned);
+	munmap(pic->map, pic->map_size);
+}
+
+int main(int argc, char **argv)
+{
+	const struct target *target = &targets[0];
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	for (i = 1; i + 1 < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+		if (strcmp(argv[i], "--threads") == 0) {
+			threads = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "--format") == 0) {
+			target = NULL;
+			for (size_t t = 0; t < sizeof(targets) / sizeof(targets[0]); t++)
+				if (strcmp(argv[i + 1], targets[t].name) == 0)
+					target = &targets[t];
+			if (target == NULL) {
+				fprintf(stderr, "unknown format %s\n", argv[i + 1]);
+				return 1;
+			}
+		} else {
+			break;
+		}
+	}
+	if (argc - i != 2) {
+		fprintf(stderr, "usage: %s [--format xrgb8888|argb8888|xbgr8888|abgr8888] "
+				"[--threads N] input.{png,ppm,bmp,img} output.{img,qoi}\n", argv[0]);
+		return 1;
+	}
+
+	const char *output = argv[i + 1];
+	size_t len = strlen(output);
+	int qoi = len > 4 && strcmp(output + len - 4, ".qoi") == 0;
+	/* QOI 里是 RGB 顺序，这里只处理内存顺序为 BGRA 的格式 */
+	if (qoi && target->rgba_order) {
+		fprintf(stderr, "qoi output needs xrgb8888 or argb8888\n");
+		return 1;
+	}
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	struct picture pic;
+	double t0 = now_ms();
+	if (picture_load(&pic, argv[i]) < 0)
+		return 1;
+	double t1 = now_ms();
+
+	size_t size = (size_t)pic.width * pic.height * 4;
+	uint32_t *pixels = malloc(size);
+	if (pixels == NULL || convert(&pic, target, pixels, threads, !qoi) < 0) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	double t2 = now_ms();
+
+	int ret;
+	size_t out_size = 0;
+	if (qoi)
+		ret = qoi_write(output, pixels, pic.width, pic.height,
+				target->has_alpha ? 4 : 3, threads, &out_size);
+	else
+		ret = image_write(output, pixels, pic.width, pic.height,
+				pic.width * 4, target->format);
+	double t3 = now_ms();
+
+	double mpix = (double)pic.width * pic.height / 1e6;
+	printf("%s: %dx%d %s, decode %.1f ms, convert %.1f ms (%d threads, %.0f Mpx/s), "
+			"%s %.1f ms\n", output, pic.width, pic.height, target->name,
+			t1 - t0, t2 - t1, threads, mpix / ((t2 - t1) / 1e3),
+			qoi ? "encode" : "write", t3 - t2);
+	if (qoi && ret == 0)
+		printf("%s: %zu B, %.2fx smaller than raw\n", output, out_size,
+				(double)size / out_size);
+
+	free(pixels);
+	picture_free(&pic);
+	return ret < 0 ? 1 : 0;
+}
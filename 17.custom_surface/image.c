@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <wayland-client.h>
+
+#include "image.h"
+#include "qoi.h"
+
+/* 解码 QOI 时每次读的大小 */
+#define QOI_READ_SIZE (64 * 1024)
+
+/* 按 8 字节做 FNV-1a，尾部不足 8 字节的逐字节处理 */
+uint64_t
+image_checksum(const void *data, uint64_t size)
+{
+	const uint8_t *p = data;
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint64_t i = 0;
+
+	for (; i + 8 <= size; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0x100000001b3ull;
+	}
+	for (; i < size; i++)
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	return h;
+}
+
+static uint64_t
+header_checksum(const struct image_header *header)
+{
+	return image_checksum(header, offsetof(struct image_header, header_checksum));
+}
+
+static uint32_t
+format_bpp(uint32_t format)
+{
+	switch (format) {
+	case WL_SHM_FORMAT_ARGB8888:
+	case WL_SHM_FORMAT_XRGB8888:
+	case WL_SHM_FORMAT_ABGR8888:
+	case WL_SHM_FORMAT_XBGR8888:
+		return 4;
+	case WL_SHM_FORMAT_RGB565:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+int
+image_copy_range(int fd_in, uint64_t off_in, int fd_out, uint64_t off_out,
+		uint64_t len)
+{
+	off64_t in = off_in, out = off_out;
+
+	while (len > 0) {
+		ssize_t n = copy_file_range(fd_in, &in, fd_out, &out, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len -= n;
+	}
+	if (len == 0)
+		return 0;
+
+	/* 跨文件系统(文件到 memfd)时 copy_file_range 会返回 EXDEV，改用 sendfile */
+	if (lseek(fd_out, out, SEEK_SET) < 0)
+		return -1;
+	while (len > 0) {
+		ssize_t n = sendfile(fd_out, fd_in, &in, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+/* 整个文件复制到 memfd，封住大小，之后只有合成器会以读写方式映射它
+ * 不加 F_SEAL_WRITE：合成器总是用 PROT_WRITE 映射 pool，加了就映射不了
+ * */
+static int
+image_seal(struct image *image)
+{
+	int fd = memfd_create("image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		fprintf(stderr, "memfd_create failed: %m\n");
+		return -1;
+	}
+
+	if (ftruncate(fd, image->file_size) < 0 ||
+		image_copy_range(image->fd, 0, fd, 0, image->file_size) < 0 ||
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		fprintf(stderr, "sealing image failed: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	close(image->fd);
+	image->fd = fd;
+	return 0;
+}
+
+void *
+image_create(struct image *image, uint32_t width, uint32_t height, uint32_t format)
+{
+	struct image_header *h = &image->header;
+
+	memset(image, 0, sizeof(*image));
+	h->magic = IMAGE_MAGIC;
+	h->version = IMAGE_VERSION;
+	h->width = width;
+	h->height = height;
+	h->stride = width * 4;
+	h->format = format;
+	h->data_offset = IMAGE_PAGE_SIZE;
+	h->data_size = (uint64_t)h->stride * h->height;
+	image->file_size = h->data_offset + h->data_size;
+
+	image->fd = memfd_create("image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (image->fd < 0 || ftruncate(image->fd, image->file_size) < 0) {
+		fprintf(stderr, "creating image memfd failed: %m\n");
+		goto fail;
+	}
+
+	void *map = mmap(NULL, image->file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			image->fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		goto fail;
+	}
+	image->map = map;
+	return (uint8_t *)map + h->data_offset;
+
+fail:
+	image_close(image);
+	return NULL;
+}
+
+int
+image_finish(struct image *image)
+{
+	struct image_header *h = &image->header;
+
+	h->data_checksum = image_checksum((uint8_t *)image->map + h->data_offset,
+			h->data_size);
+	h->header_checksum = header_checksum(h);
+	memcpy(image->map, h, sizeof(*h));
+
+	if (fcntl(image->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		fprintf(stderr, "sealing image failed: %m\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* 把 QOI 流式解码到 image_create 建好的 memfd 里，
+ * 解码器直接写映射好的 pool，之后和普通 .img 一样使用
+ * */
+static int
+image_load_qoi(struct image *image, const char *path, const uint8_t *head,
+		size_t head_size)
+{
+	struct qoi_desc desc;
+	struct qoi_decoder dec;
+	struct image decoded;
+	uint8_t *buf = NULL;
+	uint32_t *pixels;
+	int ret = -1;
+
+	if (qoi_read_header(head, head_size, &desc) < 0) {
+		fprintf(stderr, "%s: bad qoi header\n", path);
+		return -1;
+	}
+
+	pixels = image_create(&decoded, desc.width, desc.height, desc.channels == 4 ?
+			WL_SHM_FORMAT_ARGB8888 : WL_SHM_FORMAT_XRGB8888);
+	buf = malloc(QOI_READ_SIZE);
+	if (pixels == NULL || buf == NULL)
+		goto out;
+
+	qoi_decoder_init(&dec, &desc, pixels, desc.width);
+	off_t offset = QOI_HEADER_SIZE;
+	int done = 0;
+	while (!done) {
+		ssize_t n = pread(image->fd, buf, QOI_READ_SIZE, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		offset += n;
+		done = qoi_decoder_feed(&dec, buf, n);
+		if (done < 0)
+			break;
+	}
+	if (done != 1) {
+		fprintf(stderr, "%s: qoi data truncated or corrupt\n", path);
+		goto out;
+	}
+	if (image_finish(&decoded) < 0)
+		goto out;
+
+	/* 和直接打开 .img 一样，映射留到 image_map 时再做 */
+	munmap(decoded.map, decoded.file_size);
+	decoded.map = NULL;
+	image_close(image);
+	*image = decoded;
+	ret = 0;
+
+out:
+	free(buf);
+	if (ret < 0 && pixels)
+		image_close(&decoded);
+	return ret;
+}
+
+int
+image_check_header(const struct image_header *h, uint64_t file_size,
+		const char *path)
+{
+	if (h->magic != IMAGE_MAGIC || h->version != IMAGE_VERSION) {
+		fprintf(stderr, "%s: not an image file\n", path);
+		return -1;
+	}
+	if (h->header_checksum != header_checksum(h)) {
+		fprintf(stderr, "%s: header checksum mismatch\n", path);
+		return -1;
+	}
+
+	uint32_t bpp = format_bpp(h->format);
+	if (bpp == 0 || h->width == 0 || h->height == 0 ||
+		h->stride < (uint64_t)h->width * bpp ||
+		h->data_size < (uint64_t)h->stride * h->height ||
+		h->data_offset % IMAGE_PAGE_SIZE != 0) {
+		fprintf(stderr, "%s: bad header\n", path);
+		return -1;
+	}
+	/* 两个都是文件里读来的，相加可能回绕，分开和文件大小比 */
+	if (h->data_offset > file_size || h->data_size > file_size - h->data_offset) {
+		fprintf(stderr, "%s: truncated\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+int
+image_open(struct image *image, const char *path, int flags)
+{
+	struct image_header *h = &image->header;
+	struct stat st;
+
+	memset(image, 0, sizeof(*image));
+	/* 合成器会以读写方式映射 pool，直接交出去的文件不能只读打开 */
+	image->fd = open(path, (flags & IMAGE_SEALED ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+	if (image->fd < 0) {
+		fprintf(stderr, "open %s failed: %m\n", path);
+		return -1;
+	}
+
+	ssize_t n = pread(image->fd, h, sizeof(*h), 0);
+	/* QOI 没有校验和，解码能走到最后一个像素就算通过 */
+	if (n >= 4 && memcmp(h, "qoif", 4) == 0) {
+		uint8_t head[QOI_HEADER_SIZE];
+		memcpy(head, h, n < QOI_HEADER_SIZE ? n : QOI_HEADER_SIZE);
+		if (image_load_qoi(image, path, head, n) < 0)
+			goto fail;
+		return 0;
+	}
+	if (n != sizeof(*h)) {
+		fprintf(stderr, "%s: short header\n", path);
+		goto fail;
+	}
+	if (fstat(image->fd, &st) < 0 || image_check_header(h, st.st_size, path) < 0)
+		goto fail;
+	image->file_size = st.st_size;
+
+	if ((flags & IMAGE_SEALED) && image_seal(image) < 0)
+		goto fail;
+
+	if (flags & IMAGE_VERIFY) {
+		const uint8_t *data = image_map(image);
+		if (data == NULL)
+			goto fail;
+		if (image_checksum(data, h->data_size) != h->data_checksum) {
+			fprintf(stderr, "%s: data checksum mismatch\n", path);
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	image_close(image);
+	return -1;
+}
+
+void
+image_close(struct image *image)
+{
+	if (image->map)
+		munmap(image->map, image->file_size);
+	if (image->fd >= 0)
+		close(image->fd);
+	image->map = NULL;
+	image->fd = -1;
+}
+
+void *
+image_map(struct image *image)
+{
+	if (image->map == NULL) {
+		void *map = mmap(NULL, image->file_size, PROT_READ, MAP_SHARED,
+				image->fd, 0);
+		if (map == MAP_FAILED) {
+			fprintf(stderr, "mmap failed: %m\n");
+			return NULL;
+		}
+		image->map = map;
+	}
+	return (uint8_t *)image->map + image->header.data_offset;
+}
+
+int
+image_write(const char *path, const void *pixels, uint32_t width,
+		uint32_t height, uint32_t stride, uint32_t format)
+{
+	static uint8_t page[IMAGE_PAGE_SIZE];
+	struct image_header h = {
+		.magic = IMAGE_MAGIC,
+		.version = IMAGE_VERSION,
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.format = format,
+		.data_offset = IMAGE_PAGE_SIZE,
+		.data_size = (uint64_t)stride * height,
+	};
+	h.data_checksum = image_checksum(pixels, h.data_size);
+	h.header_checksum = header_checksum(&h);
+
+	memset(page, 0, sizeof(page));
+	memcpy(page, &h, sizeof(h));
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "open %s failed: %m\n", path);
+		return -1;
+	}
+
+	const uint8_t *p = pixels;
+	uint64_t left = h.data_size;
+	if (write(fd, page, sizeof(page)) != sizeof(page))
+		goto fail;
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			goto fail;
+		p += n;
+		left -= n;
+	}
+	close(fd);
+	return 0;
+
+fail:
+	fprintf(stderr, "write %s failed: %m\n", path);
+	close(fd);
+	unlink(path);
+	return -1;
+}
+
+struct wl_buffer *
+image_create_buffer(struct image *image, struct wl_shm *shm)
+{
+	const struct image_header *h = &image->header;
+
+	/* pool 的大小是 int32 */
+	if (image->file_size > INT32_MAX) {
+		fprintf(stderr, "image too large for wl_shm: %llu B\n",
+				(unsigned long long)image->file_size);
+		return NULL;
+	}
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(shm, image->fd,
+			image->file_size);
+	struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, h->data_offset,
+			h->width, h->height, h->stride, h->format);
+	wl_shm_pool_destroy(pool);
+	return buffer;
+}
@@ -0,0 +1,92 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+
+/* 可以直接交给 wl_shm 的原始图片格式(.img)
+ *
+ * 第一页是文件头，像素数据从页边界开始，格式就是 wl_shm 的格式，
+ * 加载时把文件的 fd 直接传给 wl_shm_create_pool，
+ * 用数据偏移创建 wl_buffer，不需要复制也不需要解码
+ *
+ * image_open 也能打开 .qoi：解码到一个同样布局的 memfd 里，之后用法完全一样
+ * */
+#define IMAGE_MAGIC 0x474d4c57 /* "WLMG" */
+#define IMAGE_VERSION 1
+#define IMAGE_PAGE_SIZE 4096
+
+struct image_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	/* 每行字节数 */
+	uint32_t stride;
+	/* enum wl_shm_format */
+	uint32_t format;
+	/* 像素数据的偏移，按页对齐 */
+	uint64_t data_offset;
+	uint64_t data_size;
+	/* 像素数据的校验和 */
+	uint64_t data_checksum;
+	/* 以上字段的校验和 */
+	uint64_t header_checksum;
+};
+
+/* 打开时顺便校验像素数据，会读一遍整个文件 */
+#define IMAGE_VERIFY 0x1
+/* 只读打开文件，复制到一个封存(seal)的 memfd 里
+ * 每个进程都会多一份拷贝，只在 fd 要交给别的进程(比如 asset server 的客户端)，
+ * 必须保证它不会被截短时使用
+ *
+ * 默认文件本身就是 shm pool，所有进程共用 page cache 里的同一份，不复制。
+ * 合成器会以读写方式映射 pool 所以文件要 O_RDWR 打开，但它不会往里写；
+ * 客户端自己只通过 image_map 以 PROT_READ 映射，要画就画在 image_layer 上。
+ * .qoi 总是解码到一个封存的 memfd 里
+ * */
+#define IMAGE_SEALED 0x2
+
+struct image {
+	/* IMAGE_SEALED 或解码过的 .qoi 是 memfd，否则是文件本身 */
+	int fd;
+	struct image_header header;
+	uint64_t file_size;
+	/* image_map 之后才有 */
+	void *map;
+};
+
+uint64_t image_checksum(const void *data, uint64_t size);
+
+/* 检查文件头(魔数、校验和、大小)，不对时打印原因并返回 -1 */
+int image_check_header(const struct image_header *header, uint64_t file_size,
+		const char *path);
+
+/* 打开并检查文件头，像素数据默认不读 */
+int image_open(struct image *image, const char *path, int flags);
+void image_close(struct image *image);
+
+/* 把整个文件映射进来，返回像素数据的地址，CPU 要访问像素时才需要 */
+void *image_map(struct image *image);
+
+/* 在两个 fd 之间复制 len 字节，尽量在内核里完成(copy_file_range / sendfile) */
+int image_copy_range(int fd_in, uint64_t off_in, int fd_out, uint64_t off_out,
+		uint64_t len);
+
+/* 在 memfd 里建一张同样布局的空白图片(stride 是 width * 4)，返回映射好的像素地址
+ * 像素写完后调用 image_finish 填上校验和并封存大小，之后和打开的 .img 一样使用
+ * */
+void *image_create(struct image *image, uint32_t width, uint32_t height,
+		uint32_t format);
+int image_finish(struct image *image);
+
+/* 把像素写成 .img 文件，stride 以字节为单位 */
+int image_write(const char *path, const void *pixels, uint32_t width,
+		uint32_t height, uint32_t stride, uint32_t format);
+
+struct wl_shm;
+struct wl_buffer;
+
+/* 文件本身就是 shm pool，创建指向像素数据的 wl_buffer */
+struct wl_buffer *image_create_buffer(struct image *image, struct wl_shm *shm);
+
+#endif
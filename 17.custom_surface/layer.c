@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+
+#include "viewporter-client-protocol.h"
+#include "layer.h"
+
+static void
+tile_rows(const struct image_layer *layer, int i, int *y0, int *y1)
+{
+	int height = layer->base->header.height;
+
+	*y0 = i * LAYER_TILE_ROWS;
+	*y1 = *y0 + LAYER_TILE_ROWS < height ? *y0 + LAYER_TILE_ROWS : height;
+}
+
+int
+image_layer_init(struct image_layer *layer, struct image *base,
+		struct wl_shm *shm, struct wl_compositor *compositor,
+		struct wl_subcompositor *subcompositor, struct wp_viewporter *viewporter,
+		struct wl_surface *parent)
+{
+	const struct image_header *h = &base->header;
+
+	memset(layer, 0, sizeof(*layer));
+	layer->fd = -1;
+	layer->base = base;
+	layer->compositor = compositor;
+	layer->subcompositor = subcompositor;
+	layer->viewporter = viewporter;
+	layer->parent = parent;
+	layer->stride = h->stride / 4;
+	layer->tile_count = (h->height + LAYER_TILE_ROWS - 1) / LAYER_TILE_ROWS;
+
+	if (h->stride % 4 != 0 || base->file_size > INT32_MAX) {
+		fprintf(stderr, "layer: unsupported image\n");
+		return -1;
+	}
+
+	/* 空洞文件，只有复制过的条带占内存 */
+	layer->fd = memfd_create("image-layer", MFD_CLOEXEC);
+	if (layer->fd < 0 || ftruncate(layer->fd, base->file_size) < 0) {
+		fprintf(stderr, "layer: creating memfd failed: %m\n");
+		goto fail;
+	}
+
+	layer->map = mmap(NULL, base->file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			layer->fd, 0);
+	if (layer->map == MAP_FAILED) {
+		fprintf(stderr, "layer: mmap failed: %m\n");
+		layer->map = NULL;
+		goto fail;
+	}
+	layer->pixels = (uint32_t *)(layer->map + h->data_offset);
+
+	layer->tiles = calloc(layer->tile_count, sizeof(*layer->tiles));
+	if (layer->tiles == NULL)
+		goto fail;
+
+	layer->pool = wl_shm_create_pool(shm, layer->fd, base->file_size);
+	return 0;
+
+fail:
+	image_layer_finish(layer);
+	return -1;
+}
+
+void
+image_layer_finish(struct image_layer *layer)
+{
+	for (int i = 0; layer->tiles && i < layer->tile_count; i++) {
+		struct layer_tile *tile = &layer->tiles[i];
+		if (tile->viewport)
+			wp_viewport_destroy(tile->viewport);
+		if (tile->subsurface)
+			wl_subsurface_destroy(tile->subsurface);
+		if (tile->surface)
+			wl_surface_destroy(tile->surface);
+		if (tile->buffer)
+			wl_buffer_destroy(tile->buffer);
+	}
+	free(layer->tiles);
+	layer->tiles = NULL;
+
+	if (layer->pool)
+		wl_shm_pool_destroy(layer->pool);
+	layer->pool = NULL;
+	if (layer->map)
+		munmap(layer->map, layer->base->file_size);
+	layer->map = NULL;
+	if (layer->fd >= 0)
+		close(layer->fd);
+	layer->fd = -1;
+}
+
+uint32_t *
+image_layer_begin(struct image_layer *layer, int y0, int y1)
+{
+	const struct image_header *h = &layer->base->header;
+
+	if (y0 < 0)
+		y0 = 0;
+	if (y1 > (int)h->height)
+		y1 = h->height;
+
+	for (int i = y0 / LAYER_TILE_ROWS; y0 < y1 && i <= (y1 - 1) / LAYER_TILE_ROWS; i++) {
+		struct layer_tile *tile = &layer->tiles[i];
+		int r0, r1;
+
+		tile->dirty = 1;
+		if (tile->copied)
+			continue;
+
+		/* 条带是整行宽，在文件里是连续的，一次复制完 */
+		tile_rows(layer, i, &r0, &r1);
+		uint64_t offset = h->data_offset + (uint64_t)r0 * h->stride;
+		if (image_copy_range(layer->base->fd, offset, layer->fd, offset,
+					(uint64_t)(r1 - r0) * h->stride) < 0) {
+			fprintf(stderr, "layer: copying tile %d failed: %m\n", i);
+			continue;
+		}
+		tile->copied = 1;
+		layer->copied_tiles++;
+	}
+	return layer->pixels;
+}
+
+void
+image_layer_commit(struct image_layer *layer, int dst_width, int dst_height)
+{
+	const struct image_header *h = &layer->base->header;
+	int scaled = layer->viewporter && dst_width > 0 && dst_height > 0;
+
+	for (int i = 0; i < layer->tile_count; i++) {
+		struct layer_tile *tile = &layer->tiles[i];
+		int r0, r1;
+
+		if (!tile->copied)
+			continue;
+		tile_rows(layer, i, &r0, &r1);
+
+		if (tile->surface == NULL) {
+			tile->surface = wl_compositor_create_surface(layer->compositor);
+			tile->subsurface = wl_subcompositor_get_subsurface(layer->subcompositor,
+					tile->surface, layer->parent);
+			/* 输入事件交给父 surface */
+			struct wl_region *region = wl_compositor_create_region(layer->compositor);
+			wl_surface_set_input_region(tile->surface, region);
+			wl_region_destroy(region);
+			if (layer->viewporter)
+				tile->viewport = wp_viewporter_get_viewport(layer->viewporter,
+						tile->surface);
+			tile->buffer = wl_shm_pool_create_buffer(layer->pool,
+					h->data_offset + (uint64_t)r0 * h->stride,
+					h->width, r1 - r0, h->stride, h->format);
+			tile->dirty = 1;
+		}
+
+		/* 父 surface 缩放显示时，条带按同样的比例缩放，相邻条带首尾相接 */
+		if (scaled) {
+			int s0 = (int64_t)r0 * dst_height / h->height;
+			int s1 = (int64_t)r1 * dst_height / h->height;
+			wl_subsurface_set_position(tile->subsurface, 0, s0);
+			wp_viewport_set_destination(tile->viewport, dst_width,
+					s1 > s0 ? s1 - s0 : 1);
+		} else {
+			wl_subsurface_set_position(tile->subsurface, 0, r0);
+			if (tile->viewport)
+				wp_viewport_set_destination(tile->viewport, -1, -1);
+		}
+
+		if (tile->dirty) {
+			wl_surface_attach(tile->surface, tile->buffer, 0, 0);
+			/* 条带经过 viewport 缩放，damage 要按 buffer 坐标给，
+			 * 老的合成器没有 damage_buffer，只能整个 surface 都算 damage
+			 * */
+			if (wl_proxy_get_version((struct wl_proxy *)tile->surface) >= 4)
+				wl_surface_damage_buffer(tile->surface, 0, 0, h->width, r1 - r0);
+			else
+				wl_surface_damage(tile->surface, 0, 0, INT32_MAX, INT32_MAX);
+			tile->dirty = 0;
+		}
+		wl_surface_commit(tile->surface);
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef LAYER_H
+#define LAYER_H
+
+#include <stdint.h>
+
+#include "image.h"
+
+/* 画在只读底图上面的私有图层
+ *
+ * 图层是一个和底图同样大小的 memfd，一开始是空洞文件，不占内存。
+ * 画之前用 copy_file_range 从底图复制对应的条带(整行宽、LAYER_TILE_ROWS 行)，
+ * 只有画过的条带才会被复制。每个画过的条带用一个子 surface 盖在底图上面，
+ * 没画过的地方直接显示底图，所以很多窗口可以共用同一份底图
+ * */
+#define LAYER_TILE_ROWS 32
+
+struct wl_shm;
+struct wl_compositor;
+struct wl_subcompositor;
+struct wl_surface;
+struct wl_subsurface;
+struct wl_shm_pool;
+struct wl_buffer;
+struct wp_viewporter;
+struct wp_viewport;
+
+struct layer_tile {
+	/* 已经从底图复制过 */
+	int copied;
+	/* 画过，下次 commit 时要提交 */
+	int dirty;
+	struct wl_buffer *buffer;
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	struct wp_viewport *viewport;
+};
+
+struct image_layer {
+	struct image *base;
+	int fd;
+	uint8_t *map;
+	/* 像素数据的起点，stride 以像素为单位 */
+	uint32_t *pixels;
+	int stride;
+	int tile_count;
+	struct layer_tile *tiles;
+	int copied_tiles;
+
+	struct wl_shm_pool *pool;
+	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	/* 可以为 NULL，这时不支持缩放显示 */
+	struct wp_viewporter *viewporter;
+	struct wl_surface *parent;
+};
+
+int image_layer_init(struct image_layer *layer, struct image *base,
+		struct wl_shm *shm, struct wl_compositor *compositor,
+		struct wl_subcompositor *subcompositor, struct wp_viewporter *viewporter,
+		struct wl_surface *parent);
+void image_layer_finish(struct image_layer *layer);
+
+/* 准备写 [y0, y1) 行：没复制过的条带先从底图复制，返回第 0 行的地址 */
+uint32_t *image_layer_begin(struct image_layer *layer, int y0, int y1);
+
+/* 把画过的条带挂到子 surface 上，父 surface 提交之后生效
+ * dst_width, dst_height 是父 surface 的显示大小，<= 0 表示不缩放
+ * */
+void image_layer_commit(struct image_layer *layer, int dst_width, int dst_height);
+
+#endif
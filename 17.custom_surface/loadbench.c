@@ -0,0 +1,253 @@
+/////////////////////
+// \note 启动时加载很多小图片的耗时对比
+//       逐个 image_open / 批量同步读 / 批量 io_uring，冷缓存和热缓存各测几轮，
+//       计时前每种方式都先加载一遍，逐个像素和生成时的内容比较
+//
+//       ./loadbench [--count N] [--rounds N] [--dir 目录]
+//       冷缓存用 posix_fadvise(DONTNEED) 把文件逐出 page cache，
+//       目录项和 inode 还在缓存里，真正的冷启动(重启后)只会更慢
+/////////////////////
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <wayland-client.h>
+
+#include "image.h"
+#include "asset_batch.h"
+
+/* 图标常见的几种大小 */
+static const int SIZES[] = { 16, 24, 32, 48, 64, 96, 128, 256 };
+#define SIZE_COUNT (int)(sizeof(SIZES) / sizeof(SIZES[0]))
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* 生成测试用的图标，已经存在就不再写 */
+static int
+create_assets(const char *dir, int count, char **paths)
+{
+	uint32_t *pixels = malloc(256 * 256 * 4);
+	int created = 0;
+
+	if (pixels == NULL)
+		return -1;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "mkdir %s failed: %m\n", dir);
+		free(pixels);
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int size = SIZES[i % SIZE_COUNT];
+
+		if (asprintf(&paths[i], "%s/icon-%03d-%d.img", dir, i, size) < 0) {
+			free(pixels);
+			return -1;
+		}
+		if (access(paths[i], R_OK) == 0)
+			continue;
+
+		for (int y = 0; y < size; y++)
+			for (int x = 0; x < size; x++)
+				pixels[y * size + x] = 0xff000000 | (x * 255 / size) << 16 |
+					(y * 255 / size) << 8 | (i * 37 & 0xff);
+		if (image_write(paths[i], pixels, size, size, size * 4,
+					WL_SHM_FORMAT_XRGB8888) < 0) {
+			free(pixels);
+			return -1;
+		}
+		created++;
+	}
+	if (created)
+		fprintf(stderr, "created %d assets in %s\n", created, dir);
+	free(pixels);
+	return 0;
+}
+
+/* 和 create_assets 生成的像素逐个比较，确认读进来的是完整正确的内容 */
+static int
+check_pixels(const char *path, int i, const struct image_header *h,
+		const uint8_t *data)
+{
+	int size = SIZES[i % SIZE_COUNT];
+
+	if (h->width != (uint32_t)size || h->height != (uint32_t)size) {
+		fprintf(stderr, "%s: %ux%u, expected %dx%d\n", path, h->width,
+				h->height, size, size);
+		return -1;
+	}
+	for (int y = 0; y < size; y++) {
+		const uint32_t *row = (const uint32_t *)(data + (uint64_t)y * h->stride);
+		for (int x = 0; x < size; x++) {
+			uint32_t expected = 0xff000000 | (x * 255 / size) << 16 |
+				(y * 255 / size) << 8 | (i * 37 & 0xff);
+			if (row[x] != expected) {
+				fprintf(stderr, "%s: pixel %d,%d is %08x, expected %08x\n",
+						path, x, y, row[x], expected);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* 把文件逐出 page cache，脏页先写回 */
+static void
+evict(char **paths, int count)
+{
+	for (int i = 0; i < count; i++) {
+		int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+/* 现在 17 和 15 的做法：一个一个打开，复制进封存的 memfd */
+static int
+load_serial(char **paths, int count, int verify)
+{
+	for (int i = 0; i < count; i++) {
+		struct image image;
+		uint8_t *data;
+		if (image_open(&image, paths[i], IMAGE_SEALED) < 0)
+			return -1;
+		if (verify && ((data = image_map(&image)) == NULL ||
+					check_pixels(paths[i], i, &image.header, data) < 0)) {
+			image_close(&image);
+			return -1;
+		}
+		image_close(&image);
+	}
+	return 0;
+}
+
+static int
+load_batch(char **paths, int count, int flags, unsigned *submits, int verify)
+{
+	struct asset_batch batch;
+	int loaded = asset_batch_load(&batch, (const char *const *)paths, count, flags);
+
+	if (loaded < 0)
+		return -1;
+	*submits = batch.submits;
+	if ((flags & ASSET_BATCH_URING) && !batch.uring)
+		fprintf(stderr, "io_uring unavailable, fell back to synchronous reads\n");
+	if (batch.retried)
+		fprintf(stderr, "%d assets re-read synchronously\n", batch.retried);
+	for (int i = 0; verify && loaded == count && i < count; i++) {
+		const struct asset_load *asset = &batch.assets[i];
+		const struct image_header *h =
+			(const struct image_header *)(batch.pool + asset->offset);
+
+		if (asset->size < sizeof(*h) ||
+				image_check_header(h, asset->size, asset->path) < 0 ||
+				check_pixels(asset->path, i, h,
+					batch.pool + asset->offset + h->data_offset) < 0)
+			loaded = -1;
+	}
+	asset_batch_finish(&batch);
+	return loaded == count ? 0 : -1;
+}
+
+static int
+load(int mode, char **paths, int count, unsigned *submits, int verify)
+{
+	if (mode == 0)
+		return load_serial(paths, count, verify);
+	return load_batch(paths, count, mode == 2 ? ASSET_BATCH_URING : 0,
+			submits, verify);
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = "./loadbench-assets";
+	const char *modes[] = { "image_open one by one", "batch, synchronous", "batch, io_uring" };
+	int count = 128, rounds = 5;
+	char **paths;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+			rounds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+			dir = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: %s [--count N] [--rounds N] [--dir DIR]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (count <= 0 || rounds <= 0)
+		return 1;
+
+	paths = calloc(count, sizeof(*paths));
+	if (paths == NULL || create_assets(dir, count, paths) < 0)
+		return 1;
+
+	printf("%d assets, median of %d rounds\n", count, rounds);
+	for (int cold = 1; cold >= 0; cold--)
+	{
+		for (int mode = 0; mode < 3; mode++)
+		{
+			double times[rounds];
+			unsigned submits = 0;
+
+			/* 先不计时地加载一遍并检查内容，热缓存顺便预热 */
+			if (cold)
+				evict(paths, count);
+			if (load(mode, paths, count, &submits, 1) < 0)
+			{
+				fprintf(stderr, "%s loaded wrong contents\n", modes[mode]);
+				return 1;
+			}
+			for (int r = 0; r < rounds; r++)
+			{
+				if (cold)
+					evict(paths, count);
+				double start = now_ms();
+				int ret = load(mode, paths, count, &submits, 0);
+				times[r] = now_ms() - start;
+				if (ret < 0)
+				{
+					fprintf(stderr, "%s failed\n", modes[mode]);
+					return 1;
+				}
+			}
+			qsort(times, rounds, sizeof(times[0]), compare);
+			printf("%s cache, %-22s %8.2f ms", cold ? "cold" : "warm", modes[mode],
+					times[rounds / 2]);
+			if (mode == 2)
+				printf("  (%u io_uring_enter calls)", submits);
+			printf("\n");
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+		free(paths[i]);
+	free(paths);
+	return 0;
+}
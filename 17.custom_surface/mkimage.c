@@ -0,0 +1,80 @@
+/////////////////////
+// \note 把原始的 XRGB8888 像素打包成 .img
+//       ./mkimage [--transposed] input.rgb width height output.img
+//       --transposed 表示输入是按列存放的(以前 convert.py 的输出)
+/////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <wayland-client.h>
+
+#include "image.h"
+
+int main(int argc, char **argv)
+{
+	int transposed = 0;
+	int i = 1;
+
+	if (argc > 1 && strcmp(argv[1], "--transposed") == 0) {
+		transposed = 1;
+		i++;
+	}
+	if (argc - i != 4) {
+		fprintf(stderr, "usage: %s [--transposed] input.rgb width height output.img\n",
+				argv[0]);
+		return 1;
+	}
+
+	const char *input = argv[i];
+	uint32_t width = atoi(argv[i + 1]);
+	uint32_t height = atoi(argv[i + 2]);
+	const char *output = argv[i + 3];
+	uint64_t size = (uint64_t)width * height * 4;
+
+	int fd = open(input, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "open %s failed: %m\n", input);
+		return 1;
+	}
+	if (width == 0 || height == 0 || (uint64_t)st.st_size < size) {
+		fprintf(stderr, "%s: %lld B, expected %llu B for %ux%u\n", input,
+				(long long)st.st_size, (unsigned long long)size, width, height);
+		return 1;
+	}
+
+	const uint32_t *src = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (src == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		return 1;
+	}
+
+	const uint32_t *pixels = src;
+	uint32_t *tmp = NULL;
+	if (transposed) {
+		tmp = malloc(size);
+		if (tmp == NULL)
+			return 1;
+		for (uint32_t x = 0; x < width; x++)
+			for (uint32_t y = 0; y < height; y++)
+				tmp[(size_t)y * width + x] = src[(size_t)x * height + y];
+		pixels = tmp;
+	}
+
+	int ret = image_write(output, pixels, width, height, width * 4,
+			WL_SHM_FORMAT_XRGB8888);
+	free(tmp);
+	munmap((void *)src, size);
+	if (ret < 0)
+		return 1;
+
+	printf("%s: %ux%u XRGB8888\n", output, width, height);
+	return 0;
+}
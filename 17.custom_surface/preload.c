@@ -0,0 +1,60 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "preload.h"
+
+double
+preload_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *
+preload_run(void *data)
+{
+	struct preload *preload = data;
+
+	preload->result = image_open(&preload->image, preload->path, preload->flags);
+	/* 不带 IMAGE_SEALED 打开的 .img(surface 就是这样)文件本身就是 pool，
+	 * 让内核先读进 page cache，合成器第一次读时不用等磁盘。
+	 * 能取到 seal 的是解码出来的 memfd，已经在内存里了
+	 * */
+	if (preload->result == 0 && !(preload->flags & IMAGE_SEALED) &&
+		fcntl(preload->image.fd, F_GET_SEALS) < 0)
+		posix_fadvise(preload->image.fd, 0, preload->image.file_size,
+				POSIX_FADV_WILLNEED);
+	preload->done_ms = preload_now_ms();
+	return NULL;
+}
+
+int
+preload_start(struct preload *preload, const char *path, int flags)
+{
+	memset(preload, 0, sizeof(*preload));
+	preload->path = path;
+	preload->flags = flags;
+	preload->start_ms = preload_now_ms();
+
+	if (pthread_create(&preload->thread, NULL, preload_run, preload) != 0) {
+		fprintf(stderr, "preload thread failed, loading %s in place\n", path);
+		preload_run(preload);
+		return -1;
+	}
+	preload->running = 1;
+	return 0;
+}
+
+struct image *
+preload_wait(struct preload *preload)
+{
+	if (preload->running) {
+		pthread_join(preload->thread, NULL);
+		preload->running = 0;
+	}
+	return preload->result == 0 ? &preload->image : NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef PRELOAD_H
+#define PRELOAD_H
+
+#include <pthread.h>
+
+#include "image.h"
+
+/* 在后台线程里打开(复制、解码)图片，和连接合成器、registry 往返同时进行
+ * 第一次要用像素时 preload_wait 等它完成，通常已经好了
+ * */
+struct preload {
+	pthread_t thread;
+	/* 线程已经创建还没 join */
+	int running;
+	const char *path;
+	int flags;
+	struct image image;
+	int result;
+	/* 开始和完成的时间(CLOCK_MONOTONIC，毫秒) */
+	double start_ms;
+	double done_ms;
+};
+
+double preload_now_ms(void);
+
+int preload_start(struct preload *preload, const char *path, int flags);
+
+/* 等后台加载完成，失败返回 NULL */
+struct image *preload_wait(struct preload *preload);
+
+#endif
@@ -0,0 +1,398 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "qoi.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_MASK_2 0xc0
+
+#define QOI_MAX_THREADS 64
+/* 像素数的上限和参考实现一样，防止 width * height 溢出 */
+#define QOI_PIXELS_MAX 400000000u
+
+static const uint8_t qoi_padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+static inline unsigned
+qoi_hash(uint32_t px)
+{
+	unsigned a = px >> 24, r = (px >> 16) & 0xff, g = (px >> 8) & 0xff, b = px & 0xff;
+	return (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+}
+
+static inline uint32_t
+qoi_pack(unsigned a, unsigned r, unsigned g, unsigned b)
+{
+	return (uint32_t)(a & 0xff) << 24 | (r & 0xff) << 16 | (g & 0xff) << 8 | (b & 0xff);
+}
+
+static inline uint32_t
+be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline void
+put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+int
+qoi_read_header(const uint8_t *data, size_t size, struct qoi_desc *desc)
+{
+	if (size < QOI_HEADER_SIZE || memcmp(data, "qoif", 4) != 0)
+		return -1;
+
+	desc->width = be32(data + 4);
+	desc->height = be32(data + 8);
+	desc->channels = data[12];
+	desc->colorspace = data[13];
+	if (desc->width == 0 || desc->height == 0 ||
+		(desc->channels != 3 && desc->channels != 4) ||
+		desc->height >= QOI_PIXELS_MAX / desc->width)
+		return -1;
+	return 0;
+}
+
+/* ---------------------------------------------------------------- 解码 */
+
+void
+qoi_decoder_init(struct qoi_decoder *dec, const struct qoi_desc *desc,
+		uint32_t *dst, int stride)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->px = 0xff000000;
+	dec->width = desc->width;
+	dec->height = desc->height;
+	dec->row = dst;
+	dec->stride = stride;
+}
+
+static inline uint32_t
+premultiply(uint32_t px)
+{
+	uint32_t a = px >> 24, out = px & 0xff000000;
+
+	for (int s = 0; s < 24; s += 8) {
+		uint32_t t = ((px >> s) & 0xff) * a + 128;
+		out |= ((t + (t >> 8)) >> 8) << s;
+	}
+	return out;
+}
+
+/* 写 n 个同样的像素，返回 1 表示写满了 */
+static inline int
+qoi_put(struct qoi_decoder *dec, uint32_t px, uint32_t n)
+{
+	uint32_t out = px >> 24 == 0xff ? px : premultiply(px);
+
+	/* 绝大多数操作只写一个像素 */
+	if (n == 1 && dec->x + 1 < dec->width) {
+		dec->row[dec->x++] = out;
+		return 0;
+	}
+
+	while (n > 0) {
+		uint32_t count = dec->width - dec->x;
+		if (count > n)
+			count = n;
+		for (uint32_t i = 0; i < count; i++)
+			dec->row[dec->x + i] = out;
+		dec->x += count;
+		n -= count;
+		if (dec->x == dec->width) {
+			dec->x = 0;
+			dec->row += dec->stride;
+			if (++dec->y == dec->height)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static inline int
+qoi_op_size(uint8_t b)
+{
+	if (b == QOI_OP_RGBA)
+		return 5;
+	if (b == QOI_OP_RGB)
+		return 4;
+	if ((b & QOI_MASK_2) == QOI_OP_LUMA)
+		return 2;
+	return 1;
+}
+
+/* 执行一个完整的操作，返回 1 表示所有像素都解完了 */
+static inline int
+qoi_op(struct qoi_decoder *dec, const uint8_t *p)
+{
+	uint32_t px = dec->px;
+	uint8_t b1 = p[0];
+
+	if (b1 == QOI_OP_RGBA) {
+		px = qoi_pack(p[4], p[1], p[2], p[3]);
+	} else if (b1 == QOI_OP_RGB) {
+		px = qoi_pack(px >> 24, p[1], p[2], p[3]);
+	} else {
+		switch (b1 & QOI_MASK_2) {
+		case QOI_OP_INDEX:
+			px = dec->index[b1];
+			break;
+		case QOI_OP_DIFF:
+			px = qoi_pack(px >> 24,
+					((px >> 16) & 0xff) + ((b1 >> 4) & 3) - 2,
+					((px >> 8) & 0xff) + ((b1 >> 2) & 3) - 2,
+					(px & 0xff) + (b1 & 3) - 2);
+			break;
+		case QOI_OP_LUMA: {
+			int vg = (b1 & 0x3f) - 32;
+			uint8_t b2 = p[1];
+			px = qoi_pack(px >> 24,
+					((px >> 16) & 0xff) + vg - 8 + ((b2 >> 4) & 0x0f),
+					((px >> 8) & 0xff) + vg,
+					(px & 0xff) + vg - 8 + (b2 & 0x0f));
+			break;
+		}
+		case QOI_OP_RUN:
+			/* 重复前一个像素，颜色表不变 */
+			return qoi_put(dec, px, (b1 & 0x3f) + 1);
+		}
+	}
+
+	dec->px = px;
+	dec->index[qoi_hash(px)] = px;
+	return qoi_put(dec, px, 1);
+}
+
+int
+qoi_decoder_feed(struct qoi_decoder *dec, const uint8_t *data, size_t size)
+{
+	const uint8_t *p = data, *end = data + size;
+
+	if (dec->y == dec->height)
+		return 1;
+
+	/* 先把上一块末尾被截断的操作补完整 */
+	if (dec->pending_size > 0) {
+		int need = qoi_op_size(dec->pending[0]);
+		while (dec->pending_size < need && p < end)
+			dec->pending[dec->pending_size++] = *p++;
+		if (dec->pending_size < need)
+			return 0;
+		dec->pending_size = 0;
+		if (qoi_op(dec, dec->pending))
+			return 1;
+	}
+
+	/* 剩下至少 5 字节时不用检查操作是否完整 */
+	while (end - p >= 5) {
+		int n = qoi_op_size(*p);
+		if (qoi_op(dec, p))
+			return 1;
+		p += n;
+	}
+
+	while (p < end) {
+		int n = qoi_op_size(*p);
+		if (end - p < n) {
+			memcpy(dec->pending, p, end - p);
+			dec->pending_size = end - p;
+			return 0;
+		}
+		if (qoi_op(dec, p))
+			return 1;
+		p += n;
+	}
+	return 0;
+}
+
+/* ---------------------------------------------------------------- 编码 */
+
+/* 编码 [y0, y1) 行，返回写出的字节数
+ * 条带第一个像素总是用 QOI_OP_RGBA，颜色表只用本条带写过的项，
+ * 这样解码器带着前一个条带的状态进来也能得到同样的结果
+ * */
+static size_t
+qoi_encode_band(const uint32_t *pixels, uint32_t width, uint32_t y0, uint32_t y1,
+		int stride, int channels, uint8_t *out)
+{
+	uint32_t index[64];
+	uint64_t valid = 0;
+	uint32_t prev = 0xff000000;
+	uint32_t force = channels == 3 ? 0xff000000 : 0;
+	int run = 0, first = 1;
+	uint8_t *o = out;
+
+	for (uint32_t y = y0; y < y1; y++) {
+		const uint32_t *row = pixels + (size_t)y * stride;
+
+		for (uint32_t x = 0; x < width; x++) {
+			uint32_t px = row[x] | force;
+
+			if (px == prev && !first) {
+				if (++run == 62) {
+					*o++ = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0) {
+				*o++ = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			unsigned h = qoi_hash(px);
+			if (first) {
+				*o++ = QOI_OP_RGBA;
+				*o++ = px >> 16;
+				*o++ = px >> 8;
+				*o++ = px;
+				*o++ = px >> 24;
+				first = 0;
+			} else if ((valid >> h & 1) && index[h] == px) {
+				*o++ = QOI_OP_INDEX | h;
+			} else if ((px >> 24) == (prev >> 24)) {
+				int8_t vr = (int8_t)((px >> 16) - (prev >> 16));
+				int8_t vg = (int8_t)((px >> 8) - (prev >> 8));
+				int8_t vb = (int8_t)(px - prev);
+				int8_t vg_r = vr - vg;
+				int8_t vg_b = vb - vg;
+
+				if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+					*o++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+				} else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+					vg_b > -9 && vg_b < 8) {
+					*o++ = QOI_OP_LUMA | (vg + 32);
+					*o++ = (vg_r + 8) << 4 | (vg_b + 8);
+				} else {
+					*o++ = QOI_OP_RGB;
+					*o++ = px >> 16;
+					*o++ = px >> 8;
+					*o++ = px;
+				}
+			} else {
+				*o++ = QOI_OP_RGBA;
+				*o++ = px >> 16;
+				*o++ = px >> 8;
+				*o++ = px;
+				*o++ = px >> 24;
+			}
+
+			index[h] = px;
+			valid |= (uint64_t)1 << h;
+			prev = px;
+		}
+	}
+
+	if (run > 0)
+		*o++ = QOI_OP_RUN | (run - 1);
+	return o - out;
+}
+
+struct qoi_band {
+	pthread_t thread;
+	int started;
+	const uint32_t *pixels;
+	uint32_t width;
+	uint32_t y0;
+	uint32_t y1;
+	int stride;
+	int channels;
+	uint8_t *out;
+	size_t size;
+};
+
+static void *
+qoi_band_run(void *data)
+{
+	struct qoi_band *band = data;
+
+	band->size = qoi_encode_band(band->pixels, band->width, band->y0, band->y1,
+			band->stride, band->channels, band->out);
+	return NULL;
+}
+
+uint8_t *
+qoi_encode(const uint32_t *pixels, uint32_t width, uint32_t height,
+		int stride, int channels, int threads, size_t *size)
+{
+	struct qoi_band bands[QOI_MAX_THREADS];
+	uint8_t *data = NULL;
+	int failed = 0;
+
+	if (width == 0 || height == 0 || height >= QOI_PIXELS_MAX / width ||
+		(channels != 3 && channels != 4))
+		return NULL;
+	if (threads < 1)
+		threads = 1;
+	if (threads > QOI_MAX_THREADS)
+		threads = QOI_MAX_THREADS;
+	if ((uint32_t)threads > height)
+		threads = height;
+
+	for (int i = 0; i < threads; i++) {
+		struct qoi_band *band = &bands[i];
+		band->pixels = pixels;
+		band->width = width;
+		band->y0 = (uint64_t)height * i / threads;
+		band->y1 = (uint64_t)height * (i + 1) / threads;
+		band->stride = stride;
+		band->channels = channels;
+		band->started = 0;
+		/* 最坏情况每个像素 5 字节 */
+		band->out = malloc((size_t)(band->y1 - band->y0) * width * 5);
+		if (band->out == NULL)
+			failed = 1;
+	}
+	if (failed)
+		goto out;
+
+	/* 第 0 个条带在当前线程编码 */
+	for (int i = 1; i < threads; i++) {
+		bands[i].started = pthread_create(&bands[i].thread, NULL, qoi_band_run,
+				&bands[i]) == 0;
+		if (!bands[i].started)
+			qoi_band_run(&bands[i]);
+	}
+	qoi_band_run(&bands[0]);
+	for (int i = 1; i < threads; i++)
+		if (bands[i].started)
+			pthread_join(bands[i].thread, NULL);
+
+	size_t total = QOI_HEADER_SIZE + sizeof(qoi_padding);
+	for (int i = 0; i < threads; i++)
+		total += bands[i].size;
+
+	data = malloc(total);
+	if (data == NULL)
+		goto out;
+
+	uint8_t *o = data;
+	memcpy(o, "qoif", 4);
+	put_be32(o + 4, width);
+	put_be32(o + 8, height);
+	o[12] = channels;
+	/* sRGB，alpha 是线性的 */
+	o[13] = 0;
+	o += QOI_HEADER_SIZE;
+	for (int i = 0; i < threads; i++) {
+		memcpy(o, bands[i].out, bands[i].size);
+		o += bands[i].size;
+	}
+	memcpy(o, qoi_padding, sizeof(qoi_padding));
+	*size = total;
+
+out:
+	for (int i = 0; i < threads; i++)
+		free(bands[i].out);
+	return data;
+}
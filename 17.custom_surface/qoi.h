@@ -0,0 +1,58 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* QOI 无损图片格式 (https://qoiformat.org)
+ *
+ * 单遍编码，每个像素只看前一个像素和一个 64 项的颜色表，解码几乎没有分支以外的开销。
+ * 像素在内存里都是 wl_shm 的 ARGB8888 / XRGB8888(一个 uint32_t，0xAARRGGBB)
+ * */
+#define QOI_HEADER_SIZE 14
+
+struct qoi_desc {
+	uint32_t width;
+	uint32_t height;
+	/* 3 是 RGB，4 是 RGBA */
+	uint8_t channels;
+	uint8_t colorspace;
+};
+
+/* 解析文件开头的 14 字节 */
+int qoi_read_header(const uint8_t *data, size_t size, struct qoi_desc *desc);
+
+/* 流式解码器：数据可以分成任意大小的块喂进来，
+ * 像素直接写到目标(通常就是映射好的 shm buffer)里，不需要中间缓冲
+ * 有 alpha 的像素写出时预乘，结果可以直接作为 ARGB8888 交给合成器
+ * */
+struct qoi_decoder {
+	uint32_t index[64];
+	uint32_t px;
+	uint32_t width;
+	uint32_t height;
+	uint32_t x;
+	uint32_t y;
+	uint32_t *row;
+	int stride;
+	/* 被数据块边界截断的操作 */
+	uint8_t pending[5];
+	int pending_size;
+};
+
+/* stride 以像素为单位 */
+void qoi_decoder_init(struct qoi_decoder *dec, const struct qoi_desc *desc,
+		uint32_t *dst, int stride);
+
+/* 返回 1 表示所有像素都解完了，0 表示还需要数据，-1 表示数据错误 */
+int qoi_decoder_feed(struct qoi_decoder *dec, const uint8_t *data, size_t size);
+
+/* 编码，像素是未预乘的 0xAARRGGBB，channels 为 3 时忽略 alpha
+ * 图片按行分成 threads 个条带并行编码，每个条带开头不依赖前面的状态，
+ * 拼起来仍然是标准的 QOI 文件
+ * 返回 malloc 出来的数据，失败返回 NULL
+ * */
+uint8_t *qoi_encode(const uint32_t *pixels, uint32_t width, uint32_t height,
+		int stride, int channels, int threads, size_t *size);
+
+#endif
@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "resample.h"
+
+#define LANCZOS 3
+#define WEIGHT_BITS 14
+
+/* 一个方向上的滤波器：每个输出像素取 taps 个连续的输入像素 */
+struct filter {
+	int taps;
+	int *start;
+	int16_t *weights;
+};
+
+static double
+lanczos(double x)
+{
+	if (x < 0)
+		x = -x;
+	if (x < 1e-8)
+		return 1;
+	if (x >= LANCZOS)
+		return 0;
+	x *= M_PI;
+	return LANCZOS * sin(x) * sin(x / LANCZOS) / (x * x);
+}
+
+static int
+filter_init(struct filter *f, int src, int dst)
+{
+	double ratio = (double)src / dst;
+	double fscale = ratio > 1 ? ratio : 1;
+	double support = LANCZOS * fscale;
+
+	/* 窗口取偶数个像素，SIMD 每次处理两个 */
+	f->taps = ((int)ceil(support) * 2 + 2) & ~1;
+	if (f->taps > src)
+		f->taps = src;
+	f->start = malloc(dst * sizeof(*f->start));
+	f->weights = malloc((size_t)dst * f->taps * sizeof(*f->weights));
+	if (f->start == NULL || f->weights == NULL)
+		return -1;
+
+	for (int i = 0; i < dst; i++) {
+		double center = (i + 0.5) * ratio;
+		double w[f->taps], sum = 0;
+		int start = (int)floor(center - f->taps / 2.0 + 0.5);
+		int16_t *out = f->weights + (size_t)i * f->taps;
+		int total = 0, peak = 0;
+
+		/* 靠近边缘时窗口整体移进图里，图外的像素不参与，权重重新归一化 */
+		if (start > src - f->taps)
+			start = src - f->taps;
+		if (start < 0)
+			start = 0;
+		f->start[i] = start;
+
+		for (int k = 0; k < f->taps; k++) {
+			w[k] = lanczos((start + k + 0.5 - center) / fscale);
+			sum += w[k];
+		}
+		for (int k = 0; k < f->taps; k++) {
+			out[k] = (int16_t)lrint(w[k] / sum * (1 << WEIGHT_BITS));
+			total += out[k];
+			if (out[k] > out[peak])
+				peak = k;
+		}
+		/* 舍入误差补到最大的权重上，保证权重和正好是 1 */
+		out[peak] += (1 << WEIGHT_BITS) - total;
+	}
+	return 0;
+}
+
+static void
+filter_finish(struct filter *f)
+{
+	free(f->start);
+	free(f->weights);
+}
+
+static inline uint32_t
+clamp8(int32_t v)
+{
+	v = (v + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS;
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* 颜色通道不超过 alpha，Lanczos 的负瓣在边缘会冲过头 */
+static inline uint32_t
+clamp_premultiplied(uint32_t p)
+{
+	uint32_t a = p >> 24, out = p & 0xff000000;
+
+	for (int s = 0; s < 24; s += 8) {
+		uint32_t c = (p >> s) & 0xff;
+		out |= (c < a ? c : a) << s;
+	}
+	return out;
+}
+
+/* 横向：一行里每个输出像素是 taps 个相邻像素的加权和 */
+static void
+resample_row(const struct filter *f, const uint32_t *src, uint32_t *dst, int n)
+{
+	int taps = f->taps;
+
+	for (int x = 0; x < n; x++) {
+		const uint32_t *p = src + f->start[x];
+		const int16_t *w = f->weights + (size_t)x * taps;
+		int k = 0;
+#if defined(__SSE2__)
+		const __m128i zero = _mm_setzero_si128();
+		__m128i sum = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+
+		/* 两个像素的同一通道排成一对，madd 一次乘加两个抽头 */
+		for (; k + 2 <= taps; k += 2) {
+			__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + k)), zero);
+			px = _mm_unpacklo_epi16(px, _mm_srli_si128(px, 8));
+			__m128i wk = _mm_set1_epi32((uint16_t)w[k] | (uint32_t)(uint16_t)w[k + 1] << 16);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(px, wk));
+		}
+		for (; k < taps; k++) {
+			__m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128(p[k]), zero);
+			px = _mm_unpacklo_epi16(px, zero);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(px, _mm_set1_epi32((uint16_t)w[k])));
+		}
+		sum = _mm_srai_epi32(sum, WEIGHT_BITS);
+		sum = _mm_packs_epi32(sum, sum);
+		dst[x] = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#else
+		int32_t sum[4] = { 0, 0, 0, 0 };
+
+		for (; k < taps; k++)
+			for (int c = 0; c < 4; c++)
+				sum[c] += (int32_t)((p[k] >> (c * 8)) & 0xff) * w[k];
+		dst[x] = clamp8(sum[0]) | clamp8(sum[1]) << 8 |
+			clamp8(sum[2]) << 16 | clamp8(sum[3]) << 24;
+#endif
+	}
+}
+
+/* 纵向：输出的一行是 taps 行的加权和，整行一起算 */
+static void
+resample_column(const uint32_t *const *rows, const int16_t *w, int taps,
+		uint32_t *dst, int n, int premultiplied)
+{
+	int x = 0;
+
+#if defined(__AVX2__)
+	/* unpack / pack 都是按 128 位分别进行的，拆开和拼回去的顺序一致 */
+	const __m256i zero8 = _mm256_setzero_si256();
+	const __m256i round8 = _mm256_set1_epi32(1 << (WEIGHT_BITS - 1));
+	for (; x + 8 <= n; x += 8) {
+		__m256i s0 = round8, s1 = round8, s2 = round8, s3 = round8;
+		for (int k = 0; k < taps; k += 2) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)(rows[k] + x));
+			__m256i b = k + 1 < taps ?
+				_mm256_loadu_si256((const __m256i *)(rows[k + 1] + x)) : zero8;
+			__m256i wk = _mm256_set1_epi32((uint16_t)w[k] |
+					(uint32_t)(uint16_t)(k + 1 < taps ? w[k + 1] : 0) << 16);
+			__m256i al = _mm256_unpacklo_epi8(a, zero8), ah = _mm256_unpackhi_epi8(a, zero8);
+			__m256i bl = _mm256_unpacklo_epi8(b, zero8), bh = _mm256_unpackhi_epi8(b, zero8);
+			s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi16(al, bl), wk));
+			s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi16(al, bl), wk));
+			s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi16(ah, bh), wk));
+			s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi16(ah, bh), wk));
+		}
+		__m256i lo = _mm256_packs_epi32(_mm256_srai_epi32(s0, WEIGHT_BITS),
+				_mm256_srai_epi32(s1, WEIGHT_BITS));
+		__m256i hi = _mm256_packs_epi32(_mm256_srai_epi32(s2, WEIGHT_BITS),
+				_mm256_srai_epi32(s3, WEIGHT_BITS));
+		__m256i v = _mm256_packus_epi16(lo, hi);
+		if (premultiplied) {
+			__m256i a = _mm256_srli_epi32(v, 24);
+			a = _mm256_or_si256(a, _mm256_slli_epi32(a, 8));
+			a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+			v = _mm256_min_epu8(v, a);
+		}
+		_mm256_storeu_si256((__m256i *)(dst + x), v);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+	for (; x + 4 <= n; x += 4) {
+		__m128i s0 = round, s1 = round, s2 = round, s3 = round;
+		for (int k = 0; k < taps; k += 2) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+			__m128i b = k + 1 < taps ?
+				_mm_loadu_si128((const __m128i *)(rows[k + 1] + x)) : zero;
+			__m128i wk = _mm_set1_epi32((uint16_t)w[k] |
+					(uint32_t)(uint16_t)(k + 1 < taps ? w[k + 1] : 0) << 16);
+			__m128i al = _mm_unpacklo_epi8(a, zero), ah = _mm_unpackhi_epi8(a, zero);
+			__m128i bl = _mm_unpacklo_epi8(b, zero), bh = _mm_unpackhi_epi8(b, zero);
+			s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(al, bl), wk));
+			s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(al, bl), wk));
+			s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(ah, bh), wk));
+			s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(ah, bh), wk));
+		}
+		__m128i lo = _mm_packs_epi32(_mm_srai_epi32(s0, WEIGHT_BITS),
+				_mm_srai_epi32(s1, WEIGHT_BITS));
+		__m128i hi = _mm_packs_epi32(_mm_srai_epi32(s2, WEIGHT_BITS),
+				_mm_srai_epi32(s3, WEIGHT_BITS));
+		__m128i v = _mm_packus_epi16(lo, hi);
+		if (premultiplied) {
+			__m128i a = _mm_srli_epi32(v, 24);
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+			v = _mm_min_epu8(v, a);
+		}
+		_mm_storeu_si128((__m128i *)(dst + x), v);
+	}
+#endif
+	for (; x < n; x++) {
+		int32_t sum[4] = { 0, 0, 0, 0 };
+		for (int k = 0; k < taps; k++)
+			for (int c = 0; c < 4; c++)
+				sum[c] += (int32_t)((rows[k][x] >> (c * 8)) & 0xff) * w[k];
+		uint32_t p = clamp8(sum[0]) | clamp8(sum[1]) << 8 |
+			clamp8(sum[2]) << 16 | clamp8(sum[3]) << 24;
+		dst[x] = premultiplied ? clamp_premultiplied(p) : p;
+	}
+}
+
+int
+resample(const uint32_t *src, int src_width, int src_height, int src_stride,
+		uint32_t *dst, int dst_width, int dst_height, int dst_stride,
+		int premultiplied)
+{
+	struct filter fx, fy;
+	uint32_t *tmp = NULL;
+	const uint32_t **rows = NULL;
+	int ret = -1;
+
+	memset(&fx, 0, sizeof(fx));
+	memset(&fy, 0, sizeof(fy));
+	if (filter_init(&fx, src_width, dst_width) < 0 ||
+		filter_init(&fy, src_height, dst_height) < 0)
+		goto out;
+
+	/* 先横向缩放每一行到中间图(dst_width x src_height)，再纵向 */
+	tmp = malloc((size_t)dst_width * src_height * sizeof(*tmp));
+	rows = malloc(fy.taps * sizeof(*rows));
+	if (tmp == NULL || rows == NULL)
+		goto out;
+
+	for (int y = 0; y < src_height; y++)
+		resample_row(&fx, src + (size_t)y * src_stride,
+				tmp + (size_t)y * dst_width, dst_width);
+
+	for (int y = 0; y < dst_height; y++) {
+		for (int k = 0; k < fy.taps; k++)
+			rows[k] = tmp + (size_t)(fy.start[y] + k) * dst_width;
+		resample_column(rows, fy.weights + (size_t)y * fy.taps, fy.taps,
+				dst + (size_t)y * dst_stride, dst_width, premultiplied);
+	}
+	ret = 0;
+
+out:
+	free(rows);
+	free(tmp);
+	filter_finish(&fx);
+	filter_finish(&fy);
+	return ret;
+}
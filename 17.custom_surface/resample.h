@@ -0,0 +1,21 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+/* 高质量缩放(Lanczos-3，可分离的两遍卷积)
+ *
+ * 像素是 wl_shm 的 ARGB8888 / XRGB8888，四个通道同样处理。
+ * 缩小时滤波器按比例放宽，相当于先低通再采样，不会有摩尔纹。
+ * 权重是 14 位定点数，SIMD 和标量版本的结果完全一样
+ * */
+
+/* stride 以像素为单位
+ * premultiplied 为真时像素是预乘的 ARGB，结果里颜色不会超过 alpha
+ * 返回 -1 表示内存不够
+ * */
+int resample(const uint32_t *src, int src_width, int src_height, int src_stride,
+		uint32_t *dst, int dst_width, int dst_height, int dst_stride,
+		int premultiplied);
+
+#endif
@@ -12,6 +12,13 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <unistd.h>
+#include <linux/input.h>
+
+#include "viewporter-client-protocol.h"
+#include "image.h"
+#include "layer.h"
+#include "preload.h"
+#include "asset_cache.h"
 
 static struct wl_display *display = NULL;
 static struct wl_compositor *compositor = NULL;
@@ -20,11 +27,54 @@ struct wl_shell *shell;
 struct wl_shell_surface *shell_surface;
 struct wl_shm *shm;
 struct wl_buffer *buffer;
-
-void *shm_data;
-
-int WIDTH = 825;
-int HEIGHT = 645;
+// 可选的 wp_viewporter，由合成器完成缩放
+struct wp_viewporter *viewporter;
+struct wp_viewport *viewport;
+// 按住左键在图上画，画的内容在私有图层里，不会改到底图
+struct wl_subcompositor *subcompositor;
+struct wl_seat *seat;
+struct wl_pointer *pointer;
+struct image_layer layer;
+int layer_ready = 0;
+int drawing = 0;
+int last_x, last_y;
+
+// 源图，文件本身作为底图的 shm pool，多个窗口、多个进程共用 page cache 里的一份
+// 只以只读方式映射，画的东西都在 layer 里，不会改到磁盘上的文件
+struct image image;
+const char *IMAGE_PATH = "./3.img";
+
+// 默认在后台线程里加载图片，和连接合成器同时进行，--no-preload 时按顺序加载
+int PRELOAD = 1;
+struct preload preload;
+// 启动耗时统计(毫秒，从进程开始算)
+double start_ms, connected_ms, image_ms, image_wait_ms;
+
+// 源图大小，从 .img 文件头读取
+int WIDTH = 0;
+int HEIGHT = 0;
+
+// 源图是按几倍屏画的(--asset-scale)，窗口的逻辑大小是源图大小除以它
+int ASSET_SCALE = 1;
+// 按输出的缩放倍数准备好的图，每个倍数只生成一次
+struct asset_cache cache;
+struct asset_variant *variant;
+int DISK_CACHE = 1;
+int buffer_scale = 0;
+
+// 所有 wl_output 和它们的缩放倍数，surface 在哪些输出上由 enter / leave 告诉我们
+#define MAX_OUTPUTS 8
+struct output {
+	struct wl_output *output;
+	uint32_t id;
+	int scale;
+	int entered;
+} outputs[MAX_OUTPUTS];
+int output_count = 0;
+
+// 窗口在屏幕上的目标大小，0 表示按原始大小显示
+int DST_WIDTH = 0;
+int DST_HEIGHT = 0;
 
 #define BIND_WL_REG(registry, ptr, id, intf, n) \
 	do                                          \
@@ -44,51 +94,379 @@ int HEIGHT = 645;
 // 	.release = buffer_release
 // };
 
-static struct wl_buffer *
-create_buffer()
+/* 窗口的逻辑大小，和输出的缩放倍数无关 */
+static int
+logical_width()
+{
+	return (WIDTH + ASSET_SCALE - 1) / ASSET_SCALE;
+}
+
+static int
+logical_height()
+{
+	return (HEIGHT + ASSET_SCALE - 1) / ASSET_SCALE;
+}
+
+/* surface 所在输出里最大的缩放倍数，还没进入任何输出时取所有输出里最大的，
+ * 单屏时第一帧就是对的
+ * */
+static int
+wanted_scale()
+{
+	int scale = 1, any = 0;
+
+	for (int i = 0; i < output_count; i++)
+		any |= outputs[i].entered;
+	for (int i = 0; i < output_count; i++)
+		if ((outputs[i].entered || !any) && outputs[i].scale > scale)
+			scale = outputs[i].scale;
+	/* set_buffer_scale 需要 wl_surface 3 */
+	if (wl_proxy_get_version((struct wl_proxy *)surface) < 3)
+		scale = 1;
+	return scale;
+}
+
+/* 换成当前缩放倍数对应的 buffer
+ * 文件本身就是 pool，不复制也不解码；缩放过的版本只在第一次用到时生成，
+ * 之后切换倍数只是换一个已有的 buffer
+ * */
+static int
+update_buffer()
 {
-	struct wl_shm_pool *pool;
-	int stride = WIDTH * 4; // 4 bytes per pixel
-	int size = stride * HEIGHT;
-	int fd;
-	struct wl_buffer *buff;
+	int scale = wanted_scale();
+	struct asset_variant *v;
 
-	fd = open("./3.rgb",O_RDWR);
-	if (fd < 0)
+	if (scale == buffer_scale)
+		return 0;
+
+	v = asset_cache_get(&cache, IMAGE_PATH, &image, ASSET_SCALE, scale,
+			image.header.format);
+	if (v == NULL)
 	{
-		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
-				size);
+		if (buffer != NULL)
+			return 0;
 		exit(1);
 	}
 
-	shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (shm_data == MAP_FAILED)
+	variant = v;
+	buffer = v->buffer;
+	buffer_scale = scale;
+	if (wl_proxy_get_version((struct wl_proxy *)surface) >= 3)
+		wl_surface_set_buffer_scale(surface, scale);
+	fprintf(stderr, "buffer scale %d: %ux%u (cache: %u hits, %u loaded, %u built)\n",
+			scale, v->image.header.width, v->image.header.height,
+			cache.hits, cache.loads, cache.builds);
+	return 1;
+}
+
+/* 设置 surface 的目标大小
+ * buffer 保持源图分辨率，缩放交给合成器完成，
+ * 客户端的 CPU 开销只和源图大小有关，和窗口大小无关。
+ * 负载高时也可以用更小的 buffer 渲染，再由这里放大到窗口大小。
+ * 宽高 <= 0 时取消缩放，按 buffer 原始大小显示
+ * */
+static void
+set_destination_size(int32_t dst_width, int32_t dst_height)
+{
+	if (viewport == NULL)
+		return;
+
+	if (dst_width <= 0 || dst_height <= 0)
+		wp_viewport_set_destination(viewport, -1, -1);
+	else
+		wp_viewport_set_destination(viewport, dst_width, dst_height);
+}
+
+/* 第一帧真正显示出来的时间 */
+static void
+first_frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	double now = preload_now_ms();
+
+	wl_callback_destroy(callback);
+	fprintf(stderr, "time to first frame: %.1f ms (%s; connect + registry %.1f ms, "
+			"image ready at %.1f ms, waited %.1f ms for it)\n",
+			now - start_ms, PRELOAD ? "preloaded" : "serial",
+			connected_ms - start_ms, image_ms - start_ms, image_wait_ms);
+}
+
+static const struct wl_callback_listener first_frame_listener = {
+	first_frame_done
+};
+
+/* 取图片：预加载时等后台线程，否则现在才打开 */
+static void
+load_image()
+{
+	double t = preload_now_ms();
+
+	if (PRELOAD)
 	{
-		fprintf(stderr, "mmap failed: %m\n");
-		close(fd);
-		exit(1);
+		struct image *loaded = preload_wait(&preload);
+		if (loaded == NULL)
+			exit(1);
+		image = *loaded;
+		image_ms = preload.done_ms;
+	}
+	else
+	{
+		if (image_open(&image, IMAGE_PATH, 0) < 0)
+			exit(1);
+		image_ms = preload_now_ms();
 	}
+	image_wait_ms = preload_now_ms() - t;
 
-	pool = wl_shm_create_pool(shm, fd, size);
-	buff = wl_shm_pool_create_buffer(pool, 0,
-									 WIDTH, HEIGHT,
-									 stride,
-									 WL_SHM_FORMAT_XRGB8888);
-	//wl_buffer_add_listener(buffer, &buffer_listener, buffer);
-	wl_shm_pool_destroy(pool);
-	return buff;
+	WIDTH = image.header.width;
+	HEIGHT = image.header.height;
+	fprintf(stderr, "%s: %dx%d\n", IMAGE_PATH, WIDTH, HEIGHT);
 }
 
 static void
 create_window()
 {
-	buffer = create_buffer();
+	update_buffer();
+
+	set_destination_size(DST_WIDTH, DST_HEIGHT);
 
 	wl_surface_attach(surface, buffer, 0, 0);
 	//wl_surface_damage(surface, 0, 0, WIDTH, HEIGHT);
+	wl_callback_add_listener(wl_surface_frame(surface), &first_frame_listener, NULL);
+	wl_surface_commit(surface);
+}
+
+/* 把画过的条带提交到子 surface 上，跟着父 surface 的缩放 */
+static void
+commit_layer()
+{
+	if (!layer_ready)
+		return;
+	if (viewport && DST_WIDTH > 0 && DST_HEIGHT > 0)
+		image_layer_commit(&layer, DST_WIDTH, DST_HEIGHT);
+	else if (viewport && ASSET_SCALE > 1)
+		image_layer_commit(&layer, logical_width(), logical_height());
+	else
+		image_layer_commit(&layer, 0, 0);
+}
+
+/* surface 坐标换算成图片坐标 */
+static void
+to_image(wl_fixed_t sx, wl_fixed_t sy, int *x, int *y)
+{
+	double fx = wl_fixed_to_double(sx), fy = wl_fixed_to_double(sy);
+
+	if (viewport && DST_WIDTH > 0 && DST_HEIGHT > 0)
+	{
+		fx = fx * WIDTH / DST_WIDTH;
+		fy = fy * HEIGHT / DST_HEIGHT;
+	}
+	else
+	{
+		fx = fx * WIDTH / logical_width();
+		fy = fy * HEIGHT / logical_height();
+	}
+	*x = (int)fx;
+	*y = (int)fy;
+}
+
+#define BRUSH 3
+
+/* 从上一个点到 (x, y) 画一条线 */
+static void
+draw_stroke(int x, int y)
+{
+	int x0 = last_x, y0 = last_y;
+	int steps = abs(x - x0) > abs(y - y0) ? abs(x - x0) : abs(y - y0);
+	int top = (y0 < y ? y0 : y) - BRUSH;
+	int bottom = (y0 > y ? y0 : y) + BRUSH + 1;
+	uint32_t *pixels = image_layer_begin(&layer, top, bottom);
+
+	for (int i = 0; i <= steps; i++)
+	{
+		int cx = steps ? x0 + (x - x0) * i / steps : x;
+		int cy = steps ? y0 + (y - y0) * i / steps : y;
+		for (int py = cy - BRUSH; py <= cy + BRUSH; py++)
+			for (int px = cx - BRUSH; px <= cx + BRUSH; px++)
+				if (px >= 0 && px < WIDTH && py >= 0 && py < HEIGHT)
+					pixels[py * layer.stride + px] = 0xffe04040;
+	}
+
+	last_x = x;
+	last_y = y;
+	commit_layer();
+	wl_surface_commit(surface);
+}
+
+static void
+pointer_handle_enter(void *data, struct wl_pointer *pointer,
+                     uint32_t serial, struct wl_surface *surface,
+                     wl_fixed_t sx, wl_fixed_t sy)
+{
+	to_image(sx, sy, &last_x, &last_y);
+}
+
+static void
+pointer_handle_leave(void *data, struct wl_pointer *pointer,
+                     uint32_t serial, struct wl_surface *surface)
+{
+	drawing = 0;
+}
+
+static void
+pointer_handle_motion(void *data, struct wl_pointer *pointer,
+                      uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
+{
+	int x, y;
+
+	to_image(sx, sy, &x, &y);
+	if (drawing)
+		draw_stroke(x, y);
+	last_x = x;
+	last_y = y;
+}
+
+static void
+pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
+                      uint32_t serial, uint32_t time, uint32_t button,
+                      uint32_t state)
+{
+	if (button != BTN_LEFT || !layer_ready)
+		return;
+
+	drawing = state == WL_POINTER_BUTTON_STATE_PRESSED;
+	if (drawing)
+	{
+		draw_stroke(last_x, last_y);
+	}
+	else
+	{
+		fprintf(stderr, "layer: %d/%d tiles copied from the base image\n",
+				layer.copied_tiles, layer.tile_count);
+	}
+}
+
+static void
+pointer_handle_axis(void *data, struct wl_pointer *wl_pointer,
+                    uint32_t time, uint32_t axis, wl_fixed_t value)
+{
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+	pointer_handle_enter,
+	pointer_handle_leave,
+	pointer_handle_motion,
+	pointer_handle_button,
+	pointer_handle_axis,
+};
+
+static void
+seat_handle_capabilities(void *data, struct wl_seat *seat,
+                         enum wl_seat_capability caps)
+{
+	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !pointer)
+	{
+		pointer = wl_seat_get_pointer(seat);
+		wl_pointer_add_listener(pointer, &pointer_listener, NULL);
+	}
+	else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && pointer)
+	{
+		wl_pointer_destroy(pointer);
+		pointer = NULL;
+	}
+}
+
+static const struct wl_seat_listener seat_listener = {
+	seat_handle_capabilities,
+};
+
+/* 输出的缩放倍数变了或者 surface 移到了别的输出上 */
+static void
+scale_changed()
+{
+	if (surface == NULL || buffer == NULL || !update_buffer())
+		return;
+
+	wl_surface_attach(surface, buffer, 0, 0);
+	wl_surface_damage(surface, 0, 0, logical_width(), logical_height());
 	wl_surface_commit(surface);
 }
 
+static struct output *
+find_output(struct wl_output *wl_output)
+{
+	for (int i = 0; i < output_count; i++)
+		if (outputs[i].output == wl_output)
+			return &outputs[i];
+	return NULL;
+}
+
+static void
+surface_handle_enter(void *data, struct wl_surface *wl_surface,
+                     struct wl_output *wl_output)
+{
+	struct output *output = find_output(wl_output);
+
+	if (output)
+	{
+		output->entered = 1;
+		scale_changed();
+	}
+}
+
+static void
+surface_handle_leave(void *data, struct wl_surface *wl_surface,
+                     struct wl_output *wl_output)
+{
+	struct output *output = find_output(wl_output);
+
+	if (output)
+	{
+		output->entered = 0;
+		scale_changed();
+	}
+}
+
+static const struct wl_surface_listener surface_listener = {
+	surface_handle_enter,
+	surface_handle_leave,
+};
+
+static void
+output_handle_geometry(void *data, struct wl_output *wl_output,
+                       int32_t x, int32_t y, int32_t physical_width,
+                       int32_t physical_height, int32_t subpixel,
+                       const char *make, const char *model, int32_t transform)
+{
+}
+
+static void
+output_handle_mode(void *data, struct wl_output *wl_output, uint32_t flags,
+                   int32_t width, int32_t height, int32_t refresh)
+{
+}
+
+/* 一组属性发完了，这时候 scale 才是最终的值 */
+static void
+output_handle_done(void *data, struct wl_output *wl_output)
+{
+	scale_changed();
+}
+
+static void
+output_handle_scale(void *data, struct wl_output *wl_output, int32_t factor)
+{
+	struct output *output = data;
+
+	output->scale = factor > 0 ? factor : 1;
+	fprintf(stderr, "output %u: scale %d\n", output->id, output->scale);
+}
+
+static const struct wl_output_listener output_listener = {
+	output_handle_geometry,
+	output_handle_mode,
+	output_handle_done,
+	output_handle_scale,
+};
+
 static void
 handle_ping(void *data, struct wl_shell_surface *shell_surface,
 							uint32_t serial)
@@ -101,6 +479,15 @@ static void
 handle_configure(void *data, struct wl_shell_surface *shell_surface,
 		 uint32_t edges, int32_t width, int32_t height)
 {
+	if (viewport == NULL || width <= 0 || height <= 0)
+		return;
+
+	/* 改变窗口大小时不重新生成 buffer，只修改目标大小 */
+	DST_WIDTH = width;
+	DST_HEIGHT = height;
+	set_destination_size(DST_WIDTH, DST_HEIGHT);
+	commit_layer();
+	wl_surface_commit(surface);
 }
 
 static void
@@ -131,7 +518,9 @@ global_registry_handler(void *data, struct wl_registry *registry,
 {
 	if (strcmp(interface, "wl_compositor") == 0)
 	{
-		BIND_WL_REG(registry, compositor, id, &wl_compositor_interface, 1);
+		// 版本 3 才有 wl_surface_set_buffer_scale，版本 4 才有 wl_surface_damage_buffer
+		BIND_WL_REG(registry, compositor, id, &wl_compositor_interface,
+				version < 4 ? version : 4);
 	}
 	else if (strcmp(interface, "wl_shell") == 0)
 	{
@@ -142,6 +531,29 @@ global_registry_handler(void *data, struct wl_registry *registry,
 		BIND_WL_REG(registry, shm, id, &wl_shm_interface, 1);
 		wl_shm_add_listener(shm, &shm_listener, NULL);
 	}
+	else if (strcmp(interface, wp_viewporter_interface.name) == 0)
+	{
+		BIND_WL_REG(registry, viewporter, id, &wp_viewporter_interface, 1);
+	}
+	else if (strcmp(interface, "wl_subcompositor") == 0)
+	{
+		BIND_WL_REG(registry, subcompositor, id, &wl_subcompositor_interface, 1);
+	}
+	else if (strcmp(interface, "wl_output") == 0 && output_count < MAX_OUTPUTS)
+	{
+		struct output *output = &outputs[output_count++];
+		output->id = id;
+		output->scale = 1;
+		// 版本 2 才有 scale 和 done 事件
+		BIND_WL_REG(registry, output->output, id, &wl_output_interface,
+				version < 2 ? version : 2);
+		wl_output_add_listener(output->output, &output_listener, output);
+	}
+	else if (strcmp(interface, "wl_seat") == 0)
+	{
+		BIND_WL_REG(registry, seat, id, &wl_seat_interface, 1);
+		wl_seat_add_listener(seat, &seat_listener, NULL);
+	}
 }
 
 static void
@@ -158,6 +570,50 @@ static const struct wl_registry_listener registry_listener = {
 
 int main(int argc, char **argv)
 {
+	start_ms = preload_now_ms();
+
+	// ./surface [--no-preload] [--no-disk-cache] [--asset-scale N]
+	//           [图片.img/.qoi] [目标宽度 目标高度]
+	while (argc > 1 && strncmp(argv[1], "--", 2) == 0)
+	{
+		if (strcmp(argv[1], "--no-preload") == 0)
+		{
+			PRELOAD = 0;
+		}
+		else if (strcmp(argv[1], "--no-disk-cache") == 0)
+		{
+			DISK_CACHE = 0;
+		}
+		else if (strcmp(argv[1], "--asset-scale") == 0 && argc > 2)
+		{
+			ASSET_SCALE = atoi(argv[2]) > 0 ? atoi(argv[2]) : 1;
+			argc--;
+			argv++;
+		}
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", argv[1]);
+			exit(1);
+		}
+		argc--;
+		argv++;
+	}
+	if (argc == 2 || argc == 4)
+	{
+		IMAGE_PATH = argv[1];
+		argc--;
+		argv++;
+	}
+	if (argc == 3)
+	{
+		DST_WIDTH = atoi(argv[1]);
+		DST_HEIGHT = atoi(argv[2]);
+	}
+
+	// 先让后台线程开始读图，再去连接合成器
+	if (PRELOAD)
+		preload_start(&preload, IMAGE_PATH, 0);
+
 	display = wl_display_connect(NULL);
 	if (display == NULL)
 	{
@@ -173,6 +629,8 @@ int main(int argc, char **argv)
 	wl_display_dispatch(display);
 	wl_display_roundtrip(display);
 
+	connected_ms = preload_now_ms();
+
 	if (compositor == NULL)
 	{
 		fprintf(stderr, "Can't find compositor\n");
@@ -193,6 +651,14 @@ int main(int argc, char **argv)
 	{
 		fprintf(stderr, "Created surface\n");
 	}
+	wl_surface_add_listener(surface, &surface_listener, NULL);
+	asset_cache_init(&cache, shm, DISK_CACHE ? NULL : "");
+
+	if (viewporter)
+	{
+		viewport = wp_viewporter_get_viewport(viewporter, surface);
+		fprintf(stderr, "Found viewporter\n");
+	}
 
 	/* 从 surface 创建一个 shell surface
 	 * 给已经存在的 wl_surface 创建一个 role (shell surface)
@@ -216,14 +682,41 @@ int main(int argc, char **argv)
 
 	wl_shell_surface_add_listener(shell_surface, &shell_surface_listener,NULL);
 
+	load_image();
+	if (viewport == NULL && DST_WIDTH > 0 && DST_HEIGHT > 0)
+	{
+		fprintf(stderr, "No wp_viewporter, showing %dx%d unscaled\n",
+				WIDTH, HEIGHT);
+	}
+
 	create_window();
 
+	if (subcompositor == NULL)
+	{
+		fprintf(stderr, "No wl_subcompositor, drawing disabled\n");
+	}
+	else if (ASSET_SCALE > 1 && viewporter == NULL)
+	{
+		// 图层的条带是源图分辨率，需要 viewporter 才能缩到窗口的逻辑大小
+		fprintf(stderr, "No wp_viewporter, drawing disabled\n");
+	}
+	else if (image_layer_init(&layer, &image, shm, compositor, subcompositor,
+				viewporter, surface) == 0)
+	{
+		layer_ready = 1;
+	}
+
 	while(wl_display_dispatch(display)!=-1){
 		;
 	}
 
+	if (layer_ready)
+		image_layer_finish(&layer);
+	asset_cache_finish(&cache);
 	wl_display_disconnect(display);
 	printf("disconnected from display\n");
 
+	image_close(&image);
+
 	exit(0);
 }
@@ -0,0 +1,431 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+#include "damage_diff.h"
+#include "tile_hash.h"
+#include "write_track.h"
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+fill(uint32_t *data, size_t count, uint32_t color)
+{
+	for (size_t i = 0; i < count; i++)
+		data[i] = color;
+}
+
+/* 模拟合成器把 damage 区域拷贝到纹理 */
+static void
+upload(uint32_t *dst, const uint32_t *src, int stride, const struct damage *damage)
+{
+	for (int i = 0; i < damage->count; i++) {
+		const struct damage_rect *r = &damage->rects[i];
+		for (int y = r->y; y < r->y + r->height; y++)
+			memcpy(dst + (long)y * stride + r->x, src + (long)y * stride + r->x,
+			       r->width * 4);
+	}
+}
+
+/* 变化的区域怎么分布 */
+enum change_pattern {
+	/* 画面中间的一个矩形，比如一个对话框 */
+	CHANGE_RECT,
+	/* 随机分布的 64x64 小块，比如光标、图标、文字 */
+	CHANGE_SCATTERED,
+};
+
+static const char *const pattern_names[] = { "one rect", "scattered 64x64 tiles" };
+
+static uint32_t
+xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* 从 prev 复制出 cur，再按 pattern 改掉大约 fraction 的像素，返回实际改了的比例 */
+static double
+make_change(uint32_t *cur, const uint32_t *prev, int width, int height,
+	    enum change_pattern pattern, double fraction)
+{
+	const size_t count = (size_t)width * height;
+	size_t changed = 0;
+
+	memcpy(cur, prev, count * 4);
+	if (fraction <= 0)
+		return 0;
+
+	if (pattern == CHANGE_RECT) {
+		/* 和画面同样宽高比的矩形 */
+		int w = (int)(width * sqrt(fraction) + 0.5);
+		int h = (int)(height * sqrt(fraction) + 0.5);
+		for (int y = (height - h) / 2; y < (height - h) / 2 + h; y++)
+			fill(cur + (long)y * width + (width - w) / 2, w, 0xffeeeeee);
+		changed = (size_t)w * h;
+	} else {
+		const int tiles_x = width / 64, tiles_y = height / 64;
+		const int tiles = tiles_x * tiles_y;
+		int want = (int)(tiles * fraction + 0.5);
+		uint32_t seed = 0x12345678;
+		char *used = calloc(tiles, 1);
+
+		for (int n = 0; n < want; ) {
+			int t = xorshift32(&seed) % tiles;
+			if (used[t])
+				continue;
+			used[t] = 1;
+			n++;
+			for (int y = 0; y < 64; y++)
+				fill(cur + (long)(t / tiles_x * 64 + y) * width + t % tiles_x * 64,
+				     64, 0xffeeeeee);
+		}
+		free(used);
+		changed = (size_t)want * 64 * 64;
+	}
+	return (double)changed / count;
+}
+
+/* 对比三种开销：
+ * - fill: 画满一整帧，作为参照
+ * - diff: 和上一帧比较得到 damage
+ * - upload: 按 damage 拷贝像素，代表合成器那边的开销
+ * 变化的区域分别是一个矩形和随机的小块，比例从小到大，
+ * 找出 diff + upload(damage) 不再比 upload(整帧) 便宜的位置，在相邻两个测量点之间插值。
+ * 另外测一次边画边比较(draw_frame_diff 的做法)比只画多花的时间。
+ * 每项取多次运行里最快的一次，减少其他进程的干扰
+ * */
+int
+bench_damage_diff(void)
+{
+	static const int sizes[][2] = { { 640, 480 }, { 1920, 1080 }, { 3840, 2160 } };
+	static const double fractions[] = {
+		0, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.35, 0.5, 0.75, 1.0,
+	};
+	const int runs = 20;
+
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		const int width = sizes[s][0], height = sizes[s][1];
+		const size_t count = (size_t)width * height;
+		uint32_t *prev = malloc(count * 4);
+		uint32_t *cur = malloc(count * 4);
+		uint32_t *texture = malloc(count * 4);
+		struct damage full = { 1, { { 0, 0, width, height } } };
+		struct damage damage;
+		double t, fill_us, full_upload_us, banded_us;
+
+		/* 先把所有页面都碰一遍，计时里不包含缺页 */
+		fill(prev, count, 0xff666666);
+		fill(cur, count, 0xff666666);
+		fill(texture, count, 0);
+
+		fill_us = full_upload_us = 1e30;
+		for (int r = 0; r < runs; r++) {
+			t = now_us();
+			fill(cur, count, 0xff666666 + r);
+			fill_us = fmin(fill_us, now_us() - t);
+
+			t = now_us();
+			upload(texture, cur, width, &full);
+			full_upload_us = fmin(full_upload_us, now_us() - t);
+		}
+
+		printf("%dx%d: fill %.1f us, full upload %.1f us\n",
+		       width, height, fill_us, full_upload_us);
+
+		/* 和 draw_frame_diff 一样画一条比较一条，画面没有变化，
+		 * 新画的条带还在缓存里，多出来的只有读上一帧的开销
+		 * */
+		fill(prev, count, 0xff666666);
+		banded_us = 1e30;
+		for (int r = 0; r < runs; r++) {
+			struct damage_diff diff;
+
+			t = now_us();
+			damage_diff_begin(&diff, &damage, width, height, width);
+			for (int y = 0; y < height; y += TILE_SIZE) {
+				int h = height - y < TILE_SIZE ? height - y : TILE_SIZE;
+				fill(cur + (long)y * width, (size_t)h * width, 0xff666666);
+				damage_diff_band(&diff, cur, prev, y);
+			}
+			banded_us = fmin(banded_us, now_us() - t);
+		}
+		printf("  fill + diff band by band, unchanged: %.1f us, the diff adds %.0f%% of a fill\n",
+		       banded_us, (banded_us - fill_us) / fill_us * 100);
+
+		for (int p = CHANGE_RECT; p <= CHANGE_SCATTERED; p++) {
+			double break_even = -1, last_ratio = 0, last_cost = 0;
+			double idle_diff_us = 0;
+
+			printf("  %s\n", pattern_names[p]);
+			printf("  changed  damaged  diff(us)  upload(us)  diff+upload(us)  rects\n");
+
+			for (unsigned f = 0; f < sizeof(fractions) / sizeof(fractions[0]); f++) {
+				double ratio = make_change(cur, prev, width, height, p, fractions[f]);
+				double diff_us, upload_us, cost;
+
+				diff_us = upload_us = 1e30;
+				for (int r = 0; r < runs; r++) {
+					t = now_us();
+					damage_from_diff(&damage, cur, prev, width, height, width);
+					diff_us = fmin(diff_us, now_us() - t);
+
+					t = now_us();
+					upload(texture, cur, width, &damage);
+					upload_us = fmin(upload_us, now_us() - t);
+				}
+				if (f == 0)
+					idle_diff_us = diff_us;
+				cost = diff_us + upload_us;
+
+				printf("  %6.1f%%  %6.1f%%  %8.1f  %10.1f  %15.1f  %5d\n",
+				       ratio * 100, (double)damage_area(&damage) / count * 100,
+				       diff_us, upload_us, cost, damage.count);
+
+				if (break_even < 0 && cost >= full_upload_us) {
+					break_even = ratio;
+					if (f > 0 && cost > last_cost)
+						break_even = last_ratio + (ratio - last_ratio) *
+							(full_upload_us - last_cost) / (cost - last_cost);
+				}
+				last_ratio = ratio;
+				last_cost = cost;
+			}
+
+			if (break_even < 0)
+				printf("  diff + upload stays below a full upload up to 100%% changed\n");
+			else if (break_even == 0)
+				printf("  no break-even: diffing an unchanged frame already costs a full upload\n");
+			else
+				printf("  break-even at %.1f%% of the frame changed\n", break_even * 100);
+			printf("  diff of an unchanged frame costs %.0f%% of a fill, %.0f%% of a full upload\n",
+			       idle_diff_us / fill_us * 100, idle_diff_us / full_upload_us * 100);
+		}
+
+		free(prev);
+		free(cur);
+		free(texture);
+	}
+	return 0;
+}
+
+/* 和 main.c 的 draw_tile 一样的棋盘格 */
+static void
+checkerboard(uint32_t *data, int offset)
+{
+	for (int y = 0; y < TILE_SIZE; y++)
+		for (int x = 0; x < TILE_SIZE; x++)
+			data[y * TILE_SIZE + x] =
+				(x + offset + y + offset / 8 * 8) % 16 < 8 ? 0xFF666666 : 0xFFEEEEEE;
+}
+
+static int
+expect_different(const char *what, uint64_t a, uint64_t b)
+{
+	if (a != b)
+		return 0;
+	printf("  FAIL: %s gives the same hash %016llx\n", what, (unsigned long long)a);
+	return -1;
+}
+
+int
+bench_tile_hash(void)
+{
+	static uint32_t tile[TILE_SIZE * TILE_SIZE], other[TILE_SIZE * TILE_SIZE];
+	static uint32_t shifted[20][TILE_SIZE * TILE_SIZE];
+	uint64_t shifts[20], base;
+	const int runs = 100000;
+	int ret = 0;
+	double t;
+
+	/* 滚动的棋盘格：内容不同的偏移要得到不同的 hash
+	 * (这个图案每滚动 8 个像素会回到原样)
+	 * */
+	for (int i = 0; i < 20; i++) {
+		checkerboard(shifted[i], i);
+		shifts[i] = tile_hash(shifted[i], TILE_SIZE, TILE_SIZE, TILE_SIZE);
+		for (int j = 0; j < i; j++)
+			if (shifts[i] == shifts[j] &&
+			    memcmp(shifted[i], shifted[j], sizeof(tile)) != 0) {
+				printf("  FAIL: shift %d and %d give the same hash\n", j, i);
+				ret = -1;
+			}
+	}
+
+	for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++)
+		tile[i] = i * 2654435761u;
+	base = tile_hash(tile, TILE_SIZE, TILE_SIZE, TILE_SIZE);
+
+	/* 交换两行 */
+	memcpy(other, tile, sizeof(tile));
+	memcpy(other + 3 * TILE_SIZE, tile + 10 * TILE_SIZE, TILE_SIZE * 4);
+	memcpy(other + 10 * TILE_SIZE, tile + 3 * TILE_SIZE, TILE_SIZE * 4);
+	ret |= expect_different("swapping two rows", base,
+			tile_hash(other, TILE_SIZE, TILE_SIZE, TILE_SIZE));
+
+	/* 交换同一行里的两组 32 字节 */
+	memcpy(other, tile, sizeof(tile));
+	memcpy(other + 5 * TILE_SIZE, tile + 5 * TILE_SIZE + 8, 32);
+	memcpy(other + 5 * TILE_SIZE + 8, tile + 5 * TILE_SIZE, 32);
+	ret |= expect_different("swapping two stripes", base,
+			tile_hash(other, TILE_SIZE, TILE_SIZE, TILE_SIZE));
+
+	/* 整块向右平移一个像素 */
+	for (int y = 0; y < TILE_SIZE; y++)
+		for (int x = 0; x < TILE_SIZE; x++)
+			other[y * TILE_SIZE + x] = tile[y * TILE_SIZE + (x + TILE_SIZE - 1) % TILE_SIZE];
+	ret |= expect_different("shifting by one pixel", base,
+			tile_hash(other, TILE_SIZE, TILE_SIZE, TILE_SIZE));
+
+	/* 每行都是同一种颜色、两种颜色交替：向上平移一行 */
+	for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++)
+		tile[i] = i / TILE_SIZE % 2 ? 0xFF666666 : 0xFFEEEEEE;
+	memcpy(other, tile + TILE_SIZE, sizeof(tile) - TILE_SIZE * 4);
+	memcpy(other + (TILE_SIZE - 1) * TILE_SIZE, tile, TILE_SIZE * 4);
+	ret |= expect_different("shifting stripes up one row",
+			tile_hash(tile, TILE_SIZE, TILE_SIZE, TILE_SIZE),
+			tile_hash(other, TILE_SIZE, TILE_SIZE, TILE_SIZE));
+
+	t = now_us();
+	for (int r = 0; r < runs; r++)
+		base += tile_hash(tile, TILE_SIZE, TILE_SIZE, TILE_SIZE);
+	t = now_us() - t;
+	printf("tile hash: %s, %.2f us per %dx%d tile, %.1f GB/s (%llx)\n",
+	       ret ? "FAILED" : "shift/permutation checks passed",
+	       t / runs, TILE_SIZE, TILE_SIZE,
+	       (double)runs * sizeof(tile) / t / 1e3, (unsigned long long)(base & 0xf));
+	return ret;
+}
+
+/* 写保护的代价和扫描的代价：
+ * - 跟踪中的 buffer 每一页每帧第一次被写时多一次缺页，和不跟踪时画满一帧比较
+ * - 扫描(取出写过的页并重新保护)在没写过、写了分散的小块、写满时各要多久
+ * 同时检查写过的 tile 所在的行都在 damage 里，有遗漏时返回 -1
+ * */
+int
+bench_write_track(void)
+{
+	static const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+	const int runs = 20;
+	int ret = 0;
+
+	if (write_track_init() < 0) {
+		printf("userfaultfd write tracking unavailable (needs Linux 6.7)\n");
+		return -1;
+	}
+
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		const int width = sizes[s][0], height = sizes[s][1];
+		const size_t count = (size_t)width * height;
+		const size_t pages = (count * 4 + 4095) / 4096;
+		const int tiles_x = width / TILE_SIZE, tiles_y = height / TILE_SIZE;
+		struct damage damage;
+		double t, fill_us = 1e30, tracked_us = 1e30, idle_us = 1e30;
+		double scattered_us = 1e30, full_us = 1e30;
+		int fd = memfd_create("bench-pages", MFD_CLOEXEC);
+		uint32_t *data;
+
+		if (fd < 0 || ftruncate(fd, count * 4) < 0) {
+			ret = -1;
+			break;
+		}
+		data = mmap(NULL, count * 4, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			ret = -1;
+			break;
+		}
+
+		/* 不跟踪时画满一帧 */
+		fill(data, count, 0xff666666);
+		for (int r = 0; r < runs; r++) {
+			t = now_us();
+			fill(data, count, 0xff666666 + r);
+			fill_us = fmin(fill_us, now_us() - t);
+		}
+
+		if (write_track_register(data, count * 4) < 0) {
+			printf("%dx%d: failed to register the buffer\n", width, height);
+			munmap(data, count * 4);
+			ret = -1;
+			continue;
+		}
+
+		for (int r = 0; r < runs; r++) {
+			/* 每一页都是第一次写 */
+			t = now_us();
+			fill(data, count, 0xff666666 + r);
+			tracked_us = fmin(tracked_us, now_us() - t);
+
+			t = now_us();
+			write_track_damage(&damage, data, width, height, width * 4);
+			full_us = fmin(full_us, now_us() - t);
+
+			t = now_us();
+			write_track_damage(&damage, data, width, height, width * 4);
+			idle_us = fmin(idle_us, now_us() - t);
+		}
+
+		/* 随机写 5% 的 64x64 tile */
+		for (int r = 0; r < runs; r++) {
+			uint32_t seed = 0x12345678 + r;
+			int want = tiles_x * tiles_y / 20;
+			char *written_rows = calloc(height, 1);
+
+			for (int n = 0; n < want; n++) {
+				int tile = xorshift32(&seed) % (tiles_x * tiles_y);
+				int x0 = tile % tiles_x * TILE_SIZE, y0 = tile / tiles_x * TILE_SIZE;
+				for (int y = y0; y < y0 + TILE_SIZE; y++) {
+					fill(data + (long)y * width + x0, TILE_SIZE, 0xffeeeeee);
+					written_rows[y] = 1;
+				}
+			}
+
+			t = now_us();
+			if (write_track_damage(&damage, data, width, height, width * 4) < 0)
+				ret = -1;
+			scattered_us = fmin(scattered_us, now_us() - t);
+
+			for (int y = 0; y < height; y++) {
+				int covered = 0;
+				for (int i = 0; i < damage.count && !covered; i++)
+					covered = y >= damage.rects[i].y &&
+						y < damage.rects[i].y + damage.rects[i].height;
+				if (written_rows[y] && !covered) {
+					printf("  FAIL: row %d was written but is not damaged\n", y);
+					ret = -1;
+					break;
+				}
+			}
+			if (r == runs - 1)
+				printf("%dx%d: 5%% of the tiles written, %.1f%% of the rows damaged\n",
+				       width, height, (double)damage_area(&damage) / count * 100);
+			free(written_rows);
+		}
+
+		printf("  fill %.1f us untracked, %.1f us tracked: %.2f us per page fault, %zu pages\n",
+		       fill_us, tracked_us, (tracked_us - fill_us) / pages, pages);
+		printf("  scan %.1f us with nothing written, %.1f us after 5%% tiles, %.1f us after a full fill\n",
+		       idle_us, scattered_us, full_us);
+
+		munmap(data, count * 4);
+	}
+
+	write_track_finish();
+	return ret;
+}
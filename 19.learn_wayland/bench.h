@@ -0,0 +1,11 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* 不连接合成器，直接在内存里测量各个阶段的开销 */
+int bench_damage_diff(void);
+/* 检查 tile hash 能区分平移、交换过的内容，并测量速度，有问题时返回 -1 */
+int bench_tile_hash(void);
+/* 测量写保护跟踪的缺页和扫描开销，damage 漏掉写过的行时返回 -1 */
+int bench_write_track(void);
+
+#endif
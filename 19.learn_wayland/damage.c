@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "damage.h"
+
+void
+damage_clear(struct damage *damage)
+{
+	damage->count = 0;
+}
+
+static struct damage_rect
+rect_union(const struct damage_rect *a, const struct damage_rect *b)
+{
+	int32_t x1 = a->x < b->x ? a->x : b->x;
+	int32_t y1 = a->y < b->y ? a->y : b->y;
+	int32_t x2 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+	int32_t y2 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+
+	return (struct damage_rect){ x1, y1, x2 - x1, y2 - y1 };
+}
+
+static int64_t
+rect_area(const struct damage_rect *r)
+{
+	return (int64_t)r->width * r->height;
+}
+
+/* 矩形满了，在添加顺序上相邻的两个矩形里找合并后多出来的面积最小的一对合成包围盒
+ * 矩形是从上到下、从左到右添加的，相邻的矩形在画面上也离得近，
+ * 分散的小块只会和附近的块合并，不会像整体包围盒那样把整个画面都算进来
+ * */
+static void
+damage_merge_cheapest(struct damage *damage)
+{
+	int best = 0;
+	int64_t best_cost = INT64_MAX;
+
+	for (int i = 0; i + 1 < damage->count; i++) {
+		struct damage_rect u = rect_union(&damage->rects[i], &damage->rects[i + 1]);
+		int64_t cost = rect_area(&u) - rect_area(&damage->rects[i]) -
+			rect_area(&damage->rects[i + 1]);
+
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = i;
+		}
+	}
+
+	damage->rects[best] = rect_union(&damage->rects[best], &damage->rects[best + 1]);
+	memmove(&damage->rects[best + 1], &damage->rects[best + 2],
+		(damage->count - best - 2) * sizeof(damage->rects[0]));
+	damage->count--;
+}
+
+void
+damage_add(struct damage *damage, int32_t x, int32_t y,
+		int32_t width, int32_t height)
+{
+	struct damage_rect rect = { x, y, width, height };
+	struct damage_rect *last;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (damage->count > 0) {
+		last = &damage->rects[damage->count - 1];
+		/* 同一行紧挨着的右边 */
+		if (last->y == y && last->height == height &&
+		    last->x + last->width == x) {
+			last->width += width;
+			return;
+		}
+		/* 宽度一样、紧挨着的下边 */
+		for (int i = damage->count - 1; i >= 0; i--) {
+			struct damage_rect *r = &damage->rects[i];
+			if (r->x == x && r->width == width && r->y + r->height == y) {
+				r->height += height;
+				return;
+			}
+		}
+	}
+
+	damage->rects[damage->count++] = rect;
+	if (damage->count == DAMAGE_MAX_RECTS)
+		damage_merge_cheapest(damage);
+}
+
+int64_t
+damage_area(const struct damage *damage)
+{
+	int64_t area = 0;
+
+	for (int i = 0; i < damage->count; i++)
+		area += (int64_t)damage->rects[i].width * damage->rects[i].height;
+	return area;
+}
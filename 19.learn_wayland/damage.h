@@ -0,0 +1,32 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdint.h>
+
+/* 超过这么多矩形时新的矩形并进离它最近的矩形，避免每帧发送太多 damage 请求 */
+#define DAMAGE_MAX_RECTS 64
+
+struct damage_rect {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+};
+
+/* 一帧里变化的区域，按 buffer 坐标 */
+struct damage {
+	int count;
+	struct damage_rect rects[DAMAGE_MAX_RECTS];
+};
+
+void damage_clear(struct damage *damage);
+
+/* 按从上到下、从左到右的顺序添加时，
+ * 同一行相邻的矩形和上下对齐相邻的矩形会合并在一起
+ * */
+void damage_add(struct damage *damage, int32_t x, int32_t y,
+		int32_t width, int32_t height);
+
+int64_t damage_area(const struct damage *damage);
+
+#endif
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "damage_diff.h"
+
+#define BLOCK_BYTES 64
+#define BLOCK_PIXELS (BLOCK_BYTES / 4)
+
+static inline int
+block_differs(const uint8_t *a, const uint8_t *b)
+{
+#if defined(__AVX2__)
+	__m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)a),
+			_mm256_loadu_si256((const __m256i *)b));
+	__m256i x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + 32)),
+			_mm256_loadu_si256((const __m256i *)(b + 32)));
+	__m256i x = _mm256_or_si256(x0, x1);
+	return !_mm256_testz_si256(x, x);
+#elif defined(__SSE2__)
+	__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a),
+			_mm_loadu_si128((const __m128i *)b));
+	__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + 16)),
+			_mm_loadu_si128((const __m128i *)(b + 16)));
+	__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + 32)),
+			_mm_loadu_si128((const __m128i *)(b + 32)));
+	__m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + 48)),
+			_mm_loadu_si128((const __m128i *)(b + 48)));
+	__m128i e = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+	return _mm_movemask_epi8(e) != 0xffff;
+#else
+	return memcmp(a, b, BLOCK_BYTES) != 0;
+#endif
+}
+
+/* 比较 w 个像素，w 不超过 TILE_SIZE，不够 64 字节的尾巴单独比较 */
+static inline int
+span_differs(const uint32_t *cur, const uint32_t *prev, int w)
+{
+	int x = 0;
+
+	for (; x + BLOCK_PIXELS <= w; x += BLOCK_PIXELS) {
+		if (block_differs((const uint8_t *)(cur + x), (const uint8_t *)(prev + x)))
+			return 1;
+	}
+	return x < w && memcmp(cur + x, prev + x, (w - x) * 4) != 0;
+}
+
+void
+damage_diff_begin(struct damage_diff *diff, struct damage *damage,
+		int width, int height, int stride)
+{
+	diff->damage = damage;
+	diff->width = width;
+	diff->height = height;
+	diff->stride = stride;
+	diff->full = 0;
+	damage_clear(damage);
+
+	/* 比 wl_shm 能用的还宽，不逐块比较了 */
+	if (width > DIFF_MAX_WIDTH) {
+		damage_add(damage, 0, 0, width, height);
+		diff->full = 1;
+	}
+}
+
+void
+damage_diff_band(struct damage_diff *diff, const uint32_t *cur,
+		const uint32_t *prev, int y0)
+{
+	const int h = diff->height - y0 < TILE_SIZE ? diff->height - y0 : TILE_SIZE;
+	const int tiles_x = (diff->width + TILE_SIZE - 1) / TILE_SIZE;
+	int remaining = tiles_x;
+	int span_x = 0, span_w = 0;
+
+	if (diff->full)
+		return;
+
+	/* 按行顺序读，预取效果好；一块里找到一处不同，这一块剩下的行就不用比了 */
+	memset(diff->changed, 0, tiles_x);
+	for (int y = y0; y < y0 + h && remaining; y++) {
+		const uint32_t *c = cur + (long)y * diff->stride;
+		const uint32_t *p = prev + (long)y * diff->stride;
+
+		for (int tx = 0; tx < tiles_x; tx++) {
+			int x0 = tx * TILE_SIZE;
+			int w = diff->width - x0 < TILE_SIZE ? diff->width - x0 : TILE_SIZE;
+
+			if (!diff->changed[tx] && span_differs(c + x0, p + x0, w)) {
+				diff->changed[tx] = 1;
+				remaining--;
+			}
+		}
+	}
+
+	/* 同一条带里连续变化的块合成一个 damage 矩形 */
+	for (int tx = 0; tx < tiles_x; tx++) {
+		int x0 = tx * TILE_SIZE;
+		int w = diff->width - x0 < TILE_SIZE ? diff->width - x0 : TILE_SIZE;
+
+		if (diff->changed[tx]) {
+			if (span_w == 0)
+				span_x = x0;
+			span_w += w;
+		} else if (span_w) {
+			damage_add(diff->damage, span_x, y0, span_w, h);
+			span_w = 0;
+		}
+	}
+	if (span_w)
+		damage_add(diff->damage, span_x, y0, span_w, h);
+
+	/* damage 超过半帧，剩下的比较省下的上传已经不值得，整帧提交
+	 * 矩形数到了上限会合并，damage 可能比变化的块多，所以按面积算
+	 * */
+	if (damage_area(diff->damage) * 2 > (int64_t)diff->width * diff->height) {
+		damage_clear(diff->damage);
+		damage_add(diff->damage, 0, 0, diff->width, diff->height);
+		diff->full = 1;
+	}
+}
+
+void
+damage_from_diff(struct damage *damage, const uint32_t *cur,
+		const uint32_t *prev, int width, int height, int stride)
+{
+	struct damage_diff diff;
+
+	damage_diff_begin(&diff, damage, width, height, stride);
+	for (int y = 0; y < height && !diff.full; y += TILE_SIZE)
+		damage_diff_band(&diff, cur, prev, y);
+}
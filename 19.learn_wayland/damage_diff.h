@@ -0,0 +1,40 @@
+#ifndef DAMAGE_DIFF_H
+#define DAMAGE_DIFF_H
+
+#include <stdint.h>
+
+#include "damage.h"
+#include "tile_hash.h"
+
+/* 比较新画好的一帧和上一帧，把不同的部分转成 damage 矩形
+ * 按 TILE_SIZE x TILE_SIZE 的块比较(和 tile hash 的块一样)，块里找到一处不同
+ * 整块就算作 damage，剩下的行不再比较；同一条带里相邻的块合成一个矩形，
+ * 上下对齐的矩形由 damage_add 合并。damage 超过半帧时不再比较，整帧算作 damage
+ * stride 以像素为单位，两帧的 stride 必须相同
+ * */
+#define DIFF_MAX_WIDTH 16384
+
+struct damage_diff {
+	struct damage *damage;
+	int width;
+	int height;
+	int stride;
+	/* 已经整帧算作 damage，后面的条带不用再比较 */
+	int full;
+	/* 当前条带里每一块是否已经找到不同 */
+	uint8_t changed[DIFF_MAX_WIDTH / TILE_SIZE];
+};
+
+void damage_diff_begin(struct damage_diff *diff, struct damage *damage,
+		int width, int height, int stride);
+
+/* 比较从 y 开始的一条 TILE_SIZE 行高的条带，y 是 TILE_SIZE 的倍数，从上往下依次调用
+ * 可以画完一条就比较一条，新画的内容还在缓存里
+ * */
+void damage_diff_band(struct damage_diff *diff, const uint32_t *cur,
+		const uint32_t *prev, int y);
+
+void damage_from_diff(struct damage *damage, const uint32_t *cur,
+		const uint32_t *prev, int width, int height, int stride);
+
+#endif
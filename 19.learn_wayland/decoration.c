@@ -0,0 +1,331 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "decoration.h"
+
+#define DECORATION_CACHE_MAX 8
+
+const struct decoration_theme decoration_default_theme = {
+	.title_color = 0xff303a4a,
+	.border_color = 0xff1e242e,
+	.button_color = 0xffdde3ea,
+	.shadow_alpha = 0x70,
+	.blur_radius = 6,
+	.border = 1,
+	.title_height = 26,
+	.corner_radius = 6,
+};
+
+static struct decoration_patch cache[DECORATION_CACHE_MAX];
+static int cache_count;
+
+static inline int
+max_int(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+static inline int
+min_int(int a, int b)
+{
+	return a < b ? a : b;
+}
+
+/* box blur 的几个逐行操作，每次处理一整行 16 位的值 */
+static void
+row_add(uint16_t *sum, const uint16_t *row, int n)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	for (; i + 16 <= n; i += 16) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(sum + i));
+		__m256i v = _mm256_loadu_si256((const __m256i *)(row + i));
+		_mm256_storeu_si256((__m256i *)(sum + i), _mm256_add_epi16(s, v));
+	}
+#elif defined(__SSE2__)
+	for (; i + 8 <= n; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(sum + i));
+		__m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+		_mm_storeu_si128((__m128i *)(sum + i), _mm_add_epi16(s, v));
+	}
+#endif
+	for (; i < n; i++)
+		sum[i] += row[i];
+}
+
+static void
+row_sub(uint16_t *sum, const uint16_t *row, int n)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	for (; i + 16 <= n; i += 16) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(sum + i));
+		__m256i v = _mm256_loadu_si256((const __m256i *)(row + i));
+		_mm256_storeu_si256((__m256i *)(sum + i), _mm256_sub_epi16(s, v));
+	}
+#elif defined(__SSE2__)
+	for (; i + 8 <= n; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(sum + i));
+		__m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+		_mm_storeu_si128((__m128i *)(sum + i), _mm_sub_epi16(s, v));
+	}
+#endif
+	for (; i < n; i++)
+		sum[i] -= row[i];
+}
+
+/* dst = sum * mul >> 16，mul 约等于 65536 / 窗口大小 */
+static void
+row_scale(uint16_t *dst, const uint16_t *sum, uint16_t mul, int n)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	const __m256i m = _mm256_set1_epi16(mul);
+	for (; i + 16 <= n; i += 16) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(sum + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_mulhi_epu16(s, m));
+	}
+#elif defined(__SSE2__)
+	const __m128i m = _mm_set1_epi16(mul);
+	for (; i + 8 <= n; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(sum + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_mulhi_epu16(s, m));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = (uint32_t)sum[i] * mul >> 16;
+}
+
+/* 竖直方向的 box blur，同一行的所有列一起算，边界外按 0 处理 */
+static void
+blur_columns(uint16_t *dst, const uint16_t *src, int width, int height,
+		int radius, uint16_t *sum)
+{
+	uint16_t mul = 65536 / (2 * radius + 1);
+
+	memset(sum, 0, width * sizeof(*sum));
+	for (int y = 0; y < radius && y < height; y++)
+		row_add(sum, src + y * width, width);
+
+	for (int y = 0; y < height; y++) {
+		if (y + radius < height)
+			row_add(sum, src + (y + radius) * width, width);
+		row_scale(dst + y * width, sum, mul, width);
+		if (y - radius >= 0)
+			row_sub(sum, src + (y - radius) * width, width);
+	}
+}
+
+static void
+transpose(uint16_t *dst, const uint16_t *src, int width, int height)
+{
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			dst[x * height + y] = src[y * width + x];
+}
+
+/* 可分离的 box blur：先竖直方向，转置后再做一次竖直方向，相当于水平方向 */
+static void
+box_blur(uint16_t *buf, uint16_t *tmp, int width, int height, int radius,
+		uint16_t *sum)
+{
+	blur_columns(tmp, buf, width, height, radius, sum);
+	transpose(buf, tmp, width, height);
+	blur_columns(tmp, buf, height, width, radius, sum);
+	transpose(buf, tmp, height, width);
+}
+
+static void
+fill32(uint32_t *dst, uint32_t value, int n)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	const __m256i v = _mm256_set1_epi32(value);
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+#elif defined(__SSE2__)
+	const __m128i v = _mm_set1_epi32(value);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+#endif
+	for (; i < n; i++)
+		dst[i] = value;
+}
+
+/* 标题栏上方的圆角之外不属于窗口 */
+static int
+inside_frame(int x, int y, int x0, int y0, int x1, int y1, int radius)
+{
+	if (x < x0 || x >= x1 || y < y0 || y >= y1)
+		return 0;
+	if (y >= y0 + radius)
+		return 1;
+
+	int cx;
+	if (x < x0 + radius)
+		cx = x0 + radius;
+	else if (x >= x1 - radius)
+		cx = x1 - radius - 1;
+	else
+		return 1;
+
+	int dx = x - cx, dy = y - (y0 + radius);
+	return dx * dx + dy * dy <= radius * radius;
+}
+
+/* 中心留出足够的距离，让阴影在中心行列上已经和无限大窗口一样，
+ * 这样中心那一行(列)可以任意重复
+ * */
+static int
+patch_build(struct decoration_patch *patch, const struct decoration_theme *theme,
+		int scale)
+{
+	int r = theme->blur_radius * scale;
+	int m = 3 * r;
+	int b = theme->border * scale;
+	int t = theme->title_height * scale;
+	int cr = theme->corner_radius * scale;
+	int pad = 5 * scale;
+	int bs = t - 2 * pad;
+	int e = max_int(max_int(m, pad + bs), cr);
+
+	int width = 2 * (m + b + e) + 1;
+	int height = (m + b + t + e) + 1 + (m + b + e);
+	int fx0 = m, fy0 = m, fx1 = width - m, fy1 = height - m;
+
+	uint32_t *pixels = malloc((size_t)width * height * sizeof(uint32_t));
+	uint16_t *mask = calloc((size_t)width * height, sizeof(uint16_t));
+	uint16_t *tmp = malloc((size_t)width * height * sizeof(uint16_t));
+	uint16_t *sum = malloc(max_int(width, height) * sizeof(uint16_t));
+	if (!pixels || !mask || !tmp || !sum) {
+		free(pixels);
+		free(mask);
+		free(tmp);
+		free(sum);
+		return -1;
+	}
+
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			if (inside_frame(x, y, fx0, fy0, fx1, fy1, cr))
+				mask[y * width + x] = 255;
+
+	/* 3 次 box blur 接近高斯模糊 */
+	if (r > 0)
+		for (int i = 0; i < 3; i++)
+			box_blur(mask, tmp, width, height, r, sum);
+
+	int bx = fx1 - b - pad - bs, by = fy0 + b + (t - bs) / 2;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			uint32_t *p = &pixels[y * width + x];
+
+			if (!inside_frame(x, y, fx0, fy0, fx1, fy1, cr)) {
+				/* 黑色阴影，预乘后只剩 alpha */
+				*p = (uint32_t)(mask[y * width + x] * theme->shadow_alpha / 255) << 24;
+				continue;
+			}
+
+			if (x < fx0 + b || x >= fx1 - b || y < fy0 + b || y >= fy1 - b)
+				*p = theme->border_color;
+			else
+				*p = theme->title_color;
+
+			/* 关闭按钮上的 X */
+			int dx = x - bx, dy = y - by, in = 2 * scale;
+			if (dx >= in && dx < bs - in && dy >= in && dy < bs - in &&
+				(abs(dx - dy) <= scale / 2 || abs(dx + dy - (bs - 1)) <= scale / 2))
+				*p = theme->button_color;
+		}
+	}
+
+	free(mask);
+	free(tmp);
+	free(sum);
+
+	patch->theme = theme;
+	patch->scale = scale;
+	patch->pixels = pixels;
+	patch->width = width;
+	patch->height = height;
+	patch->left = m + b + e;
+	patch->top = m + b + t + e;
+	patch->right = m + b + e;
+	patch->bottom = m + b + e;
+	patch->content_left = m + b;
+	patch->content_top = m + b + t;
+	patch->content_right = m + b;
+	patch->content_bottom = m + b;
+	patch->frame_left = b;
+	patch->frame_top = b + t;
+	patch->frame_right = b;
+	patch->frame_bottom = b;
+	patch->button_right = width - bx;
+	patch->button_top = by;
+	patch->button_size = bs;
+	return 0;
+}
+
+const struct decoration_patch *
+decoration_get(const struct decoration_theme *theme, int scale)
+{
+	for (int i = 0; i < cache_count; i++)
+		if (cache[i].theme == theme && cache[i].scale == scale)
+			return &cache[i];
+
+	/* 缓存满了就丢掉最早生成的 */
+	if (cache_count == DECORATION_CACHE_MAX) {
+		free(cache[0].pixels);
+		memmove(&cache[0], &cache[1], (DECORATION_CACHE_MAX - 1) * sizeof(cache[0]));
+		cache_count--;
+	}
+
+	if (patch_build(&cache[cache_count], theme, scale) < 0)
+		return NULL;
+	return &cache[cache_count++];
+}
+
+void
+decoration_cache_clear(void)
+{
+	for (int i = 0; i < cache_count; i++)
+		free(cache[i].pixels);
+	cache_count = 0;
+}
+
+void
+decoration_compose(const struct decoration_patch *patch, uint32_t *dst,
+		int stride, int width, int height)
+{
+	int lw = min_int(patch->left, width / 2);
+	int rw = min_int(patch->right, width - lw);
+	int mw = width - lw - rw;
+	int th = min_int(patch->top, height);
+	int bh = min_int(patch->bottom, height - th);
+	int mh = height - th - bh;
+
+	for (int y = 0; y < height; y++) {
+		uint32_t *row = dst + (size_t)y * stride;
+		const uint32_t *src;
+		int middle = 0;
+
+		if (y < th) {
+			src = patch->pixels + y * patch->width;
+		} else if (y >= th + mh) {
+			src = patch->pixels + (patch->height - (height - y)) * patch->width;
+		} else {
+			src = patch->pixels + patch->top * patch->width;
+			middle = 1;
+		}
+
+		memcpy(row, src, lw * sizeof(uint32_t));
+		memcpy(row + lw + mw, src + patch->width - rw, rw * sizeof(uint32_t));
+		/* 中间几行的中间部分在窗口内容下面，不用画 */
+		if (!middle)
+			fill32(row + lw, src[patch->left], mw);
+	}
+}
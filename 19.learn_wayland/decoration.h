@@ -0,0 +1,68 @@
+#ifndef DECORATION_H
+#define DECORATION_H
+
+#include <stdint.h>
+
+/* 客户端窗口装饰：阴影、边框和标题栏
+ * 尺寸都是 scale 为 1 时的逻辑像素
+ * */
+struct decoration_theme {
+	uint32_t title_color;
+	uint32_t border_color;
+	uint32_t button_color;
+	/* 阴影最深处的不透明度 0-255 */
+	int shadow_alpha;
+	/* 阴影做 3 次半径为 blur_radius 的 box blur，向外扩展 3 * blur_radius */
+	int blur_radius;
+	int border;
+	int title_height;
+	/* 标题栏上方两个圆角的半径 */
+	int corner_radius;
+};
+
+extern const struct decoration_theme decoration_default_theme;
+
+/* 预先画好的九宫格，四个角原样复制，边上的行或列重复铺开
+ * 同一个主题和 scale 只生成一次
+ * */
+struct decoration_patch {
+	const struct decoration_theme *theme;
+	int scale;
+	uint32_t *pixels;
+	int width;
+	int height;
+	/* 中心像素的位置，也就是四个角的宽高 */
+	int left;
+	int top;
+	int right;
+	int bottom;
+	/* 装饰 buffer 边缘到窗口内容的距离 */
+	int content_left;
+	int content_top;
+	int content_right;
+	int content_bottom;
+	/* 窗口边框(不含阴影)相对内容的外扩 */
+	int frame_left;
+	int frame_top;
+	int frame_right;
+	int frame_bottom;
+	/* 关闭按钮：左边缘到装饰 buffer 右边缘的距离，上边缘的位置和边长 */
+	int button_right;
+	int button_top;
+	int button_size;
+};
+
+/* 取主题在某个 scale 下的九宫格，第一次使用时生成并缓存
+ * 缓存满了会淘汰最早的一项，返回的指针在下一次调用之后可能失效
+ * */
+const struct decoration_patch *decoration_get(const struct decoration_theme *theme,
+		int scale);
+void decoration_cache_clear(void);
+
+/* 把九宫格铺到 width x height 的 ARGB8888(预乘)装饰 buffer 上，
+ * 只有复制和填充，中间被窗口内容盖住的部分不写
+ * */
+void decoration_compose(const struct decoration_patch *patch, uint32_t *dst,
+		int stride, int width, int height);
+
+#endif
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <wayland-client.h>
+
+#include "event_loop.h"
+#include "io_thread.h"
+
+#define MAX_EVENTS 32
+
+static const char *const type_names[] = {
+	"fd", "timer", "signal", "wakeup", "wayland",
+};
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int
+event_loop_init(struct event_loop *loop, struct wl_display *display)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+	memset(loop, 0, sizeof(*loop));
+	loop->display = display;
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		fprintf(stderr, "epoll_create1 failed: %m\n");
+		return -1;
+	}
+	/* data.ptr 为 NULL 的就是 display 的 fd */
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, wl_display_get_fd(display), &ev) < 0) {
+		fprintf(stderr, "adding the display fd to epoll failed: %m\n");
+		close(loop->epoll_fd);
+		return -1;
+	}
+	loop->display_events = EPOLLIN;
+	loop->report_ns = now_ns();
+	return 0;
+}
+
+/* 真正的 dispatch 在 event_loop_dispatch 开头，这里只是被唤醒 */
+static void
+io_wakeup(void *data)
+{
+}
+
+int
+event_loop_init_queue(struct event_loop *loop, struct wl_display *display,
+		struct wl_event_queue *queue, struct io_thread *io)
+{
+	struct epoll_event ev = { .events = 0, .data.ptr = NULL };
+
+	if (io->notify_count >= IO_THREAD_MAX_LOOPS || event_loop_init(loop, display) < 0)
+		return -1;
+	/* 不读 socket，display fd 只在发送缓冲区满时等 EPOLLOUT(出错时总会报告) */
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, wl_display_get_fd(display), &ev);
+	loop->display_events = 0;
+	loop->queue = queue;
+	loop->io = io;
+	loop->io_wakeup = event_loop_add_wakeup(loop, io_wakeup, NULL);
+	if (loop->io_wakeup == NULL) {
+		event_loop_finish(loop);
+		return -1;
+	}
+	io->notify[io->notify_count++] = loop->io_wakeup;
+	return 0;
+}
+
+static void
+free_removed(struct event_loop *loop)
+{
+	while (loop->removed) {
+		struct event_source *source = loop->removed;
+		loop->removed = source->next;
+		free(source);
+	}
+}
+
+void
+event_loop_finish(struct event_loop *loop)
+{
+	while (loop->sources)
+		event_source_remove(loop->sources);
+	free_removed(loop);
+	if (loop->epoll_fd >= 0)
+		close(loop->epoll_fd);
+	loop->epoll_fd = -1;
+}
+
+static struct event_source *
+add_source(struct event_loop *loop, enum event_source_type type, int fd,
+		void *data)
+{
+	struct event_source *source;
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	if (fd < 0)
+		return NULL;
+	source = calloc(1, sizeof(*source));
+	if (source == NULL)
+		return NULL;
+	source->loop = loop;
+	source->type = type;
+	source->fd = fd;
+	source->data = data;
+	ev.data.ptr = source;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		fprintf(stderr, "epoll_ctl failed: %m\n");
+		free(source);
+		return NULL;
+	}
+	source->next = loop->sources;
+	loop->sources = source;
+	return source;
+}
+
+struct event_source *
+event_loop_add_fd(struct event_loop *loop, int fd, uint32_t events,
+		event_fd_func func, void *data)
+{
+	struct event_source *source = add_source(loop, EVENT_SOURCE_FD, fd, data);
+	struct epoll_event ev = { .events = events };
+
+	if (source == NULL)
+		return NULL;
+	source->func.fd = func;
+	if (events != EPOLLIN) {
+		ev.data.ptr = source;
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+	}
+	return source;
+}
+
+struct event_source *
+event_loop_add_timer(struct event_loop *loop, event_timer_func func, void *data)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	struct event_source *source = add_source(loop, EVENT_SOURCE_TIMER, fd, data);
+
+	if (source == NULL) {
+		fprintf(stderr, "creating timer failed: %m\n");
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	source->func.timer = func;
+	return source;
+}
+
+int
+event_source_timer_update(struct event_source *source, int delay_ms,
+		int interval_ms)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (delay_ms > 0) {
+		its.it_value.tv_sec = delay_ms / 1000;
+		its.it_value.tv_nsec = (delay_ms % 1000) * 1000000L;
+		its.it_interval.tv_sec = interval_ms / 1000;
+		its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+	}
+	return timerfd_settime(source->fd, 0, &its, NULL);
+}
+
+int
+event_source_timer_set_abs(struct event_source *source, uint64_t time_ns)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	/* it_value 全是 0 会停掉定时器 */
+	if (time_ns == 0)
+		time_ns = 1;
+	its.it_value.tv_sec = time_ns / 1000000000ull;
+	its.it_value.tv_nsec = time_ns % 1000000000ull;
+	return timerfd_settime(source->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+struct event_source *
+event_loop_add_signal(struct event_loop *loop, int signo,
+		event_signal_func func, void *data)
+{
+	struct event_source *source;
+	sigset_t mask;
+	int fd;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, signo);
+	/* 不屏蔽的话信号还是按默认方式处理，signalfd 读不到 */
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	source = add_source(loop, EVENT_SOURCE_SIGNAL, fd, data);
+	if (source == NULL) {
+		fprintf(stderr, "creating signalfd failed: %m\n");
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	source->signo = signo;
+	source->func.signal = func;
+	return source;
+}
+
+struct event_source *
+event_loop_add_wakeup(struct event_loop *loop, event_wakeup_func func, void *data)
+{
+	int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	struct event_source *source = add_source(loop, EVENT_SOURCE_WAKEUP, fd, data);
+
+	if (source == NULL) {
+		fprintf(stderr, "creating eventfd failed: %m\n");
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	source->func.wakeup = func;
+	return source;
+}
+
+/* 可以在任何线程调用 */
+void
+event_source_wakeup(struct event_source *source)
+{
+	uint64_t one = 1;
+
+	/* 计数器满了才会失败，那时候本来就会被唤醒 */
+	if (write(source->fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "eventfd write failed: %m\n");
+}
+
+void
+event_source_remove(struct event_source *source)
+{
+	struct event_loop *loop = source->loop;
+	struct event_source **link;
+
+	for (link = &loop->sources; *link; link = &(*link)->next) {
+		if (*link == source) {
+			*link = source->next;
+			break;
+		}
+	}
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	if (source->type != EVENT_SOURCE_FD)
+		close(source->fd);
+	source->fd = -1;
+	source->removed = 1;
+	source->next = loop->removed;
+	loop->removed = source;
+}
+
+static void
+dispatch_source(struct event_source *source, uint32_t events)
+{
+	struct signalfd_siginfo info;
+	uint64_t count;
+
+	switch (source->type) {
+	case EVENT_SOURCE_FD:
+		source->func.fd(source->data, source->fd, events);
+		break;
+	case EVENT_SOURCE_TIMER:
+		/* 定时器被重新设置过时可能已经读不到了 */
+		if (read(source->fd, &count, sizeof(count)) == sizeof(count))
+			source->func.timer(source->data, count);
+		break;
+	case EVENT_SOURCE_SIGNAL:
+		while (read(source->fd, &info, sizeof(info)) == sizeof(info))
+			source->func.signal(source->data, info.ssi_signo);
+		break;
+	case EVENT_SOURCE_WAKEUP:
+		if (read(source->fd, &count, sizeof(count)) == sizeof(count))
+			source->func.wakeup(source->data);
+		break;
+	default:
+		break;
+	}
+}
+
+/* 每隔 report_ms 打印一次这段时间里平均每秒唤醒几次 */
+static void
+report(struct event_loop *loop)
+{
+	uint64_t now = now_ns();
+	double seconds = (now - loop->report_ns) / 1e9;
+	char buf[256] = "";
+	int len = 0;
+
+	if (loop->report_ms <= 0 || seconds * 1000 < loop->report_ms)
+		return;
+
+	for (int i = 0; i <= EVENT_SOURCE_TYPES; i++) {
+		uint64_t n = loop->dispatched[i] - loop->report_dispatched[i];
+		if (n && len < (int)sizeof(buf))
+			len += snprintf(buf + len, sizeof(buf) - len, ", %s %.1f",
+					type_names[i], n / seconds);
+		loop->report_dispatched[i] = loop->dispatched[i];
+	}
+	printf("event loop: %.1f wakeups/s%s\n",
+			(loop->wakeups - loop->report_wakeups) / seconds, buf);
+	loop->report_wakeups = loop->wakeups;
+	loop->report_ns = now;
+}
+
+/* 发送缓冲区满时等 EPOLLOUT，发完了再去掉，否则 epoll 会一直唤醒 */
+static int
+flush_display(struct event_loop *loop)
+{
+	uint32_t events = loop->io ? 0 : EPOLLIN;
+	struct epoll_event ev = { .data.ptr = NULL };
+
+	if (wl_display_flush(loop->display) < 0) {
+		if (errno != EAGAIN)
+			return -1;
+		events |= EPOLLOUT;
+	}
+	if (events != loop->display_events) {
+		ev.events = events;
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD,
+					wl_display_get_fd(loop->display), &ev) < 0)
+			return -1;
+		loop->display_events = events;
+	}
+	return 0;
+}
+
+static int
+dispatch_queue(struct event_loop *loop)
+{
+	if (loop->queue)
+		return wl_display_dispatch_queue_pending(loop->display, loop->queue);
+	return wl_display_dispatch_pending(loop->display);
+}
+
+/* socket 由 io 线程读，只处理自己队列里已经读到的事件 */
+static int
+dispatch_external(struct event_loop *loop, int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int n;
+
+	if (dispatch_queue(loop) < 0 || io_thread_failed(loop->io))
+		return -1;
+	if (flush_display(loop) < 0)
+		return -1;
+
+	n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+	if (n > 0)
+		loop->wakeups++;
+
+	/* 和自己读 socket 时一样，先处理 io 线程已经放进队列的事件，
+	 * 同一次唤醒里的定时器回调看到的是最新的状态
+	 * */
+	if (dispatch_queue(loop) < 0 || io_thread_failed(loop->io))
+		return -1;
+	for (int i = 0; i < n; i++) {
+		struct event_source *source = events[i].data.ptr;
+		if (source == NULL) {
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				return -1;
+			continue;
+		}
+		if (source->removed)
+			continue;
+		/* io 线程的唤醒算作 Wayland 事件 */
+		loop->dispatched[source == loop->io_wakeup ?
+			EVENT_SOURCE_TYPES : source->type]++;
+		dispatch_source(source, events[i].events);
+	}
+	free_removed(loop);
+	report(loop);
+	return 0;
+}
+
+int
+event_loop_dispatch(struct event_loop *loop, int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	uint32_t display_revents = 0;
+	int n;
+
+	if (loop->io)
+		return dispatch_external(loop, timeout_ms);
+
+	/* prepare_read 成功之后到 read_events / cancel_read 之间，
+	 * 其他线程读到的事件不会被漏掉，也不会有人抢着读
+	 * */
+	while (wl_display_prepare_read(loop->display) != 0)
+		if (wl_display_dispatch_pending(loop->display) < 0)
+			return -1;
+	if (flush_display(loop) < 0) {
+		wl_display_cancel_read(loop->display);
+		return -1;
+	}
+
+	n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout_ms);
+	if (n < 0) {
+		wl_display_cancel_read(loop->display);
+		return errno == EINTR ? 0 : -1;
+	}
+	if (n > 0)
+		loop->wakeups++;
+
+	for (int i = 0; i < n; i++)
+		if (events[i].data.ptr == NULL)
+			display_revents = events[i].events;
+
+	if (display_revents & EPOLLIN) {
+		if (wl_display_read_events(loop->display) < 0)
+			return -1;
+		loop->dispatched[EVENT_SOURCE_TYPES]++;
+	} else {
+		wl_display_cancel_read(loop->display);
+		if (display_revents & (EPOLLERR | EPOLLHUP))
+			return -1;
+	}
+	if (wl_display_dispatch_pending(loop->display) < 0)
+		return -1;
+
+	for (int i = 0; i < n; i++) {
+		struct event_source *source = events[i].data.ptr;
+		if (source == NULL || source->removed)
+			continue;
+		loop->dispatched[source->type]++;
+		dispatch_source(source, events[i].events);
+	}
+	free_removed(loop);
+	report(loop);
+	return 0;
+}
@@ -0,0 +1,111 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+
+/* 基于 epoll 的事件循环
+ *
+ * Wayland 的 fd 用 wl_display_prepare_read / read_events / dispatch_pending 接进来，
+ * 和 timerfd(定时器)、signalfd(信号)、eventfd(其他线程唤醒)以及任意 fd 一起等待，
+ * 没有事件时一直睡在 epoll_wait 里，不需要额外的线程也不会空转。
+ * 顺便统计每秒被唤醒的次数
+ * */
+
+struct wl_display;
+struct wl_event_queue;
+struct io_thread;
+struct event_loop;
+
+typedef void (*event_fd_func)(void *data, int fd, uint32_t events);
+/* expirations 是上次回调之后定时器到期的次数，处理晚了会大于 1 */
+typedef void (*event_timer_func)(void *data, uint64_t expirations);
+typedef void (*event_signal_func)(void *data, int signo);
+typedef void (*event_wakeup_func)(void *data);
+
+enum event_source_type {
+	EVENT_SOURCE_FD,
+	EVENT_SOURCE_TIMER,
+	EVENT_SOURCE_SIGNAL,
+	EVENT_SOURCE_WAKEUP,
+	EVENT_SOURCE_TYPES,
+};
+
+struct event_source {
+	struct event_loop *loop;
+	enum event_source_type type;
+	int fd;
+	int signo;
+	union {
+		event_fd_func fd;
+		event_timer_func timer;
+		event_signal_func signal;
+		event_wakeup_func wakeup;
+	} func;
+	void *data;
+	/* 在回调里删掉的 source 要等这一轮事件处理完才能释放 */
+	int removed;
+	struct event_source *next;
+};
+
+struct event_loop {
+	int epoll_fd;
+	struct wl_display *display;
+	/* 由 io_thread 读 socket 时，这里只 dispatch 自己的队列(NULL 是默认队列)，
+	 * io_thread 读到事件后通过 io_wakeup 唤醒
+	 * */
+	struct wl_event_queue *queue;
+	struct io_thread *io;
+	struct event_source *io_wakeup;
+	/* display fd 现在等待的事件，发送缓冲区满了才需要 EPOLLOUT */
+	uint32_t display_events;
+	struct event_source *sources;
+	struct event_source *removed;
+
+	/* 统计：唤醒次数，以及其中各类事件的次数(最后一项是 Wayland) */
+	uint64_t wakeups;
+	uint64_t dispatched[EVENT_SOURCE_TYPES + 1];
+	/* 大于 0 时每隔这么多毫秒打印一次每秒唤醒次数 */
+	int report_ms;
+	uint64_t report_ns;
+	uint64_t report_wakeups;
+	uint64_t report_dispatched[EVENT_SOURCE_TYPES + 1];
+};
+
+int event_loop_init(struct event_loop *loop, struct wl_display *display);
+/* 不自己读 socket，等 io 线程读到事件后 dispatch queue，要在 io_thread_start 之前调用 */
+int event_loop_init_queue(struct event_loop *loop, struct wl_display *display,
+		struct wl_event_queue *queue, struct io_thread *io);
+void event_loop_finish(struct event_loop *loop);
+
+/* fd 不归事件循环所有，删掉 source 时不会关闭 */
+struct event_source *event_loop_add_fd(struct event_loop *loop, int fd,
+		uint32_t events, event_fd_func func, void *data);
+
+/* 新建的定时器没有启动，用 event_source_timer_update 设置 */
+struct event_source *event_loop_add_timer(struct event_loop *loop,
+		event_timer_func func, void *data);
+/* delay_ms 后第一次触发，之后每 interval_ms 一次(0 表示只触发一次)，delay_ms 为 0 时停止 */
+int event_source_timer_update(struct event_source *source, int delay_ms,
+		int interval_ms);
+/* 在 CLOCK_MONOTONIC 的 time_ns 触发一次，已经过了就马上触发 */
+int event_source_timer_set_abs(struct event_source *source, uint64_t time_ns);
+
+/* 会在当前线程屏蔽这个信号，要在创建其他线程之前调用，它们才会继承屏蔽字 */
+struct event_source *event_loop_add_signal(struct event_loop *loop, int signo,
+		event_signal_func func, void *data);
+
+/* 其他线程调用 event_source_wakeup 后，func 在事件循环的线程里执行
+ * 唤醒多次只回调一次
+ * */
+struct event_source *event_loop_add_wakeup(struct event_loop *loop,
+		event_wakeup_func func, void *data);
+void event_source_wakeup(struct event_source *source);
+
+void event_source_remove(struct event_source *source);
+
+/* 处理 Wayland 的事件并等待下一批事件，timeout_ms 为 -1 时一直等
+ * 和 wl_display_dispatch 一样，连接断开时返回 -1
+ * */
+int event_loop_dispatch(struct event_loop *loop, int timeout_ms);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame_sched.h"
+
+/* 间隔不在这个范围里的不当成刷新间隔，比如窗口被遮住后很久才来的 callback */
+#define MIN_INTERVAL_NS 2000000ll
+#define MAX_INTERVAL_NS 100000000ll
+#define REPORT_FRAMES 120
+/* 开始的几帧不等，收到 callback 马上画，用这期间最短的间隔作为刷新间隔 */
+#define WARMUP_FRAMES 8
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int64_t
+abs64(int64_t v)
+{
+	return v < 0 ? -v : v;
+}
+
+void
+frame_sched_init(struct frame_sched *sched, int margin_us)
+{
+	memset(sched, 0, sizeof(*sched));
+	sched->margin_ns = (int64_t)margin_us * 1000;
+}
+
+void
+frame_sched_reset(struct frame_sched *sched)
+{
+	sched->predicted_ns = 0;
+	sched->deadline_ns = 0;
+}
+
+/* 用时间戳的差更新刷新间隔，中间丢了几帧时按帧数平分
+ * 时间戳只精确到毫秒，每次只往新的值靠 1/16，平均下来能到亚毫秒
+ *
+ * 开始时丢了帧(第一帧要分配 buffer、缺页)，估计出来的会是刷新间隔的整数倍，
+ * 按这个间隔去等又会每次都错过中间那次刷新，一直锁在一半的帧率上。
+ * 所以先不等，取最短的间隔；之后 callback 也不可能比刷新更频繁，
+ * 连续两次看到间隔差不多是估计值的 1/k，就把估计值除以 k
+ * */
+static void
+update_interval(struct frame_sched *sched, int64_t delta_ns)
+{
+	int64_t n;
+
+	if (delta_ns < MIN_INTERVAL_NS || delta_ns > MAX_INTERVAL_NS * 8)
+		return;
+	if (sched->interval_ns == 0 ||
+		(sched->frames <= WARMUP_FRAMES && delta_ns < sched->interval_ns)) {
+		if (delta_ns <= MAX_INTERVAL_NS)
+			sched->interval_ns = delta_ns;
+		return;
+	}
+	if (delta_ns < sched->interval_ns * 3 / 4) {
+		n = (sched->interval_ns + delta_ns / 2) / delta_ns;
+		if (abs64(sched->interval_ns - n * delta_ns) < sched->interval_ns / 8 &&
+			++sched->short_deltas >= 2) {
+			sched->interval_ns /= n;
+			sched->short_deltas = 0;
+		}
+		return;
+	}
+	sched->short_deltas = 0;
+	if (sched->frames <= WARMUP_FRAMES)
+		return;
+	n = (delta_ns + sched->interval_ns / 2) / sched->interval_ns;
+	if (n < 1 || n > 8)
+		return;
+	delta_ns /= n;
+	if (delta_ns >= MIN_INTERVAL_NS && delta_ns <= MAX_INTERVAL_NS)
+		sched->interval_ns += (delta_ns - sched->interval_ns) / 16;
+}
+
+/* 收到 callback 的时间总是比时间戳晚一点(还有截断到毫秒的误差)，
+ * 取最小的差作为两个时钟的偏移，再慢慢往上跟，这样时钟漂移也能跟上
+ * */
+static void
+update_offset(struct frame_sched *sched, int64_t offset_ns)
+{
+	if (sched->frames == 0 || offset_ns < sched->clock_offset_ns)
+		sched->clock_offset_ns = offset_ns;
+	else
+		sched->clock_offset_ns += (offset_ns - sched->clock_offset_ns) / 64;
+}
+
+void
+frame_sched_frame_done(struct frame_sched *sched, uint32_t time, uint64_t now)
+{
+	int64_t ms;
+
+	/* 32 位的毫秒 49 天会回绕，按差值扩展成 64 位 */
+	if (sched->frames == 0)
+		ms = time;
+	else
+		ms = sched->last_ms + (int32_t)(time - (uint32_t)sched->last_ms);
+
+	if (sched->frames > 0)
+		update_interval(sched, (ms - sched->last_ms) * 1000000);
+	update_offset(sched, (int64_t)now - ms * 1000000);
+	sched->last_ms = ms;
+	sched->frames++;
+
+	sched->vblank_ns = ms * 1000000 + sched->clock_offset_ns;
+
+	/* 和预测的比较，中间丢了几帧时和最近的那一次刷新比 */
+	if (sched->predicted_ns && sched->interval_ns) {
+		int64_t err = (int64_t)(sched->vblank_ns - sched->predicted_ns);
+		int64_t n = err / sched->interval_ns;
+
+		err -= n * sched->interval_ns;
+		if (err > sched->interval_ns / 2) {
+			err -= sched->interval_ns;
+			n++;
+		} else if (err < -sched->interval_ns / 2) {
+			err += sched->interval_ns;
+			n--;
+		}
+		sched->predictions++;
+		sched->vblank_err_sum_ns += abs64(err);
+		if (abs64(err) > sched->vblank_err_max_ns)
+			sched->vblank_err_max_ns = abs64(err);
+		sched->vblank_ns = sched->predicted_ns + n * sched->interval_ns + err / 8;
+	}
+	sched->predicted_ns = sched->interval_ns && sched->frames > WARMUP_FRAMES ?
+		sched->vblank_ns + sched->interval_ns : 0;
+}
+
+uint64_t
+frame_sched_plan(struct frame_sched *sched)
+{
+	uint64_t now = now_ns();
+	int64_t estimate = sched->render_avg_ns + 2 * sched->render_dev_ns;
+	uint64_t start;
+
+	sched->plan_ns = now;
+	sched->wake_ns = 0;
+	sched->deadline_ns = 0;
+	if (sched->predicted_ns == 0)
+		return 0;
+
+	/* 提交要赶在下一次刷新前 margin 完成，callback 来晚了错过了这次就顺延到后面那次 */
+	sched->deadline_ns = sched->predicted_ns - sched->margin_ns;
+	while (sched->deadline_ns < now)
+		sched->deadline_ns += sched->interval_ns;
+	start = sched->deadline_ns - estimate - sched->wake_late_ns;
+	if (start <= now) {
+		sched->late_starts++;
+		return 0;
+	}
+	sched->wake_ns = start;
+	return start;
+}
+
+void
+frame_sched_start(struct frame_sched *sched)
+{
+	sched->start_ns = now_ns();
+	if (sched->wake_ns == 0)
+		return;
+	sched->wake_late_ns += ((int64_t)(sched->start_ns - sched->wake_ns) - sched->wake_late_ns) / 8;
+	sched->waited_ns += sched->start_ns - sched->plan_ns;
+	sched->wake_ns = 0;
+}
+
+static void
+report(struct frame_sched *sched)
+{
+	printf("frame pacing: %.2f Hz, render estimate %.2f ms, wakeup %.2f ms late, "
+			"vblank error avg %.2f max %.2f ms, render error avg %.2f max %.2f ms, "
+			"%u missed, %u late, waited %.2f ms/frame\n",
+			sched->interval_ns ? 1e9 / sched->interval_ns : 0.0,
+			(sched->render_avg_ns + 2 * sched->render_dev_ns) / 1e6,
+			sched->wake_late_ns / 1e6,
+			sched->predictions ? sched->vblank_err_sum_ns / 1e6 / sched->predictions : 0.0,
+			sched->vblank_err_max_ns / 1e6,
+			sched->renders ? sched->render_err_sum_ns / 1e6 / sched->renders : 0.0,
+			sched->render_err_max_ns / 1e6,
+			sched->missed, sched->late_starts,
+			sched->renders ? sched->waited_ns / 1e6 / sched->renders : 0.0);
+	sched->predictions = 0;
+	sched->vblank_err_sum_ns = 0;
+	sched->vblank_err_max_ns = 0;
+	sched->renders = 0;
+	sched->render_err_sum_ns = 0;
+	sched->render_err_max_ns = 0;
+	sched->missed = 0;
+	sched->late_starts = 0;
+	sched->waited_ns = 0;
+}
+
+void
+frame_sched_rendered(struct frame_sched *sched, uint64_t end)
+{
+	int64_t took = end - sched->start_ns;
+	int64_t err = took - sched->render_avg_ns;
+
+	/* 平均值靠 1/8，平均偏差靠 1/4 */
+	if (sched->renders == 0 && sched->render_avg_ns == 0) {
+		sched->render_avg_ns = took;
+		sched->render_dev_ns = took / 2;
+	} else {
+		sched->render_err_sum_ns += abs64(err);
+		if (abs64(err) > sched->render_err_max_ns)
+			sched->render_err_max_ns = abs64(err);
+		sched->render_avg_ns += err / 8;
+		sched->render_dev_ns += (abs64(err) - sched->render_dev_ns) / 4;
+	}
+	if (sched->deadline_ns && end > sched->deadline_ns)
+		sched->missed++;
+	if (++sched->renders == REPORT_FRAMES)
+		report(sched);
+}
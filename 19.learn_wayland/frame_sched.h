@@ -0,0 +1,76 @@
+#ifndef FRAME_SCHED_H
+#define FRAME_SCHED_H
+
+#include <stdint.h>
+
+/* 预测下一次刷新的时间，尽量晚地开始画下一帧
+ *
+ * frame callback 带的时间戳(毫秒)相减得到刷新间隔，再和收到 callback 时
+ * 本地的 CLOCK_MONOTONIC 比较得到时间戳到本地时钟的偏移，也就是刷新的相位。
+ * 收到 callback 后不马上画，而是在事件循环里定一个绝对时间的定时器，到
+ *     下一次刷新 - margin - 预计的绘制时间
+ * 再开始画，等的时候照常处理事件，画的时候读到的输入状态更新，画面的延迟更低。
+ * 预计的绘制时间是实测值的平均加上两倍的平均偏差，和 TCP 估计 RTO 的方法一样。
+ * 时间戳只有毫秒，每一次的刷新时间不直接用，而是把预测值往观察值修正 1/8
+ * */
+
+struct frame_sched {
+	/* 估计的刷新间隔，0 表示还没有估计出来 */
+	int64_t interval_ns;
+	/* 连续看到只有估计值几分之一的间隔的次数 */
+	int short_deltas;
+	/* callback 时间戳(扩展到 64 位的毫秒)加上 clock_offset 就是本地时钟 */
+	int64_t last_ms;
+	int64_t clock_offset_ns;
+	/* 最近一次刷新的本地时间和预测的下一次 callback 时间，0 表示没有预测 */
+	uint64_t vblank_ns;
+	uint64_t predicted_ns;
+	/* 提交要在刷新前这么久完成，合成器才来得及合成 */
+	int64_t margin_ns;
+
+	/* 绘制时间的平均值和平均偏差 */
+	int64_t render_avg_ns;
+	int64_t render_dev_ns;
+	/* 定时器回调平均晚了多久，定时器提前这么多 */
+	int64_t wake_late_ns;
+	/* 这一帧计划的时间、定好的开始时间(0 表示马上画)、实际开始的时间和期限 */
+	uint64_t plan_ns;
+	uint64_t wake_ns;
+	uint64_t start_ns;
+	uint64_t deadline_ns;
+
+	/* 统计：callback 时间的预测误差、绘制时间的预测误差、错过期限的帧数、
+	 * 来不及等就开始画的帧数、等了多久
+	 * */
+	uint32_t frames;
+	uint32_t predictions;
+	int64_t vblank_err_sum_ns;
+	int64_t vblank_err_max_ns;
+	uint32_t renders;
+	int64_t render_err_sum_ns;
+	int64_t render_err_max_ns;
+	uint32_t missed;
+	uint32_t late_starts;
+	uint64_t waited_ns;
+};
+
+void frame_sched_init(struct frame_sched *sched, int margin_us);
+
+/* 画面停下(不再请求 frame callback)之后，下一个 callback 不能用来预测 */
+void frame_sched_reset(struct frame_sched *sched);
+
+/* 收到 frame callback 时调用，time 是 callback 带的时间戳，now_ns 是收到的时间 */
+void frame_sched_frame_done(struct frame_sched *sched, uint32_t time, uint64_t now_ns);
+
+/* 收到 callback 后调用，返回该开始画的时间(CLOCK_MONOTONIC)，
+ * 交给 event_source_timer_set_abs；返回 0 表示马上画(还不知道刷新间隔或者已经晚了)
+ * */
+uint64_t frame_sched_plan(struct frame_sched *sched);
+
+/* 真正开始画的时候调用，更新定时器晚了多久的估计 */
+void frame_sched_start(struct frame_sched *sched);
+
+/* 一帧画完并提交后调用，用来更新绘制时间的估计，每 120 帧打印一次统计 */
+void frame_sched_rendered(struct frame_sched *sched, uint64_t end_ns);
+
+#endif
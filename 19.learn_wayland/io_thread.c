@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <wayland-client.h>
+
+#include "io_thread.h"
+#include "event_loop.h"
+
+int
+io_thread_init(struct io_thread *io, struct wl_display *display)
+{
+	memset(io, 0, sizeof(*io));
+	io->display = display;
+	io->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (io->stop_fd < 0) {
+		fprintf(stderr, "eventfd failed: %m\n");
+		return -1;
+	}
+	io->queue = wl_display_create_queue(display);
+	if (io->queue == NULL) {
+		close(io->stop_fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+notify_all(struct io_thread *io)
+{
+	for (int i = 0; i < io->notify_count; i++)
+		event_source_wakeup(io->notify[i]);
+}
+
+static void *
+io_thread_run(void *data)
+{
+	struct io_thread *io = data;
+	struct pollfd fds[2] = {
+		{ wl_display_get_fd(io->display), POLLIN, 0 },
+		{ io->stop_fd, POLLIN, 0 },
+	};
+
+	for (;;) {
+		/* 这个队列上没有任何对象，prepare 总是一次成功 */
+		while (wl_display_prepare_read_queue(io->display, io->queue) != 0)
+			wl_display_dispatch_queue_pending(io->display, io->queue);
+
+		if (poll(fds, 2, -1) < 0) {
+			wl_display_cancel_read(io->display);
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			wl_display_cancel_read(io->display);
+			return NULL;
+		}
+		if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+			/* 出错时 read_events 返回 -1 */
+			if (wl_display_read_events(io->display) < 0)
+				break;
+			io->reads++;
+			notify_all(io);
+		} else {
+			wl_display_cancel_read(io->display);
+		}
+	}
+
+	fprintf(stderr, "wayland connection lost: %m\n");
+	__atomic_store_n(&io->error, 1, __ATOMIC_RELEASE);
+	notify_all(io);
+	return NULL;
+}
+
+int
+io_thread_start(struct io_thread *io)
+{
+	if (pthread_create(&io->thread, NULL, io_thread_run, io) != 0)
+		return -1;
+	io->running = 1;
+	return 0;
+}
+
+void
+io_thread_finish(struct io_thread *io)
+{
+	uint64_t one = 1;
+
+	if (io->running) {
+		if (write(io->stop_fd, &one, sizeof(one)) < 0)
+			fprintf(stderr, "stopping io thread failed: %m\n");
+		pthread_join(io->thread, NULL);
+		io->running = 0;
+	}
+	if (io->queue)
+		wl_event_queue_destroy(io->queue);
+	io->queue = NULL;
+	if (io->stop_fd >= 0)
+		close(io->stop_fd);
+	io->stop_fd = -1;
+}
+
+int
+io_thread_failed(struct io_thread *io)
+{
+	return __atomic_load_n(&io->error, __ATOMIC_ACQUIRE);
+}
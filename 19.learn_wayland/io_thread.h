@@ -0,0 +1,44 @@
+#ifndef IO_THREAD_H
+#define IO_THREAD_H
+
+#include <pthread.h>
+
+/* 专门读 Wayland socket 的线程
+ *
+ * 只有这个线程调用 wl_display_read_events，读到的事件由 libwayland 分到各个
+ * wl_event_queue，然后通过 eventfd 唤醒所有登记过的事件循环，
+ * 各个线程只 dispatch 自己的队列。主线程画得再慢，输入事件也会被及时读出来，
+ * 交给输入线程处理
+ *
+ * 它用一个永远为空的队列做 wl_display_prepare_read_queue，所以不需要自己 dispatch
+ * */
+
+#define IO_THREAD_MAX_LOOPS 4
+
+struct wl_display;
+struct wl_event_queue;
+struct event_source;
+
+struct io_thread {
+	struct wl_display *display;
+	struct wl_event_queue *queue;
+	pthread_t thread;
+	int running;
+	int stop_fd;
+	/* 读到事件后要唤醒的事件循环，只能在 io_thread_start 之前登记 */
+	struct event_source *notify[IO_THREAD_MAX_LOOPS];
+	int notify_count;
+	/* 连接断开后置 1，事件循环看到后返回 -1 */
+	int error;
+	/* 统计：读 socket 的次数 */
+	unsigned long reads;
+};
+
+int io_thread_init(struct io_thread *io, struct wl_display *display);
+int io_thread_start(struct io_thread *io);
+/* 停下线程并释放资源，登记的事件循环要在这之后再 finish */
+void io_thread_finish(struct io_thread *io);
+
+int io_thread_failed(struct io_thread *io);
+
+#endif
@@ -7,10 +7,23 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
 #include "xdg-shell-client-protocol.h"
 #include "text-input-unstable-v1-client-protocol.h"
+#include "tile_hash.h"
+#include "damage.h"
+#include "damage_diff.h"
+#include "write_track.h"
+#include "bench.h"
+#include "decoration.h"
+#include "event_loop.h"
+#include "io_thread.h"
+#include "frame_sched.h"
 #include <xkbcommon/xkbcommon.h>
 #include <assert.h>
+#include <linux/input-event-codes.h>
 
 struct my_xkb {
     struct xkb_context *context;
@@ -18,8 +31,46 @@ struct my_xkb {
     struct xkb_state *state;
 };
 
+#define BUFFER_COUNT 3
+#define MAX_OUTPUTS 8
+
+/* damage 的来源
+ * DAMAGE_HASH: 按 tile 画并计算 hash，和上一帧比较
+ * DAMAGE_DIFF: 直接画整帧，画完后和上一帧的 buffer 逐块比较
+ * DAMAGE_PAGES: 和 DAMAGE_HASH 一样画，damage 取自这一帧写过的内存页
+ * */
+enum damage_mode {
+    DAMAGE_HASH,
+    DAMAGE_DIFF,
+    DAMAGE_PAGES,
+};
+
+struct my_buffer {
+    struct my_output *output;
+    struct wl_buffer *wl_buffer;
+    uint32_t *data;
+    int32_t width;
+    int32_t height;
+    size_t size;
+    int busy;
+    /* buffer 里现有内容每个 tile 的 hash，新内容相同的 tile 不用重写 */
+    uint64_t *tile_hash;
+    int tile_count;
+    int hash_valid;
+};
+
+/* 合成器的一个输出，窗口进入后装饰按它的 scale 画 */
+struct output_info {
+    struct wl_output *wl_output;
+    uint32_t name;
+    int32_t scale;
+    int entered;
+};
+
 struct my_output {
+    struct wl_display *display;
     struct wl_compositor * compositor;
+    struct wl_subcompositor *subcompositor;
     struct wl_shm * shm;
 	struct xdg_wm_base *xdg_wm_base;
 	struct xdg_surface *xdg_surface;
@@ -33,11 +84,131 @@ struct my_output {
     uint32_t last_frame;
     int32_t width;
     int32_t height;
+    /* xdg_toplevel.configure 给的大小，开始画下一帧时才生效 */
+    int32_t conf_width;
+    int32_t conf_height;
     struct my_xkb xkb;
     struct zwp_text_input_manager_v1 *zwp_text_input_manager_v1;
     struct zwp_text_input_v1 *text_input;
+    struct my_buffer buffers[BUFFER_COUNT];
+    /* 最后一次提交给合成器的画面每个 tile 的 hash */
+    uint64_t *tile_hash;
+    int tiles_x;
+    int tiles_y;
+    int hash_valid;
+    struct damage damage;
+    enum damage_mode damage_mode;
+    /* 最后一次提交的 buffer，也就是合成器正在显示的内容 */
+    struct my_buffer *front;
+    int frame_pending;
+    uint32_t frames;
+    uint32_t skipped_frames;
+    /* 从 frame done 到 commit 的时间 */
+    uint64_t frame_done_ns;
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+    uint32_t latency_count;
+
+    /* 流水线模式：渲染线程在第 N 帧显示时画好第 N+1 帧，
+     * frame done 时只需要 attach/damage/commit
+     * 下面的字段和 buffer 的 busy 由 lock 保护
+     * */
+    int pipelined;
+    pthread_t render_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* 已经画好、等待提交的帧 */
+    struct my_buffer *ready;
+    struct damage ready_damage;
+    /* 需要渲染线程再画一帧 */
+    int render_wanted;
+    /* 渲染线程正在画 */
+    int rendering;
+    /* 画好后立即提交，不用等下一个 frame done */
+    int commit_on_ready;
+    int quit;
+
+    /* 窗口装饰画在主 surface 下面的子 surface 上，只在窗口大小或 scale 变化时重新拼一次
+     * decor 和 decor_scale 会被输入线程读，改的时候要拿 lock
+     * */
+    int decorations;
+    const struct decoration_patch *decor;
+    int decor_scale;
+    struct wl_surface *decor_surface;
+    struct wl_subsurface *decor_subsurface;
+    struct my_buffer decor_buffers[2];
+    /* 装饰 surface 的大小，逻辑像素 */
+    int32_t decor_width;
+    int32_t decor_height;
+    /* 还没按现在的大小和 scale 拼好(buffer 都在合成器手里或者分配失败)，
+     * 装饰 buffer 被释放时重试
+     * */
+    int decor_dirty;
+    /* 统计：拼装饰的次数和耗时，随帧统计一起打印 */
+    uint32_t decor_composes;
+    uint64_t decor_compose_ns;
+    /* 窗口所在的输出里最大的 scale 决定装饰的 scale */
+    struct output_info outputs[MAX_OUTPUTS];
+    int output_count;
+    /* 指针所在的 surface 和位置，用来处理标题栏拖动和关闭按钮 */
+    struct wl_surface *pointer_surface;
+    double pointer_x;
+    double pointer_y;
+    /* 输入线程(关闭按钮)和信号处理都会设置，主循环读，用原子操作访问 */
+    int closed;
+
+    /* 所有 fd 在同一个 epoll 里等：Wayland、按键重复的定时器、退出信号、
+     * 渲染线程画好一帧后的唤醒，没有事件时不会醒来
+     * */
+    struct event_loop loop;
+    struct event_source *repeat_timer;
+    struct event_source *present_wakeup;
+    /* 合成器给的按键重复速率(每秒几次)和延迟，速率为 0 表示不重复 */
+    int32_t repeat_rate;
+    int32_t repeat_delay;
+    uint32_t repeat_key;
+
+    /* --input-thread：io 线程负责读 socket，wl_seat 及其下的输入对象和 text input
+     * 放在 input_queue 里，由输入线程用自己的事件循环处理，
+     * 主线程只处理默认队列(窗口、frame callback)，画得慢也不会耽误输入
+     * */
+    int input_threaded;
+    struct io_thread io;
+    struct wl_event_queue *input_queue;
+    struct wl_registry *input_registry;
+    struct event_loop input_loop;
+    pthread_t input_thread;
+    struct event_source *input_stop;
+    int input_quit;
+    /* 输入线程要求关闭窗口时唤醒主线程 */
+    struct event_source *close_wakeup;
+
+    /* --render-load=MS：每帧额外忙等 MS 毫秒，模拟很慢的绘制 */
+    int render_load_ms;
+    /* 输入事件从合成器发出到被处理的延迟，只在处理输入的线程里访问 */
+    uint32_t input_events;
+    uint64_t input_delay_sum;
+    uint32_t input_delay_max;
+
+    /* --frame-pacing[=MARGIN_US]：收到 frame callback 后用定时器等到预测的时间再画，
+     * 等的时候事件循环照常运行，只用在同步绘制的模式
+     * */
+    int pacing;
+    struct frame_sched sched;
+    struct event_source *frame_timer;
+    /* 定时器已经定好，到时候会画下一帧 */
+    int frame_scheduled;
 };
 
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 static int
 set_cloexec_or_close(int fd)
 {
@@ -105,55 +276,483 @@ allocate_shm_file(size_t size)
 	return fd;
 }
 
+static void retry_decorations(struct my_output *state);
+
 static void
 wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
 {
     /* Sent by the compositor when it's no longer using this buffer */
-    wl_buffer_destroy(wl_buffer);
+    struct my_buffer *buffer = data;
+    struct my_output *state = buffer->output;
+
+    /* 渲染线程在等空闲的 buffer */
+    pthread_mutex_lock(&state->lock);
+    buffer->busy = 0;
+    pthread_cond_signal(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+
+    if (state->decor_dirty && buffer >= state->decor_buffers &&
+        buffer < state->decor_buffers + 2)
+        retry_decorations(state);
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
     .release = wl_buffer_release,
 };
 
-static struct wl_buffer* draw_frame(struct my_output *state)
+static void
+buffer_destroy(struct my_buffer *buffer)
+{
+    if (buffer->wl_buffer) {
+        wl_buffer_destroy(buffer->wl_buffer);
+        munmap(buffer->data, buffer->size);
+    }
+    free(buffer->tile_hash);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+static int
+shm_buffer_create(struct my_output *state, struct my_buffer *buffer,
+        int width, int height, uint32_t format)
 {
-    const int width = state->width, height = state->height;
     int stride = width * 4;
     int size = stride * height;
-    int offset = state->offset;
+
+    buffer_destroy(buffer);
 
     int fd = allocate_shm_file(size);
     if (fd == -1) {
-        return NULL;
+        return -1;
     }
 
     uint32_t *data = mmap(NULL, size,
             PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     if (data == MAP_FAILED) {
         close(fd);
-        return NULL;
+        return -1;
     }
 
     struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, size);
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0,
-            width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
+            width, height, stride, format);
     wl_shm_pool_destroy(pool);
     close(fd);
 
-    /* Draw checkerboxed background */
+    wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
+    buffer->output = state;
+    buffer->data = data;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->size = size;
+    return 0;
+}
+
+/* 窗口大小变化后重新分配 tile hash，下一帧整个窗口都算 damage */
+static void
+ensure_tiles(struct my_output *state)
+{
+    int tiles_x = (state->width + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (state->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    if (state->tile_hash && tiles_x == state->tiles_x && tiles_y == state->tiles_y)
+        return;
+
+    free(state->tile_hash);
+    state->tile_hash = calloc(tiles_x * tiles_y, sizeof(uint64_t));
+    state->tiles_x = tiles_x;
+    state->tiles_y = tiles_y;
+    state->hash_valid = 0;
+}
+
+/* buffer 的 tile hash 要和 state 的 tile 数一致，draw_frame 按 state 的 tile 数写 */
+static int
+buffer_ensure_tiles(struct my_output *state, struct my_buffer *buffer)
+{
+    int count = state->tiles_x * state->tiles_y;
+
+    if (buffer->tile_hash && buffer->tile_count == count)
+        return 0;
+    free(buffer->tile_hash);
+    buffer->tile_hash = calloc(count, sizeof(uint64_t));
+    buffer->tile_count = buffer->tile_hash ? count : 0;
+    buffer->hash_valid = 0;
+    return buffer->tile_hash ? 0 : -1;
+}
+
+static int
+buffer_allocate(struct my_output *state, struct my_buffer *buffer)
+{
+    if (shm_buffer_create(state, buffer, state->width, state->height,
+                WL_SHM_FORMAT_XRGB8888) < 0)
+        return -1;
+    /* 没跟踪上的 buffer 在 draw_frame_pages 里读不到写过的页，用 hash 的 damage */
+    if (state->damage_mode == DAMAGE_PAGES &&
+        write_track_register(buffer->data, buffer->size) < 0)
+        printf("failed to track writes to a %dx%d buffer, using tile hash damage for it\n",
+                buffer->width, buffer->height);
+    return buffer_ensure_tiles(state, buffer);
+}
+
+/* 取一个合成器没有在使用的 buffer，窗口大小变了的 buffer 重新分配 */
+static struct my_buffer *
+next_buffer(struct my_output *state)
+{
+    /* 先按现在的窗口大小算出 tile 数，再分配 buffer 的 tile hash */
+    ensure_tiles(state);
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        struct my_buffer *buffer = &state->buffers[i];
+        if (buffer->busy)
+            continue;
+        /* 比较时要用到上一帧的内容，不能在它上面画 */
+        if (state->damage_mode == DAMAGE_DIFF && buffer == state->front)
+            continue;
+        if (buffer->wl_buffer == NULL ||
+            buffer->width != state->width || buffer->height != state->height) {
+            if (buffer_allocate(state, buffer) < 0)
+                return NULL;
+        } else if (buffer_ensure_tiles(state, buffer) < 0) {
+            return NULL;
+        }
+        return buffer;
+    }
+    return NULL;
+}
+
+/* Draw checkerboxed background */
+static void
+draw_tile(struct my_output *state, uint32_t *data, int stride,
+        int x0, int y0, int width, int height)
+{
+    int offset = state->offset;
+
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            if ((x + offset + y + offset / 8 * 8) % 16 < 8)
-                data[y * width + x] = 0xFF666666;
+            if ((x0 + x + offset + y0 + y + offset / 8 * 8) % 16 < 8)
+                data[y * stride + x] = 0xFF666666;
             else
-                data[y * width + x] = 0xFFEEEEEE;
+                data[y * stride + x] = 0xFFEEEEEE;
+        }
+    }
+}
+
+/* 逐个 tile 画到一块小的临时内存里，趁数据还在缓存里计算 hash：
+ * - hash 和上一次提交的画面相同的 tile 不算 damage
+ * - hash 和 buffer 里已有内容以及上一帧都相同的 tile 不用写回 buffer，
+ *   和上一帧不同的 tile 一定会被写，按写过的页算 damage 时不会漏掉
+ * 没有任何 tile 变化时返回 0，这一帧不需要提交
+ * */
+static int
+draw_frame(struct my_output *state, struct my_buffer *buffer)
+{
+    uint32_t scratch[TILE_SIZE * TILE_SIZE];
+
+    /* tile 数已经在 next_buffer 里按这一帧的大小更新过了 */
+    damage_clear(&state->damage);
+
+    for (int ty = 0; ty < state->tiles_y; ty++) {
+        int y0 = ty * TILE_SIZE;
+        int h = state->height - y0 < TILE_SIZE ? state->height - y0 : TILE_SIZE;
+        int span_x = 0, span_w = 0;
+
+        for (int tx = 0; tx < state->tiles_x; tx++) {
+            int x0 = tx * TILE_SIZE;
+            int w = state->width - x0 < TILE_SIZE ? state->width - x0 : TILE_SIZE;
+            int idx = ty * state->tiles_x + tx;
+
+            draw_tile(state, scratch, TILE_SIZE, x0, y0, w, h);
+            uint64_t hash = tile_hash(scratch, TILE_SIZE, w, h);
+            int changed = !state->hash_valid || state->tile_hash[idx] != hash;
+
+            if (changed || !buffer->hash_valid || buffer->tile_hash[idx] != hash) {
+                for (int y = 0; y < h; y++)
+                    memcpy(buffer->data + (y0 + y) * buffer->width + x0,
+                           scratch + y * TILE_SIZE, w * 4);
+                buffer->tile_hash[idx] = hash;
+            }
+
+            /* 同一行连续变化的 tile 合成一个 damage 矩形 */
+            if (changed) {
+                if (span_w == 0)
+                    span_x = x0;
+                span_w += w;
+            } else if (span_w) {
+                damage_add(&state->damage, span_x, y0, span_w, h);
+                span_w = 0;
+            }
+            state->tile_hash[idx] = hash;
+        }
+        if (span_w)
+            damage_add(&state->damage, span_x, y0, span_w, h);
+    }
+
+    state->hash_valid = 1;
+    buffer->hash_valid = 1;
+    return state->damage.count > 0;
+}
+
+/* 画完再和上一帧比较得到 damage，适用于不知道自己改了哪里的绘制代码
+ * 按条带画，画完一条马上比较，新画的内容还在缓存里，比较时只需要从内存读上一帧
+ * 上一帧在另一个 buffer 里，大小变了或者还没有上一帧时整个窗口都是 damage
+ * */
+static int
+draw_frame_diff(struct my_output *state, struct my_buffer *buffer)
+{
+    struct my_buffer *front = state->front;
+    struct damage_diff diff;
+    int compare = front && front != buffer && front->data &&
+        front->width == buffer->width && front->height == buffer->height;
+
+    /* 这条路径不维护 tile hash */
+    buffer->hash_valid = 0;
+    state->hash_valid = 0;
+
+    damage_diff_begin(&diff, &state->damage, buffer->width, buffer->height,
+            buffer->width);
+    if (!compare)
+        damage_add(&state->damage, 0, 0, buffer->width, buffer->height);
+
+    for (int y0 = 0; y0 < state->height; y0 += TILE_SIZE) {
+        int h = state->height - y0 < TILE_SIZE ? state->height - y0 : TILE_SIZE;
+
+        draw_tile(state, buffer->data + y0 * buffer->width, buffer->width,
+                0, y0, state->width, h);
+        if (compare)
+            damage_diff_band(&diff, buffer->data, front->data, y0);
+    }
+    return state->damage.count > 0;
+}
+
+/* 按 tile 画，但 damage 不用 hash 的比较结果，
+ * 而是由内核记录的这个 buffer 上次画完以后写过的页得到，每页覆盖的行整行算作 damage
+ * 读不到写过的页时保留 hash 得到的 damage
+ * */
+static int
+draw_frame_pages(struct my_output *state, struct my_buffer *buffer)
+{
+    struct damage written;
+
+    draw_frame(state, buffer);
+    if (write_track_damage(&written, buffer->data, buffer->width,
+                buffer->height, buffer->width * 4) == 0)
+        state->damage = written;
+
+    return state->damage.count > 0;
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener;
+
+/* 已经有 frame callback 在等待时不再重复请求 */
+static void
+request_frame(struct my_output *state)
+{
+    if (state->frame_pending)
+        return;
+
+    struct wl_callback *cb = wl_surface_frame(state->wl_surface);
+    wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
+    state->frame_pending = 1;
+}
+
+/* 按 damage_mode 画一帧，返回 0 表示和上一帧相比没有变化 */
+static int
+render_frame(struct my_output *state, struct my_buffer *buffer)
+{
+    /* 画面一直滚动，每一帧都有变化，frame callback 不会停 */
+    if (state->render_load_ms) {
+        uint64_t end = now_ns() + state->render_load_ms * 1000000ull;
+        state->offset += 1;
+        while (now_ns() < end)
+            ;
+    }
+
+    if (state->damage_mode == DAMAGE_DIFF)
+        return draw_frame_diff(state, buffer);
+    else if (state->damage_mode == DAMAGE_PAGES)
+        return draw_frame_pages(state, buffer);
+    return draw_frame(state, buffer);
+}
+
+/* 提交之后的统计，每 60 帧打印一次 damage 和 commit 延迟 */
+static void
+frame_committed(struct my_output *state, const struct damage *damage)
+{
+    if (state->frame_done_ns) {
+        uint64_t latency = now_ns() - state->frame_done_ns;
+        state->latency_sum_ns += latency;
+        if (latency > state->latency_max_ns)
+            state->latency_max_ns = latency;
+        state->latency_count++;
+        state->frame_done_ns = 0;
+    }
+
+    state->skipped_frames = 0;
+    if (++state->frames % 60 == 0) {
+        printf("frame %u: %d damage rects, %lld of %d pixels\n",
+                state->frames, damage->count,
+                (long long)damage_area(damage),
+                state->width * state->height);
+        if (state->latency_count) {
+            printf("frame done -> commit: avg %.1f us, max %.1f us (%s)\n",
+                    state->latency_sum_ns / 1000.0 / state->latency_count,
+                    state->latency_max_ns / 1000.0,
+                    state->pipelined ? "pipelined" : "synchronous");
+            state->latency_sum_ns = 0;
+            state->latency_max_ns = 0;
+            state->latency_count = 0;
+        }
+        if (state->decor_composes) {
+            printf("decorations: %u composed at scale %d, avg %.1f us\n",
+                    state->decor_composes, state->decor_scale,
+                    state->decor_compose_ns / 1000.0 / state->decor_composes);
+            state->decor_composes = 0;
+            state->decor_compose_ns = 0;
         }
     }
+}
+
+/* 画一帧并提交，返回 0 表示这一帧没有提交
+ * 画面没有变化时既不 attach/commit，也不再请求 frame callback，
+ * 直到窗口状态变化(比如 configure)再重新开始
+ * */
+static int
+redraw(struct my_output *state)
+{
+    state->width = state->conf_width;
+    state->height = state->conf_height;
+
+    struct my_buffer *buffer = next_buffer(state);
 
-    munmap(data, size);
-    wl_buffer_add_listener(buffer, &wl_buffer_listener, NULL);
-    return buffer;
+    if (buffer == NULL) {
+        /* buffer 都在合成器手里，等下一个 frame callback 再画 */
+        request_frame(state);
+        wl_surface_commit(state->wl_surface);
+        return 1;
+    }
+
+    if (!render_frame(state, buffer)) {
+        state->frame_done_ns = 0;
+        if (state->skipped_frames++ == 0)
+            printf("no tile changed, skip commit and stop frame callbacks\n");
+        return 0;
+    }
+
+    request_frame(state);
+    wl_surface_attach(state->wl_surface, buffer->wl_buffer, 0, 0);
+    for (int i = 0; i < state->damage.count; i++) {
+        struct damage_rect *r = &state->damage.rects[i];
+        wl_surface_damage_buffer(state->wl_surface, r->x, r->y, r->width, r->height);
+    }
+    buffer->busy = 1;
+    wl_surface_commit(state->wl_surface);
+    state->front = buffer;
+
+    frame_committed(state, &state->damage);
+    return 1;
+}
+
+/* 提交渲染线程画好的帧，这里只有 attach/damage/commit，调用时持有 lock
+ * 提交后马上让渲染线程开始画下一帧
+ * */
+static void
+pipeline_present(struct my_output *state)
+{
+    struct my_buffer *buffer = state->ready;
+
+    state->ready = NULL;
+    state->commit_on_ready = 0;
+
+    request_frame(state);
+    wl_surface_attach(state->wl_surface, buffer->wl_buffer, 0, 0);
+    for (int i = 0; i < state->ready_damage.count; i++) {
+        struct damage_rect *r = &state->ready_damage.rects[i];
+        wl_surface_damage_buffer(state->wl_surface, r->x, r->y, r->width, r->height);
+    }
+    wl_surface_commit(state->wl_surface);
+    state->front = buffer;
+    frame_committed(state, &state->ready_damage);
+
+    state->render_wanted = 1;
+    pthread_cond_signal(&state->cond);
+}
+
+/* 渲染线程：有空闲 buffer 且上一帧已经提交时就画下一帧
+ * tile hash、damage 这些渲染状态只有这个线程访问，
+ * 每一帧画好后都会按顺序提交，所以和"上一帧"比较的结果仍然正确
+ * */
+static void *
+render_thread(void *data)
+{
+    struct my_output *state = data;
+
+    pthread_mutex_lock(&state->lock);
+    while (!state->quit) {
+        struct my_buffer *buffer = NULL;
+
+        if (state->render_wanted && state->ready == NULL) {
+            state->width = state->conf_width;
+            state->height = state->conf_height;
+            buffer = next_buffer(state);
+        }
+        if (buffer == NULL) {
+            pthread_cond_wait(&state->cond, &state->lock);
+            continue;
+        }
+
+        /* 画的时候合成器不会用这个 buffer，先占住它 */
+        buffer->busy = 1;
+        state->render_wanted = 0;
+        state->rendering = 1;
+        pthread_mutex_unlock(&state->lock);
+
+        int changed = render_frame(state, buffer);
+
+        pthread_mutex_lock(&state->lock);
+        state->rendering = 0;
+        if (changed) {
+            state->ready = buffer;
+            state->ready_damage = state->damage;
+            /* frame done 已经来过了，没必要再等，让主线程马上提交 */
+            if (state->commit_on_ready)
+                event_source_wakeup(state->present_wakeup);
+        } else {
+            buffer->busy = 0;
+            state->commit_on_ready = 0;
+            state->frame_done_ns = 0;
+            if (state->skipped_frames++ == 0)
+                printf("no tile changed, render thread goes idle\n");
+        }
+    }
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+/* 渲染线程画好了一帧，frame done 已经来过，在主线程里提交
+ * 这样所有的 Wayland 请求都从主线程发出
+ * */
+static void
+present_ready(void *data)
+{
+    struct my_output *state = data;
+
+    pthread_mutex_lock(&state->lock);
+    if (state->ready && state->commit_on_ready)
+        pipeline_present(state);
+    pthread_mutex_unlock(&state->lock);
+}
+
+/* 有画好的帧就直接提交，否则让渲染线程画完后唤醒主线程提交 */
+static void
+pipeline_kick(struct my_output *state)
+{
+    if (state->ready) {
+        pipeline_present(state);
+        return;
+    }
+    state->commit_on_ready = 1;
+    if (!state->rendering) {
+        state->render_wanted = 1;
+        pthread_cond_signal(&state->cond);
+    }
 }
 
 void test_format(void *data,
@@ -178,6 +777,29 @@ static const struct xdg_wm_base_listener xdg_wm_base_listener = {
     .ping = xdg_wm_base_ping,
 };
 
+/* 输入事件的 time 是合成器的毫秒时间戳，常见的合成器用的都是 CLOCK_MONOTONIC，
+ * 和现在的时间相减就是事件在 socket 和队列里等了多久
+ * */
+static void
+input_delay(struct my_output *state, uint32_t time)
+{
+    uint32_t delay = (uint32_t)(now_ns() / 1000000) - time;
+
+    /* 时钟对不上时没法比较 */
+    if (delay > 10000)
+        return;
+    state->input_delay_sum += delay;
+    if (delay > state->input_delay_max)
+        state->input_delay_max = delay;
+    if (++state->input_events % 200 == 0) {
+        printf("input: 200 events on the %s thread, delay avg %.1f ms, max %u ms\n",
+                state->input_threaded ? "input" : "main",
+                state->input_delay_sum / 200.0, state->input_delay_max);
+        state->input_delay_sum = 0;
+        state->input_delay_max = 0;
+    }
+}
+
 static void wl_pointer_enter(void *data,
 	      struct wl_pointer *wl_pointer,
 	      uint32_t serial,
@@ -185,6 +807,10 @@ static void wl_pointer_enter(void *data,
 	      wl_fixed_t surface_x,
 	      wl_fixed_t surface_y)
 {
+    struct my_output *state = data;
+    state->pointer_surface = surface;
+    state->pointer_x = wl_fixed_to_double(surface_x);
+    state->pointer_y = wl_fixed_to_double(surface_y);
     printf("catch wl pointer enter event,(%f,%f) serial:%d\n", wl_fixed_to_double(surface_x), wl_fixed_to_double(surface_y), serial);
 }
 
@@ -193,6 +819,8 @@ static void wl_pointer_leave(void *data,
 	      uint32_t serial,
 	      struct wl_surface *surface)
 {
+    struct my_output *state = data;
+    state->pointer_surface = NULL;
 }
 
 static void wl_pointer_motion(void *data,
@@ -201,6 +829,10 @@ static void wl_pointer_motion(void *data,
 	       wl_fixed_t surface_x,
 	       wl_fixed_t surface_y)
 {
+    struct my_output *state = data;
+    state->pointer_x = wl_fixed_to_double(surface_x);
+    state->pointer_y = wl_fixed_to_double(surface_y);
+    input_delay(state, time);
 }
 
 static void wl_pointer_button(void *data,
@@ -210,7 +842,31 @@ static void wl_pointer_button(void *data,
 	       uint32_t button,
 	       uint32_t state)
 {
+    struct my_output *output = data;
     printf("catch button event:%d\n", button);
+    input_delay(output, time);
+
+    if (!output->decorations || output->pointer_surface != output->decor_surface ||
+        button != BTN_LEFT || state != WL_POINTER_BUTTON_STATE_PRESSED)
+        return;
+
+    /* 在装饰上按下左键：点中关闭按钮就退出，否则开始拖动窗口
+     * 装饰的九宫格和大小由主线程更新，按钮的位置换算成逻辑像素
+     * */
+    pthread_mutex_lock(&output->lock);
+    const struct decoration_patch *p = output->decor;
+    double scale = output->decor_scale;
+    double bx = output->decor_width - p->button_right / scale;
+    double by = p->button_top / scale;
+    double bs = p->button_size / scale;
+    pthread_mutex_unlock(&output->lock);
+    if (output->pointer_x >= bx && output->pointer_x < bx + bs &&
+        output->pointer_y >= by && output->pointer_y < by + bs) {
+        __atomic_store_n(&output->closed, 1, __ATOMIC_RELEASE);
+        if (output->close_wakeup)
+            event_source_wakeup(output->close_wakeup);
+    } else
+        xdg_toplevel_move(output->xdg_toplevel, output->wl_seat, serial);
 }
 
 static struct wl_pointer_listener wl_pointer_listener = {
@@ -231,16 +887,17 @@ static void wl_keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
     assert(map_shm != MAP_FAILED);
     //printf("map share memory for keyboard:%s\n", map_shm);
     /* 生成 keymap */
-    state->xkb.keymap = xkb_keymap_new_from_string(state->xkb.context, map_shm,
+    struct xkb_keymap *keymap = xkb_keymap_new_from_string(state->xkb.context, map_shm,
         XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
     munmap(map_shm, size);
     close(fd);
-    state->xkb.state = xkb_state_new(state->xkb.keymap);
-    /* 这里为什么要执行这个 keymap 和 state 的 unref ???
-     * 取消，之前 xkb 键的映射，以防合成器在运行时候更改键位
+    /* 取消之前 xkb 键的映射，以防合成器在运行时候更改键位
+     * 新的 keymap 和 state 之后还要用(按键、按键重复)，不能马上 unref
      * */
-    xkb_keymap_unref(state->xkb.keymap);
     xkb_state_unref(state->xkb.state);
+    xkb_keymap_unref(state->xkb.keymap);
+    state->xkb.keymap = keymap;
+    state->xkb.state = xkb_state_new(keymap);
 }
 
 void wl_keyboard_enter(void *data,
@@ -270,6 +927,27 @@ void wl_keyboard_leave(void *data,
 	      struct wl_surface *surface)
 {
     printf("catch keyboard leave\n");
+    struct my_output *state = (struct my_output *)data;
+    /* 失去焦点就收不到松开的事件了 */
+    state->repeat_key = 0;
+    if (state->repeat_timer)
+        event_source_timer_update(state->repeat_timer, 0, 0);
+}
+
+static void
+print_key(struct my_output *state, uint32_t key)
+{
+    char buf[128];
+
+    if (state->xkb.state == NULL)
+        return;
+    xkb_keysym_t sym = xkb_state_key_get_one_sym(
+                    state->xkb.state, key + 8);
+    xkb_keysym_get_name(sym, buf, sizeof(buf));
+    fprintf(stderr, "sym: %-12s (%d), ", buf, sym);
+    xkb_state_key_get_utf8(state->xkb.state,
+                    key + 8, buf, sizeof(buf));
+    fprintf(stderr, "utf8: '%s'\n", buf);
 }
 
 void wl_keyboard_key(void *data,
@@ -281,16 +959,35 @@ void wl_keyboard_key(void *data,
 {
     printf("catch keyboard key event\n");
     struct my_output *my_state = (struct my_output *)data;
-    char buf[128];
 
     printf("key=%d\n", key);
-    xkb_keysym_t sym = xkb_state_key_get_one_sym(
-                    my_state->xkb.state, key + 8);
-    xkb_keysym_get_name(sym, buf, sizeof(buf));
-    fprintf(stderr, "sym: %-12s (%d), ", buf, sym);
-    xkb_state_key_get_utf8(my_state->xkb.state,
-                    key + 8, buf, sizeof(buf));
-    fprintf(stderr, "utf8: '%s'\n", buf);
+    print_key(my_state, key);
+    input_delay(my_state, time);
+
+    /* 按下可以重复的键时启动定时器，松开或者按了别的键时停下 */
+    if (my_state->repeat_timer == NULL || my_state->xkb.keymap == NULL)
+        return;
+    if (state == WL_KEYBOARD_KEY_STATE_PRESSED && my_state->repeat_rate > 0 &&
+        xkb_keymap_key_repeats(my_state->xkb.keymap, key + 8)) {
+        my_state->repeat_key = key;
+        event_source_timer_update(my_state->repeat_timer, my_state->repeat_delay,
+                1000 / my_state->repeat_rate);
+    } else if (state == WL_KEYBOARD_KEY_STATE_PRESSED || key == my_state->repeat_key) {
+        my_state->repeat_key = 0;
+        event_source_timer_update(my_state->repeat_timer, 0, 0);
+    }
+}
+
+/* 按键重复的定时器，处理晚了就把错过的次数补上 */
+static void
+key_repeat(void *data, uint64_t expirations)
+{
+    struct my_output *state = data;
+
+    for (uint64_t i = 0; i < expirations && state->repeat_key; i++) {
+        printf("key=%d (repeat)\n", state->repeat_key);
+        print_key(state, state->repeat_key);
+    }
 }
 
 void wl_keyboard_modifiers(void *data,
@@ -310,6 +1007,12 @@ void wl_keyboard_repeat_info(void *data,
 		    int32_t delay)
 {
     printf("catch keyboard repeat_info event\n");
+    struct my_output *state = (struct my_output *)data;
+    state->repeat_rate = rate;
+    state->repeat_delay = delay;
+    /* 最快也只能 1 毫秒一次 */
+    if (state->repeat_rate > 1000)
+        state->repeat_rate = 1000;
 }
 
 static struct wl_keyboard_listener wl_keyboard_listener = {
@@ -460,6 +1163,196 @@ static const struct wl_seat_listener wl_seat_listener = {
     .name = wl_seat_name,
 };
 
+/* 内容大小变化时把缓存的九宫格重新铺到装饰 buffer 上
+ * 装饰子 surface 是同步模式，会和下一次主 surface 的提交一起生效
+ * 九宫格的尺寸是 buffer 像素，换算成逻辑像素要除以 scale(主题的尺寸都是 scale 的整数倍)
+ * */
+static void
+update_decorations(struct my_output *state, int32_t width, int32_t height)
+{
+    const struct decoration_patch *p = state->decor;
+    int scale = state->decor_scale;
+    int dw = width * scale + p->content_left + p->content_right;
+    int dh = height * scale + p->content_top + p->content_bottom;
+    struct my_buffer *buffer = NULL;
+
+    if (!state->decor_dirty && dw / scale == state->decor_width &&
+        dh / scale == state->decor_height)
+        return;
+    /* 下面任何一步没做成都留到装饰 buffer 被释放时再来 */
+    state->decor_dirty = 1;
+
+    for (int i = 0; i < 2; i++) {
+        if (!state->decor_buffers[i].busy) {
+            buffer = &state->decor_buffers[i];
+            break;
+        }
+    }
+    if (buffer == NULL)
+        return;
+    if (buffer->wl_buffer == NULL || buffer->width != dw || buffer->height != dh) {
+        if (shm_buffer_create(state, buffer, dw, dh, WL_SHM_FORMAT_ARGB8888) < 0)
+            return;
+    }
+
+    uint64_t t0 = now_ns();
+    decoration_compose(p, buffer->data, dw, dw, dh);
+    state->decor_compose_ns += now_ns() - t0;
+    state->decor_composes++;
+
+    wl_surface_attach(state->decor_surface, buffer->wl_buffer, 0, 0);
+    wl_surface_set_buffer_scale(state->decor_surface, scale);
+    wl_surface_damage_buffer(state->decor_surface, 0, 0, dw, dh);
+    buffer->busy = 1;
+
+    /* 阴影部分不接收输入，点击会落到后面的窗口上 */
+    int frame_x = p->frame_left / scale, frame_y = p->frame_top / scale;
+    int frame_w = width + (p->frame_left + p->frame_right) / scale;
+    int frame_h = height + (p->frame_top + p->frame_bottom) / scale;
+    struct wl_region *region = wl_compositor_create_region(state->compositor);
+    wl_region_add(region, p->content_left / scale - frame_x,
+            p->content_top / scale - frame_y, frame_w, frame_h);
+    wl_surface_set_input_region(state->decor_surface, region);
+    wl_region_destroy(region);
+    wl_surface_commit(state->decor_surface);
+    wl_subsurface_set_position(state->decor_subsurface,
+            -p->content_left / scale, -p->content_top / scale);
+
+    /* 窗口的几何范围包括标题栏和边框，不包括阴影 */
+    xdg_surface_set_window_geometry(state->xdg_surface,
+            -frame_x, -frame_y, frame_w, frame_h);
+
+    pthread_mutex_lock(&state->lock);
+    state->decor_width = dw / scale;
+    state->decor_height = dh / scale;
+    pthread_mutex_unlock(&state->lock);
+    state->decor_dirty = 0;
+}
+
+/* 装饰 buffer 被释放或 scale 变了，按最近一次 configure 的大小补拼，
+ * 再提交主 surface 让同步模式的子 surface 和窗口几何生效，提交的方式和 configure 一样
+ * */
+static void
+retry_decorations(struct my_output *state)
+{
+    pthread_mutex_lock(&state->lock);
+    int32_t width = state->conf_width, height = state->conf_height;
+    pthread_mutex_unlock(&state->lock);
+
+    if (width <= 0 || height <= 0)
+        return;
+    update_decorations(state, width, height);
+    if (state->decor_dirty)
+        return;
+
+    if (state->pipelined) {
+        pthread_mutex_lock(&state->lock);
+        if (state->ready == NULL)
+            wl_surface_commit(state->wl_surface);
+        pipeline_kick(state);
+        pthread_mutex_unlock(&state->lock);
+    } else if (!state->frame_scheduled && !redraw(state)) {
+        wl_surface_commit(state->wl_surface);
+    }
+}
+
+/* 窗口所在的输出变了或者输出的 scale 变了，装饰换成对应 scale 的九宫格 */
+static void
+update_scale(struct my_output *state)
+{
+    const struct decoration_patch *p;
+    int scale = 1;
+
+    for (int i = 0; i < state->output_count; i++)
+        if (state->outputs[i].entered && state->outputs[i].scale > scale)
+            scale = state->outputs[i].scale;
+    /* 初始化时的 roundtrip 里输出的事件就来了，那时装饰还没建好 */
+    if (state->decor_surface == NULL || scale == state->decor_scale)
+        return;
+
+    /* 缓存里旧的九宫格可能被淘汰，输入线程读它时拿着锁 */
+    pthread_mutex_lock(&state->lock);
+    p = decoration_get(&decoration_default_theme, scale);
+    if (p) {
+        state->decor = p;
+        state->decor_scale = scale;
+    }
+    pthread_mutex_unlock(&state->lock);
+    if (p == NULL)
+        return;
+    state->decor_dirty = 1;
+    retry_decorations(state);
+}
+
+static struct output_info *
+find_output(struct my_output *state, struct wl_output *wl_output)
+{
+    for (int i = 0; i < state->output_count; i++)
+        if (state->outputs[i].wl_output == wl_output)
+            return &state->outputs[i];
+    return NULL;
+}
+
+static void
+output_geometry(void *data, struct wl_output *wl_output, int32_t x, int32_t y,
+        int32_t physical_width, int32_t physical_height, int32_t subpixel,
+        const char *make, const char *model, int32_t transform)
+{
+}
+
+static void
+output_mode(void *data, struct wl_output *wl_output, uint32_t flags,
+        int32_t width, int32_t height, int32_t refresh)
+{
+}
+
+static void
+output_scale(void *data, struct wl_output *wl_output, int32_t factor)
+{
+    struct output_info *output = find_output(data, wl_output);
+    if (output && factor > 0)
+        output->scale = factor;
+}
+
+/* 一组属性发完才生效 */
+static void
+output_done(void *data, struct wl_output *wl_output)
+{
+    update_scale(data);
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale,
+};
+
+static void
+surface_enter(void *data, struct wl_surface *surface, struct wl_output *wl_output)
+{
+    struct output_info *output = find_output(data, wl_output);
+    if (output) {
+        output->entered = 1;
+        update_scale(data);
+    }
+}
+
+static void
+surface_leave(void *data, struct wl_surface *surface, struct wl_output *wl_output)
+{
+    struct output_info *output = find_output(data, wl_output);
+    if (output) {
+        output->entered = 0;
+        update_scale(data);
+    }
+}
+
+static const struct wl_surface_listener surface_listener = {
+    .enter = surface_enter,
+    .leave = surface_leave,
+};
+
 static void registry_handle_global(void *data, struct wl_registry *registry,
 		uint32_t name, const char *interface, uint32_t version)
 {
@@ -471,6 +1364,10 @@ static void registry_handle_global(void *data, struct wl_registry *registry,
 		/* 绑定混合器 */
 		state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
 		printf("绑定混合器\n");
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        state->subcompositor = wl_registry_bind(
+            registry, name, &wl_subcompositor_interface, 1);
+		printf("绑定 wl_subcompositor\n");
 	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
         state->shm = wl_registry_bind(
             registry, name, &wl_shm_interface, 1);
@@ -482,16 +1379,39 @@ static void registry_handle_global(void *data, struct wl_registry *registry,
 		xdg_wm_base_add_listener(state->xdg_wm_base, &xdg_wm_base_listener, state);
 		printf("绑定 xdg_wm_base\n");
 	} else if (strcmp(interface, wl_seat_interface.name) == 0) {
+        /* wl_keyboard.repeat_info 需要版本 4
+         * --input-thread 时通过输入队列的 registry wrapper 绑定，
+         * 之后由它创建的 wl_pointer / wl_keyboard 也都在输入队列里
+         * */
         state->wl_seat = wl_registry_bind(
-            registry, name, &wl_seat_interface, 1);
+            state->input_registry ? state->input_registry : registry,
+            name, &wl_seat_interface, version < 4 ? version : 4);
 		wl_seat_add_listener(state->wl_seat, &wl_seat_listener, state);
 		printf("绑定 wl_seat\n");
 	} else if (strcmp(interface, zwp_text_input_manager_v1_interface.name) == 0) {
         state->zwp_text_input_manager_v1 = wl_registry_bind(
             registry, name, &zwp_text_input_manager_v1_interface, 1);
-        state->text_input = zwp_text_input_manager_v1_create_text_input(state->zwp_text_input_manager_v1);
+        struct zwp_text_input_manager_v1 *manager = state->zwp_text_input_manager_v1;
+        /* 用 wrapper 指定队列，不去改 manager 本身的队列 */
+        if (state->input_queue) {
+            manager = wl_proxy_create_wrapper(manager);
+            wl_proxy_set_queue((struct wl_proxy *)manager, state->input_queue);
+        }
+        state->text_input = zwp_text_input_manager_v1_create_text_input(manager);
+        if (manager != state->zwp_text_input_manager_v1)
+            wl_proxy_wrapper_destroy(manager);
         zwp_text_input_v1_add_listener(state->text_input, &zwp_text_input_v1_listener, state);
         printf("绑定 zwp_text_input_v1\n");
+    } else if (strcmp(interface, wl_output_interface.name) == 0 &&
+            state->output_count < MAX_OUTPUTS) {
+        /* scale 事件需要版本 2 */
+        struct output_info *output = &state->outputs[state->output_count++];
+        output->wl_output = wl_registry_bind(registry, name,
+                &wl_output_interface, version < 2 ? version : 2);
+        output->name = name;
+        output->scale = 1;
+        wl_output_add_listener(output->wl_output, &output_listener, state);
+        printf("绑定 wl_output\n");
     }
 }
 
@@ -499,7 +1419,17 @@ static void
 registry_handle_global_remove(void *data, struct wl_registry *registry,
 		uint32_t name)
 {
-	// This space deliberately left blank
+    struct my_output *state = data;
+
+    /* 拔掉的显示器 */
+    for (int i = 0; i < state->output_count; i++) {
+        if (state->outputs[i].name != name)
+            continue;
+        wl_output_destroy(state->outputs[i].wl_output);
+        state->outputs[i] = state->outputs[--state->output_count];
+        update_scale(state);
+        return;
+    }
 }
 
 static const struct wl_registry_listener
@@ -515,16 +1445,58 @@ xdg_surface_configure(void *data,
     struct my_output *state = data;
     xdg_surface_ack_configure(xdg_surface, serial);
 
-    struct wl_buffer *buffer = draw_frame(state);
-    wl_surface_attach(state->wl_surface, buffer, 0, 0);
-    wl_surface_commit(state->wl_surface);
+    if (state->decorations) {
+        pthread_mutex_lock(&state->lock);
+        int32_t width = state->conf_width, height = state->conf_height;
+        pthread_mutex_unlock(&state->lock);
+        update_decorations(state, width, height);
+    }
+
+    /* ack_configure 要在下一次 commit 时才生效，画面没变也要提交 */
+    if (state->pipelined) {
+        pthread_mutex_lock(&state->lock);
+        if (state->ready == NULL)
+            wl_surface_commit(state->wl_surface);
+        pipeline_kick(state);
+        pthread_mutex_unlock(&state->lock);
+    } else if (state->frame_scheduled) {
+        /* 定时器到了就会用新的大小画一帧并提交，ack 随它一起生效 */
+    } else if (!redraw(state)) {
+        wl_surface_commit(state->wl_surface);
+    }
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
     .configure = xdg_surface_configure,
 };
 
-static const struct wl_callback_listener wl_surface_frame_listener;
+/* Submit a frame, only the changed tiles are damaged
+ * and another frame is requested only if something changed */
+static void
+paced_redraw(struct my_output *state)
+{
+	if (state->pacing)
+		frame_sched_start(&state->sched);
+
+	uint32_t frames = state->frames;
+	if (!redraw(state)) {
+		/* 没有再请求 callback，下一个 callback 离这次很远，不能拿来预测 */
+		if (state->pacing)
+			frame_sched_reset(&state->sched);
+	} else if (state->pacing && state->frames != frames) {
+		frame_sched_rendered(&state->sched, now_ns());
+	}
+}
+
+/* 在 frame callback 里定的时间到了，这时候已经处理完了之前读到的事件 */
+static void
+frame_timer_fired(void *data, uint64_t expirations)
+{
+	struct my_output *state = data;
+
+	state->frame_scheduled = 0;
+	paced_redraw(state);
+}
 
 static void
 wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
@@ -532,25 +1504,32 @@ wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
 	/* Destroy this callback */
 	wl_callback_destroy(cb);
 
-	/* Request another frame */
 	struct my_output *state = data;
-	cb = wl_surface_frame(state->wl_surface);
-	wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
-
-	/* Update scroll amount at 24 pixels per second */
-	if (state->last_frame != 0) {
-		int elapsed = time - state->last_frame;
-		//state->offset += elapsed / 1000.0 * 24;
-		state->offset += 0; //elapsed / 1000.0 * 24;
-	}
 
-	/* Submit a frame for this event */
-	struct wl_buffer *buffer = draw_frame(state);
-	wl_surface_attach(state->wl_surface, buffer, 0, 0);
-	wl_surface_damage_buffer(state->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
-	wl_surface_commit(state->wl_surface);
+	if (state->pipelined) {
+		pthread_mutex_lock(&state->lock);
+		state->frame_pending = 0;
+		state->frame_done_ns = now_ns();
+		pipeline_kick(state);
+		pthread_mutex_unlock(&state->lock);
+		state->last_frame = time;
+		return;
+	}
 
+	state->frame_pending = 0;
+	state->frame_done_ns = now_ns();
 	state->last_frame = time;
+
+	/* 这里的 frame done -> commit 延迟包含了等定时器的时间 */
+	if (state->pacing) {
+		frame_sched_frame_done(&state->sched, time, state->frame_done_ns);
+		uint64_t start = frame_sched_plan(&state->sched);
+		if (start && event_source_timer_set_abs(state->frame_timer, start) == 0) {
+			state->frame_scheduled = 1;
+			return;
+		}
+	}
+	paced_redraw(state);
 }
 
 static const struct wl_callback_listener wl_surface_frame_listener = {
@@ -570,13 +1549,26 @@ void xdg_toplevel_configure(void *data,
         return;
     }
 
-    state->width = width;
-    state->height = height;
+    /* 合成器给的是整个窗口的大小，减去标题栏和边框才是内容的大小 */
+    if (state->decorations) {
+        const struct decoration_patch *p = state->decor;
+        width -= (p->frame_left + p->frame_right) / state->decor_scale;
+        height -= (p->frame_top + p->frame_bottom) / state->decor_scale;
+        if (width <= 0 || height <= 0)
+            return;
+    }
+
+    pthread_mutex_lock(&state->lock);
+    state->conf_width = width;
+    state->conf_height = height;
+    pthread_mutex_unlock(&state->lock);
 }
 
 void xdg_toplevel_close(void *data,
 	      struct xdg_toplevel *xdg_toplevel)
 {
+    struct my_output *state = data;
+    __atomic_store_n(&state->closed, 1, __ATOMIC_RELEASE);
 }
 
 static struct xdg_toplevel_listener xdg_toplevel_listener = {
@@ -584,15 +1576,95 @@ static struct xdg_toplevel_listener xdg_toplevel_listener = {
     .close = xdg_toplevel_close,
 };
 
+/* 主线程被唤醒后会检查 closed */
+static void
+close_requested(void *data)
+{
+}
+
+static void
+stop_input(void *data)
+{
+    struct my_output *state = data;
+    state->input_quit = 1;
+}
+
+static void *
+input_thread(void *data)
+{
+    struct my_output *state = data;
+
+    while (!state->input_quit && event_loop_dispatch(&state->input_loop, -1) != -1)
+        ;
+    return NULL;
+}
+
+static void
+handle_signal(void *data, int signo)
+{
+    struct my_output *state = data;
+    printf("caught signal %d, exiting\n", signo);
+    __atomic_store_n(&state->closed, 1, __ATOMIC_RELEASE);
+}
+
 int
 main(int argc, char *argv[])
 {
-	struct wl_display *display = wl_display_connect(NULL);
     struct my_output state = {0};
 	struct wl_surface *surface = NULL;
 
-    state.width = 900;
-    state.height = 900;
+    /* ./wldemo [--damage=hash|diff|pages] [--pipelined] [--input-thread] [--render-load=MS]
+     *          [--frame-pacing[=MARGIN_US]] [--no-decorations] [--bench-diff] [--bench-hash]
+     *          [--bench-pages]
+     * */
+    state.decorations = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--damage=diff") == 0)
+            state.damage_mode = DAMAGE_DIFF;
+        else if (strcmp(argv[i], "--damage=pages") == 0)
+            state.damage_mode = DAMAGE_PAGES;
+        else if (strcmp(argv[i], "--damage=hash") == 0)
+            state.damage_mode = DAMAGE_HASH;
+        else if (strcmp(argv[i], "--no-decorations") == 0)
+            state.decorations = 0;
+        else if (strcmp(argv[i], "--pipelined") == 0)
+            state.pipelined = 1;
+        else if (strcmp(argv[i], "--input-thread") == 0)
+            state.input_threaded = 1;
+        else if (strncmp(argv[i], "--render-load=", 14) == 0)
+            state.render_load_ms = atoi(argv[i] + 14);
+        else if (strcmp(argv[i], "--frame-pacing") == 0 ||
+                strncmp(argv[i], "--frame-pacing=", 15) == 0) {
+            /* 默认要求提交在刷新前 2 ms 完成 */
+            state.pacing = 1;
+            frame_sched_init(&state.sched, argv[i][14] == '=' ? atoi(argv[i] + 15) : 2000);
+        }
+        else if (strcmp(argv[i], "--bench-diff") == 0)
+            return bench_damage_diff();
+        else if (strcmp(argv[i], "--bench-hash") == 0)
+            return bench_tile_hash() < 0 ? 1 : 0;
+        else if (strcmp(argv[i], "--bench-pages") == 0)
+            return bench_write_track() < 0 ? 1 : 0;
+    }
+
+    /* 流水线模式下一帧在上一帧显示时就画好了，没有可以推迟的绘制 */
+    if (state.pacing && state.pipelined) {
+        printf("--frame-pacing only applies to synchronous rendering, ignored\n");
+        state.pacing = 0;
+    }
+
+    if (state.damage_mode == DAMAGE_PAGES && write_track_init() < 0) {
+        printf("userfaultfd write tracking unavailable, using tile hash damage\n");
+        state.damage_mode = DAMAGE_HASH;
+    }
+
+	struct wl_display *display = wl_display_connect(NULL);
+
+    state.display = display;
+    state.width = state.conf_width = 900;
+    state.height = state.conf_height = 900;
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cond, NULL);
 	if (display)
 	{
 		printf("Create connection success\n");
@@ -603,7 +1675,43 @@ main(int argc, char *argv[])
 		return -1;
 	}
 
+    /* --input-thread 时两个事件循环都不读 socket，由 io 线程读到事件后唤醒 */
+    if (state.input_threaded) {
+        if (io_thread_init(&state.io, display) < 0)
+            return -1;
+        state.input_queue = wl_display_create_queue(display);
+        if (state.input_queue == NULL ||
+            event_loop_init_queue(&state.loop, display, NULL, &state.io) < 0 ||
+            event_loop_init_queue(&state.input_loop, display, state.input_queue, &state.io) < 0)
+            return -1;
+        state.input_stop = event_loop_add_wakeup(&state.input_loop, stop_input, &state);
+        state.close_wakeup = event_loop_add_wakeup(&state.loop, close_requested, &state);
+    } else if (event_loop_init(&state.loop, display) < 0) {
+        return -1;
+    }
+
+    /* 信号要在创建其他线程之前屏蔽，它们继承屏蔽字后信号只会从 signalfd 读到 */
+    state.loop.report_ms = 5000;
+    event_loop_add_signal(&state.loop, SIGINT, handle_signal, &state);
+    event_loop_add_signal(&state.loop, SIGTERM, handle_signal, &state);
+    /* 按键重复由处理键盘事件的线程负责 */
+    state.repeat_timer = event_loop_add_timer(
+            state.input_threaded ? &state.input_loop : &state.loop, key_repeat, &state);
+    state.present_wakeup = event_loop_add_wakeup(&state.loop, present_ready, &state);
+    if (state.pacing) {
+        state.frame_timer = event_loop_add_timer(&state.loop, frame_timer_fired, &state);
+        if (state.frame_timer == NULL)
+            state.pacing = 0;
+    }
+    /* 合成器不发 repeat_info 时(wl_seat 版本低于 4)用常见的默认值 */
+    state.repeat_rate = 25;
+    state.repeat_delay = 600;
+
 	struct wl_registry *registry = wl_display_get_registry(display);
+    if (state.input_queue) {
+        state.input_registry = wl_proxy_create_wrapper(registry);
+        wl_proxy_set_queue((struct wl_proxy *)state.input_registry, state.input_queue);
+    }
     state.xkb.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 	wl_registry_add_listener(registry, &registry_listener, &state);
 	wl_display_roundtrip(display);
@@ -634,17 +1742,45 @@ main(int argc, char *argv[])
     xdg_toplevel_add_listener(state.xdg_toplevel, &xdg_toplevel_listener, &state);
     //xdg_toplevel_set_fullscreen(state.xdg_toplevel, state.wl);
 
+    /* 先按 scale 1 画，进入输出后再换成它的 scale */
+    wl_surface_add_listener(state.wl_surface, &surface_listener, &state);
+    if (state.decorations && state.subcompositor)
+        state.decor = decoration_get(&decoration_default_theme, 1);
+    if (state.decor) {
+        state.decor_scale = 1;
+        state.decor_surface = wl_compositor_create_surface(state.compositor);
+        state.decor_subsurface = wl_subcompositor_get_subsurface(
+                state.subcompositor, state.decor_surface, state.wl_surface);
+        wl_subsurface_place_below(state.decor_subsurface, state.wl_surface);
+        wl_subsurface_set_position(state.decor_subsurface,
+                -state.decor->content_left, -state.decor->content_top);
+    } else {
+        state.decorations = 0;
+    }
+
+    if (state.pipelined && (state.present_wakeup == NULL ||
+        pthread_create(&state.render_thread, NULL, render_thread, &state) != 0)) {
+        printf("failed to start render thread, rendering synchronously\n");
+        state.pipelined = 0;
+    }
+
+    /* 从这里开始只有 io 线程读 socket，主线程不能再 roundtrip */
+    if (state.input_threaded &&
+        (io_thread_start(&state.io) < 0 ||
+         pthread_create(&state.input_thread, NULL, input_thread, &state) != 0)) {
+        printf("failed to start the io and input threads\n");
+        return -1;
+    }
+
     wl_surface_commit(state.wl_surface);
 	printf("buffer commit is done\n");
 
-    struct wl_callback *cb = wl_surface_frame(state.wl_surface);
-	wl_callback_add_listener(cb, &wl_surface_frame_listener, &state);
-
     zwp_text_input_v1_show_input_panel(state.text_input);
     zwp_text_input_v1_activate(state.text_input, state.wl_seat, state.wl_surface);
     printf("show keyboard virtual\n");
 	/* 处理接收到的 events */
-	while (-1 != wl_display_dispatch(display))
+	while (!__atomic_load_n(&state.closed, __ATOMIC_ACQUIRE) &&
+	       -1 != event_loop_dispatch(&state.loop, -1))
 	{
 #if 0
 		sleep(10);
@@ -666,6 +1802,26 @@ main(int argc, char *argv[])
 #endif
 	}
 
+    /* 先停输入线程和 io 线程，io 线程会唤醒两个事件循环，之后才能释放它们 */
+    if (state.input_threaded) {
+        event_source_wakeup(state.input_stop);
+        pthread_join(state.input_thread, NULL);
+        io_thread_finish(&state.io);
+        event_loop_finish(&state.input_loop);
+        /* 只是 registry 的包装，通过它创建的对象还在 input_queue 上 */
+        wl_proxy_wrapper_destroy(state.input_registry);
+    }
+    if (state.pipelined) {
+        pthread_mutex_lock(&state.lock);
+        state.quit = 1;
+        pthread_cond_signal(&state.cond);
+        pthread_mutex_unlock(&state.lock);
+        pthread_join(state.render_thread, NULL);
+    }
+    if (state.damage_mode == DAMAGE_PAGES) {
+        write_track_finish();
+    }
+    event_loop_finish(&state.loop);
 	return 0;
 }
 
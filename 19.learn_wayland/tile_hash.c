@@ -0,0 +1,156 @@
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "tile_hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define PRIME32_1 0x9E3779B1U
+
+/* 和数据异或的密钥，作用和 XXH3 的 secret 一样：
+ * 一行里第 s 组(32 字节)用 secret[s] 开始的 4 个数，同样的数据放在不同的位置
+ * 会得到不同的结果，交换两组数据 hash 就会变。
+ * 一次最多累加 STRIPES_PER_BLOCK 组，之后用最后 4 个数打乱累加器，
+ * 每一行结束时也打乱一次，所以交换两行、整块平移 hash 也会变
+ * */
+#define STRIPES_PER_BLOCK 16
+#define SECRET_SIZE 24
+#define SCRAMBLE_KEY (SECRET_SIZE - 4)
+
+static const uint64_t secret[SECRET_SIZE] = {
+	0x10ed8e5b59c65c69ULL, 0x0f8313de44630002ULL, 0x296493c150b58b95ULL,
+	0x88864468eea31a80ULL, 0xc2c7f5a78c66df1eULL, 0xef100433672293a8ULL,
+	0x5a3560386242688fULL, 0x9995d657d4090dcdULL, 0xad900f92f3c61d5dULL,
+	0xdb62975a5c02c19eULL, 0xee76fce00f3a4885ULL, 0xe6757bfa21374758ULL,
+	0x525b552fafcf90ecULL, 0xc54cc45fc42d888bULL, 0x0718aa76d9191647ULL,
+	0x9f417ac957cede98ULL, 0x3ac2127645fddfcfULL, 0xe859fcfd1f49e4dcULL,
+	0x9f4ab9248623aedbULL, 0xbfcfc8293827aaadULL, 0x13e48d489e46d2dcULL,
+	0xb55492661c293b1dULL, 0x94137e2dfb847cc3ULL, 0xa6e6c9ee71fda535ULL,
+};
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+/* 32 字节一组，4 路累加，第 s 组的 key 是 secret + s：
+ * acc[i] += lo32(d[i] ^ key[i]) * hi32(d[i] ^ key[i]) + d[i ^ 1]
+ * stripes 不超过 STRIPES_PER_BLOCK
+ * */
+static inline void
+accumulate_scalar(uint64_t acc[4], const uint8_t *p, int stripes)
+{
+	for (int s = 0; s < stripes; s++, p += 32) {
+		uint64_t d[4];
+		memcpy(d, p, sizeof(d));
+		for (int i = 0; i < 4; i++) {
+			uint64_t dk = d[i] ^ secret[s + i];
+			acc[i] += (uint64_t)(uint32_t)dk * (dk >> 32) + d[i ^ 1];
+		}
+	}
+}
+
+#if defined(__AVX2__)
+static inline void
+accumulate(uint64_t acc[4], const uint8_t *p, int stripes)
+{
+	__m256i a = _mm256_loadu_si256((const __m256i *)acc);
+
+	for (int s = 0; s < stripes; s++, p += 32) {
+		__m256i key = _mm256_loadu_si256((const __m256i *)(secret + s));
+		__m256i d = _mm256_loadu_si256((const __m256i *)p);
+		__m256i dk = _mm256_xor_si256(d, key);
+		__m256i prod = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+		__m256i swap = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+		a = _mm256_add_epi64(a, _mm256_add_epi64(prod, swap));
+	}
+	_mm256_storeu_si256((__m256i *)acc, a);
+}
+#elif defined(__SSE2__)
+static inline void
+accumulate(uint64_t acc[4], const uint8_t *p, int stripes)
+{
+	__m128i a0 = _mm_loadu_si128((const __m128i *)acc);
+	__m128i a1 = _mm_loadu_si128((const __m128i *)(acc + 2));
+
+	for (int s = 0; s < stripes; s++, p += 32) {
+		__m128i k0 = _mm_loadu_si128((const __m128i *)(secret + s));
+		__m128i k1 = _mm_loadu_si128((const __m128i *)(secret + s + 2));
+		__m128i d0 = _mm_loadu_si128((const __m128i *)p);
+		__m128i d1 = _mm_loadu_si128((const __m128i *)(p + 16));
+		__m128i dk0 = _mm_xor_si128(d0, k0);
+		__m128i dk1 = _mm_xor_si128(d1, k1);
+		__m128i prod0 = _mm_mul_epu32(dk0, _mm_srli_epi64(dk0, 32));
+		__m128i prod1 = _mm_mul_epu32(dk1, _mm_srli_epi64(dk1, 32));
+		a0 = _mm_add_epi64(a0, _mm_add_epi64(prod0,
+				_mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+		a1 = _mm_add_epi64(a1, _mm_add_epi64(prod1,
+				_mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+	_mm_storeu_si128((__m128i *)acc, a0);
+	_mm_storeu_si128((__m128i *)(acc + 2), a1);
+}
+#else
+#define accumulate accumulate_scalar
+#endif
+
+/* 和 XXH3 的 scramble 一样，累加器的高位混回低位，和下一块的累加不能交换顺序 */
+static inline void
+scramble(uint64_t acc[4])
+{
+	for (int i = 0; i < 4; i++) {
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= secret[SCRAMBLE_KEY + i];
+		acc[i] = a * PRIME32_1;
+	}
+}
+
+uint64_t
+tile_hash(const uint32_t *pixels, int stride, int width, int height)
+{
+	uint64_t acc[4] = { PRIME64_3, PRIME64_2, PRIME64_1, PRIME64_5 };
+	const int stripes = width / 8;
+	const int tail = width % 8;
+	uint64_t h;
+
+	for (int y = 0; y < height; y++) {
+		const uint32_t *row = pixels + (long)y * stride;
+
+		for (int s = 0; s < stripes; s += STRIPES_PER_BLOCK) {
+			int n = stripes - s < STRIPES_PER_BLOCK ? stripes - s : STRIPES_PER_BLOCK;
+
+			if (s)
+				scramble(acc);
+			accumulate(acc, (const uint8_t *)(row + s * 8), n);
+		}
+		/* 不够 32 字节的部分逐个像素混进第 0 路 */
+		for (int x = stripes * 8; x < stripes * 8 + tail; x++)
+			acc[0] = rotl64(acc[0] + row[x] * PRIME64_2, 31) * PRIME64_1;
+		scramble(acc);
+	}
+
+	h = PRIME64_5 + (uint64_t)width * height * 4;
+	for (int i = 0; i < 4; i++)
+		h = rotl64(h ^ avalanche(acc[i]), 27) * PRIME64_1 + PRIME64_4;
+	return avalanche(h);
+}
@@ -0,0 +1,17 @@
+#ifndef TILE_HASH_H
+#define TILE_HASH_H
+
+#include <stdint.h>
+
+/* 画面按 TILE_SIZE x TILE_SIZE 分块，每块计算一个 hash
+ * 和上一帧同一块的 hash 相同就认为这块没有变化
+ * */
+#define TILE_SIZE 64
+
+/* 计算 width x height 像素的 hash，stride 以像素为单位
+ * xxHash(XXH3) 风格的 4 路累加，有 AVX2/SSE2 时按 32 字节一组并行计算，
+ * 不同实现得到的结果相同。同样的像素换了位置(平移、交换行或列)结果不同
+ * */
+uint64_t tile_hash(const uint32_t *pixels, int stride, int width, int height);
+
+#endif
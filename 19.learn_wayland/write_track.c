@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+
+#include "write_track.h"
+
+#define PAGE_SIZE 4096
+
+/* 旧的内核头文件里没有，数值来自 Linux 6.7 的 uapi */
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PM_SCAN_WP_MATCHING (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+
+struct page_region {
+	uint64_t start;
+	uint64_t end;
+	uint64_t categories;
+};
+
+struct pm_scan_arg {
+	uint64_t size;
+	uint64_t flags;
+	uint64_t start;
+	uint64_t end;
+	uint64_t walk_end;
+	uint64_t vec;
+	uint64_t vec_len;
+	uint64_t max_pages;
+	uint64_t category_inverted;
+	uint64_t category_mask;
+	uint64_t category_anyof_mask;
+	uint64_t return_mask;
+};
+
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+#define WP_FEATURES (UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_HUGETLBFS_SHMEM | \
+		UFFD_FEATURE_WP_UNPOPULATED)
+
+static int uffd = -1;
+static int pagemap_fd = -1;
+
+static int
+protect(void *data, size_t size)
+{
+	struct uffdio_writeprotect wp = {
+		.range = { .start = (uintptr_t)data, .len = size },
+		.mode = UFFDIO_WRITEPROTECT_MODE_WP,
+	};
+
+	return ioctl(uffd, UFFDIO_WRITEPROTECT, &wp);
+}
+
+int
+write_track_register(void *data, size_t size)
+{
+	/* mmap 的映射按页取整，长度也要按页 */
+	size = (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+	struct uffdio_register reg = {
+		.range = { .start = (uintptr_t)data, .len = size },
+		.mode = UFFDIO_REGISTER_MODE_WP,
+	};
+
+	/* munmap 时注册自动失效，不需要单独注销 */
+	if (ioctl(uffd, UFFDIO_REGISTER, &reg) < 0)
+		return -1;
+	return protect(data, size);
+}
+
+/* 取出 [start, end) 里写过的页，回调每一段连续的页，同时重新保护 */
+static int
+scan(uintptr_t start, uintptr_t end,
+     void (*range)(uintptr_t lo, uintptr_t hi, void *data), void *data)
+{
+	struct page_region regions[64];
+	struct pm_scan_arg arg = {
+		.size = sizeof(arg),
+		.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC,
+		.vec = (uintptr_t)regions,
+		.vec_len = sizeof(regions) / sizeof(regions[0]),
+		.category_mask = PAGE_IS_WRITTEN,
+		.return_mask = PAGE_IS_WRITTEN,
+	};
+
+	/* 写过的段比 regions 多时从停下的地方继续 */
+	while (start < end) {
+		arg.start = start;
+		arg.end = end;
+		int n = ioctl(pagemap_fd, PAGEMAP_SCAN, &arg);
+		if (n < 0)
+			return -1;
+		for (int i = 0; i < n; i++)
+			range(regions[i].start, regions[i].end, data);
+		if (arg.walk_end <= start)
+			return -1;
+		start = arg.walk_end;
+	}
+	return 0;
+}
+
+static void
+count_pages(uintptr_t lo, uintptr_t hi, void *data)
+{
+	*(size_t *)data += (hi - lo) / PAGE_SIZE;
+}
+
+/* 在共享内存上真的注册、写、扫描一次：内核太旧、没有 userfaultfd
+ * 或者 shmem 不支持写保护时任何一步都会失败
+ * */
+static int
+probe(void)
+{
+	volatile uint8_t *page;
+	size_t written = 0, again = 0;
+	int ret = -1;
+
+	page = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (page == MAP_FAILED)
+		return -1;
+
+	if (write_track_register((void *)page, PAGE_SIZE) == 0) {
+		page[0] = 1;
+		if (scan((uintptr_t)page, (uintptr_t)page + PAGE_SIZE, count_pages, &written) == 0 &&
+		    scan((uintptr_t)page, (uintptr_t)page + PAGE_SIZE, count_pages, &again) == 0 &&
+		    written == 1 && again == 0)
+			ret = 0;
+	}
+
+	munmap((void *)page, PAGE_SIZE);
+	return ret;
+}
+
+int
+write_track_init(void)
+{
+	struct uffdio_api api = { .api = UFFD_API, .features = WP_FEATURES };
+
+	/* 只处理用户态的缺页，不需要特权 */
+	uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+	pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+	if (uffd < 0 || pagemap_fd < 0 || ioctl(uffd, UFFDIO_API, &api) < 0 ||
+	    (api.features & WP_FEATURES) != WP_FEATURES || probe() < 0) {
+		write_track_finish();
+		return -1;
+	}
+	return 0;
+}
+
+void
+write_track_finish(void)
+{
+	if (uffd >= 0)
+		close(uffd);
+	if (pagemap_fd >= 0)
+		close(pagemap_fd);
+	uffd = pagemap_fd = -1;
+}
+
+struct bands {
+	struct damage *damage;
+	uintptr_t start;
+	size_t size;
+	int width;
+	int stride;
+	int y0;
+	int y1;
+};
+
+static void
+add_band(uintptr_t lo, uintptr_t hi, void *data)
+{
+	struct bands *b = data;
+	int y0, y1;
+
+	/* 这一段页在 buffer 里的字节范围对应的行 */
+	lo = lo > b->start ? lo - b->start : 0;
+	hi = hi - b->start < b->size ? hi - b->start : b->size;
+	y0 = lo / b->stride;
+	y1 = (hi - 1) / b->stride + 1;
+
+	/* 相邻的段合成一段行 */
+	if (b->y1 >= y0) {
+		b->y1 = y1 > b->y1 ? y1 : b->y1;
+		return;
+	}
+	if (b->y0 >= 0)
+		damage_add(b->damage, 0, b->y0, b->width, b->y1 - b->y0);
+	b->y0 = y0;
+	b->y1 = y1;
+}
+
+int
+write_track_damage(struct damage *damage, const void *data,
+		int width, int height, int stride)
+{
+	struct bands b = {
+		.damage = damage,
+		.start = (uintptr_t)data,
+		.size = (size_t)stride * height,
+		.width = width,
+		.stride = stride,
+		.y0 = -1,
+		.y1 = -1,
+	};
+	uintptr_t first = b.start / PAGE_SIZE * PAGE_SIZE;
+	uintptr_t last = (b.start + b.size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+	damage_clear(damage);
+	if (scan(first, last, add_band, &b) < 0)
+		return -1;
+	if (b.y0 >= 0)
+		damage_add(damage, 0, b.y0, width, b.y1 - b.y0);
+	return 0;
+}
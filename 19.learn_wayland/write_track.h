@@ -0,0 +1,27 @@
+#ifndef WRITE_TRACK_H
+#define WRITE_TRACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "damage.h"
+
+/* 用 userfaultfd 的异步写保护记录 buffer 里哪些页被写过，不用比较像素就能得到 damage
+ * 只保护注册过的 buffer，不影响进程里别的内存。被保护的页第一次被写时
+ * 由内核直接解除保护(不需要处理缺页的线程)，之后 PAGEMAP_SCAN 取出写过的页并重新保护
+ * 需要 Linux 6.7 以上，初始化时会实际写一个页来检测
+ * */
+int write_track_init(void);
+void write_track_finish(void);
+
+/* 开始跟踪 mmap 得到的 data 开始的 size 字节，之后的写入才会被记录 */
+int write_track_register(void *data, size_t size);
+
+/* 把 data 开始的 buffer 中上次调用以后被写过的 4KiB 页换算成行，作为 damage，
+ * 同时重新保护这些页。每页覆盖的行按整行计算，stride 以字节为单位
+ * 失败时返回 -1，damage 的内容不可用
+ * */
+int write_track_damage(struct damage *damage, const void *data,
+		int width, int height, int stride);
+
+#endif
@@ -0,0 +1,438 @@
+/////////////////////
+// \note 使用保留模式场景图绘制一个几乎不变的仪表盘
+//       每帧只重画变化的节点，帧开销和变化量成正比，而不是和窗口大小成正比
+/////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "xdg-shell-client-protocol.h"
+#include "scene.h"
+
+#define SLOT_COUNT 3
+
+/* 交换链里的一个 buffer
+ * damage 记录自从这个 buffer 上次被画过之后场景中变化的区域，
+ * 下次复用时只需要重画这些区域
+ * */
+struct buffer_slot {
+    struct wl_buffer *wl_buffer;
+    uint32_t *data;
+    int32_t width;
+    int32_t height;
+    size_t size;
+    int busy;
+    struct scene_damage damage;
+};
+
+struct my_output {
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *xdg_wm_base;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct wl_surface *wl_surface;
+    int32_t width;
+    int32_t height;
+    int closed;
+    int running;
+    struct buffer_slot slots[SLOT_COUNT];
+
+    struct scene scene;
+    struct scene_node *header;
+    struct scene_node *clock;
+    struct scene_node *bar;
+    uint32_t *image;
+
+    uint32_t frames;
+    int64_t rasterized;
+};
+
+static int
+set_cloexec_or_close(int fd)
+{
+        long flags;
+
+        if (fd == -1)
+                return -1;
+
+        flags = fcntl(fd, F_GETFD);
+        if (flags == -1)
+                goto err;
+
+        if (fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+                goto err;
+
+        return fd;
+
+err:
+        close(fd);
+        return -1;
+}
+
+static int
+create_shm_file(void)
+{
+#define NAME_TEMPLATE    "/wl_s1-XXXXXX"
+	char name[64] = {0};
+	const char *path;
+	int fd;
+
+	path = getenv("XDG_RUNTIME_DIR");
+	if (path)
+	{
+		strcpy(name, path);
+	}
+	strcat(name, NAME_TEMPLATE);
+
+	/* 根据模板创建临时文件句柄 */
+	fd = mkstemp(name);
+    if (fd >= 0) {
+        fd = set_cloexec_or_close(fd);
+        unlink(name);
+		return fd;
+    }
+
+	return -1;
+}
+
+static int
+allocate_shm_file(size_t size)
+{
+	int fd = create_shm_file();
+	int ret;
+	if (fd < 0)
+		return -1;
+	do {
+		ret = ftruncate(fd, size);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    struct buffer_slot *slot = data;
+    slot->busy = 0;
+}
+
+static const struct wl_buffer_listener wl_buffer_listener = {
+    .release = wl_buffer_release,
+};
+
+static void
+slot_destroy(struct buffer_slot *slot)
+{
+    if (slot->wl_buffer) {
+        wl_buffer_destroy(slot->wl_buffer);
+        munmap(slot->data, slot->size);
+    }
+    slot->wl_buffer = NULL;
+    slot->data = NULL;
+}
+
+/* 新分配的 buffer 里面没有任何内容，整个窗口都记为 damage */
+static int
+slot_allocate(struct my_output *state, struct buffer_slot *slot)
+{
+    const int width = state->width, height = state->height;
+    int stride = width * 4;
+    size_t size = (size_t)stride * height;
+    struct scene_rect all = {0, 0, width, height};
+
+    slot_destroy(slot);
+
+    int fd = allocate_shm_file(size);
+    if (fd == -1) {
+        return -1;
+    }
+
+    slot->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (slot->data == MAP_FAILED) {
+        slot->data = NULL;
+        close(fd);
+        return -1;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, size);
+    slot->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
+            width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    wl_buffer_add_listener(slot->wl_buffer, &wl_buffer_listener, slot);
+    slot->width = width;
+    slot->height = height;
+    slot->size = size;
+    scene_damage_clear(&slot->damage);
+    scene_damage_add(&slot->damage, &all);
+    return 0;
+}
+
+/* 取一个空闲的 buffer，窗口大小变了的 buffer 在这里重新分配 */
+static struct buffer_slot *
+next_slot(struct my_output *state)
+{
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        struct buffer_slot *slot = &state->slots[i];
+        if (slot->busy)
+            continue;
+        if (slot->wl_buffer == NULL ||
+            slot->width != state->width || slot->height != state->height) {
+            if (slot_allocate(state, slot) < 0)
+                return NULL;
+        }
+        return slot;
+    }
+    return NULL;
+}
+
+static void
+build_scene(struct my_output *state)
+{
+    struct scene_node *root = &state->scene.root;
+    struct scene_node *cards;
+    struct scene_node *header;
+    static const char *labels[] = { "CPU", "MEMORY", "NETWORK" };
+
+    header = scene_group_create(root, 0, 0);
+    state->header = scene_rect_create(header, 0, 0, state->width, 40, 0xff303a4a);
+    scene_text_create(header, 12, 12, "scene graph dashboard", 0xffffffff, 2);
+
+    cards = scene_group_create(root, 20, 60);
+    for (int i = 0; i < 3; i++) {
+        struct scene_node *card = scene_group_create(cards, i * 220, 0);
+        scene_rect_create(card, 0, 0, 200, 180, 0xffdde3ea);
+        scene_text_create(card, 10, 10, labels[i], 0xff303a4a, 2);
+    }
+
+    /* 静态图片：一张渐变图 */
+    state->image = malloc(128 * 128 * sizeof(uint32_t));
+    for (int y = 0; y < 128; y++)
+        for (int x = 0; x < 128; x++)
+            state->image[y * 128 + x] = 0xff000000 | (x * 2) << 16 | (y * 2) << 8 | 0x80;
+    scene_image_create(cards->first_child, 36, 40, 128, 128, state->image, 128);
+
+    state->clock = scene_text_create(root, 20, 260, "", 0xff303a4a, 3);
+    scene_rect_create(root, 20, 300, 640, 12, 0xffc0c8d0);
+    state->bar = scene_rect_create(root, 20, 300, 0, 12, 0xff2f9e44);
+}
+
+/* 只修改变化的节点：时钟每 100ms 变一次，进度条每帧前进 1 个像素 */
+static void
+update_scene(struct my_output *state)
+{
+    struct timespec ts;
+    char text[SCENE_TEXT_MAX];
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    snprintf(text, sizeof(text), "uptime %ld.%ld s",
+             (long)ts.tv_sec, ts.tv_nsec / 100000000);
+    scene_text_set_text(state->clock, text);
+    scene_rect_set_size(state->bar, state->frames % 641, 12);
+    scene_rect_set_size(state->header, state->width, 40);
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener;
+
+static void
+draw_frame(struct my_output *state)
+{
+    struct scene_damage damage;
+    struct buffer_slot *slot;
+    struct wl_callback *cb;
+
+    cb = wl_surface_frame(state->wl_surface);
+    wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
+
+    /* 没有空闲 buffer 时不收集 damage，脏标记留到下一帧 */
+    slot = next_slot(state);
+    if (slot == NULL) {
+        wl_surface_commit(state->wl_surface);
+        return;
+    }
+
+    update_scene(state);
+    scene_collect_damage(&state->scene, &damage);
+    if (damage.count == 0) {
+        wl_surface_commit(state->wl_surface);
+        return;
+    }
+
+    /* 每个 buffer 都要补上这一帧的变化 */
+    for (int i = 0; i < SLOT_COUNT; i++)
+        scene_damage_union(&state->slots[i].damage, &damage);
+
+    scene_render(&state->scene, slot->data, slot->width, &slot->damage);
+    state->rasterized += scene_damage_area(&slot->damage);
+    scene_damage_clear(&slot->damage);
+
+    wl_surface_attach(state->wl_surface, slot->wl_buffer, 0, 0);
+    for (int i = 0; i < damage.count; i++)
+        wl_surface_damage_buffer(state->wl_surface,
+                damage.rects[i].x, damage.rects[i].y,
+                damage.rects[i].width, damage.rects[i].height);
+    slot->busy = 1;
+    wl_surface_commit(state->wl_surface);
+
+    if (++state->frames % 120 == 0) {
+        printf("%u frames, %lld pixels rasterized/frame (window %d pixels)\n",
+               state->frames, (long long)(state->rasterized / 120),
+               state->width * state->height);
+        state->rasterized = 0;
+    }
+}
+
+static void
+wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
+{
+	wl_callback_destroy(cb);
+	draw_frame(data);
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener = {
+    .done = wl_surface_frame_done,
+};
+
+static void
+xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial)
+{
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+    .ping = xdg_wm_base_ping,
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version)
+{
+	struct my_output *state = (struct my_output *)data;
+	if (!strcmp(interface, wl_compositor_interface.name))
+	{
+		/* wl_surface_damage_buffer 需要版本 4 */
+		state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(
+            registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        state->xdg_wm_base = wl_registry_bind(
+            registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(state->xdg_wm_base, &xdg_wm_base_listener, state);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name)
+{
+}
+
+static const struct wl_registry_listener
+registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+static void
+xdg_surface_configure(void *data,
+        struct xdg_surface *xdg_surface, uint32_t serial)
+{
+    struct my_output *state = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    if (state->scene.width != state->width ||
+        state->scene.height != state->height)
+        scene_resize(&state->scene, state->width, state->height);
+
+    /* 第一次 configure 时开始绘制，之后由 frame callback 驱动 */
+    if (!state->running) {
+        state->running = 1;
+        draw_frame(state);
+    }
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+static void
+xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+		int32_t width, int32_t height, struct wl_array *states)
+{
+    struct my_output *state = data;
+    if (width == 0 || height == 0)
+        return;
+
+    state->width = width;
+    state->height = height;
+}
+
+static void
+xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+    struct my_output *state = data;
+    state->closed = 1;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+int
+main(int argc, char *argv[])
+{
+	struct wl_display *display = wl_display_connect(NULL);
+    struct my_output state = {0};
+
+    state.width = 700;
+    state.height = 340;
+	if (!display)
+	{
+		printf("Failed create connection to server\n");
+		return -1;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &state);
+	wl_display_roundtrip(display);
+
+	if (!state.compositor || !state.shm || !state.xdg_wm_base)
+	{
+		printf("missing wl_compositor, wl_shm or xdg_wm_base\n");
+		return -2;
+	}
+
+    scene_init(&state.scene, state.width, state.height, 0xfff4f6f8);
+    build_scene(&state);
+
+	state.wl_surface = wl_compositor_create_surface(state.compositor);
+	state.xdg_surface = xdg_wm_base_get_xdg_surface(state.xdg_wm_base, state.wl_surface);
+    xdg_surface_add_listener(state.xdg_surface, &xdg_surface_listener, &state);
+    state.xdg_toplevel = xdg_surface_get_toplevel(state.xdg_surface);
+    xdg_toplevel_set_title(state.xdg_toplevel, "Scene graph");
+    xdg_toplevel_add_listener(state.xdg_toplevel, &xdg_toplevel_listener, &state);
+    wl_surface_commit(state.wl_surface);
+
+	while (!state.closed && wl_display_dispatch(display) != -1)
+		;
+
+    for (int i = 0; i < SLOT_COUNT; i++)
+        slot_destroy(&state.slots[i]);
+    scene_finish(&state.scene);
+    free(state.image);
+	wl_display_disconnect(display);
+	return 0;
+}
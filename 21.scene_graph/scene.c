@@ -0,0 +1,596 @@
+/////////////////////
+// \note 保留模式场景图的实现
+/////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene.h"
+
+/* 5x7 点阵字体，每个字符 5 列，每列一个字节，低位在上
+ * 只包含 ' ' 到 'Z'，小写字母按大写显示
+ * */
+#define FONT_FIRST ' '
+#define FONT_LAST 'Z'
+#define GLYPH_WIDTH 6
+#define GLYPH_HEIGHT 8
+
+static const uint8_t font5x7[][5] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5f, 0x00, 0x00},
+	{0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7f, 0x14, 0x7f, 0x14},
+	{0x24, 0x2a, 0x7f, 0x2a, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+	{0x36, 0x49, 0x56, 0x20, 0x50}, {0x00, 0x08, 0x07, 0x03, 0x00},
+	{0x00, 0x1c, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1c, 0x00},
+	{0x2a, 0x1c, 0x7f, 0x1c, 0x2a}, {0x08, 0x08, 0x3e, 0x08, 0x08},
+	{0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},
+	{0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+	{0x3e, 0x51, 0x49, 0x45, 0x3e}, {0x00, 0x42, 0x7f, 0x40, 0x00},
+	{0x72, 0x49, 0x49, 0x49, 0x46}, {0x21, 0x41, 0x49, 0x4d, 0x33},
+	{0x18, 0x14, 0x12, 0x7f, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},
+	{0x3c, 0x4a, 0x49, 0x49, 0x31}, {0x41, 0x21, 0x11, 0x09, 0x07},
+	{0x36, 0x49, 0x49, 0x49, 0x36}, {0x46, 0x49, 0x49, 0x29, 0x1e},
+	{0x00, 0x00, 0x14, 0x00, 0x00}, {0x00, 0x40, 0x34, 0x00, 0x00},
+	{0x00, 0x08, 0x14, 0x22, 0x41}, {0x14, 0x14, 0x14, 0x14, 0x14},
+	{0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x59, 0x09, 0x06},
+	{0x3e, 0x41, 0x5d, 0x59, 0x4e}, {0x7c, 0x12, 0x11, 0x12, 0x7c},
+	{0x7f, 0x49, 0x49, 0x49, 0x36}, {0x3e, 0x41, 0x41, 0x41, 0x22},
+	{0x7f, 0x41, 0x41, 0x41, 0x3e}, {0x7f, 0x49, 0x49, 0x49, 0x41},
+	{0x7f, 0x09, 0x09, 0x09, 0x01}, {0x3e, 0x41, 0x41, 0x51, 0x73},
+	{0x7f, 0x08, 0x08, 0x08, 0x7f}, {0x00, 0x41, 0x7f, 0x41, 0x00},
+	{0x20, 0x40, 0x41, 0x3f, 0x01}, {0x7f, 0x08, 0x14, 0x22, 0x41},
+	{0x7f, 0x40, 0x40, 0x40, 0x40}, {0x7f, 0x02, 0x1c, 0x02, 0x7f},
+	{0x7f, 0x04, 0x08, 0x10, 0x7f}, {0x3e, 0x41, 0x41, 0x41, 0x3e},
+	{0x7f, 0x09, 0x09, 0x09, 0x06}, {0x3e, 0x41, 0x51, 0x21, 0x5e},
+	{0x7f, 0x09, 0x19, 0x29, 0x46}, {0x26, 0x49, 0x49, 0x49, 0x32},
+	{0x03, 0x01, 0x7f, 0x01, 0x03}, {0x3f, 0x40, 0x40, 0x40, 0x3f},
+	{0x1f, 0x20, 0x40, 0x20, 0x1f}, {0x3f, 0x40, 0x38, 0x40, 0x3f},
+	{0x63, 0x14, 0x08, 0x14, 0x63}, {0x03, 0x04, 0x78, 0x04, 0x03},
+	{0x61, 0x59, 0x49, 0x4d, 0x43},
+};
+
+static int
+rect_empty(const struct scene_rect *r)
+{
+	return r->width <= 0 || r->height <= 0;
+}
+
+static struct scene_rect
+rect_union(const struct scene_rect *a, const struct scene_rect *b)
+{
+	struct scene_rect r;
+	int32_t x2, y2;
+
+	if (rect_empty(a))
+		return *b;
+	if (rect_empty(b))
+		return *a;
+
+	r.x = a->x < b->x ? a->x : b->x;
+	r.y = a->y < b->y ? a->y : b->y;
+	x2 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+	y2 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+	r.width = x2 - r.x;
+	r.height = y2 - r.y;
+	return r;
+}
+
+static struct scene_rect
+rect_intersect(const struct scene_rect *a, const struct scene_rect *b)
+{
+	struct scene_rect r;
+	int32_t x2, y2;
+
+	r.x = a->x > b->x ? a->x : b->x;
+	r.y = a->y > b->y ? a->y : b->y;
+	x2 = a->x + a->width < b->x + b->width ? a->x + a->width : b->x + b->width;
+	y2 = a->y + a->height < b->y + b->height ? a->y + a->height : b->y + b->height;
+	r.width = x2 - r.x;
+	r.height = y2 - r.y;
+	if (rect_empty(&r))
+		r.width = r.height = 0;
+	return r;
+}
+
+static int64_t
+rect_area(const struct scene_rect *r)
+{
+	return rect_empty(r) ? 0 : (int64_t)r->width * r->height;
+}
+
+void
+scene_damage_clear(struct scene_damage *damage)
+{
+	damage->count = 0;
+}
+
+/* 和已有矩形相交的直接合并；
+ * 矩形个数到了上限时，合并到使面积增加最少的那个矩形
+ * */
+void
+scene_damage_add(struct scene_damage *damage, const struct scene_rect *rect)
+{
+	struct scene_rect r = *rect;
+	int64_t best_growth = -1;
+	int best = 0;
+	int i;
+
+	if (rect_empty(&r))
+		return;
+
+	for (i = 0; i < damage->count; i++)
+	{
+		struct scene_rect inter = rect_intersect(&damage->rects[i], &r);
+		if (!rect_empty(&inter))
+		{
+			r = rect_union(&damage->rects[i], &r);
+			damage->rects[i] = damage->rects[--damage->count];
+			i = -1; // 合并后的矩形可能又和其他矩形相交
+		}
+	}
+
+	if (damage->count < SCENE_DAMAGE_MAX)
+	{
+		damage->rects[damage->count++] = r;
+		return;
+	}
+
+	for (i = 0; i < damage->count; i++)
+	{
+		struct scene_rect u = rect_union(&damage->rects[i], &r);
+		int64_t growth = rect_area(&u) - rect_area(&damage->rects[i]);
+		if (best_growth < 0 || growth < best_growth)
+		{
+			best_growth = growth;
+			best = i;
+		}
+	}
+	r = rect_union(&damage->rects[best], &r);
+	damage->rects[best] = damage->rects[--damage->count];
+	scene_damage_add(damage, &r);
+}
+
+void
+scene_damage_union(struct scene_damage *damage, const struct scene_damage *other)
+{
+	int i;
+
+	for (i = 0; i < other->count; i++)
+		scene_damage_add(damage, &other->rects[i]);
+}
+
+int64_t
+scene_damage_area(const struct scene_damage *damage)
+{
+	int64_t area = 0;
+	int i;
+
+	for (i = 0; i < damage->count; i++)
+		area += rect_area(&damage->rects[i]);
+	return area;
+}
+
+static void
+node_init(struct scene_node *node, enum scene_node_type type,
+		  struct scene_node *parent, int32_t x, int32_t y)
+{
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->x = x;
+	node->y = y;
+	node->visible = 1;
+	node->parent = parent;
+}
+
+/* 把 child_dirty 一路传到根节点
+ * 某个节点已经是 child_dirty 时，它的祖先也都已经标记过了
+ * */
+static void
+node_mark_child_dirty(struct scene_node *node)
+{
+	struct scene_node *p;
+
+	for (p = node; p && !p->child_dirty; p = p->parent)
+		p->child_dirty = 1;
+}
+
+static void
+node_mark_dirty(struct scene_node *node)
+{
+	node->dirty = 1;
+	node_mark_child_dirty(node->parent);
+}
+
+static struct scene_node *
+node_create(enum scene_node_type type, struct scene_node *parent,
+			int32_t x, int32_t y)
+{
+	struct scene_node *node = malloc(sizeof(*node));
+
+	if (node == NULL)
+		return NULL;
+
+	node_init(node, type, parent, x, y);
+	if (parent->last_child)
+		parent->last_child->next = node;
+	else
+		parent->first_child = node;
+	parent->last_child = node;
+
+	node_mark_dirty(node);
+	return node;
+}
+
+void
+scene_init(struct scene *scene, int32_t width, int32_t height,
+		   uint32_t background)
+{
+	memset(scene, 0, sizeof(*scene));
+	scene->background = background;
+	node_init(&scene->root, SCENE_NODE_GROUP, NULL, 0, 0);
+	scene_resize(scene, width, height);
+}
+
+static void
+node_free_children(struct scene_node *node)
+{
+	struct scene_node *child = node->first_child;
+	struct scene_node *next;
+
+	while (child)
+	{
+		next = child->next;
+		node_free_children(child);
+		free(child);
+		child = next;
+	}
+	node->first_child = node->last_child = NULL;
+}
+
+void
+scene_finish(struct scene *scene)
+{
+	node_free_children(&scene->root);
+}
+
+/* 窗口大小变了，整个窗口都需要重画 */
+void
+scene_resize(struct scene *scene, int32_t width, int32_t height)
+{
+	struct scene_rect all = {0, 0, width, height};
+
+	scene->width = width;
+	scene->height = height;
+	scene_damage_clear(&scene->pending);
+	scene_damage_add(&scene->pending, &all);
+}
+
+struct scene_node *
+scene_group_create(struct scene_node *parent, int32_t x, int32_t y)
+{
+	return node_create(SCENE_NODE_GROUP, parent, x, y);
+}
+
+struct scene_node *
+scene_rect_create(struct scene_node *parent, int32_t x, int32_t y,
+				  int32_t width, int32_t height, uint32_t color)
+{
+	struct scene_node *node = node_create(SCENE_NODE_RECT, parent, x, y);
+
+	if (node)
+	{
+		node->rect.width = width;
+		node->rect.height = height;
+		node->rect.color = color;
+	}
+	return node;
+}
+
+struct scene_node *
+scene_image_create(struct scene_node *parent, int32_t x, int32_t y,
+				   int32_t width, int32_t height,
+				   const uint32_t *pixels, int32_t stride)
+{
+	struct scene_node *node = node_create(SCENE_NODE_IMAGE, parent, x, y);
+
+	if (node)
+	{
+		node->image.width = width;
+		node->image.height = height;
+		node->image.stride = stride;
+		node->image.pixels = pixels;
+	}
+	return node;
+}
+
+struct scene_node *
+scene_text_create(struct scene_node *parent, int32_t x, int32_t y,
+				  const char *text, uint32_t color, int scale)
+{
+	struct scene_node *node = node_create(SCENE_NODE_TEXT, parent, x, y);
+
+	if (node)
+	{
+		node->text.color = color;
+		node->text.scale = scale > 0 ? scale : 1;
+		strncpy(node->text.text, text, SCENE_TEXT_MAX - 1);
+	}
+	return node;
+}
+
+/* 删除节点和它的子树，原来占用的区域记到 pending damage 里 */
+void
+scene_node_destroy(struct scene *scene, struct scene_node *node)
+{
+	struct scene_node *parent = node->parent;
+	struct scene_node **link;
+	struct scene_node *prev = NULL;
+
+	if (parent == NULL)
+		return;
+
+	scene_damage_add(&scene->pending, &node->bounds);
+
+	for (link = &parent->first_child; *link != node; link = &(*link)->next)
+		prev = *link;
+	*link = node->next;
+	if (parent->last_child == node)
+		parent->last_child = prev;
+
+	// 父节点的范围需要重新计算
+	node_mark_child_dirty(parent);
+
+	node_free_children(node);
+	free(node);
+}
+
+void
+scene_node_set_position(struct scene_node *node, int32_t x, int32_t y)
+{
+	if (node->x == x && node->y == y)
+		return;
+
+	node->x = x;
+	node->y = y;
+	node_mark_dirty(node);
+}
+
+void
+scene_node_set_visible(struct scene_node *node, int visible)
+{
+	if (node->visible == !!visible)
+		return;
+
+	node->visible = !!visible;
+	node_mark_dirty(node);
+}
+
+void
+scene_rect_set_size(struct scene_node *node, int32_t width, int32_t height)
+{
+	if (node->rect.width == width && node->rect.height == height)
+		return;
+
+	node->rect.width = width;
+	node->rect.height = height;
+	node_mark_dirty(node);
+}
+
+void
+scene_rect_set_color(struct scene_node *node, uint32_t color)
+{
+	if (node->rect.color == color)
+		return;
+
+	node->rect.color = color;
+	node_mark_dirty(node);
+}
+
+void
+scene_text_set_text(struct scene_node *node, const char *text)
+{
+	if (strncmp(node->text.text, text, SCENE_TEXT_MAX - 1) == 0)
+		return;
+
+	strncpy(node->text.text, text, SCENE_TEXT_MAX - 1);
+	node_mark_dirty(node);
+}
+
+/* 叶子节点在窗口坐标系中的范围 */
+static struct scene_rect
+leaf_bounds(const struct scene_node *node, int32_t x, int32_t y)
+{
+	struct scene_rect r = {x, y, 0, 0};
+
+	switch (node->type)
+	{
+	case SCENE_NODE_RECT:
+		r.width = node->rect.width;
+		r.height = node->rect.height;
+		break;
+	case SCENE_NODE_IMAGE:
+		r.width = node->image.width;
+		r.height = node->image.height;
+		break;
+	case SCENE_NODE_TEXT:
+		r.width = (int32_t)strlen(node->text.text) * GLYPH_WIDTH * node->text.scale;
+		r.height = GLYPH_HEIGHT * node->text.scale;
+		break;
+	case SCENE_NODE_GROUP:
+		break;
+	}
+	return r;
+}
+
+/* 更新子树的 bounds，脏节点的新旧位置都加入 damage
+ * ancestor_dirty 表示某个祖先已经把整个子树的新旧范围记为 damage 了，
+ * 这时只更新 bounds，不再重复添加
+ * */
+static void
+collect_node(struct scene_node *node, int32_t ox, int32_t oy,
+			 int ancestor_dirty, struct scene_damage *damage)
+{
+	struct scene_rect old = node->bounds;
+	struct scene_rect now = {0, 0, 0, 0};
+	struct scene_node *child;
+	int32_t x = ox + node->x;
+	int32_t y = oy + node->y;
+
+	if (!ancestor_dirty && !node->dirty && !node->child_dirty)
+		return;
+
+	if (node->type == SCENE_NODE_GROUP)
+	{
+		for (child = node->first_child; child; child = child->next)
+		{
+			collect_node(child, x, y, ancestor_dirty || node->dirty, damage);
+			now = rect_union(&now, &child->bounds);
+		}
+	}
+	else
+	{
+		now = leaf_bounds(node, x, y);
+	}
+
+	if (!node->visible)
+		now.width = now.height = 0;
+
+	if (node->dirty && !ancestor_dirty)
+	{
+		scene_damage_add(damage, &old);
+		scene_damage_add(damage, &now);
+	}
+
+	node->bounds = now;
+	node->dirty = 0;
+	node->child_dirty = 0;
+}
+
+void
+scene_collect_damage(struct scene *scene, struct scene_damage *damage)
+{
+	struct scene_rect all = {0, 0, scene->width, scene->height};
+	int i;
+
+	scene_damage_clear(damage);
+	collect_node(&scene->root, 0, 0, 0, damage);
+	scene_damage_union(damage, &scene->pending);
+	scene_damage_clear(&scene->pending);
+
+	// 裁剪到窗口范围
+	for (i = 0; i < damage->count;)
+	{
+		damage->rects[i] = rect_intersect(&damage->rects[i], &all);
+		if (rect_empty(&damage->rects[i]))
+			damage->rects[i] = damage->rects[--damage->count];
+		else
+			i++;
+	}
+}
+
+static void
+fill_rect(uint32_t *pixels, int32_t stride, const struct scene_rect *r,
+		  uint32_t color)
+{
+	int32_t x, y;
+
+	for (y = r->y; y < r->y + r->height; y++)
+	{
+		uint32_t *row = pixels + (int64_t)y * stride;
+		for (x = r->x; x < r->x + r->width; x++)
+			row[x] = color;
+	}
+}
+
+static void
+draw_image(uint32_t *pixels, int32_t stride, const struct scene_node *node,
+		   const struct scene_rect *clip)
+{
+	const struct scene_rect *b = &node->bounds;
+	int32_t y;
+
+	for (y = clip->y; y < clip->y + clip->height; y++)
+	{
+		const uint32_t *src = node->image.pixels +
+			(int64_t)(y - b->y) * node->image.stride + (clip->x - b->x);
+		memcpy(pixels + (int64_t)y * stride + clip->x, src,
+			   clip->width * sizeof(uint32_t));
+	}
+}
+
+static void
+draw_text(uint32_t *pixels, int32_t stride, const struct scene_node *node,
+		  const struct scene_rect *clip)
+{
+	const struct scene_rect *b = &node->bounds;
+	int scale = node->text.scale;
+	int32_t x, y;
+
+	for (y = clip->y; y < clip->y + clip->height; y++)
+	{
+		int row = (y - b->y) / scale;
+		uint32_t *dst = pixels + (int64_t)y * stride;
+
+		if (row >= 7)
+			continue;
+		for (x = clip->x; x < clip->x + clip->width; x++)
+		{
+			int col = (x - b->x) / scale;
+			int c = (unsigned char)node->text.text[col / GLYPH_WIDTH];
+
+			if (col % GLYPH_WIDTH == 5)
+				continue;
+			if (c >= 'a' && c <= 'z')
+				c -= 'a' - 'A';
+			if (c < FONT_FIRST || c > FONT_LAST)
+				continue;
+			if (font5x7[c - FONT_FIRST][col % GLYPH_WIDTH] & (1 << row))
+				dst[x] = node->text.color;
+		}
+	}
+}
+
+/* 按树的顺序画出和 clip 相交的节点，后面的节点盖住前面的节点 */
+static void
+render_node(const struct scene_node *node, uint32_t *pixels, int32_t stride,
+			const struct scene_rect *clip)
+{
+	struct scene_rect r;
+	const struct scene_node *child;
+
+	if (!node->visible)
+		return;
+
+	r = rect_intersect(&node->bounds, clip);
+	if (rect_empty(&r))
+		return;
+
+	switch (node->type)
+	{
+	case SCENE_NODE_GROUP:
+		for (child = node->first_child; child; child = child->next)
+			render_node(child, pixels, stride, &r);
+		break;
+	case SCENE_NODE_RECT:
+		fill_rect(pixels, stride, &r, node->rect.color);
+		break;
+	case SCENE_NODE_IMAGE:
+		draw_image(pixels, stride, node, &r);
+		break;
+	case SCENE_NODE_TEXT:
+		draw_text(pixels, stride, node, &r);
+		break;
+	}
+}
+
+void
+scene_render(struct scene *scene, uint32_t *pixels, int32_t stride,
+			 const struct scene_damage *damage)
+{
+	int i;
+
+	for (i = 0; i < damage->count; i++)
+	{
+		fill_rect(pixels, stride, &damage->rects[i], scene->background);
+		render_node(&scene->root, pixels, stride, &damage->rects[i]);
+	}
+}
@@ -0,0 +1,121 @@
+/////////////////////
+// \note 保留模式的场景图
+//       节点(矩形、图片、文字、分组)修改后只标记为脏，
+//       渲染时只重画脏节点覆盖的区域
+/////////////////////
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+
+struct scene_rect {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+};
+
+/* damage 区域：若干个矩形，超过上限时合并成较大的矩形 */
+#define SCENE_DAMAGE_MAX 16
+
+struct scene_damage {
+	int count;
+	struct scene_rect rects[SCENE_DAMAGE_MAX];
+};
+
+enum scene_node_type {
+	SCENE_NODE_GROUP,
+	SCENE_NODE_RECT,
+	SCENE_NODE_IMAGE,
+	SCENE_NODE_TEXT,
+};
+
+#define SCENE_TEXT_MAX 64
+
+struct scene_node {
+	enum scene_node_type type;
+	struct scene_node *parent;
+	struct scene_node *first_child;
+	struct scene_node *last_child;
+	struct scene_node *next;
+
+	// 相对父节点的平移
+	int32_t x;
+	int32_t y;
+	int visible;
+
+	// 自己的内容或者位置变了
+	int dirty;
+	// 子树里面有脏节点
+	int child_dirty;
+	// 上一次收集 damage 时在窗口中的位置，分组节点是整个子树的范围
+	struct scene_rect bounds;
+
+	union {
+		struct {
+			int32_t width;
+			int32_t height;
+			uint32_t color;
+		} rect;
+		struct {
+			int32_t width;
+			int32_t height;
+			int32_t stride; // 以像素为单位
+			const uint32_t *pixels;
+		} image;
+		struct {
+			char text[SCENE_TEXT_MAX];
+			uint32_t color;
+			int scale;
+		} text;
+	};
+};
+
+struct scene {
+	int32_t width;
+	int32_t height;
+	uint32_t background;
+	struct scene_node root;
+	// 删除节点、改变窗口大小产生的 damage，下次收集时一起返回
+	struct scene_damage pending;
+};
+
+void scene_init(struct scene *scene, int32_t width, int32_t height,
+		uint32_t background);
+void scene_finish(struct scene *scene);
+void scene_resize(struct scene *scene, int32_t width, int32_t height);
+
+struct scene_node *scene_group_create(struct scene_node *parent,
+		int32_t x, int32_t y);
+struct scene_node *scene_rect_create(struct scene_node *parent,
+		int32_t x, int32_t y, int32_t width, int32_t height, uint32_t color);
+struct scene_node *scene_image_create(struct scene_node *parent,
+		int32_t x, int32_t y, int32_t width, int32_t height,
+		const uint32_t *pixels, int32_t stride);
+struct scene_node *scene_text_create(struct scene_node *parent,
+		int32_t x, int32_t y, const char *text, uint32_t color, int scale);
+void scene_node_destroy(struct scene *scene, struct scene_node *node);
+
+void scene_node_set_position(struct scene_node *node, int32_t x, int32_t y);
+void scene_node_set_visible(struct scene_node *node, int visible);
+void scene_rect_set_size(struct scene_node *node, int32_t width, int32_t height);
+void scene_rect_set_color(struct scene_node *node, uint32_t color);
+void scene_text_set_text(struct scene_node *node, const char *text);
+
+/* 收集上一次调用之后所有变化产生的 damage，并清除脏标记
+ * 只遍历有脏节点的子树，开销和变化的多少成正比
+ * */
+void scene_collect_damage(struct scene *scene, struct scene_damage *damage);
+
+/* 只重画 damage 覆盖的像素，其余像素保持 buffer 里原来的内容 */
+void scene_render(struct scene *scene, uint32_t *pixels, int32_t stride,
+		const struct scene_damage *damage);
+
+void scene_damage_clear(struct scene_damage *damage);
+void scene_damage_add(struct scene_damage *damage, const struct scene_rect *rect);
+void scene_damage_union(struct scene_damage *damage,
+		const struct scene_damage *other);
+int64_t scene_damage_area(const struct scene_damage *damage);
+
+#endif
@@ -0,0 +1,512 @@
+/////////////////////
+// \note 播放原始的 NV12/I420 视频帧
+//       合成器支持对应的 YUV shm 格式时直接把 YUV 平面交给合成器，不做任何转换；
+//       否则用 SIMD 定点运算按行多线程转换成 XRGB8888，直接写进 shm buffer
+//
+//       测试文件可以用 ffmpeg 生成：
+//       ffmpeg -i input.mp4 -pix_fmt nv12 -f rawvideo video.nv12
+//       ./video_yuv video.nv12 1280x720
+/////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "xdg-shell-client-protocol.h"
+#include "yuv.h"
+
+#define SLOT_COUNT 3
+
+struct buffer_slot {
+    struct wl_buffer *wl_buffer;
+    uint8_t *data;
+    size_t size;
+    int busy;
+};
+
+struct my_output {
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *xdg_wm_base;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct wl_surface *wl_surface;
+    int closed;
+    int running;
+    struct buffer_slot slots[SLOT_COUNT];
+
+    /* 合成器通过 wl_shm.format 报告支持的 YUV 格式 */
+    int shm_nv12;
+    int shm_yuv420;
+
+    /* 视频源 */
+    int fd;
+    enum yuv_format format;
+    enum yuv_matrix matrix;
+    int width;
+    int height;
+    size_t frame_size;
+    uint8_t *frame;
+
+    /* 直接提交 YUV 时 buffer 的 wl_shm 格式，否则转换成 XRGB8888 */
+    int passthrough;
+    uint32_t shm_format;
+    struct yuv_converter *converter;
+
+    uint32_t frames;
+    uint64_t read_ns;
+    uint64_t convert_ns;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+set_cloexec_or_close(int fd)
+{
+        long flags;
+
+        if (fd == -1)
+                return -1;
+
+        flags = fcntl(fd, F_GETFD);
+        if (flags == -1)
+                goto err;
+
+        if (fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+                goto err;
+
+        return fd;
+
+err:
+        close(fd);
+        return -1;
+}
+
+static int
+create_shm_file(void)
+{
+#define NAME_TEMPLATE    "/wl_s1-XXXXXX"
+	char name[64] = {0};
+	const char *path;
+	int fd;
+
+	path = getenv("XDG_RUNTIME_DIR");
+	if (path)
+	{
+		strcpy(name, path);
+	}
+	strcat(name, NAME_TEMPLATE);
+
+	/* 根据模板创建临时文件句柄 */
+	fd = mkstemp(name);
+    if (fd >= 0) {
+        fd = set_cloexec_or_close(fd);
+        unlink(name);
+		return fd;
+    }
+
+	return -1;
+}
+
+static int
+allocate_shm_file(size_t size)
+{
+	int fd = create_shm_file();
+	int ret;
+	if (fd < 0)
+		return -1;
+	do {
+		ret = ftruncate(fd, size);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    struct buffer_slot *slot = data;
+    slot->busy = 0;
+}
+
+static const struct wl_buffer_listener wl_buffer_listener = {
+    .release = wl_buffer_release,
+};
+
+static void
+slot_destroy(struct buffer_slot *slot)
+{
+    if (slot->wl_buffer) {
+        wl_buffer_destroy(slot->wl_buffer);
+        munmap(slot->data, slot->size);
+    }
+    slot->wl_buffer = NULL;
+    slot->data = NULL;
+}
+
+/* YUV 格式的 buffer 只需要给出 Y 平面的 stride，
+ * 合成器按紧密排列推算色度平面的位置，和文件里的布局一样
+ * */
+static int
+slot_allocate(struct my_output *state, struct buffer_slot *slot)
+{
+    int stride;
+    size_t size;
+
+    if (state->passthrough) {
+        stride = state->width;
+        size = state->frame_size;
+    } else {
+        stride = state->width * 4;
+        size = (size_t)stride * state->height;
+    }
+
+    int fd = allocate_shm_file(size);
+    if (fd == -1) {
+        return -1;
+    }
+
+    slot->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (slot->data == MAP_FAILED) {
+        slot->data = NULL;
+        close(fd);
+        return -1;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, size);
+    slot->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
+            state->width, state->height, stride, state->shm_format);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    wl_buffer_add_listener(slot->wl_buffer, &wl_buffer_listener, slot);
+    slot->size = size;
+    return 0;
+}
+
+static struct buffer_slot *
+next_slot(struct my_output *state)
+{
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        struct buffer_slot *slot = &state->slots[i];
+        if (slot->busy)
+            continue;
+        if (slot->wl_buffer == NULL && slot_allocate(state, slot) < 0)
+            return NULL;
+        return slot;
+    }
+    return NULL;
+}
+
+/* 顺序读下一帧，到文件末尾后从头循环 */
+static int
+read_frame(struct my_output *state, uint8_t *dst)
+{
+    size_t done = 0;
+    int rewound = 0;
+
+    while (done < state->frame_size) {
+        ssize_t n = read(state->fd, dst + done, state->frame_size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0) {
+            /* 文件连一帧都不够 */
+            if (rewound || done)
+                return -1;
+            lseek(state->fd, 0, SEEK_SET);
+            rewound = 1;
+            continue;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener;
+
+static void
+draw_frame(struct my_output *state)
+{
+    struct buffer_slot *slot;
+    struct wl_callback *cb;
+
+    cb = wl_surface_frame(state->wl_surface);
+    wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
+
+    slot = next_slot(state);
+    if (slot == NULL) {
+        wl_surface_commit(state->wl_surface);
+        return;
+    }
+
+    uint64_t t0 = now_ns();
+    /* 直通时把文件内容直接读进 shm buffer，不经过中间内存 */
+    if (read_frame(state, state->passthrough ? slot->data : state->frame) < 0) {
+        printf("failed to read a whole frame\n");
+        state->closed = 1;
+        return;
+    }
+    uint64_t t1 = now_ns();
+    if (!state->passthrough) {
+        struct yuv_frame frame;
+        yuv_frame_init(&frame, state->format, state->width, state->height,
+                state->frame);
+        yuv_convert(state->converter, &frame, state->matrix,
+                (uint32_t *)slot->data, state->width);
+    }
+    uint64_t t2 = now_ns();
+    state->read_ns += t1 - t0;
+    state->convert_ns += t2 - t1;
+
+    wl_surface_attach(state->wl_surface, slot->wl_buffer, 0, 0);
+    wl_surface_damage_buffer(state->wl_surface, 0, 0, state->width, state->height);
+    slot->busy = 1;
+    wl_surface_commit(state->wl_surface);
+
+    if (++state->frames % 120 == 0) {
+        printf("%u frames, read %.0f us/frame, convert %.0f us/frame\n",
+               state->frames, state->read_ns / 1000.0 / 120,
+               state->convert_ns / 1000.0 / 120);
+        state->read_ns = 0;
+        state->convert_ns = 0;
+    }
+}
+
+static void
+wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
+{
+	wl_callback_destroy(cb);
+	draw_frame(data);
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener = {
+    .done = wl_surface_frame_done,
+};
+
+static void
+shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+    struct my_output *state = data;
+
+    if (format == WL_SHM_FORMAT_NV12)
+        state->shm_nv12 = 1;
+    else if (format == WL_SHM_FORMAT_YUV420)
+        state->shm_yuv420 = 1;
+}
+
+static const struct wl_shm_listener shm_listener = {
+    .format = shm_format,
+};
+
+static void
+xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial)
+{
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+    .ping = xdg_wm_base_ping,
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version)
+{
+	struct my_output *state = (struct my_output *)data;
+	if (!strcmp(interface, wl_compositor_interface.name))
+	{
+		/* wl_surface_damage_buffer 需要版本 4 */
+		state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(
+            registry, name, &wl_shm_interface, 1);
+		wl_shm_add_listener(state->shm, &shm_listener, state);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        state->xdg_wm_base = wl_registry_bind(
+            registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(state->xdg_wm_base, &xdg_wm_base_listener, state);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name)
+{
+}
+
+static const struct wl_registry_listener
+registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+static void
+xdg_surface_configure(void *data,
+        struct xdg_surface *xdg_surface, uint32_t serial)
+{
+    struct my_output *state = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    /* 第一次 configure 时开始播放，之后由 frame callback 驱动 */
+    if (!state->running) {
+        state->running = 1;
+        draw_frame(state);
+    } else {
+        wl_surface_commit(state->wl_surface);
+    }
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+/* 窗口大小固定为视频大小 */
+static void
+xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+		int32_t width, int32_t height, struct wl_array *states)
+{
+}
+
+static void
+xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+    struct my_output *state = data;
+    state->closed = 1;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+static void
+usage(const char *name)
+{
+    printf("usage: %s FILE WIDTHxHEIGHT [--i420] [--bt709] [--threads N] [--convert]\n"
+           "  --i420      input is planar I420 instead of NV12\n"
+           "  --bt709     use the BT.709 matrix instead of BT.601\n"
+           "  --threads   number of conversion threads, default: all CPUs\n"
+           "  --convert   always convert to XRGB8888 even if the compositor takes YUV\n",
+           name);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct my_output state = {0};
+    int threads = 0, force_convert = 0;
+
+    if (argc < 3 || sscanf(argv[2], "%dx%d", &state.width, &state.height) != 2 ||
+        state.width <= 0 || state.height <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    state.format = YUV_NV12;
+    state.matrix = YUV_BT601;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--i420") == 0)
+            state.format = YUV_I420;
+        else if (strcmp(argv[i], "--bt709") == 0)
+            state.matrix = YUV_BT709;
+        else if (strcmp(argv[i], "--convert") == 0)
+            force_convert = 1;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    state.fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (state.fd < 0) {
+        printf("failed to open %s: %s\n", argv[1], strerror(errno));
+        return -1;
+    }
+    state.frame_size = yuv_frame_size(state.format, state.width, state.height);
+
+	struct wl_display *display = wl_display_connect(NULL);
+	if (!display)
+	{
+		printf("Failed create connection to server\n");
+		return -1;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &state);
+	wl_display_roundtrip(display);
+	/* 再来一次，收齐 wl_shm.format 事件 */
+	wl_display_roundtrip(display);
+
+	if (!state.compositor || !state.shm || !state.xdg_wm_base)
+	{
+		printf("missing wl_compositor, wl_shm or xdg_wm_base\n");
+		return -2;
+	}
+
+    /* 合成器按紧密排列推算色度平面，奇数宽高时行对不齐，只能转换 */
+    int even = state.width % 2 == 0 && state.height % 2 == 0;
+    if (!force_convert && even && state.format == YUV_NV12 && state.shm_nv12) {
+        state.passthrough = 1;
+        state.shm_format = WL_SHM_FORMAT_NV12;
+    } else if (!force_convert && even && state.format == YUV_I420 && state.shm_yuv420) {
+        state.passthrough = 1;
+        state.shm_format = WL_SHM_FORMAT_YUV420;
+    } else {
+        state.shm_format = WL_SHM_FORMAT_XRGB8888;
+        state.frame = malloc(state.frame_size);
+        state.converter = yuv_converter_create(threads);
+        if (!state.frame || !state.converter) {
+            printf("out of memory\n");
+            return -1;
+        }
+    }
+
+    if (state.passthrough) {
+        printf("%dx%d %s, passed through to the compositor\n",
+               state.width, state.height,
+               state.format == YUV_NV12 ? "NV12" : "I420");
+    } else {
+        printf("%dx%d %s, converted to XRGB8888 (%s) on %d threads\n",
+               state.width, state.height,
+               state.format == YUV_NV12 ? "NV12" : "I420",
+               state.matrix == YUV_BT709 ? "BT.709" : "BT.601",
+               yuv_converter_threads(state.converter));
+    }
+
+	state.wl_surface = wl_compositor_create_surface(state.compositor);
+	state.xdg_surface = xdg_wm_base_get_xdg_surface(state.xdg_wm_base, state.wl_surface);
+    xdg_surface_add_listener(state.xdg_surface, &xdg_surface_listener, &state);
+    state.xdg_toplevel = xdg_surface_get_toplevel(state.xdg_surface);
+    xdg_toplevel_set_title(state.xdg_toplevel, "YUV video");
+    xdg_toplevel_add_listener(state.xdg_toplevel, &xdg_toplevel_listener, &state);
+    wl_surface_commit(state.wl_surface);
+
+	while (!state.closed && wl_display_dispatch(display) != -1)
+		;
+
+    for (int i = 0; i < SLOT_COUNT; i++)
+        slot_destroy(&state.slots[i]);
+    yuv_converter_destroy(state.converter);
+    free(state.frame);
+    close(state.fd);
+	wl_display_disconnect(display);
+	return 0;
+}
@@ -0,0 +1,383 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+#include "yuv.h"
+
+/* 系数放大 64 倍，全部运算在 16 位整数内完成：
+ * R = (74(Y-16) + 32 + rv(V-128)) >> 6
+ * G = (74(Y-16) + 32 - gu(U-128) - gv(V-128)) >> 6
+ * B = (74(Y-16) + 32 + bu(U-128)) >> 6
+ * 只有 B 会超出 int16，SIMD 用饱和加法，结果本来就要截到 255，和标量版一致
+ * */
+struct coeffs {
+	int16_t y, rv, gu, gv, bu;
+};
+
+static const struct coeffs matrices[] = {
+	[YUV_BT601] = { 74, 102, 25, 52, 129 },
+	[YUV_BT709] = { 74, 115, 14, 34, 135 },
+};
+
+size_t
+yuv_frame_size(enum yuv_format format, int width, int height)
+{
+	size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+
+	(void)format;
+	return (size_t)width * height + chroma * 2;
+}
+
+void
+yuv_frame_init(struct yuv_frame *frame, enum yuv_format format,
+		int width, int height, const uint8_t *data)
+{
+	int cw = (width + 1) / 2, ch = (height + 1) / 2;
+
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	frame->y = data;
+	frame->y_stride = width;
+	frame->u = data + (size_t)width * height;
+	if (format == YUV_NV12) {
+		frame->v = NULL;
+		frame->uv_stride = cw * 2;
+	} else {
+		frame->v = frame->u + (size_t)cw * ch;
+		frame->uv_stride = cw;
+	}
+}
+
+static inline uint32_t
+clamp8(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline uint32_t
+yuv_pixel(const struct coeffs *c, int y, int u, int v)
+{
+	int yy = (y - 16) * c->y + 32;
+
+	u -= 128;
+	v -= 128;
+	return 0xff000000 |
+		clamp8((yy + v * c->rv) >> 6) << 16 |
+		clamp8((yy - u * c->gu - v * c->gv) >> 6) << 8 |
+		clamp8((yy + u * c->bu) >> 6);
+}
+
+#if defined(__AVX2__)
+/* 一次 16 个像素 */
+static int
+row_avx2(const struct coeffs *c, const uint8_t *y, const uint8_t *u,
+		const uint8_t *v, int nv12, uint32_t *dst, int x, int width)
+{
+	const __m256i k_y = _mm256_set1_epi16(c->y);
+	const __m256i k_rv = _mm256_set1_epi16(c->rv);
+	const __m256i k_gu = _mm256_set1_epi16(c->gu);
+	const __m256i k_gv = _mm256_set1_epi16(c->gv);
+	const __m256i k_bu = _mm256_set1_epi16(c->bu);
+	const __m256i off_y = _mm256_set1_epi16(16);
+	const __m256i off_uv = _mm256_set1_epi16(128);
+	const __m256i round = _mm256_set1_epi16(32);
+	const __m256i alpha = _mm256_set1_epi16(255);
+	/* 每个色度样本复制给相邻的两个像素 */
+	const __m128i dup = _mm_setr_epi8(0, 0, 1, 1, 2, 2, 3, 3,
+			4, 4, 5, 5, 6, 6, 7, 7);
+	const __m128i even = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6,
+			8, 8, 10, 10, 12, 12, 14, 14);
+	const __m128i odd = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7,
+			9, 9, 11, 11, 13, 13, 15, 15);
+
+	for (; x + 16 <= width; x += 16) {
+		__m128i us, vs;
+
+		if (nv12) {
+			__m128i uv = _mm_loadu_si128((const __m128i *)(u + x));
+			us = _mm_shuffle_epi8(uv, even);
+			vs = _mm_shuffle_epi8(uv, odd);
+		} else {
+			us = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)(u + x / 2)), dup);
+			vs = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)(v + x / 2)), dup);
+		}
+
+		__m256i yw = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x)));
+		__m256i uw = _mm256_sub_epi16(_mm256_cvtepu8_epi16(us), off_uv);
+		__m256i vw = _mm256_sub_epi16(_mm256_cvtepu8_epi16(vs), off_uv);
+		__m256i yy = _mm256_add_epi16(
+				_mm256_mullo_epi16(_mm256_sub_epi16(yw, off_y), k_y), round);
+
+		__m256i r = _mm256_srai_epi16(
+				_mm256_adds_epi16(yy, _mm256_mullo_epi16(vw, k_rv)), 6);
+		__m256i g = _mm256_srai_epi16(_mm256_subs_epi16(
+				_mm256_subs_epi16(yy, _mm256_mullo_epi16(uw, k_gu)),
+				_mm256_mullo_epi16(vw, k_gv)), 6);
+		__m256i b = _mm256_srai_epi16(
+				_mm256_adds_epi16(yy, _mm256_mullo_epi16(uw, k_bu)), 6);
+
+		/* 每个 128 位通道内交错成 B G R X，最后把两个通道的结果排回顺序 */
+		__m256i br = _mm256_packus_epi16(b, r);
+		__m256i gx = _mm256_packus_epi16(g, alpha);
+		__m256i bg = _mm256_unpacklo_epi8(br, gx);
+		__m256i rx = _mm256_unpackhi_epi8(br, gx);
+		__m256i lo = _mm256_unpacklo_epi16(bg, rx);
+		__m256i hi = _mm256_unpackhi_epi16(bg, rx);
+
+		_mm256_storeu_si256((__m256i *)(dst + x),
+				_mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + x + 8),
+				_mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	return x;
+}
+#endif
+
+#if defined(__SSSE3__)
+/* 一次 8 个像素，AVX2 剩下的部分也走这里 */
+static int
+row_ssse3(const struct coeffs *c, const uint8_t *y, const uint8_t *u,
+		const uint8_t *v, int nv12, uint32_t *dst, int x, int width)
+{
+	const __m128i k_y = _mm_set1_epi16(c->y);
+	const __m128i k_rv = _mm_set1_epi16(c->rv);
+	const __m128i k_gu = _mm_set1_epi16(c->gu);
+	const __m128i k_gv = _mm_set1_epi16(c->gv);
+	const __m128i k_bu = _mm_set1_epi16(c->bu);
+	const __m128i off_y = _mm_set1_epi16(16);
+	const __m128i off_uv = _mm_set1_epi16(128);
+	const __m128i round = _mm_set1_epi16(32);
+	const __m128i alpha = _mm_set1_epi16(255);
+	const __m128i zero = _mm_setzero_si128();
+	/* 直接展开成 16 位，-1 的位置填 0 */
+	const __m128i dup = _mm_setr_epi8(0, -1, 0, -1, 1, -1, 1, -1,
+			2, -1, 2, -1, 3, -1, 3, -1);
+	const __m128i even = _mm_setr_epi8(0, -1, 0, -1, 2, -1, 2, -1,
+			4, -1, 4, -1, 6, -1, 6, -1);
+	const __m128i odd = _mm_setr_epi8(1, -1, 1, -1, 3, -1, 3, -1,
+			5, -1, 5, -1, 7, -1, 7, -1);
+
+	for (; x + 8 <= width; x += 8) {
+		__m128i uw, vw;
+
+		if (nv12) {
+			__m128i uv = _mm_loadl_epi64((const __m128i *)(u + x));
+			uw = _mm_shuffle_epi8(uv, even);
+			vw = _mm_shuffle_epi8(uv, odd);
+		} else {
+			int32_t u4, v4;
+			memcpy(&u4, u + x / 2, 4);
+			memcpy(&v4, v + x / 2, 4);
+			uw = _mm_shuffle_epi8(_mm_cvtsi32_si128(u4), dup);
+			vw = _mm_shuffle_epi8(_mm_cvtsi32_si128(v4), dup);
+		}
+		uw = _mm_sub_epi16(uw, off_uv);
+		vw = _mm_sub_epi16(vw, off_uv);
+
+		__m128i yw = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + x)), zero);
+		__m128i yy = _mm_add_epi16(
+				_mm_mullo_epi16(_mm_sub_epi16(yw, off_y), k_y), round);
+
+		__m128i r = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(vw, k_rv)), 6);
+		__m128i g = _mm_srai_epi16(_mm_subs_epi16(
+				_mm_subs_epi16(yy, _mm_mullo_epi16(uw, k_gu)),
+				_mm_mullo_epi16(vw, k_gv)), 6);
+		__m128i b = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(uw, k_bu)), 6);
+
+		__m128i br = _mm_packus_epi16(b, r);
+		__m128i gx = _mm_packus_epi16(g, alpha);
+		__m128i bg = _mm_unpacklo_epi8(br, gx);
+		__m128i rx = _mm_unpackhi_epi8(br, gx);
+
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_unpacklo_epi16(bg, rx));
+		_mm_storeu_si128((__m128i *)(dst + x + 4), _mm_unpackhi_epi16(bg, rx));
+	}
+	return x;
+}
+#endif
+
+static void
+convert_row(const struct coeffs *c, const struct yuv_frame *frame,
+		int row, uint32_t *dst)
+{
+	const uint8_t *y = frame->y + (size_t)row * frame->y_stride;
+	const uint8_t *u = frame->u + (size_t)(row / 2) * frame->uv_stride;
+	const uint8_t *v = frame->v ? frame->v + (size_t)(row / 2) * frame->uv_stride : NULL;
+	int nv12 = frame->format == YUV_NV12;
+	int x = 0;
+
+#if defined(__AVX2__)
+	x = row_avx2(c, y, u, v, nv12, dst, x, frame->width);
+#endif
+#if defined(__SSSE3__)
+	x = row_ssse3(c, y, u, v, nv12, dst, x, frame->width);
+#endif
+	for (; x < frame->width; x++) {
+		int cu = nv12 ? u[x / 2 * 2] : u[x / 2];
+		int cv = nv12 ? u[x / 2 * 2 + 1] : v[x / 2];
+		dst[x] = yuv_pixel(c, y[x], cu, cv);
+	}
+}
+
+void
+yuv_to_xrgb_rows(const struct yuv_frame *frame, enum yuv_matrix matrix,
+		uint32_t *dst, int dst_stride, int row_begin, int row_end)
+{
+	const struct coeffs *c = &matrices[matrix];
+
+	for (int row = row_begin; row < row_end; row++)
+		convert_row(c, frame, row, dst + (size_t)row * dst_stride);
+}
+
+struct yuv_worker {
+	struct yuv_converter *conv;
+	pthread_t thread;
+	int index;
+};
+
+/* 常驻的线程，每帧唤醒一次，避免每帧创建线程的开销
+ * 调用 yuv_convert 的线程自己处理第 0 段
+ * */
+struct yuv_converter {
+	int threads;
+	struct yuv_worker *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned generation;
+	int pending;
+	int quit;
+
+	const struct yuv_frame *frame;
+	enum yuv_matrix matrix;
+	uint32_t *dst;
+	int dst_stride;
+};
+
+/* 每段行数取偶数，同一对色度行不会被拆到两个线程 */
+static void
+convert_band(struct yuv_converter *conv, int index)
+{
+	int height = conv->frame->height;
+	int rows = ((height + conv->threads - 1) / conv->threads + 1) & ~1;
+	int begin = index * rows;
+	int end = begin + rows < height ? begin + rows : height;
+
+	if (begin < end)
+		yuv_to_xrgb_rows(conv->frame, conv->matrix, conv->dst,
+				conv->dst_stride, begin, end);
+}
+
+static void *
+worker_main(void *data)
+{
+	struct yuv_worker *worker = data;
+	struct yuv_converter *conv = worker->conv;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&conv->lock);
+	for (;;) {
+		while (conv->generation == seen && !conv->quit)
+			pthread_cond_wait(&conv->start, &conv->lock);
+		if (conv->quit)
+			break;
+		seen = conv->generation;
+		pthread_mutex_unlock(&conv->lock);
+
+		convert_band(conv, worker->index);
+
+		pthread_mutex_lock(&conv->lock);
+		if (--conv->pending == 0)
+			pthread_cond_signal(&conv->done);
+	}
+	pthread_mutex_unlock(&conv->lock);
+	return NULL;
+}
+
+struct yuv_converter *
+yuv_converter_create(int threads)
+{
+	struct yuv_converter *conv = calloc(1, sizeof(*conv));
+
+	if (conv == NULL)
+		return NULL;
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+
+	pthread_mutex_init(&conv->lock, NULL);
+	pthread_cond_init(&conv->start, NULL);
+	pthread_cond_init(&conv->done, NULL);
+	conv->workers = calloc(threads, sizeof(*conv->workers));
+	conv->threads = 1;
+	for (int i = 1; i < threads && conv->workers; i++) {
+		struct yuv_worker *worker = &conv->workers[i];
+		worker->conv = conv;
+		worker->index = i;
+		if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+			break;
+		conv->threads++;
+	}
+	return conv;
+}
+
+void
+yuv_converter_destroy(struct yuv_converter *conv)
+{
+	if (conv == NULL)
+		return;
+
+	pthread_mutex_lock(&conv->lock);
+	conv->quit = 1;
+	pthread_cond_broadcast(&conv->start);
+	pthread_mutex_unlock(&conv->lock);
+	for (int i = 1; i < conv->threads; i++)
+		pthread_join(conv->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&conv->done);
+	pthread_cond_destroy(&conv->start);
+	pthread_mutex_destroy(&conv->lock);
+	free(conv->workers);
+	free(conv);
+}
+
+int
+yuv_converter_threads(const struct yuv_converter *conv)
+{
+	return conv->threads;
+}
+
+void
+yuv_convert(struct yuv_converter *conv, const struct yuv_frame *frame,
+		enum yuv_matrix matrix, uint32_t *dst, int dst_stride)
+{
+	conv->frame = frame;
+	conv->matrix = matrix;
+	conv->dst = dst;
+	conv->dst_stride = dst_stride;
+
+	if (conv->threads == 1) {
+		convert_band(conv, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&conv->lock);
+	conv->pending = conv->threads - 1;
+	conv->generation++;
+	pthread_cond_broadcast(&conv->start);
+	pthread_mutex_unlock(&conv->lock);
+
+	convert_band(conv, 0);
+
+	pthread_mutex_lock(&conv->lock);
+	while (conv->pending)
+		pthread_cond_wait(&conv->done, &conv->lock);
+	pthread_mutex_unlock(&conv->lock);
+}
@@ -0,0 +1,56 @@
+#ifndef YUV_H
+#define YUV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 摄像头和视频解码器常见的两种 4:2:0 格式
+ * NV12: Y 平面之后是 UV 交错的平面
+ * I420: Y 平面之后是 U 平面和 V 平面
+ * */
+enum yuv_format {
+	YUV_NV12,
+	YUV_I420,
+};
+
+/* 色彩矩阵，都按 limited range(Y 16-235，UV 16-240)处理 */
+enum yuv_matrix {
+	YUV_BT601,
+	YUV_BT709,
+};
+
+struct yuv_frame {
+	enum yuv_format format;
+	int width;
+	int height;
+	const uint8_t *y;
+	/* NV12 时 u 指向 UV 交错平面，v 不用 */
+	const uint8_t *u;
+	const uint8_t *v;
+	int y_stride;
+	int uv_stride;
+};
+
+/* 紧密排列的一帧占用的字节数 */
+size_t yuv_frame_size(enum yuv_format format, int width, int height);
+
+/* 按紧密排列的方式填好 frame 里各个平面的指针和 stride */
+void yuv_frame_init(struct yuv_frame *frame, enum yuv_format format,
+		int width, int height, const uint8_t *data);
+
+/* 把 [row_begin, row_end) 这些行转换成 XRGB8888，dst_stride 以像素为单位
+ * 定点运算，AVX2、SSSE3 和标量实现的结果完全相同
+ * */
+void yuv_to_xrgb_rows(const struct yuv_frame *frame, enum yuv_matrix matrix,
+		uint32_t *dst, int dst_stride, int row_begin, int row_end);
+
+/* 按行分给多个线程转换整帧，threads 为 0 时使用 CPU 核数 */
+struct yuv_converter;
+
+struct yuv_converter *yuv_converter_create(int threads);
+void yuv_converter_destroy(struct yuv_converter *conv);
+int yuv_converter_threads(const struct yuv_converter *conv);
+void yuv_convert(struct yuv_converter *conv, const struct yuv_frame *frame,
+		enum yuv_matrix matrix, uint32_t *dst, int dst_stride);
+
+#endif
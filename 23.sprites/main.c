@@ -0,0 +1,456 @@
+/////////////////////
+// \note 精灵(粒子)压力测试：大量半透明精灵在窗口里反弹
+//       位置、速度、颜色按结构数组存放，物理更新用 SIMD，
+//       绘制前按 tile 分桶，多个线程各自画完整的 tile
+//
+//       ./sprites [精灵数] [线程数]
+//       ./sprites --bench [精灵数] [最大线程数]  不连接合成器，测试 1 到 N 个线程
+/////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "xdg-shell-client-protocol.h"
+#include "sprites.h"
+
+#define SLOT_COUNT 3
+#define BACKGROUND 0xff1a1d23
+
+struct buffer_slot {
+    struct wl_buffer *wl_buffer;
+    uint32_t *data;
+    int32_t width;
+    int32_t height;
+    size_t size;
+    int busy;
+};
+
+struct my_output {
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *xdg_wm_base;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct wl_surface *wl_surface;
+    int32_t width;
+    int32_t height;
+    int closed;
+    int running;
+    struct buffer_slot slots[SLOT_COUNT];
+
+    struct sprites sprites;
+    struct sprite_renderer *renderer;
+    uint32_t last_time;
+    uint32_t frames;
+    uint64_t render_ns;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+set_cloexec_or_close(int fd)
+{
+        long flags;
+
+        if (fd == -1)
+                return -1;
+
+        flags = fcntl(fd, F_GETFD);
+        if (flags == -1)
+                goto err;
+
+        if (fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+                goto err;
+
+        return fd;
+
+err:
+        close(fd);
+        return -1;
+}
+
+static int
+create_shm_file(void)
+{
+#define NAME_TEMPLATE    "/wl_s1-XXXXXX"
+	char name[64] = {0};
+	const char *path;
+	int fd;
+
+	path = getenv("XDG_RUNTIME_DIR");
+	if (path)
+	{
+		strcpy(name, path);
+	}
+	strcat(name, NAME_TEMPLATE);
+
+	/* 根据模板创建临时文件句柄 */
+	fd = mkstemp(name);
+    if (fd >= 0) {
+        fd = set_cloexec_or_close(fd);
+        unlink(name);
+		return fd;
+    }
+
+	return -1;
+}
+
+static int
+allocate_shm_file(size_t size)
+{
+	int fd = create_shm_file();
+	int ret;
+	if (fd < 0)
+		return -1;
+	do {
+		ret = ftruncate(fd, size);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    struct buffer_slot *slot = data;
+    slot->busy = 0;
+}
+
+static const struct wl_buffer_listener wl_buffer_listener = {
+    .release = wl_buffer_release,
+};
+
+
+static void
+slot_destroy(struct buffer_slot *slot)
+{
+    if (slot->wl_buffer) {
+        wl_buffer_destroy(slot->wl_buffer);
+        munmap(slot->data, slot->size);
+    }
+    slot->wl_buffer = NULL;
+    slot->data = NULL;
+}
+
+static int
+slot_allocate(struct my_output *state, struct buffer_slot *slot)
+{
+    const int width = state->width, height = state->height;
+    int stride = width * 4;
+    size_t size = (size_t)stride * height;
+
+    slot_destroy(slot);
+
+    int fd = allocate_shm_file(size);
+    if (fd == -1) {
+        return -1;
+    }
+
+    slot->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (slot->data == MAP_FAILED) {
+        slot->data = NULL;
+        close(fd);
+        return -1;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, size);
+    slot->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
+            width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    wl_buffer_add_listener(slot->wl_buffer, &wl_buffer_listener, slot);
+    slot->width = width;
+    slot->height = height;
+    slot->size = size;
+    return 0;
+}
+
+/* 取一个空闲的 buffer，窗口大小变了的 buffer 在这里重新分配 */
+static struct buffer_slot *
+next_slot(struct my_output *state)
+{
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        struct buffer_slot *slot = &state->slots[i];
+        if (slot->busy)
+            continue;
+        if (slot->wl_buffer == NULL ||
+            slot->width != state->width || slot->height != state->height) {
+            if (slot_allocate(state, slot) < 0)
+                return NULL;
+        }
+        return slot;
+    }
+    return NULL;
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener;
+
+/* 每帧整个窗口都在变，直接画进 shm buffer，整个窗口都是 damage */
+static void
+draw_frame(struct my_output *state, uint32_t time)
+{
+    struct buffer_slot *slot;
+    struct wl_callback *cb;
+
+    cb = wl_surface_frame(state->wl_surface);
+    wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
+
+    slot = next_slot(state);
+    if (slot == NULL) {
+        wl_surface_commit(state->wl_surface);
+        return;
+    }
+
+    /* 按 frame callback 的时间推进，第一帧和停顿之后按 60 Hz 算 */
+    float dt = 1 / 60.0f;
+    if (state->last_time && time - state->last_time < 100)
+        dt = (time - state->last_time) / 1000.0f;
+    state->last_time = time;
+
+    uint64_t t0 = now_ns();
+    sprite_renderer_frame(state->renderer, &state->sprites, dt, BACKGROUND,
+            slot->data, slot->width, slot->width, slot->height);
+    state->render_ns += now_ns() - t0;
+
+    wl_surface_attach(state->wl_surface, slot->wl_buffer, 0, 0);
+    wl_surface_damage_buffer(state->wl_surface, 0, 0, slot->width, slot->height);
+    slot->busy = 1;
+    wl_surface_commit(state->wl_surface);
+
+    if (++state->frames % 120 == 0) {
+        printf("%d sprites on %d threads: %.2f ms/frame\n",
+               state->sprites.count, sprite_renderer_threads(state->renderer),
+               state->render_ns / 1e6 / 120);
+        state->render_ns = 0;
+    }
+}
+
+static void
+wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
+{
+	wl_callback_destroy(cb);
+	draw_frame(data, time);
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener = {
+    .done = wl_surface_frame_done,
+};
+
+static void
+xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial)
+{
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+    .ping = xdg_wm_base_ping,
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version)
+{
+	struct my_output *state = (struct my_output *)data;
+	if (!strcmp(interface, wl_compositor_interface.name))
+	{
+		/* wl_surface_damage_buffer 需要版本 4 */
+		state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(
+            registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        state->xdg_wm_base = wl_registry_bind(
+            registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(state->xdg_wm_base, &xdg_wm_base_listener, state);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name)
+{
+}
+
+static const struct wl_registry_listener
+registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+static void
+xdg_surface_configure(void *data,
+        struct xdg_surface *xdg_surface, uint32_t serial)
+{
+    struct my_output *state = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    /* 第一次 configure 时开始绘制，之后由 frame callback 驱动 */
+    if (!state->running) {
+        state->running = 1;
+        draw_frame(state, 0);
+    } else {
+        wl_surface_commit(state->wl_surface);
+    }
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+static void
+xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+		int32_t width, int32_t height, struct wl_array *states)
+{
+    struct my_output *state = data;
+    if (width == 0 || height == 0)
+        return;
+
+    state->width = width;
+    state->height = height;
+}
+
+static void
+xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+    struct my_output *state = data;
+    state->closed = 1;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+/* 不连接合成器，在 1280x720 的内存里画，测 1 到 max_threads 个线程的帧时间，
+ * 并按帧时间换算出 60 Hz(16.7ms)内能画多少精灵
+ * */
+static int
+run_bench(int count, int max_threads)
+{
+    const int width = 1280, height = 720, frames = 120;
+    uint32_t *pixels = malloc((size_t)width * height * sizeof(uint32_t));
+    double base = 0;
+
+    if (pixels == NULL)
+        return -1;
+
+    printf("%d sprites, %dx%d, %d frames\n", count, width, height, frames);
+    printf("threads  ms/frame  speedup  sprites per 60 Hz frame\n");
+    for (int threads = 1; threads <= max_threads; threads++) {
+        struct sprites sprites;
+        struct sprite_renderer *renderer;
+
+        if (sprites_init(&sprites, count, width, height, 1) < 0)
+            break;
+        renderer = sprite_renderer_create(threads);
+        if (renderer == NULL) {
+            sprites_finish(&sprites);
+            break;
+        }
+
+        /* 先跑几帧，让缓冲区都分配好、页都换进来 */
+        for (int i = 0; i < 10; i++)
+            sprite_renderer_frame(renderer, &sprites, 1 / 60.0f, BACKGROUND,
+                    pixels, width, width, height);
+
+        uint64_t t0 = now_ns();
+        for (int i = 0; i < frames; i++)
+            sprite_renderer_frame(renderer, &sprites, 1 / 60.0f, BACKGROUND,
+                    pixels, width, width, height);
+        double ms = (now_ns() - t0) / 1e6 / frames;
+
+        if (threads == 1)
+            base = ms;
+        printf("%7d  %8.3f  %7.2f  %d\n", sprite_renderer_threads(renderer), ms,
+               base / ms, (int)(count * (1000.0 / 60) / ms));
+
+        sprite_renderer_destroy(renderer);
+        sprites_finish(&sprites);
+    }
+
+    free(pixels);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct my_output state = {0};
+    int count = 20000, threads = 0;
+
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc > 2)
+            count = atoi(argv[2]);
+        if (argc > 3)
+            max_threads = atoi(argv[3]);
+        return run_bench(count, max_threads < 1 ? 1 : max_threads);
+    }
+    if (argc > 1)
+        count = atoi(argv[1]);
+    if (argc > 2)
+        threads = atoi(argv[2]);
+
+    struct wl_display *display = wl_display_connect(NULL);
+
+    state.width = 960;
+    state.height = 640;
+	if (!display)
+	{
+		printf("Failed create connection to server\n");
+		return -1;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &state);
+	wl_display_roundtrip(display);
+
+	if (!state.compositor || !state.shm || !state.xdg_wm_base)
+	{
+		printf("missing wl_compositor, wl_shm or xdg_wm_base\n");
+		return -2;
+	}
+
+    state.renderer = sprite_renderer_create(threads);
+    if (state.renderer == NULL ||
+        sprites_init(&state.sprites, count, state.width, state.height, 1) < 0)
+    {
+        printf("out of memory\n");
+        return -1;
+    }
+
+	state.wl_surface = wl_compositor_create_surface(state.compositor);
+	state.xdg_surface = xdg_wm_base_get_xdg_surface(state.xdg_wm_base, state.wl_surface);
+    xdg_surface_add_listener(state.xdg_surface, &xdg_surface_listener, &state);
+    state.xdg_toplevel = xdg_surface_get_toplevel(state.xdg_surface);
+    xdg_toplevel_set_title(state.xdg_toplevel, "Sprites");
+    xdg_toplevel_add_listener(state.xdg_toplevel, &xdg_toplevel_listener, &state);
+    wl_surface_commit(state.wl_surface);
+
+	while (!state.closed && wl_display_dispatch(display) != -1)
+		;
+
+    for (int i = 0; i < SLOT_COUNT; i++)
+        slot_destroy(&state.slots[i]);
+    sprite_renderer_destroy(state.renderer);
+    sprites_finish(&state.sprites);
+	wl_display_disconnect(display);
+	return 0;
+}
@@ -0,0 +1,534 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "sprites.h"
+
+static const uint32_t palette[SPRITE_COLORS] = {
+	0xe03131, 0xf08c00, 0xf5d90a, 0x2f9e44,
+	0x1c7ed6, 0x7048e8, 0xd6336c, 0x0ca678,
+};
+
+static uint32_t
+xorshift(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static float
+random_float(uint32_t *state, float lo, float hi)
+{
+	return lo + (hi - lo) * (xorshift(state) & 0xffffff) / (float)0x1000000;
+}
+
+static float *
+alloc_floats(int count)
+{
+	/* 按 32 字节对齐，大小向上取整到 8 个 */
+	size_t size = ((size_t)count + 7) / 8 * 8 * sizeof(float);
+	return aligned_alloc(32, size ? size : 32);
+}
+
+/* 边缘柔和的圆点，中间也有一点透明，叠在一起时能看出混合 */
+static void
+build_images(struct sprites *sprites)
+{
+	const float radius = SPRITE_SIZE / 2.0f;
+
+	for (int c = 0; c < SPRITE_COLORS; c++) {
+		for (int y = 0; y < SPRITE_SIZE; y++) {
+			for (int x = 0; x < SPRITE_SIZE; x++) {
+				float dx = x + 0.5f - radius, dy = y + 0.5f - radius;
+				float edge = (radius - sqrtf(dx * dx + dy * dy)) * 2.0f;
+				uint32_t a = edge <= 0 ? 0 : edge >= 1 ? 220 : (uint32_t)(edge * 220);
+				uint32_t r = (palette[c] >> 16 & 0xff) * a / 255;
+				uint32_t g = (palette[c] >> 8 & 0xff) * a / 255;
+				uint32_t b = (palette[c] & 0xff) * a / 255;
+				sprites->image[c][y * SPRITE_SIZE + x] = a << 24 | r << 16 | g << 8 | b;
+			}
+		}
+	}
+}
+
+int
+sprites_init(struct sprites *sprites, int count, int width, int height,
+		uint32_t seed)
+{
+	uint32_t rng = seed ? seed : 1;
+
+	memset(sprites, 0, sizeof(*sprites));
+	sprites->x = alloc_floats(count);
+	sprites->y = alloc_floats(count);
+	sprites->vx = alloc_floats(count);
+	sprites->vy = alloc_floats(count);
+	sprites->color = malloc(count ? count : 1);
+	if (!sprites->x || !sprites->y || !sprites->vx || !sprites->vy || !sprites->color) {
+		sprites_finish(sprites);
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		sprites->x[i] = random_float(&rng, 0, width - SPRITE_SIZE);
+		sprites->y[i] = random_float(&rng, 0, height - SPRITE_SIZE);
+		sprites->vx[i] = random_float(&rng, -250, 250);
+		sprites->vy[i] = random_float(&rng, -250, 250);
+		sprites->color[i] = xorshift(&rng) % SPRITE_COLORS;
+	}
+	sprites->count = count;
+	build_images(sprites);
+	return 0;
+}
+
+void
+sprites_finish(struct sprites *sprites)
+{
+	free(sprites->x);
+	free(sprites->y);
+	free(sprites->vx);
+	free(sprites->vy);
+	free(sprites->color);
+	memset(sprites, 0, sizeof(*sprites));
+}
+
+/* 一个坐标轴上的移动和反弹 */
+static void
+update_axis(float *pos, float *vel, int begin, int end, float dt, float limit)
+{
+	int i = begin;
+#if defined(__AVX2__)
+	const __m256 vdt = _mm256_set1_ps(dt);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 max = _mm256_set1_ps(limit);
+	const __m256 max2 = _mm256_set1_ps(2 * limit);
+
+	for (; i + 8 <= end; i += 8) {
+		__m256 p = _mm256_loadu_ps(pos + i);
+		__m256 v = _mm256_loadu_ps(vel + i);
+
+		p = _mm256_add_ps(p, _mm256_mul_ps(v, vdt));
+		__m256 lo = _mm256_cmp_ps(p, zero, _CMP_LT_OQ);
+		__m256 hi = _mm256_cmp_ps(p, max, _CMP_GT_OQ);
+		p = _mm256_blendv_ps(p, _mm256_sub_ps(zero, p), lo);
+		p = _mm256_blendv_ps(p, _mm256_sub_ps(max2, p), hi);
+		v = _mm256_blendv_ps(v, _mm256_sub_ps(zero, v), _mm256_or_ps(lo, hi));
+		/* 窗口变小后可能一次越过两条边 */
+		p = _mm256_min_ps(_mm256_max_ps(p, zero), max);
+
+		_mm256_storeu_ps(pos + i, p);
+		_mm256_storeu_ps(vel + i, v);
+	}
+#elif defined(__SSE2__)
+	const __m128 vdt = _mm_set1_ps(dt);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 max = _mm_set1_ps(limit);
+	const __m128 max2 = _mm_set1_ps(2 * limit);
+
+	for (; i + 4 <= end; i += 4) {
+		__m128 p = _mm_loadu_ps(pos + i);
+		__m128 v = _mm_loadu_ps(vel + i);
+
+		p = _mm_add_ps(p, _mm_mul_ps(v, vdt));
+		__m128 lo = _mm_cmplt_ps(p, zero);
+		__m128 hi = _mm_cmpgt_ps(p, max);
+		p = _mm_or_ps(_mm_andnot_ps(lo, p), _mm_and_ps(lo, _mm_sub_ps(zero, p)));
+		p = _mm_or_ps(_mm_andnot_ps(hi, p), _mm_and_ps(hi, _mm_sub_ps(max2, p)));
+		__m128 flip = _mm_or_ps(lo, hi);
+		v = _mm_or_ps(_mm_andnot_ps(flip, v), _mm_and_ps(flip, _mm_sub_ps(zero, v)));
+		p = _mm_min_ps(_mm_max_ps(p, zero), max);
+
+		_mm_storeu_ps(pos + i, p);
+		_mm_storeu_ps(vel + i, v);
+	}
+#endif
+	for (; i < end; i++) {
+		float p = pos[i] + vel[i] * dt;
+		if (p < 0 || p > limit) {
+			p = p < 0 ? -p : 2 * limit - p;
+			vel[i] = -vel[i];
+		}
+		pos[i] = p < 0 ? 0 : p > limit ? limit : p;
+	}
+}
+
+void
+sprites_update(struct sprites *sprites, int begin, int end, float dt,
+		float width, float height)
+{
+	update_axis(sprites->x, sprites->vx, begin, end, dt, width - SPRITE_SIZE);
+	update_axis(sprites->y, sprites->vy, begin, end, dt, height - SPRITE_SIZE);
+}
+
+/* 预乘 alpha 的 over 混合：dst = src + dst * (255 - src.a) / 255
+ * 除以 255 用 (x + 128 + ((x + 128) >> 8)) >> 8，SIMD 和标量结果相同
+ * */
+static inline uint32_t
+div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static void
+blend_row(uint32_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i k255 = _mm_set1_epi16(255);
+	const __m128i k128 = _mm_set1_epi16(128);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+		__m128i d_lo = _mm_unpacklo_epi8(d, zero);
+		__m128i d_hi = _mm_unpackhi_epi8(d, zero);
+
+		/* 每个像素的 alpha 复制到 4 个通道 */
+		__m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo,
+				_MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi,
+				_MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+		__m128i p_lo = _mm_add_epi16(_mm_mullo_epi16(d_lo, _mm_sub_epi16(k255, a_lo)), k128);
+		__m128i p_hi = _mm_add_epi16(_mm_mullo_epi16(d_hi, _mm_sub_epi16(k255, a_hi)), k128);
+		p_lo = _mm_srli_epi16(_mm_add_epi16(p_lo, _mm_srli_epi16(p_lo, 8)), 8);
+		p_hi = _mm_srli_epi16(_mm_add_epi16(p_hi, _mm_srli_epi16(p_hi, 8)), 8);
+
+		__m128i out = _mm_packus_epi16(_mm_add_epi16(s_lo, p_lo),
+				_mm_add_epi16(s_hi, p_hi));
+		_mm_storeu_si128((__m128i *)(dst + i), out);
+	}
+#endif
+	for (; i < n; i++) {
+		uint32_t s = src[i], d = dst[i];
+		uint32_t inv = 255 - (s >> 24);
+		uint32_t out = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			uint32_t c = (s >> shift & 0xff) + div255((d >> shift & 0xff) * inv);
+			out |= (c > 255 ? 255 : c) << shift;
+		}
+		dst[i] = out;
+	}
+}
+
+static void
+fill_row(uint32_t *dst, uint32_t value, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = value;
+}
+
+struct sprite_worker {
+	struct sprite_renderer *renderer;
+	pthread_t thread;
+	int index;
+};
+
+typedef void (*sprite_job)(struct sprite_renderer *renderer, int index);
+
+/* 常驻线程池，每个阶段唤醒一次，调用者自己是第 0 个线程 */
+struct sprite_renderer {
+	int threads;
+	struct sprite_worker *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned generation;
+	int pending;
+	int quit;
+	sprite_job job;
+
+	/* 当前帧 */
+	struct sprites *sprites;
+	float dt;
+	uint32_t background;
+	uint32_t *dst;
+	int stride;
+	int width;
+	int height;
+
+	/* 按 tile 分桶：tile t 的精灵是 refs[tile_start[t] .. tile_start[t + 1]) */
+	int tiles_x;
+	int tiles_y;
+	int tile_capacity;
+	uint32_t *tile_start;
+	uint32_t *tile_fill;
+	int ref_capacity;
+	uint32_t *refs;
+	int next_tile;
+};
+
+static void *
+worker_main(void *data)
+{
+	struct sprite_worker *worker = data;
+	struct sprite_renderer *r = worker->renderer;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		while (r->generation == seen && !r->quit)
+			pthread_cond_wait(&r->start, &r->lock);
+		if (r->quit)
+			break;
+		seen = r->generation;
+		pthread_mutex_unlock(&r->lock);
+
+		r->job(r, worker->index);
+
+		pthread_mutex_lock(&r->lock);
+		if (--r->pending == 0)
+			pthread_cond_signal(&r->done);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+/* 在所有线程上执行 job，等全部完成后返回 */
+static void
+run_job(struct sprite_renderer *r, sprite_job job)
+{
+	r->job = job;
+	if (r->threads == 1) {
+		job(r, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->pending = r->threads - 1;
+	r->generation++;
+	pthread_cond_broadcast(&r->start);
+	pthread_mutex_unlock(&r->lock);
+
+	job(r, 0);
+
+	pthread_mutex_lock(&r->lock);
+	while (r->pending)
+		pthread_cond_wait(&r->done, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+}
+
+struct sprite_renderer *
+sprite_renderer_create(int threads)
+{
+	struct sprite_renderer *r = calloc(1, sizeof(*r));
+
+	if (r == NULL)
+		return NULL;
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->start, NULL);
+	pthread_cond_init(&r->done, NULL);
+	r->workers = calloc(threads, sizeof(*r->workers));
+	r->threads = 1;
+	for (int i = 1; i < threads && r->workers; i++) {
+		struct sprite_worker *worker = &r->workers[i];
+		worker->renderer = r;
+		worker->index = i;
+		if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+			break;
+		r->threads++;
+	}
+	return r;
+}
+
+void
+sprite_renderer_destroy(struct sprite_renderer *r)
+{
+	if (r == NULL)
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	r->quit = 1;
+	pthread_cond_broadcast(&r->start);
+	pthread_mutex_unlock(&r->lock);
+	for (int i = 1; i < r->threads; i++)
+		pthread_join(r->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&r->done);
+	pthread_cond_destroy(&r->start);
+	pthread_mutex_destroy(&r->lock);
+	free(r->workers);
+	free(r->tile_start);
+	free(r->tile_fill);
+	free(r->refs);
+	free(r);
+}
+
+int
+sprite_renderer_threads(const struct sprite_renderer *r)
+{
+	return r->threads;
+}
+
+/* 每个线程更新一段连续的精灵，段的边界按 8 对齐 */
+static void
+physics_job(struct sprite_renderer *r, int index)
+{
+	int count = r->sprites->count;
+	int per = ((count + r->threads - 1) / r->threads + 7) & ~7;
+	int begin = index * per;
+	int end = begin + per < count ? begin + per : count;
+
+	if (begin < end)
+		sprites_update(r->sprites, begin, end, r->dt, r->width, r->height);
+}
+
+/* 精灵覆盖的 tile 范围，完全在画面外时返回 0 */
+static int
+sprite_tiles(const struct sprite_renderer *r, int sx, int sy,
+		int *tx0, int *ty0, int *tx1, int *ty1)
+{
+	if (sx + SPRITE_SIZE <= 0 || sy + SPRITE_SIZE <= 0 ||
+		sx >= r->width || sy >= r->height)
+		return 0;
+
+	*tx0 = sx < 0 ? 0 : sx / SPRITE_TILE;
+	*ty0 = sy < 0 ? 0 : sy / SPRITE_TILE;
+	*tx1 = (sx + SPRITE_SIZE - 1) / SPRITE_TILE;
+	*ty1 = (sy + SPRITE_SIZE - 1) / SPRITE_TILE;
+	if (*tx1 >= r->tiles_x)
+		*tx1 = r->tiles_x - 1;
+	if (*ty1 >= r->tiles_y)
+		*ty1 = r->tiles_y - 1;
+	return 1;
+}
+
+/* 计数排序：先数每个 tile 有多少精灵，再按精灵顺序填进去，
+ * 同一个 tile 里保持精灵原来的先后顺序，重叠时的覆盖关系和整体画一遍一样
+ * */
+static int
+bin_sprites(struct sprite_renderer *r)
+{
+	const struct sprites *s = r->sprites;
+	int tiles = r->tiles_x * r->tiles_y;
+	int tx0, ty0, tx1, ty1;
+
+	if (tiles + 1 > r->tile_capacity) {
+		free(r->tile_start);
+		free(r->tile_fill);
+		r->tile_start = malloc((tiles + 1) * sizeof(uint32_t));
+		r->tile_fill = malloc((tiles + 1) * sizeof(uint32_t));
+		if (!r->tile_start || !r->tile_fill) {
+			r->tile_capacity = 0;
+			return -1;
+		}
+		r->tile_capacity = tiles + 1;
+	}
+	/* 精灵比 tile 小，最多跨 4 个 tile */
+	if (s->count * 4 > r->ref_capacity) {
+		free(r->refs);
+		r->refs = malloc((size_t)s->count * 4 * sizeof(uint32_t));
+		if (!r->refs) {
+			r->ref_capacity = 0;
+			return -1;
+		}
+		r->ref_capacity = s->count * 4;
+	}
+
+	memset(r->tile_fill, 0, (tiles + 1) * sizeof(uint32_t));
+	for (int i = 0; i < s->count; i++) {
+		if (!sprite_tiles(r, (int)s->x[i], (int)s->y[i], &tx0, &ty0, &tx1, &ty1))
+			continue;
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				r->tile_fill[ty * r->tiles_x + tx]++;
+	}
+
+	r->tile_start[0] = 0;
+	for (int t = 0; t < tiles; t++) {
+		r->tile_start[t + 1] = r->tile_start[t] + r->tile_fill[t];
+		r->tile_fill[t] = r->tile_start[t];
+	}
+
+	for (int i = 0; i < s->count; i++) {
+		if (!sprite_tiles(r, (int)s->x[i], (int)s->y[i], &tx0, &ty0, &tx1, &ty1))
+			continue;
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				r->refs[r->tile_fill[ty * r->tiles_x + tx]++] = i;
+	}
+	return 0;
+}
+
+/* 一个 tile 只由一个线程画，画的时候整块都在缓存里 */
+static void
+draw_tile(struct sprite_renderer *r, int tile)
+{
+	const struct sprites *s = r->sprites;
+	int x0 = tile % r->tiles_x * SPRITE_TILE;
+	int y0 = tile / r->tiles_x * SPRITE_TILE;
+	int x1 = x0 + SPRITE_TILE < r->width ? x0 + SPRITE_TILE : r->width;
+	int y1 = y0 + SPRITE_TILE < r->height ? y0 + SPRITE_TILE : r->height;
+
+	for (int y = y0; y < y1; y++)
+		fill_row(r->dst + (size_t)y * r->stride + x0, r->background, x1 - x0);
+
+	for (uint32_t k = r->tile_start[tile]; k < r->tile_start[tile + 1]; k++) {
+		int i = r->refs[k];
+		int sx = (int)s->x[i], sy = (int)s->y[i];
+		int cx0 = sx > x0 ? sx : x0;
+		int cy0 = sy > y0 ? sy : y0;
+		int cx1 = sx + SPRITE_SIZE < x1 ? sx + SPRITE_SIZE : x1;
+		int cy1 = sy + SPRITE_SIZE < y1 ? sy + SPRITE_SIZE : y1;
+		const uint32_t *image = s->image[s->color[i]];
+
+		for (int y = cy0; y < cy1; y++)
+			blend_row(r->dst + (size_t)y * r->stride + cx0,
+					image + (y - sy) * SPRITE_SIZE + (cx0 - sx), cx1 - cx0);
+	}
+}
+
+/* tile 里的精灵数量差别很大，线程用原子计数器动态领取 tile
+ * 第一个 tile 按线程编号直接分配，计数器从 threads 开始，
+ * 各个线程开始时不用同时去抢同一个计数器
+ * */
+static void
+tile_job(struct sprite_renderer *r, int index)
+{
+	int tiles = r->tiles_x * r->tiles_y;
+	int tile = index;
+
+	while (tile < tiles) {
+		draw_tile(r, tile);
+		tile = __atomic_fetch_add(&r->next_tile, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void
+sprite_renderer_frame(struct sprite_renderer *r, struct sprites *sprites,
+		float dt, uint32_t background, uint32_t *dst, int stride,
+		int width, int height)
+{
+	r->sprites = sprites;
+	r->dt = dt;
+	r->background = background;
+	r->dst = dst;
+	r->stride = stride;
+	r->width = width;
+	r->height = height;
+	r->tiles_x = (width + SPRITE_TILE - 1) / SPRITE_TILE;
+	r->tiles_y = (height + SPRITE_TILE - 1) / SPRITE_TILE;
+
+	run_job(r, physics_job);
+	if (bin_sprites(r) < 0)
+		return;
+	r->next_tile = r->threads;
+	run_job(r, tile_job);
+}
@@ -0,0 +1,43 @@
+#ifndef SPRITES_H
+#define SPRITES_H
+
+#include <stdint.h>
+
+#define SPRITE_SIZE 16
+#define SPRITE_COLORS 8
+/* 画面按这个大小分块，每块由一个线程完整画完 */
+#define SPRITE_TILE 64
+
+/* 结构数组(SoA)：同一个属性连续存放，物理更新时一次处理 8 个精灵 */
+struct sprites {
+	int count;
+	float *x;
+	float *y;
+	float *vx;
+	float *vy;
+	uint8_t *color;
+	/* 每种颜色一张预乘 alpha 的精灵图 */
+	uint32_t image[SPRITE_COLORS][SPRITE_SIZE * SPRITE_SIZE];
+};
+
+int sprites_init(struct sprites *sprites, int count, int width, int height,
+		uint32_t seed);
+void sprites_finish(struct sprites *sprites);
+
+/* 更新 [begin, end) 的位置，碰到边缘反弹 */
+void sprites_update(struct sprites *sprites, int begin, int end, float dt,
+		float width, float height);
+
+/* 精灵按 tile 分桶后由多个线程并行绘制 */
+struct sprite_renderer;
+
+struct sprite_renderer *sprite_renderer_create(int threads);
+void sprite_renderer_destroy(struct sprite_renderer *renderer);
+int sprite_renderer_threads(const struct sprite_renderer *renderer);
+
+/* 更新物理并把一帧画到 dst 上，stride 以像素为单位 */
+void sprite_renderer_frame(struct sprite_renderer *renderer,
+		struct sprites *sprites, float dt, uint32_t background,
+		uint32_t *dst, int stride, int width, int height);
+
+#endif
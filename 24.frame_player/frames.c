@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frames.h"
+
+int
+frame_file_open(struct frame_file *file, const char *path, size_t frame_size,
+		int readahead)
+{
+	struct stat st;
+
+	memset(file, 0, sizeof(*file));
+	file->frame_size = frame_size;
+	file->readahead = readahead;
+
+	file->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (file->fd < 0) {
+		fprintf(stderr, "open %s failed: %m\n", path);
+		return -1;
+	}
+	if (fstat(file->fd, &st) < 0 || (size_t)st.st_size < frame_size) {
+		fprintf(stderr, "%s: smaller than one frame\n", path);
+		goto fail;
+	}
+	file->size = st.st_size;
+	file->count = file->size / frame_size;
+
+	file->map = mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+	if (file->map == MAP_FAILED) {
+		fprintf(stderr, "mmap %s failed: %m\n", path);
+		file->map = NULL;
+		goto fail;
+	}
+	/* 访问模式由下面的 madvise 明确告诉内核，不需要它自己猜 */
+	madvise(file->map, file->size, MADV_RANDOM);
+	return 0;
+
+fail:
+	close(file->fd);
+	file->fd = -1;
+	return -1;
+}
+
+void
+frame_file_close(struct frame_file *file)
+{
+	if (file->map)
+		munmap(file->map, file->size);
+	if (file->fd >= 0)
+		close(file->fd);
+	file->map = NULL;
+	file->fd = -1;
+}
+
+/* 帧在文件里的范围，起点向下对齐到页 */
+static void
+frame_range(const struct frame_file *file, uint64_t index, uint8_t **start,
+		size_t *len)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t offset = (index % file->count) * file->frame_size;
+	size_t aligned = offset & ~(page - 1);
+
+	*start = file->map + aligned;
+	*len = offset + file->frame_size - aligned;
+}
+
+const uint8_t *
+frame_file_get(struct frame_file *file, uint64_t index)
+{
+	uint64_t end = index + 1 + file->readahead;
+	uint8_t *start;
+	size_t len;
+
+	/* 跳帧时之前预读的窗口作废，从当前帧后面重新开始 */
+	if (file->advised <= index)
+		file->advised = index + 1;
+	for (; file->readahead > 0 && file->advised < end; file->advised++) {
+		frame_range(file, file->advised, &start, &len);
+		madvise(start, len, MADV_WILLNEED);
+		file->advised_bytes += len;
+	}
+	return file->map + (index % file->count) * file->frame_size;
+}
+
+void
+frame_file_done(struct frame_file *file, uint64_t index)
+{
+	uint8_t *start;
+	size_t len;
+
+	/* 只解除映射，页还在 page cache 里，下一轮循环时仍然能命中 */
+	frame_range(file, index, &start, &len);
+	madvise(start, len, MADV_DONTNEED);
+}
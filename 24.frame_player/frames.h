@@ -0,0 +1,37 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 原始帧序列文件：一帧接一帧紧密排列，没有文件头
+ *
+ * 整个文件只读映射进来，播放到第 i 帧时用 madvise(MADV_WILLNEED)
+ * 让内核在后台把后面 readahead 帧读进 page cache，
+ * 用过的帧 MADV_DONTNEED 解除映射，进程占用的内存不随文件大小增长
+ * */
+struct frame_file {
+	int fd;
+	uint8_t *map;
+	size_t size;
+	size_t frame_size;
+	int count;
+	/* 提前预读的帧数，0 表示不预读 */
+	int readahead;
+	/* 下一个还没有 madvise 过的帧(绝对序号，循环播放时一直增长) */
+	uint64_t advised;
+	/* 统计 madvise 过的字节数 */
+	uint64_t advised_bytes;
+};
+
+int frame_file_open(struct frame_file *file, const char *path,
+		size_t frame_size, int readahead);
+void frame_file_close(struct frame_file *file);
+
+/* 取第 index 帧(按帧数取模，循环播放)，并预读后面的帧 */
+const uint8_t *frame_file_get(struct frame_file *file, uint64_t index);
+
+/* 这一帧已经复制走了，不再需要映射 */
+void frame_file_done(struct frame_file *file, uint64_t index);
+
+#endif
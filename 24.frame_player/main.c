@@ -0,0 +1,443 @@
+/////////////////////
+// \note 播放原始帧序列(录下来的界面或者解码好的视频)
+//       帧文件整个 mmap 进来，边播放边用 madvise 提前预读后面几帧，
+//       三个 shm buffer 轮流使用，由 wl_surface.frame 回调驱动，统计丢帧
+//
+//       测试文件可以用 ffmpeg 生成(bgra 在内存里就是 XRGB8888)：
+//       ffmpeg -i input.mp4 -pix_fmt bgra -f rawvideo video.raw
+//       ./frame_player video.raw 3840x2160 --fps 60
+/////////////////////
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "xdg-shell-client-protocol.h"
+#include "frames.h"
+
+#define SLOT_COUNT 3
+/* 每隔这么多帧打印一次统计 */
+#define REPORT_FRAMES 300
+
+struct buffer_slot {
+    struct wl_buffer *wl_buffer;
+    uint8_t *data;
+    int busy;
+};
+
+struct my_output {
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *xdg_wm_base;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct wl_surface *wl_surface;
+    int closed;
+    int running;
+
+    /* 三个 buffer 在同一个 pool 里 */
+    struct buffer_slot slots[SLOT_COUNT];
+    uint8_t *pool_data;
+    size_t pool_size;
+
+    struct frame_file file;
+    int width;
+    int height;
+    uint32_t format;
+    int fps;
+    int once;
+
+    /* 第 0 帧在 configure 时显示，第一次回调时开始计时，
+     * 之后按回调时间计算每次应该显示哪一帧
+     * */
+    int timed;
+    uint32_t start_time;
+    uint32_t last_time;
+    /* 已经显示的帧(绝对序号)，还没有显示过时 shown_any 为 0 */
+    uint64_t shown;
+    int shown_any;
+
+    /* 统计 */
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t repeated;
+    uint64_t no_buffer;
+    uint64_t copy_ns;
+    uint64_t copy_max_ns;
+    long majflt;
+    uint64_t report_frames;
+    uint64_t report_dropped;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* 缺页(需要等磁盘)的次数，预读生效时播放过程中应该不增长 */
+static long
+major_faults(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_majflt;
+}
+
+static void
+wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    struct buffer_slot *slot = data;
+    slot->busy = 0;
+}
+
+static const struct wl_buffer_listener wl_buffer_listener = {
+    .release = wl_buffer_release,
+};
+
+/* 一开始就建好三个 buffer，之后只是轮流使用 */
+static int
+create_slots(struct my_output *state)
+{
+    int stride = state->width * 4;
+    size_t size = (size_t)stride * state->height;
+
+    state->pool_size = size * SLOT_COUNT;
+    if (state->pool_size > INT32_MAX) {
+        printf("frames too large for one wl_shm pool\n");
+        return -1;
+    }
+
+    int fd = memfd_create("frame-player", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, state->pool_size) < 0) {
+        printf("creating shm pool failed: %s\n", strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    state->pool_data = mmap(NULL, state->pool_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if (state->pool_data == MAP_FAILED) {
+        printf("mmap failed: %s\n", strerror(errno));
+        state->pool_data = NULL;
+        close(fd);
+        return -1;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, state->pool_size);
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        struct buffer_slot *slot = &state->slots[i];
+        slot->data = state->pool_data + size * i;
+        slot->wl_buffer = wl_shm_pool_create_buffer(pool, size * i,
+                state->width, state->height, stride, state->format);
+        wl_buffer_add_listener(slot->wl_buffer, &wl_buffer_listener, slot);
+    }
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return 0;
+}
+
+static void
+destroy_slots(struct my_output *state)
+{
+    for (int i = 0; i < SLOT_COUNT; i++)
+        if (state->slots[i].wl_buffer)
+            wl_buffer_destroy(state->slots[i].wl_buffer);
+    if (state->pool_data)
+        munmap(state->pool_data, state->pool_size);
+}
+
+static struct buffer_slot *
+next_slot(struct my_output *state)
+{
+    for (int i = 0; i < SLOT_COUNT; i++)
+        if (!state->slots[i].busy)
+            return &state->slots[i];
+    return NULL;
+}
+
+static void
+report(struct my_output *state, const char *prefix)
+{
+    uint64_t frames = state->frames - state->report_frames;
+    long majflt = major_faults();
+
+    printf("%s%llu frames shown, %llu dropped (%llu in the last %llu), "
+           "%llu repeated, %llu with no free buffer, copy %.2f ms avg / %.2f ms max, "
+           "%ld major faults\n",
+           prefix, (unsigned long long)state->frames,
+           (unsigned long long)state->dropped,
+           (unsigned long long)(state->dropped - state->report_dropped),
+           (unsigned long long)frames, (unsigned long long)state->repeated,
+           (unsigned long long)state->no_buffer,
+           frames ? state->copy_ns / 1e6 / frames : 0, state->copy_max_ns / 1e6,
+           majflt - state->majflt);
+    state->report_frames = state->frames;
+    state->report_dropped = state->dropped;
+    state->copy_ns = 0;
+    state->copy_max_ns = 0;
+    state->majflt = majflt;
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener;
+
+/* 按 frame 回调给的毫秒时间戳 time 和帧率算出这次应该显示哪一帧
+ * (第一次从 configure 调用时没有时间戳)：
+ * 显示器比视频快时重复上一帧，来不及时跳过的帧计为丢帧
+ * */
+static void
+draw_frame(struct my_output *state, uint32_t time)
+{
+    struct buffer_slot *slot;
+    struct wl_callback *cb;
+    uint64_t due;
+
+    cb = wl_surface_frame(state->wl_surface);
+    wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
+
+    if (!state->shown_any) {
+        due = 0;
+    } else {
+        if (!state->timed) {
+            /* 第一次回调显示第 1 帧 */
+            state->start_time = time - 1000 / state->fps;
+            state->timed = 1;
+        }
+        state->last_time = time;
+        /* 四舍五入，回调时间有一两毫秒的抖动也不会在两帧之间来回跳 */
+        due = ((uint64_t)(uint32_t)(time - state->start_time) * state->fps + 500) / 1000;
+    }
+
+    if (state->once && due >= (uint64_t)state->file.count) {
+        state->closed = 1;
+        return;
+    }
+    if (state->shown_any && due <= state->shown) {
+        state->repeated++;
+        wl_surface_commit(state->wl_surface);
+        return;
+    }
+
+    slot = next_slot(state);
+    if (slot == NULL) {
+        /* 三个 buffer 都还在合成器手里，这一帧没法显示，下次回调时算作丢帧 */
+        state->no_buffer++;
+        wl_surface_commit(state->wl_surface);
+        return;
+    }
+
+    if (state->shown_any)
+        state->dropped += due - state->shown - 1;
+    state->shown = due;
+    state->shown_any = 1;
+
+    uint64_t t0 = now_ns();
+    const uint8_t *frame = frame_file_get(&state->file, due);
+    memcpy(slot->data, frame, state->file.frame_size);
+    frame_file_done(&state->file, due);
+    uint64_t t = now_ns() - t0;
+    state->copy_ns += t;
+    if (t > state->copy_max_ns)
+        state->copy_max_ns = t;
+
+    wl_surface_attach(state->wl_surface, slot->wl_buffer, 0, 0);
+    wl_surface_damage_buffer(state->wl_surface, 0, 0, state->width, state->height);
+    slot->busy = 1;
+    wl_surface_commit(state->wl_surface);
+
+    if (++state->frames % REPORT_FRAMES == 0)
+        report(state, "");
+}
+
+static void
+wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
+{
+	wl_callback_destroy(cb);
+	draw_frame(data, time);
+}
+
+static const struct wl_callback_listener wl_surface_frame_listener = {
+    .done = wl_surface_frame_done,
+};
+
+static void
+xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial)
+{
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+    .ping = xdg_wm_base_ping,
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version)
+{
+	struct my_output *state = (struct my_output *)data;
+	if (!strcmp(interface, wl_compositor_interface.name))
+	{
+		/* wl_surface_damage_buffer 需要版本 4 */
+		state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(
+            registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        state->xdg_wm_base = wl_registry_bind(
+            registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(state->xdg_wm_base, &xdg_wm_base_listener, state);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name)
+{
+}
+
+static const struct wl_registry_listener
+registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+static void
+xdg_surface_configure(void *data,
+        struct xdg_surface *xdg_surface, uint32_t serial)
+{
+    struct my_output *state = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    /* 第一次 configure 时显示第 0 帧，之后由 frame callback 驱动 */
+    if (!state->running) {
+        state->running = 1;
+        draw_frame(state, 0);
+    } else {
+        wl_surface_commit(state->wl_surface);
+    }
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+/* 窗口大小固定为帧的大小 */
+static void
+xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+		int32_t width, int32_t height, struct wl_array *states)
+{
+}
+
+static void
+xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+    struct my_output *state = data;
+    state->closed = 1;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+static void
+usage(const char *name)
+{
+    printf("usage: %s FILE WIDTHxHEIGHT [--fps N] [--readahead N] [--argb] [--once]\n"
+           "  --fps        frame rate of the sequence, default: 60\n"
+           "  --readahead  frames to prefetch ahead of the current one, default: 8, 0 disables\n"
+           "  --argb       frames are premultiplied ARGB8888 instead of XRGB8888\n"
+           "  --once       stop at the end of the file instead of looping\n",
+           name);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct my_output state = {0};
+    int readahead = 8;
+
+    if (argc < 3 || sscanf(argv[2], "%dx%d", &state.width, &state.height) != 2 ||
+        state.width <= 0 || state.height <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    state.fps = 60;
+    state.format = WL_SHM_FORMAT_XRGB8888;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            state.fps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--readahead") == 0 && i + 1 < argc)
+            readahead = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--argb") == 0)
+            state.format = WL_SHM_FORMAT_ARGB8888;
+        else if (strcmp(argv[i], "--once") == 0)
+            state.once = 1;
+        else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (state.fps <= 0 || readahead < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (frame_file_open(&state.file, argv[1], (size_t)state.width * state.height * 4,
+                readahead) < 0)
+        return -1;
+    printf("%s: %d frames of %dx%d at %d fps, reading %d frames ahead\n",
+           argv[1], state.file.count, state.width, state.height, state.fps, readahead);
+
+	struct wl_display *display = wl_display_connect(NULL);
+	if (!display)
+	{
+		printf("Failed create connection to server\n");
+		return -1;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &state);
+	wl_display_roundtrip(display);
+
+	if (!state.compositor || !state.shm || !state.xdg_wm_base)
+	{
+		printf("missing wl_compositor, wl_shm or xdg_wm_base\n");
+		return -2;
+	}
+    if (create_slots(&state) < 0)
+        return -1;
+    state.majflt = major_faults();
+
+	state.wl_surface = wl_compositor_create_surface(state.compositor);
+	state.xdg_surface = xdg_wm_base_get_xdg_surface(state.xdg_wm_base, state.wl_surface);
+    xdg_surface_add_listener(state.xdg_surface, &xdg_surface_listener, &state);
+    state.xdg_toplevel = xdg_surface_get_toplevel(state.xdg_surface);
+    xdg_toplevel_set_title(state.xdg_toplevel, "frame player");
+    xdg_toplevel_add_listener(state.xdg_toplevel, &xdg_toplevel_listener, &state);
+    wl_surface_commit(state.wl_surface);
+
+	while (!state.closed && wl_display_dispatch(display) != -1)
+		;
+
+    report(&state, "total: ");
+    printf("%.1f s played, %.1f MB prefetched\n",
+           (uint32_t)(state.last_time - state.start_time) / 1000.0,
+           state.file.advised_bytes / 1e6);
+
+    destroy_slots(&state);
+    frame_file_close(&state.file);
+	wl_display_disconnect(display);
+	return 0;
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "asset_client.h"
+
+int
+asset_name_valid(const char *name)
+{
+	const char *p = name;
+
+	if (*name == '\0' || *name == '/' || strlen(name) >= ASSET_NAME_MAX)
+		return 0;
+	/* 不能用 .. 跑到资源目录外面 */
+	while (p) {
+		if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+			return 0;
+		p = strchr(p, '/');
+		if (p)
+			p++;
+	}
+	return 1;
+}
+
+int
+asset_socket_path(char *path, int size, const char *socket)
+{
+	const char *runtime = getenv("XDG_RUNTIME_DIR");
+
+	if (socket)
+		return snprintf(path, size, "%s", socket) < size ? 0 : -1;
+	if (runtime == NULL || *runtime == '\0') {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set\n");
+		return -1;
+	}
+	return snprintf(path, size, "%s/%s", runtime, ASSET_SERVER_SOCKET) < size ? 0 : -1;
+}
+
+int
+asset_client_connect(struct asset_client *client, const char *socket_path,
+		const char *dir)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	memset(client, 0, sizeof(*client));
+	snprintf(client->dir, sizeof(client->dir), "%s", dir ? dir : ".");
+	client->fd = -1;
+	if (asset_socket_path(addr.sun_path, sizeof(addr.sun_path), socket_path) < 0)
+		return -1;
+
+	client->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (client->fd < 0)
+		return -1;
+	if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "no asset server at %s (%m), loading assets locally\n",
+				addr.sun_path);
+		close(client->fd);
+		client->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void
+asset_client_close(struct asset_client *client)
+{
+	if (client->fd >= 0)
+		close(client->fd);
+	client->fd = -1;
+}
+
+/* 收一条回复和它带的 fd，error 不为 0 时 fd 是 -1 */
+static int
+receive_reply(int sock, struct asset_reply *reply, int *fd_out)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { reply, sizeof(*reply) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	int fd = -1;
+	ssize_t n;
+
+	do {
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	if (n != sizeof(*reply) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		if (fd >= 0)
+			close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	if ((reply->error == 0) != (fd >= 0)) {
+		if (fd >= 0)
+			close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	*fd_out = fd;
+	return 0;
+}
+
+/* 服务端给的 fd 要封住了大小，否则它被截短时我们和合成器都会 SIGBUS */
+static int
+check_shared(struct image *image, const struct asset_reply *reply, const char *name)
+{
+	int seals = fcntl(image->fd, F_GET_SEALS);
+	struct stat st;
+
+	if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_SEAL)) != (F_SEAL_SHRINK | F_SEAL_SEAL)) {
+		fprintf(stderr, "%s: asset server sent an unsealed fd\n", name);
+		return -1;
+	}
+	if (fstat(image->fd, &st) < 0 || (uint64_t)st.st_size != reply->size) {
+		fprintf(stderr, "%s: asset size mismatch\n", name);
+		return -1;
+	}
+	image->file_size = st.st_size;
+	if (pread(image->fd, &image->header, sizeof(image->header), 0) != sizeof(image->header))
+		return -1;
+	return image_check_header(&image->header, image->file_size, name);
+}
+
+static int
+open_local(struct asset_client *client, const char *name, struct image *image)
+{
+	char path[512];
+
+	snprintf(path, sizeof(path), "%s/%s", client->dir, name);
+	if (image_open(image, path, IMAGE_SEALED) < 0)
+		return -1;
+	client->local++;
+	return 0;
+}
+
+int
+asset_client_open(struct asset_client *client, const char *name,
+		struct image *image)
+{
+	struct asset_reply reply;
+
+	memset(image, 0, sizeof(*image));
+	image->fd = -1;
+	if (!asset_name_valid(name)) {
+		fprintf(stderr, "invalid asset name %s\n", name);
+		return -1;
+	}
+	if (client->fd < 0)
+		return open_local(client, name, image);
+
+	if (send(client->fd, name, strlen(name), MSG_NOSIGNAL) < 0 ||
+		receive_reply(client->fd, &reply, &image->fd) < 0) {
+		/* 服务退出了，之后都在本地加载 */
+		fprintf(stderr, "asset server connection failed: %m\n");
+		asset_client_close(client);
+		return open_local(client, name, image);
+	}
+	if (reply.error) {
+		fprintf(stderr, "%s: asset server: %s\n", name, strerror(reply.error));
+		return -1;
+	}
+	if (check_shared(image, &reply, name) < 0) {
+		image_close(image);
+		return -1;
+	}
+	client->shared++;
+	return 0;
+}
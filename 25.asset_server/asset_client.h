@@ -0,0 +1,52 @@
+#ifndef ASSET_CLIENT_H
+#define ASSET_CLIENT_H
+
+#include <stdint.h>
+
+#include "image.h"
+
+/* 从本机的资源服务(asset_server)取图片
+ *
+ * 服务端把每个资源解码一次放进封存的 memfd，客户端发资源名，
+ * 服务端通过 Unix socket 用 SCM_RIGHTS 把 fd 发回来。
+ * memfd 的布局和 .img 一样，客户端拿到的就是一个打开好的 struct image，
+ * 直接 image_create_buffer 交给合成器，N 个进程共用同一份物理内存，也都不用解码。
+ * 连不上服务时退回自己 image_open
+ * */
+
+/* 在 $XDG_RUNTIME_DIR 下 */
+#define ASSET_SERVER_SOCKET "wl-asset-server"
+/* 资源名是服务端资源目录下的相对路径 */
+#define ASSET_NAME_MAX 256
+
+/* 服务端的回复，error 为 0 时带一个 fd */
+struct asset_reply {
+	int32_t error;
+	uint32_t reserved;
+	/* memfd 的大小 */
+	uint64_t size;
+};
+
+struct asset_client {
+	int fd;
+	/* 没有服务时在本地从这个目录打开 */
+	char dir[256];
+	/* 统计：从服务拿到的、自己加载的资源数 */
+	unsigned shared;
+	unsigned local;
+};
+
+/* socket 为 NULL 时用默认路径，连不上返回 -1，之后的 asset_client_open 全部本地加载 */
+int asset_client_connect(struct asset_client *client, const char *socket,
+		const char *dir);
+void asset_client_close(struct asset_client *client);
+
+/* 得到的 image 和 image_open(IMAGE_SEALED) 的一样用，用完 image_close */
+int asset_client_open(struct asset_client *client, const char *name,
+		struct image *image);
+
+/* 服务端和客户端共用 */
+int asset_name_valid(const char *name);
+int asset_socket_path(char *path, int size, const char *socket);
+
+#endif
@@ -0,0 +1,314 @@
+/////////////////////
+// \note 本机的资源服务：每个图片只解码一次，放进封存的 memfd，
+//       通过 Unix socket 用 SCM_RIGHTS 把 fd 发给客户端(和 os_create_anonymous_file
+//       那段注释说的传 fd 给合成器是同一个机制)，
+//       客户端直接用这个 fd 建 wl_shm pool，所有进程共用一份物理内存
+//
+//       ./asset_server [--dir 资源目录] [--socket 路径]
+//       资源可以是 .img 或 .qoi，文件改了下次请求时重新加载
+/////////////////////
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "image.h"
+#include "asset_client.h"
+
+#define MAX_CLIENTS 64
+
+struct asset {
+	char name[ASSET_NAME_MAX];
+	/* 文件变了就重新加载 */
+	struct timespec mtime;
+	off_t file_size;
+	struct image image;
+	unsigned sent;
+};
+
+struct server {
+	const char *dir;
+	int listen_fd;
+	struct pollfd fds[MAX_CLIENTS + 1];
+	int client_count;
+
+	struct asset *assets;
+	int asset_count;
+	uint64_t bytes;
+	/* 统计：发出去的 fd、其中要先加载的 */
+	unsigned requests;
+	unsigned loads;
+};
+
+static volatile sig_atomic_t quit;
+
+static void
+handle_signal(int sig)
+{
+	quit = 1;
+}
+
+static struct asset *
+find_asset(struct server *server, const char *name)
+{
+	for (int i = 0; i < server->asset_count; i++)
+		if (strcmp(server->assets[i].name, name) == 0)
+			return &server->assets[i];
+	return NULL;
+}
+
+/* 返回已经加载好的资源，出错时返回 NULL 并设置 errno */
+static struct asset *
+get_asset(struct server *server, const char *name)
+{
+	struct asset *asset = find_asset(server, name);
+	char path[512];
+	struct stat st;
+	struct image image;
+
+	snprintf(path, sizeof(path), "%s/%s", server->dir, name);
+	if (stat(path, &st) < 0)
+		return NULL;
+	if (!S_ISREG(st.st_mode)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (asset && asset->file_size == st.st_size &&
+		asset->mtime.tv_sec == st.st_mtim.tv_sec &&
+		asset->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return asset;
+
+	/* IMAGE_SEALED 复制(.img)或解码(.qoi)进封存的 memfd，
+	 * 文件改了旧的 memfd 还在客户端手里，不受影响
+	 * */
+	if (image_open(&image, path, IMAGE_SEALED) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	/* 解码用的映射用不着了 */
+	if (image.map) {
+		munmap(image.map, image.file_size);
+		image.map = NULL;
+	}
+	server->loads++;
+
+	if (asset == NULL) {
+		struct asset *assets = realloc(server->assets,
+				(server->asset_count + 1) * sizeof(*assets));
+		if (assets == NULL) {
+			image_close(&image);
+			errno = ENOMEM;
+			return NULL;
+		}
+		server->assets = assets;
+		asset = &assets[server->asset_count++];
+		memset(asset, 0, sizeof(*asset));
+		snprintf(asset->name, sizeof(asset->name), "%.*s", ASSET_NAME_MAX - 1, name);
+	} else {
+		server->bytes -= asset->image.file_size;
+		image_close(&asset->image);
+		fprintf(stderr, "%s changed, reloaded\n", name);
+	}
+	asset->image = image;
+	asset->mtime = st.st_mtim;
+	asset->file_size = st.st_size;
+	server->bytes += image.file_size;
+	return asset;
+}
+
+static int
+send_reply(int sock, const struct asset_reply *reply, int fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { (void *)reply, sizeof(*reply) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+
+	if (fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	return sendmsg(sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) == sizeof(*reply) ? 0 : -1;
+}
+
+/* 处理一个请求，连接出错返回 -1 */
+static int
+handle_request(struct server *server, int sock)
+{
+	char name[ASSET_NAME_MAX + 1];
+	struct asset_reply reply = { 0 };
+	struct asset *asset = NULL;
+	ssize_t n;
+
+	n = recv(sock, name, sizeof(name), MSG_DONTWAIT | MSG_TRUNC);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	if (n == 0)
+		return -1;
+
+	if (n >= (ssize_t)sizeof(name) || memchr(name, '\0', n)) {
+		reply.error = ENAMETOOLONG;
+	} else {
+		name[n] = '\0';
+		if (!asset_name_valid(name))
+			reply.error = EINVAL;
+		else if ((asset = get_asset(server, name)) == NULL)
+			reply.error = errno ? errno : EIO;
+	}
+
+	server->requests++;
+	if (asset) {
+		reply.size = asset->image.file_size;
+		asset->sent++;
+	}
+	return send_reply(sock, &reply, asset ? asset->image.fd : -1);
+}
+
+static void
+add_client(struct server *server)
+{
+	int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+	if (fd < 0)
+		return;
+	if (server->client_count >= MAX_CLIENTS) {
+		fprintf(stderr, "too many clients\n");
+		close(fd);
+		return;
+	}
+	server->fds[1 + server->client_count].fd = fd;
+	server->fds[1 + server->client_count].events = POLLIN;
+	server->client_count++;
+}
+
+static void
+remove_client(struct server *server, int i)
+{
+	close(server->fds[1 + i].fd);
+	server->fds[1 + i] = server->fds[server->client_count];
+	server->client_count--;
+}
+
+/* 已经有服务在跑时不能把它的 socket 删掉 */
+static int
+listen_socket(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "an asset server is already running at %s\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	/* 只有自己能连 */
+	mode_t mask = umask(0077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		fprintf(stderr, "listening on %s failed: %m\n", path);
+		umask(mask);
+		close(fd);
+		return -1;
+	}
+	umask(mask);
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	struct server server = { .dir = "." };
+	const char *socket_arg = NULL;
+	char path[108];
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+			server.dir = argv[++i];
+		else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+			socket_arg = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: %s [--dir DIR] [--socket PATH]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (asset_socket_path(path, sizeof(path), socket_arg) < 0)
+		return 1;
+	server.listen_fd = listen_socket(path);
+	if (server.listen_fd < 0)
+		return 1;
+	server.fds[0].fd = server.listen_fd;
+	server.fds[0].events = POLLIN;
+
+	struct sigaction sa = { .sa_handler = handle_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	printf("serving assets from %s on %s\n", server.dir, path);
+
+	while (!quit)
+	{
+		if (poll(server.fds, 1 + server.client_count, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		/* 倒着处理，删掉的位置会被最后一个客户端补上 */
+		for (int i = server.client_count - 1; i >= 0; i--)
+		{
+			short revents = server.fds[1 + i].revents;
+			if (revents & POLLIN)
+			{
+				if (handle_request(&server, server.fds[1 + i].fd) < 0)
+					remove_client(&server, i);
+			}
+			else if (revents & (POLLHUP | POLLERR))
+			{
+				remove_client(&server, i);
+			}
+		}
+		if (server.fds[0].revents & POLLIN)
+			add_client(&server);
+	}
+
+	printf("%u requests, %u loads, %d assets in %.1f MiB\n", server.requests,
+			server.loads, server.asset_count, server.bytes / 1048576.0);
+	for (int i = 0; i < server.asset_count; i++)
+		image_close(&server.assets[i].image);
+	free(server.assets);
+	for (int i = 0; i < server.client_count; i++)
+		close(server.fds[1 + i].fd);
+	close(server.listen_fd);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,248 @@
+/////////////////////
+// \note 从资源服务取一张图片显示出来
+//       拿到的 fd 直接建 wl_shm pool，不解码也不复制；
+//       多开几个 viewer，打印出来的 inode 相同，说明用的是同一个 memfd
+//
+//       ./asset_server --dir ../17.custom_surface &
+//       ./viewer 3.qoi
+//       ./viewer 3.qoi --bench 100   # 不开窗口，和本地 image_open 比较耗时
+/////////////////////
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "xdg-shell-client-protocol.h"
+#include "asset_client.h"
+
+struct my_output {
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *xdg_wm_base;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct wl_surface *wl_surface;
+    struct wl_buffer *buffer;
+    int closed;
+};
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* 从服务取 rounds 次，再本地 image_open 同样次数，各取中位数 */
+static int
+bench(struct asset_client *client, const char *name, int rounds)
+{
+    double *times = calloc(rounds, sizeof(*times));
+    char path[512];
+
+    if (times == NULL)
+        return -1;
+    snprintf(path, sizeof(path), "%s/%s", client->dir, name);
+    for (int mode = 0; mode < 2; mode++) {
+        if (mode == 0 && client->fd < 0)
+            continue;
+        for (int r = 0; r < rounds; r++) {
+            struct image image;
+            double start = now_ms();
+            int ret = mode == 0 ? asset_client_open(client, name, &image) :
+                image_open(&image, path, IMAGE_SEALED);
+            times[r] = now_ms() - start;
+            if (ret < 0) {
+                free(times);
+                return -1;
+            }
+            image_close(&image);
+        }
+        qsort(times, rounds, sizeof(*times), compare);
+        printf("%-22s %8.3f ms median, %8.3f ms max\n",
+               mode == 0 ? "from asset server" : "image_open locally",
+               times[rounds / 2], times[rounds - 1]);
+    }
+    free(times);
+    return 0;
+}
+
+static void
+xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial)
+{
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+    .ping = xdg_wm_base_ping,
+};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version)
+{
+	struct my_output *state = (struct my_output *)data;
+	if (!strcmp(interface, wl_compositor_interface.name))
+	{
+		state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(
+            registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        state->xdg_wm_base = wl_registry_bind(
+            registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(state->xdg_wm_base, &xdg_wm_base_listener, state);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name)
+{
+}
+
+static const struct wl_registry_listener
+registry_listener = {
+	.global = registry_handle_global,
+	.global_remove = registry_handle_global_remove,
+};
+
+static void
+xdg_surface_configure(void *data,
+        struct xdg_surface *xdg_surface, uint32_t serial)
+{
+    struct my_output *state = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    /* buffer 一直是同一个，合成器要读的时候就去读服务端的 memfd */
+    wl_surface_attach(state->wl_surface, state->buffer, 0, 0);
+    wl_surface_damage_buffer(state->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_commit(state->wl_surface);
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+/* 窗口大小固定为图片的大小 */
+static void
+xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+		int32_t width, int32_t height, struct wl_array *states)
+{
+}
+
+static void
+xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+    struct my_output *state = data;
+    state->closed = 1;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+static void
+usage(const char *name)
+{
+    printf("usage: %s NAME [--dir DIR] [--socket PATH] [--bench N]\n"
+           "  --dir     where to load NAME from when no asset server is running, default: .\n"
+           "  --socket  asset server socket, default: $XDG_RUNTIME_DIR/" ASSET_SERVER_SOCKET "\n"
+           "  --bench   time N loads from the server and N local loads, without a window\n",
+           name);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct my_output state = {0};
+    struct asset_client client;
+    struct image image;
+    const char *dir = ".", *socket = NULL;
+    int rounds = 0;
+    struct stat st;
+
+    if (argc < 2 || argv[1][0] == '-') {
+        usage(argv[0]);
+        return -1;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socket = argv[++i];
+        else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    double start = now_ms();
+    asset_client_connect(&client, socket, dir);
+    if (rounds > 0) {
+        int ret = bench(&client, argv[1], rounds);
+        asset_client_close(&client);
+        return ret < 0 ? -1 : 0;
+    }
+    if (asset_client_open(&client, argv[1], &image) < 0)
+        return -1;
+    fstat(image.fd, &st);
+    printf("%s: %ux%u, %.1f MiB %s in %.2f ms (inode %lu)\n", argv[1],
+           image.header.width, image.header.height, image.file_size / 1048576.0,
+           client.shared ? "shared by the asset server" : "loaded locally",
+           now_ms() - start, (unsigned long)st.st_ino);
+
+	struct wl_display *display = wl_display_connect(NULL);
+	if (!display)
+	{
+		printf("Failed create connection to server\n");
+		return -1;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &state);
+	wl_display_roundtrip(display);
+
+	if (!state.compositor || !state.shm || !state.xdg_wm_base)
+	{
+		printf("missing wl_compositor, wl_shm or xdg_wm_base\n");
+		return -2;
+	}
+    state.buffer = image_create_buffer(&image, state.shm);
+    if (state.buffer == NULL)
+        return -1;
+
+    state.wl_surface = wl_compositor_create_surface(state.compositor);
+    state.xdg_surface = xdg_wm_base_get_xdg_surface(state.xdg_wm_base, state.wl_surface);
+    xdg_surface_add_listener(state.xdg_surface, &xdg_surface_listener, &state);
+    state.xdg_toplevel = xdg_surface_get_toplevel(state.xdg_surface);
+    xdg_toplevel_set_title(state.xdg_toplevel, argv[1]);
+    xdg_toplevel_add_listener(state.xdg_toplevel, &xdg_toplevel_listener, &state);
+    wl_surface_commit(state.wl_surface);
+
+	while (!state.closed && wl_display_dispatch(display) != -1)
+		;
+
+    wl_buffer_destroy(state.buffer);
+    image_close(&image);
+    asset_client_close(&client);
+	wl_display_disconnect(display);
+	return 0;
+}